@@ -0,0 +1,55 @@
+# Host benchmark, builds NativeCodecReader / NativeCodecWriter against the synthetic media backend in this directory
+# instead of the NDK. Needs Qt and OpenCV 4 (pkg-config opencv4) on the host:
+#   qmake bench.pro && make && ./codecbench --help
+# The stand-in follows __ANDROID_API__ like the NDK headers do. The default build covers what API 26 offers, build a second
+# time with ANDROID_API=28 for the asynchronous codec, custom data source and sample size paths:
+#   qmake bench.pro ANDROID_API=28 && make && ./codecbench --scenarios async,read
+
+TEMPLATE = app
+TARGET = codecbench
+QT = core
+CONFIG += console c++14 link_pkgconfig
+CONFIG -= app_bundle
+PKGCONFIG += opencv4
+
+isEmpty(ANDROID_API): ANDROID_API = 26
+
+# media/ here stands in for the NDK headers
+INCLUDEPATH += $$PWD $$PWD/..
+DEFINES += __ANDROID_API__=$$ANDROID_API
+
+HEADERS += \
+    syntheticmedia.h \
+    ../nativecodecvideo.h \
+    ../bitratecontroller.h \
+    ../codecprobe.h \
+    ../codecprofiler.h \
+    ../decodescheduler.h \
+    ../framecache.h \
+    ../framepool.h \
+    ../framequeue.h \
+    ../mediasource.h \
+    ../multirenditionwriter.h \
+    ../multistreamreader.h \
+    ../paralleltranscoder.h \
+    ../sampleindex.h \
+    ../videoremuxer.h \
+    ../yuvconvert.h
+
+SOURCES += \
+    benchmark.cpp \
+    syntheticmedia.cpp \
+    ../nativecodecvideo.cpp \
+    ../bitratecontroller.cpp \
+    ../codecprobe.cpp \
+    ../codecprofiler.cpp \
+    ../decodescheduler.cpp \
+    ../framecache.cpp \
+    ../framepool.cpp \
+    ../mediasource.cpp \
+    ../multirenditionwriter.cpp \
+    ../multistreamreader.cpp \
+    ../paralleltranscoder.cpp \
+    ../sampleindex.cpp \
+    ../videoremuxer.cpp \
+    ../yuvconvert.cpp
@@ -0,0 +1,971 @@
+/**
+ * Host benchmark of NativeCodecReader / NativeCodecWriter against the synthetic media backend (see syntheticmedia.h).
+ * Checks the vectorized YUV conversion and scaling paths against their scalar references (parity) and
+ * measures read (which also checks the decoded pixels), async (read through startAsync(), needs a bench built with ANDROID_API=28), scale (read at half size), seek, write, transcode (read -> write), remux (stream copy trim), batch (many files through a DecodeScheduler),
+ * sync (frame sets of several streams through a MultiStreamReader), parallel (GOP segments through a ParallelTranscoder),
+ * renditions (a full size and a half size recording from one MultiRenditionWriter, compared with two plain writers) and thumbnails (a strip from sync frames only) throughput at 720p, 1080p and 4K and reports frames per second,
+ * per frame latency percentiles and heap allocations per frame, so regressions in the conversion, copy and polling paths
+ * show up on a Linux CI box without a device. Scenario checks that do not hold are marked FAILED and make the exit status non-zero.
+ *
+ *   codecbench [--frames N] [--scenarios parity,read,async,scale,seek,write,transcode,remux,batch,sync,parallel,renditions,thumbnails]
+ *              [--resolutions 720p,1080p,2160p]
+ *              [--decode-latency us] [--encode-latency us] [--adaptive-bitrate]
+ *              [--jobs N] [--workers N] [--hardware-codecs N] [--streams N] [--instances N] [--thumbnails N] [--verbose]
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QStringList>
+
+#include <opencv2/opencv.hpp>
+
+#include "../decodescheduler.h"
+#include "../multirenditionwriter.h"
+#include "../multistreamreader.h"
+#include "../nativecodecvideo.h"
+#include "../paralleltranscoder.h"
+#include "../videoremuxer.h"
+#include "../yuvconvert.h"
+#include "syntheticmedia.h"
+
+
+// Count every heap allocation of the process, whoever makes it (OpenCV allocates through posix_memalign).
+static std::atomic<uint64_t> gAllocations(0);
+
+#if defined(__GLIBC__)
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+
+void* malloc(size_t size){
+    gAllocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size){
+    gAllocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size){
+    gAllocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size){
+    gAllocations.fetch_add(1, std::memory_order_relaxed);
+    *ptr = __libc_memalign(alignment, size);
+    return *ptr != nullptr ? 0 : ENOMEM;
+}
+}
+#endif
+
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct Resolution {
+    const char* name;
+    int width;
+    int height;
+};
+
+const Resolution RESOLUTIONS[] = {
+    {"720p", 1280, 720},
+    {"1080p", 1920, 1080},
+    {"2160p", 3840, 2160}
+};
+
+/**
+ * read() is polled, a frame usually needs a few calls. Give up on a frame after this many.
+ */
+const int MAX_READ_ATTEMPTS = 1000;
+
+/**
+ * Frames of the read scenario compared against a scalar conversion of what the decoder produced.
+ */
+const int CONTENT_CHECK_FRAMES = 8;
+
+/**
+ * Frames the thumbnails scenario reads before taking the strip, whose position readThumbnails() has to keep.
+ */
+const int THUMBNAIL_READ_AHEAD = 5;
+
+struct Result {
+    int frames;
+    double seconds;
+    std::vector<double> latenciesUs;
+    uint64_t allocations;
+    int bitrate;            ///< encoder bitrate at the end, 0 if nothing was encoded
+    QString note;           ///< printed below the numbers if set
+    bool failed;            ///< a check of the scenario did not hold, note says which
+
+    Result() : frames(0), seconds(0), allocations(0), bitrate(0), failed(false) {}
+};
+
+double elapsedUs(Clock::time_point start){
+    return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+double percentile(std::vector<double> values, double p){
+    if(values.empty()){
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    size_t index = static_cast<size_t>(p / 100.0 * (values.size() - 1) + 0.5);
+    return values[std::min(index, values.size() - 1)];
+}
+
+bool readFrame(NativeCodecReader& reader, cv::Mat& frame){
+    for(int attempt = 0; attempt < MAX_READ_ATTEMPTS; attempt++){
+        if(reader.read(frame)){
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Reads the first frames again and compares them with the scalar BGR conversion of the decoder's output,
+ * so a reader that is fast but hands out the wrong pixels (layout, stride, crop or SIMD mistakes) fails.
+ */
+void checkDecodedContent(Result& result, int frames){
+    const SyntheticMediaConfig config = syntheticMediaConfig();
+    YUVFrameLayout layout;
+    if(!yuvLayoutFromColorFormat(config.colorFormat, layout.layout)){
+        return;
+    }
+    layout.width = config.width;
+    layout.height = config.height;
+    layout.cropRight = config.width - 1;
+    layout.cropBottom = config.height - 1;
+
+    NativeCodecReader reader("synthetic.mp4");
+    cv::Mat frame;
+    std::vector<uint8_t> decoded;
+    YUVPlanes planes;
+    cv::Mat expected(config.height, config.width, CV_8UC3);
+    for(int i = 0; i < std::min(frames, CONTENT_CHECK_FRAMES); i++){
+        if(!readFrame(reader, frame)){
+            result.note = QString("frame %1 could not be read again for the content check").arg(i);
+            result.failed = true;
+            return;
+        }
+        syntheticMediaDecodedFrame(i, decoded, layout.stride, layout.sliceHeight);
+        yuvResolvePlanes(decoded.data(), decoded.size(), layout, planes);
+        yuv420ToBGRScalar(planes, expected.data, expected.step);
+        if(frame.size() != expected.size() || frame.type() != expected.type() || cv::norm(frame, expected, cv::NORM_INF) != 0){
+            result.note = QString("frame %1 differs from the decoder's output").arg(i);
+            result.failed = true;
+            return;
+        }
+    }
+}
+
+Result benchRead(int frames){
+    Result result;
+    NativeCodecReader reader("synthetic.mp4");
+    cv::Mat frame;
+
+    const uint64_t allocations = gAllocations.load();
+    const Clock::time_point start = Clock::now();
+    for(int i = 0; i < frames; i++){
+        const Clock::time_point frameStart = Clock::now();
+        if(!readFrame(reader, frame)){
+            break;
+        }
+        result.latenciesUs.push_back(elapsedUs(frameStart));
+        result.frames++;
+    }
+    result.seconds = elapsedUs(start) / 1e6;
+    result.allocations = gAllocations.load() - allocations;
+    checkDecodedContent(result, result.frames);
+    return result;
+}
+
+/**
+ * Random samples in a buffer of the given layout, padded past the width and the height so the strides differ from it.
+ */
+struct RandomFrame {
+    std::vector<uint8_t> buffer;
+    YUVPlanes planes;
+};
+
+void makeRandomFrame(std::mt19937& random, YUVPlaneLayout layout, int width, int height, RandomFrame& frame){
+    std::uniform_int_distribution<int> padding(0, 24);
+    std::uniform_int_distribution<int> sample(0, 255);
+    YUVFrameLayout frameLayout;
+    frameLayout.layout = layout;
+    frameLayout.width = width;
+    frameLayout.height = height;
+    frameLayout.stride = ((width + 1) & ~1) + 2 * padding(random);
+    frameLayout.sliceHeight = height + padding(random);
+    frameLayout.cropRight = width - 1;
+    frameLayout.cropBottom = height - 1;
+    frame.buffer.resize(yuvFrameSize(frameLayout));
+    for(uint8_t& value : frame.buffer){
+        value = static_cast<uint8_t>(sample(random));
+    }
+    yuvResolvePlanes(frame.buffer.data(), frame.buffer.size(), frameLayout, frame.planes);
+}
+
+/**
+ * Destination sizes worth checking for a source size: exact halving and quartering (the vectorized paths),
+ * arbitrary shrinking, the same size and enlarging.
+ */
+std::vector<cv::Size> scaledSizes(std::mt19937& random, int width, int height){
+    std::uniform_int_distribution<int> dstWidth(1, width);
+    std::uniform_int_distribution<int> dstHeight(1, height);
+    std::vector<cv::Size> sizes;
+    sizes.push_back(cv::Size(std::max(width / 2, 1), std::max(height / 2, 1)));
+    sizes.push_back(cv::Size(std::max(width / 4, 1), std::max(height / 4, 1)));
+    sizes.push_back(cv::Size(dstWidth(random), dstHeight(random)));
+    sizes.push_back(cv::Size(width, height));
+    sizes.push_back(cv::Size(width + dstWidth(random), height + dstHeight(random)));
+    return sizes;
+}
+
+/**
+ * Compares rows of width bytes of two images, ignoring the padding past them.
+ */
+bool sameRows(const cv::Mat& a, const cv::Mat& b, int width){
+    for(int row = 0; row < a.rows; row++){
+        if(memcmp(a.ptr(row), b.ptr(row), static_cast<size_t>(width)) != 0){
+            return false;
+        }
+    }
+    return true;
+}
+
+bool sameFrames(const RandomFrame& a, const RandomFrame& b){
+    const YUVPlanes& pa = a.planes;
+    const YUVPlanes& pb = b.planes;
+    for(int row = 0; row < pa.height; row++){
+        if(memcmp(pa.y + static_cast<size_t>(row) * pa.yStride, pb.y + static_cast<size_t>(row) * pb.yStride, static_cast<size_t>(pa.width)) != 0){
+            return false;
+        }
+    }
+    for(int row = 0; row < (pa.height + 1) / 2; row++){
+        for(int column = 0; column < (pa.width + 1) / 2; column++){
+            const size_t offsetA = static_cast<size_t>(row) * pa.uvStride + static_cast<size_t>(column) * pa.uvPixelStride;
+            const size_t offsetB = static_cast<size_t>(row) * pb.uvStride + static_cast<size_t>(column) * pb.uvPixelStride;
+            if(pa.u[offsetA] != pb.u[offsetB] || pa.v[offsetA] != pb.v[offsetB]){
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * The vectorized conversion and scaling paths against their scalar references on random frames of every layout,
+ * the resolution's own size first, then odd and small sizes that exercise the SIMD tails.
+ * A single differing byte fails the scenario, latency is per case (all four functions, both paths).
+ */
+Result benchParity(int cases, const Resolution& resolution){
+    Result result;
+    const YUVPlaneLayout layouts[] = {YUV_LAYOUT_I420, YUV_LAYOUT_NV12, YUV_LAYOUT_NV21};
+    const char* layoutNames[] = {"I420", "NV12", "NV21"};
+    std::mt19937 random(7);
+    std::uniform_int_distribution<int> size(1, 199);
+    RandomFrame src;
+    RandomFrame simdFrame;
+    RandomFrame scalarFrame;
+    cv::Mat simd;
+    cv::Mat scalar;
+
+    const uint64_t allocations = gAllocations.load();
+    const Clock::time_point start = Clock::now();
+    for(int i = 0; i < cases && !result.failed; i++){
+        const Clock::time_point caseStart = Clock::now();
+        const int layoutIndex = i % 3;
+        const YUVPlaneLayout layout = layouts[layoutIndex];
+        const int width = i < 3 ? resolution.width : size(random);
+        const int height = i < 3 ? resolution.height : size(random);
+        makeRandomFrame(random, layout, width, height, src);
+        QString mismatch;
+
+        // padding past the width stays random in both, only the image itself is compared
+        simd.create(height, width * 3 + 16, CV_8UC1);
+        scalar.create(height, width * 3 + 16, CV_8UC1);
+        yuv420ToBGR(src.planes, simd.data, simd.step);
+        yuv420ToBGRScalar(src.planes, scalar.data, scalar.step);
+        if(!sameRows(simd, scalar, width * 3)){
+            mismatch = "yuv420ToBGR";
+        }
+
+        // the scalar BGR image back to YUV, into the same random layout
+        if(mismatch.isEmpty()){
+            makeRandomFrame(random, layout, width, height, simdFrame);
+            makeRandomFrame(random, layout, width, height, scalarFrame);
+            bgrToYUV420(scalar.data, scalar.step, simdFrame.planes);
+            bgrToYUV420Scalar(scalar.data, scalar.step, scalarFrame.planes);
+            if(!sameFrames(simdFrame, scalarFrame)){
+                mismatch = "bgrToYUV420";
+            }
+        }
+
+        for(const cv::Size& dstSize : scaledSizes(random, width, height)){
+            if(!mismatch.isEmpty()){
+                break;
+            }
+            simd.create(dstSize.height, dstSize.width * 3, CV_8UC1);
+            scalar.create(dstSize.height, dstSize.width * 3, CV_8UC1);
+            yuv420ToBGRScaled(src.planes, simd.data, simd.step, dstSize.width, dstSize.height);
+            yuv420ToBGRScaledScalar(src.planes, scalar.data, scalar.step, dstSize.width, dstSize.height);
+            if(!sameRows(simd, scalar, dstSize.width * 3)){
+                mismatch = QString("yuv420ToBGRScaled to %1x%2").arg(dstSize.width).arg(dstSize.height);
+                break;
+            }
+
+            // into a frame of another layout, so (de)interleaving gets checked too
+            const YUVPlaneLayout dstLayout = layouts[(layoutIndex + 1 + i / 3 % 2) % 3];
+            makeRandomFrame(random, dstLayout, dstSize.width, dstSize.height, simdFrame);
+            makeRandomFrame(random, dstLayout, dstSize.width, dstSize.height, scalarFrame);
+            yuv420Scale(src.planes, simdFrame.planes);
+            yuv420ScaleScalar(src.planes, scalarFrame.planes);
+            if(!sameFrames(simdFrame, scalarFrame)){
+                mismatch = QString("yuv420Scale to %1 %2x%3").arg(layoutNames[(layoutIndex + 1 + i / 3 % 2) % 3])
+                        .arg(dstSize.width).arg(dstSize.height);
+            }
+        }
+
+        result.latenciesUs.push_back(elapsedUs(caseStart));
+        result.frames++;
+        if(!mismatch.isEmpty()){
+            result.note = QString("%1 differs from the scalar path for a %2 %3x%4 frame")
+                    .arg(mismatch).arg(layoutNames[layoutIndex]).arg(width).arg(height);
+            result.failed = true;
+        }
+    }
+    result.seconds = elapsedUs(start) / 1e6;
+    result.allocations = gAllocations.load() - allocations;
+    if(!result.failed){
+        result.note = QString("%1 cases, vectorized and scalar paths bit exact").arg(result.frames);
+    }
+    return result;
+}
+
+Result benchAsync(int frames){
+    Result result;
+    NativeCodecReader reader("synthetic.mp4");
+    cv::Mat frame;
+
+    const uint64_t allocations = gAllocations.load();
+    const Clock::time_point start = Clock::now();
+    if(!reader.startAsync()){
+        result.note = QString("startAsync() failed, asynchronous decoding needs a bench built with ANDROID_API=28");
+        return result;
+    }
+    for(int i = 0; i < frames; i++){
+        const Clock::time_point frameStart = Clock::now();
+        if(!reader.read(frame)){
+            break;
+        }
+        result.latenciesUs.push_back(elapsedUs(frameStart));
+        result.frames++;
+    }
+    result.seconds = elapsedUs(start) / 1e6;
+    result.allocations = gAllocations.load() - allocations;
+    reader.stopAsync();
+    if(reader.droppedFrames() > 0){
+        result.note = QString("%1 frames dropped").arg(reader.droppedFrames());
+    }
+    return result;
+}
+
+Result benchScale(int frames, const Resolution& resolution){
+    Result result;
+    const cv::Size half(resolution.width / 2, resolution.height / 2);
+    NativeCodecReader reader("synthetic.mp4");
+    reader.setOutputSize(half);
+    cv::Mat frame;
+
+    const uint64_t allocations = gAllocations.load();
+    const Clock::time_point start = Clock::now();
+    for(int i = 0; i < frames; i++){
+        const Clock::time_point frameStart = Clock::now();
+        if(!readFrame(reader, frame)){
+            break;
+        }
+        result.latenciesUs.push_back(elapsedUs(frameStart));
+        result.frames++;
+    }
+    result.seconds = elapsedUs(start) / 1e6;
+    result.allocations = gAllocations.load() - allocations;
+
+    // the same frames converted at full size and shrunk afterwards
+    NativeCodecReader fullReader("synthetic.mp4");
+    cv::Mat full;
+    cv::Mat resized;
+    std::vector<double> latenciesUs;
+    for(int i = 0; i < result.frames; i++){
+        const Clock::time_point frameStart = Clock::now();
+        if(!readFrame(fullReader, full)){
+            break;
+        }
+        cv::resize(full, resized, half, 0, 0, cv::INTER_AREA);
+        latenciesUs.push_back(elapsedUs(frameStart));
+    }
+    result.note = QString("to %1x%2, full size read + cv::resize(INTER_AREA) p50 %3 us")
+            .arg(half.width).arg(half.height).arg(percentile(latenciesUs, 50), 0, 'f', 1);
+    return result;
+}
+
+Result benchSeek(int frames){
+    Result result;
+    NativeCodecReader reader("synthetic.mp4");
+    cv::Mat frame;
+    std::mt19937 random(42);
+    std::uniform_int_distribution<int> target(0, std::max<int>(0, static_cast<int>(reader.nFrames()) - 1));
+    const int seeks = std::max(frames / 10, 1);
+
+    const uint64_t allocations = gAllocations.load();
+    const Clock::time_point start = Clock::now();
+    for(int i = 0; i < seeks; i++){
+        const Clock::time_point seekStart = Clock::now();
+        if(!reader.seek(frame, target(random))){
+            break;
+        }
+        result.latenciesUs.push_back(elapsedUs(seekStart));
+        result.frames++;
+    }
+    result.seconds = elapsedUs(start) / 1e6;
+    result.allocations = gAllocations.load() - allocations;
+    return result;
+}
+
+/**
+ * The thumbnail strip has to be complete (the stand-in's GOPs are regular, so every sync frame up to count gets picked),
+ * and the read() after it (resumed, presented at resumedUs) has to return the frame the reader was at before, with the pixels a plain read gives.
+ */
+void checkThumbnails(Result& result, size_t thumbnails, int count, const SampleIndex& index,
+                     int64 resumeFrame, const cv::Mat& resumed, int64 resumedUs){
+    const size_t expected = std::min(static_cast<size_t>(count), index.syncFrames().size());
+    if(thumbnails < expected){
+        result.note = QString("%1 of %2 thumbnails").arg(static_cast<int>(thumbnails)).arg(static_cast<int>(expected));
+        result.failed = true;
+        return;
+    }
+
+    NativeCodecReader plainReader("synthetic.mp4");
+    cv::Mat expectedFrame;
+    for(int64 i = 0; i <= resumeFrame; i++){
+        readFrame(plainReader, expectedFrame);
+    }
+    if(resumed.empty() || resumedUs != index.frameTime(resumeFrame)
+            || resumed.size() != expectedFrame.size() || cv::norm(resumed, expectedFrame, cv::NORM_INF) != 0){
+        result.note = QString("read() after the thumbnails did not return frame %1").arg(resumeFrame);
+        result.failed = true;
+    }
+}
+
+Result benchThumbnails(int count){
+    Result result;
+    NativeCodecReader reader("synthetic.mp4");
+    std::vector<DecodedFrame> thumbnails;
+
+    // somewhere into the video, so there is a position to keep
+    cv::Mat frame;
+    for(int i = 0; i < THUMBNAIL_READ_AHEAD; i++){
+        readFrame(reader, frame);
+    }
+    const int64 resumeFrame = reader.currentFrame();
+
+    const uint64_t allocations = gAllocations.load();
+    const Clock::time_point start = Clock::now();
+    reader.readThumbnails(count, cv::Size(160, 0), thumbnails);
+    result.latenciesUs.push_back(elapsedUs(start));
+    result.seconds = elapsedUs(start) / 1e6;
+    result.allocations = gAllocations.load() - allocations;
+    result.frames = static_cast<int>(thumbnails.size());
+
+    cv::Mat resumed;
+    readFrame(reader, resumed);
+    const int64 resumedUs = reader.lastPresentationTimeUs();
+
+    // the same frames the way it had to be done before, one seek() per thumbnail at full size
+    const Clock::time_point seekStart = Clock::now();
+    for(const DecodedFrame& thumbnail : thumbnails){
+        reader.seek(frame, reader.sampleIndex().frameAt(thumbnail.presentationTimeUs));
+    }
+    result.note = QString("%1 of %2 thumbnails, seek() per thumbnail took %3 ms")
+            .arg(static_cast<int>(thumbnails.size())).arg(count).arg(elapsedUs(seekStart) / 1000, 0, 'f', 1);
+    checkThumbnails(result, thumbnails.size(), count, reader.sampleIndex(), resumeFrame, resumed, resumedUs);
+    return result;
+}
+
+Result benchWrite(int frames, const Resolution& resolution, const QString& output, bool adaptiveBitrate){
+    Result result;
+    NativeCodecWriter writer(output, 30, cv::Size(resolution.width, resolution.height));
+    writer.setAdaptiveBitrate(adaptiveBitrate);
+    writer.prepareEncoder();
+
+    cv::Mat frame(resolution.height, resolution.width, CV_8UC3);
+    cv::randu(frame, cv::Scalar::all(0), cv::Scalar::all(255));
+
+    const uint64_t allocations = gAllocations.load();
+    const Clock::time_point start = Clock::now();
+    for(int i = 0; i < frames; i++){
+        const Clock::time_point frameStart = Clock::now();
+        if(writer.write(frame, i)){
+            result.frames++;
+        }
+        result.latenciesUs.push_back(elapsedUs(frameStart));
+    }
+    writer.end();
+    writer.waitForFinished();
+    result.seconds = elapsedUs(start) / 1e6;
+    result.allocations = gAllocations.load() - allocations;
+    result.bitrate = writer.bitrate();
+    return result;
+}
+
+Result benchRenditions(int frames, const Resolution& resolution, const QString& output){
+    Result result;
+    const cv::Size size(resolution.width, resolution.height);
+    const cv::Size previewSize(resolution.width / 2, resolution.height / 2);
+    // a preview at half the size and a fifth of the bitrate
+    EncoderConfig preview;
+    preview.bitrate /= 5;
+    const QString previewOutput = QDir::temp().filePath("codecbench_preview.mp4");
+
+    cv::Mat frame(resolution.height, resolution.width, CV_8UC3);
+    cv::randu(frame, cv::Scalar::all(0), cv::Scalar::all(255));
+
+    uint64_t previewDropped = 0;
+    const uint64_t allocations = gAllocations.load();
+    const std::clock_t cpuStart = std::clock();
+    const Clock::time_point start = Clock::now();
+    {
+        MultiRenditionWriter writer(30, size);
+        writer.addRendition(output, size);
+        writer.addRendition(previewOutput, previewSize, preview);
+        writer.prepareEncoder();
+        for(int i = 0; i < frames; i++){
+            const Clock::time_point frameStart = Clock::now();
+            if(writer.write(frame, i)){
+                result.frames++;
+            }
+            result.latenciesUs.push_back(elapsedUs(frameStart));
+        }
+        writer.end();
+        writer.waitForFinished();
+        result.bitrate = writer.rendition(0).bitrate();
+        previewDropped = writer.rendition(1).droppedFrames();
+    }
+    result.seconds = elapsedUs(start) / 1e6;
+    result.allocations = gAllocations.load() - allocations;
+    const double cpuMs = 1000.0 * (std::clock() - cpuStart) / CLOCKS_PER_SEC;
+
+    // the same two recordings from two plain writers, the preview resized by the caller
+    std::vector<double> plainLatenciesUs;
+    const std::clock_t plainCpuStart = std::clock();
+    const Clock::time_point plainStart = Clock::now();
+    {
+        NativeCodecWriter full(output, 30, size);
+        NativeCodecWriter half(previewOutput, 30, previewSize, preview);
+        full.prepareEncoder();
+        half.prepareEncoder();
+        cv::Mat small;
+        for(int i = 0; i < frames; i++){
+            const Clock::time_point frameStart = Clock::now();
+            cv::resize(frame, small, previewSize, 0, 0, cv::INTER_AREA);
+            full.write(frame, i);
+            half.write(small, i);
+            plainLatenciesUs.push_back(elapsedUs(frameStart));
+        }
+        full.end();
+        half.end();
+        full.waitForFinished();
+        half.waitForFinished();
+    }
+    const double plainSeconds = elapsedUs(plainStart) / 1e6;
+    const double plainCpuMs = 1000.0 * (std::clock() - plainCpuStart) / CLOCKS_PER_SEC;
+
+    result.note = QString("2 renditions, %1 frames dropped by the preview, %2 ms CPU; two plain writers: %3 fps, write() p50 %4 us, %5 ms CPU")
+            .arg(static_cast<long long>(previewDropped)).arg(cpuMs, 0, 'f', 0)
+            .arg(frames / std::max(plainSeconds, 1e-9), 0, 'f', 1).arg(percentile(plainLatenciesUs, 50), 0, 'f', 0)
+            .arg(plainCpuMs, 0, 'f', 0);
+    QFile::remove(previewOutput);
+    return result;
+}
+
+Result benchTranscode(int frames, const Resolution& resolution, const QString& output, bool adaptiveBitrate){
+    Result result;
+    NativeCodecReader reader("synthetic.mp4");
+    NativeCodecWriter writer(output, 30, cv::Size(resolution.width, resolution.height));
+    writer.setFramePool(reader.framePool());
+    writer.setAdaptiveBitrate(adaptiveBitrate);
+    writer.prepareEncoder();
+    cv::Mat frame;
+
+    const uint64_t allocations = gAllocations.load();
+    const Clock::time_point start = Clock::now();
+    for(int i = 0; i < frames; i++){
+        const Clock::time_point frameStart = Clock::now();
+        if(!readFrame(reader, frame) || !writer.write(frame, i)){
+            break;
+        }
+        result.latenciesUs.push_back(elapsedUs(frameStart));
+        result.frames++;
+    }
+    writer.end();
+    writer.waitForFinished();
+    result.seconds = elapsedUs(start) / 1e6;
+    result.allocations = gAllocations.load() - allocations;
+    result.bitrate = writer.bitrate();
+    return result;
+}
+
+/**
+ * The clip has to start at the last sync frame at or before startUs and hold exactly the samples the index has for its range
+ * (the stand-in only has a video track, so all copied samples are video).
+ */
+void checkRemux(Result& result, bool ok, const VideoRemuxer& remuxer, int64_t startUs){
+    const SampleIndex& index = remuxer.sampleIndex();
+    if(!ok){
+        result.note = QString("trim() failed");
+        result.failed = true;
+        return;
+    }
+    const int64_t expectedStartUs = index.frameTime(index.syncFrameBefore(index.frameAt(startUs)));
+    if(remuxer.clipStartUs() != expectedStartUs || !index.isSyncFrame(index.frameAt(remuxer.clipStartUs()))){
+        result.note = QString("the clip starts at %1 us instead of the sync frame at %2 us").arg(remuxer.clipStartUs()).arg(expectedStartUs);
+        result.failed = true;
+        return;
+    }
+    uint64_t expectedSamples = 0;
+    for(const SampleIndex::Sample& sample : index.samples()){
+        if(sample.presentationTimeUs >= remuxer.clipStartUs() && sample.presentationTimeUs < remuxer.clipEndUs()){
+            expectedSamples++;
+        }
+    }
+    if(remuxer.copiedSamples() != expectedSamples){
+        result.note = QString("%1 samples copied, the index has %2 from %3 to %4 us").arg(remuxer.copiedSamples()).arg(expectedSamples)
+                .arg(remuxer.clipStartUs()).arg(remuxer.clipEndUs());
+        result.failed = true;
+    }
+}
+
+Result benchRemux(const QString& output){
+    Result result;
+    VideoRemuxer remuxer("synthetic.mp4");
+    const int64_t durationUs = remuxer.sampleIndex().durationUs();
+
+    // cut the middle half, as a clip export would
+    const uint64_t allocations = gAllocations.load();
+    const Clock::time_point start = Clock::now();
+    const bool ok = remuxer.trim(output, durationUs / 4, durationUs * 3 / 4);
+    if(ok){
+        result.frames = static_cast<int>(remuxer.copiedSamples());
+        result.latenciesUs.push_back(elapsedUs(start));
+    }
+    result.seconds = elapsedUs(start) / 1e6;
+    result.allocations = gAllocations.load() - allocations;
+    checkRemux(result, ok, remuxer, durationUs / 4);
+    return result;
+}
+
+/**
+ * Every job has to be decoded, and the scheduler must never hand out more hardware slots than the stand-in backend has instances:
+ * a hardware decoder the backend refused means a slot that did not exist.
+ */
+void checkBatch(Result& result, const DecodeSchedulerStats& stats, int jobs, uint64_t refusedCodecs){
+    if(stats.jobsDone != jobs || stats.jobsFailed > 0){
+        result.note = QString("%1 of %2 jobs done, %3 failed").arg(stats.jobsDone).arg(jobs).arg(stats.jobsFailed);
+        result.failed = true;
+    }
+    else if(stats.peakHardwareInstances > stats.hardwareLimit){
+        result.note = QString("%1 hardware decoders at once with %2 slots").arg(stats.peakHardwareInstances).arg(stats.hardwareLimit);
+        result.failed = true;
+    }
+    else if(refusedCodecs > 0){
+        result.note = QString("the backend refused %1 hardware decoders the scheduler had slots for").arg(refusedCodecs);
+        result.failed = true;
+    }
+}
+
+Result benchBatch(int jobs, int workers){
+    Result result;
+    DecodeScheduler scheduler(workers);
+    // probed up front, so the refusal that ends the probe does not count against the scheduler
+    scheduler.setHardwareLimit(std::max(DecodeScheduler::probeHardwareDecoders(MediaSource::file("synthetic_0.mp4")), 1));
+    syntheticMediaResetCounters();
+    std::vector<Clock::time_point> jobStart(jobs);
+    std::vector<Clock::time_point> jobEnd(jobs);
+    // every job only touches its own entries
+    scheduler.setReaderSetup([&](int job, NativeCodecReader&){
+        jobStart[job] = Clock::now();
+    });
+    scheduler.setFrameCallback([&](int job, const cv::Mat&, int64){
+        jobEnd[job] = Clock::now();
+    });
+    for(int i = 0; i < jobs; i++){
+        scheduler.addJob(QString("synthetic_%1.mp4").arg(i));
+    }
+
+    const uint64_t allocations = gAllocations.load();
+    scheduler.start();
+    scheduler.waitForFinished();
+    result.allocations = gAllocations.load() - allocations;
+
+    const DecodeSchedulerStats stats = scheduler.stats();
+    result.frames = static_cast<int>(stats.frames);
+    result.seconds = stats.seconds;
+    for(int i = 0; i < jobs; i++){
+        if(jobEnd[i] > jobStart[i]){
+            result.latenciesUs.push_back(std::chrono::duration<double, std::micro>(jobEnd[i] - jobStart[i]).count());
+        }
+    }
+    result.note = QString("%1 jobs on %2 hardware / %3 software decoders, peak %4 of %5 hardware slots, %6 failed")
+            .arg(stats.jobsDone).arg(stats.hardwareJobs).arg(stats.softwareJobs)
+            .arg(stats.peakHardwareInstances).arg(stats.hardwareLimit).arg(stats.jobsFailed);
+    checkBatch(result, stats, jobs, syntheticMediaCounters().refusedCodecs);
+    return result;
+}
+
+Result benchSync(int streams){
+    Result result;
+    MultiStreamReader reader;
+    for(int i = 0; i < streams; i++){
+        // a few milliseconds apart, as separately started cameras would be
+        reader.addStream(QString("synthetic_%1.mp4").arg(i), i * 3000);
+    }
+    reader.start();
+    FrameSet set;
+
+    const uint64_t allocations = gAllocations.load();
+    const Clock::time_point start = Clock::now();
+    while(true){
+        const Clock::time_point setStart = Clock::now();
+        if(!reader.read(set)){
+            break;
+        }
+        result.latenciesUs.push_back(elapsedUs(setStart));
+        result.frames++;
+    }
+    result.seconds = elapsedUs(start) / 1e6;
+    result.allocations = gAllocations.load() - allocations;
+
+    uint64_t dropped = 0;
+    uint64_t duplicated = 0;
+    for(int i = 0; i < streams; i++){
+        dropped += reader.streamStats(i).dropped;
+        duplicated += reader.streamStats(i).duplicated;
+    }
+    result.note = QString("%1 streams, %2 sets skipped, %3 frames dropped, %4 duplicated")
+            .arg(streams).arg(static_cast<long long>(reader.skippedSets())).arg(static_cast<long long>(dropped)).arg(static_cast<long long>(duplicated));
+    // the stand-in streams are identical and far closer than half a frame apart, so every frame has to pair up exactly once
+    const int frameCount = syntheticMediaConfig().frameCount;
+    if(reader.sets() != static_cast<uint64_t>(frameCount) || reader.skippedSets() > 0 || dropped > 0 || duplicated > 0){
+        result.note = QString("%1 of %2 sets, %3 skipped, %4 frames dropped, %5 duplicated")
+                .arg(static_cast<long long>(reader.sets())).arg(frameCount).arg(static_cast<long long>(reader.skippedSets()))
+                .arg(static_cast<long long>(dropped)).arg(static_cast<long long>(duplicated));
+        result.failed = true;
+    }
+    return result;
+}
+
+Result benchParallel(int instances, const QString& output){
+    Result result;
+    ParallelTranscoder transcoder(MediaSource::file("synthetic.mp4"));
+    transcoder.setInstances(instances);
+
+    const uint64_t allocations = gAllocations.load();
+    const Clock::time_point start = Clock::now();
+    const bool ok = transcoder.transcode(output);
+    result.latenciesUs.push_back(elapsedUs(start));
+    result.allocations = gAllocations.load() - allocations;
+
+    const TranscodeStats stats = transcoder.stats();
+    result.frames = static_cast<int>(stats.frames);
+    result.seconds = stats.seconds;
+    result.note = QString("%1 segments on %2 instances, %3 codec config mismatches")
+            .arg(stats.segments).arg(stats.instances).arg(stats.configMismatches);
+    // every input frame has to come out, from encoders that agree on their codec config
+    const int64_t expectedFrames = transcoder.sampleIndex().frameCount();
+    if(!ok || stats.configMismatches > 0 || static_cast<int64_t>(stats.frames) != expectedFrames){
+        result.note = QString("transcode() %1, %2 of %3 frames written, %4 codec config mismatches")
+                .arg(ok ? "succeeded" : "failed").arg(stats.frames).arg(expectedFrames).arg(stats.configMismatches);
+        result.failed = true;
+    }
+    return result;
+}
+
+/**
+ * The adaptive bitrate has to back off when the simulated encoder cannot keep up, or the controller is broken.
+ */
+void checkBitrateDropped(Result& result, bool adaptiveBitrate, int encodeLatencyUs){
+    if(!adaptiveBitrate || encodeLatencyUs <= 0 || result.frames < 2 * BitrateController::WINDOW_FRAMES){
+        return;
+    }
+    const int initialBitrate = EncoderConfig().bitrate;
+    if(result.bitrate >= initialBitrate){
+        result.failed = true;
+        result.note = QString("the adaptive bitrate stayed at %1 kbit/s despite %2 us encoder latency")
+                .arg(result.bitrate / 1000).arg(encodeLatencyUs);
+    }
+}
+
+int gFailures = 0;
+
+void report(const char* scenario, const Resolution& resolution, const Result& result){
+    printf("%-10s %-6s %7d %10.1f %10.1f %10.1f %10.1f %10.1f %12.2f\n",
+           scenario, resolution.name, result.frames,
+           result.seconds > 0 ? result.frames / result.seconds : 0.0,
+           percentile(result.latenciesUs, 50), percentile(result.latenciesUs, 90), percentile(result.latenciesUs, 99),
+           result.latenciesUs.empty() ? 0.0 : *std::max_element(result.latenciesUs.begin(), result.latenciesUs.end()),
+           result.frames > 0 ? static_cast<double>(result.allocations) / result.frames : 0.0);
+    if(result.bitrate > 0){
+        printf("%-17s encoder ended at %d kbit/s\n", "", result.bitrate / 1000);
+    }
+    if(!result.note.isEmpty()){
+        printf("%-17s %s%s\n", "", result.failed ? "FAILED: " : "", result.note.toLocal8Bit().constData());
+    }
+    if(result.failed){
+        gFailures++;
+    }
+    fflush(stdout);
+}
+
+bool gVerbose = false;
+
+void messageHandler(QtMsgType type, const QMessageLogContext&, const QString& message){
+    // the codec classes are chatty, only show what matters unless asked to
+    if(gVerbose || type == QtCriticalMsg || type == QtFatalMsg){
+        fprintf(stderr, "%s\n", message.toLocal8Bit().constData());
+    }
+}
+
+} // namespace
+
+
+int main(int argc, char* argv[]){
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("codecbench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Benchmarks NativeCodecReader / NativeCodecWriter against a synthetic media backend.");
+    parser.addHelpOption();
+    QCommandLineOption framesOption("frames", "Frames per scenario.", "n", "300");
+    QCommandLineOption scenariosOption("scenarios", "Comma separated: parity, read, async, scale, seek, write, transcode, remux, batch, sync, parallel, renditions, thumbnails.", "list", "parity,read,async,scale,seek,write,transcode,remux,batch,sync,parallel,renditions,thumbnails");
+    QCommandLineOption resolutionsOption("resolutions", "Comma separated: 720p, 1080p, 2160p.", "list", "720p,1080p,2160p");
+    QCommandLineOption decodeLatencyOption("decode-latency", "Simulated decoder latency per frame.", "us", "0");
+    QCommandLineOption encodeLatencyOption("encode-latency", "Simulated encoder latency per frame.", "us", "0");
+    QCommandLineOption adaptiveOption("adaptive-bitrate", "Let the writer adapt its bitrate (the simulated encoder latency scales with it).");
+    QCommandLineOption jobsOption("jobs", "Files decoded by the batch scenario, each with the given number of frames.", "n", "8");
+    QCommandLineOption workersOption("workers", "Decode threads of the batch scenario, 0 for one per core.", "n", "0");
+    QCommandLineOption hardwareCodecsOption("hardware-codecs", "Hardware codec instances the synthetic backend allows at once, 0 for no limit.", "n", "4");
+    QCommandLineOption streamsOption("streams", "Streams read in lockstep by the sync scenario.", "n", "2");
+    QCommandLineOption instancesOption("instances", "Codec instances of the parallel scenario, 0 to probe.", "n", "0");
+    QCommandLineOption thumbnailsOption("thumbnails", "Thumbnails of the thumbnails scenario.", "n", "100");
+    QCommandLineOption verboseOption("verbose", "Show the codec classes' log output.");
+    parser.addOption(framesOption);
+    parser.addOption(scenariosOption);
+    parser.addOption(resolutionsOption);
+    parser.addOption(decodeLatencyOption);
+    parser.addOption(encodeLatencyOption);
+    parser.addOption(adaptiveOption);
+    parser.addOption(jobsOption);
+    parser.addOption(workersOption);
+    parser.addOption(hardwareCodecsOption);
+    parser.addOption(streamsOption);
+    parser.addOption(instancesOption);
+    parser.addOption(thumbnailsOption);
+    parser.addOption(verboseOption);
+    parser.process(app);
+
+    gVerbose = parser.isSet(verboseOption);
+    qInstallMessageHandler(messageHandler);
+
+    const int frames = std::max(parser.value(framesOption).toInt(), 1);
+    const QStringList scenarios = parser.value(scenariosOption).split(',');
+    const QStringList resolutions = parser.value(resolutionsOption).split(',');
+    const bool adaptiveBitrate = parser.isSet(adaptiveOption);
+    const QString output = QDir::temp().filePath("codecbench.mp4");
+
+    printf("%-10s %-6s %7s %10s %10s %10s %10s %10s %12s\n",
+           "scenario", "size", "frames", "fps", "p50 us", "p90 us", "p99 us", "max us", "allocs/frame");
+
+    for(const Resolution& resolution : RESOLUTIONS){
+        if(!resolutions.contains(resolution.name)){
+            continue;
+        }
+        SyntheticMediaConfig config;
+        config.width = resolution.width;
+        config.height = resolution.height;
+        config.frameCount = frames;
+        config.decodeLatencyUs = parser.value(decodeLatencyOption).toInt();
+        config.encodeLatencyUs = parser.value(encodeLatencyOption).toInt();
+        config.hardwareCodecs = parser.value(hardwareCodecsOption).toInt();
+        syntheticMediaSetConfig(config);
+
+        if(scenarios.contains("parity")){
+            report("parity", resolution, benchParity(frames, resolution));
+        }
+        if(scenarios.contains("read")){
+            report("read", resolution, benchRead(frames));
+        }
+        if(scenarios.contains("async")){
+            report("async", resolution, benchAsync(frames));
+        }
+        if(scenarios.contains("scale")){
+            report("scale", resolution, benchScale(frames, resolution));
+        }
+        if(scenarios.contains("seek")){
+            report("seek", resolution, benchSeek(frames));
+        }
+        if(scenarios.contains("write")){
+            Result result = benchWrite(frames, resolution, output, adaptiveBitrate);
+            checkBitrateDropped(result, adaptiveBitrate, config.encodeLatencyUs);
+            report("write", resolution, result);
+        }
+        if(scenarios.contains("transcode")){
+            Result result = benchTranscode(frames, resolution, output, adaptiveBitrate);
+            checkBitrateDropped(result, adaptiveBitrate, config.encodeLatencyUs);
+            report("transcode", resolution, result);
+        }
+        if(scenarios.contains("remux")){
+            report("remux", resolution, benchRemux(output));
+        }
+        if(scenarios.contains("batch")){
+            report("batch", resolution, benchBatch(std::max(parser.value(jobsOption).toInt(), 1), parser.value(workersOption).toInt()));
+        }
+        if(scenarios.contains("sync")){
+            report("sync", resolution, benchSync(std::max(parser.value(streamsOption).toInt(), 1)));
+        }
+        if(scenarios.contains("parallel")){
+            report("parallel", resolution, benchParallel(parser.value(instancesOption).toInt(), output));
+        }
+        if(scenarios.contains("renditions")){
+            report("renditions", resolution, benchRenditions(frames, resolution, output));
+        }
+        if(scenarios.contains("thumbnails")){
+            report("thumbnails", resolution, benchThumbnails(std::max(parser.value(thumbnailsOption).toInt(), 1)));
+        }
+    }
+
+    QFile::remove(output);
+    if(gFailures > 0){
+        fprintf(stderr, "%d scenario checks failed\n", gFailures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,88 @@
+#ifndef _NDK_MEDIA_CODEC_H
+#define _NDK_MEDIA_CODEC_H
+
+/*
+ * Host stand-in for the NDK's media/NdkMediaCodec.h, only for building the benchmark off-device (see syntheticmedia.h).
+ */
+
+#include <sys/types.h>
+
+#include "NdkMediaCrypto.h"
+#include "NdkMediaError.h"
+#include "NdkMediaFormat.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct ANativeWindow;
+typedef struct ANativeWindow ANativeWindow;
+
+struct AMediaCodec;
+typedef struct AMediaCodec AMediaCodec;
+
+struct AMediaCodecBufferInfo {
+    int32_t offset;
+    int32_t size;
+    int64_t presentationTimeUs;
+    uint32_t flags;
+};
+typedef struct AMediaCodecBufferInfo AMediaCodecBufferInfo;
+
+enum {
+    AMEDIACODEC_BUFFER_FLAG_CODEC_CONFIG = 2,
+    AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM = 4,
+    AMEDIACODEC_BUFFER_FLAG_PARTIAL_FRAME = 8,
+
+    AMEDIACODEC_CONFIGURE_FLAG_ENCODE = 1,
+    AMEDIACODEC_INFO_OUTPUT_BUFFERS_CHANGED = -3,
+    AMEDIACODEC_INFO_OUTPUT_FORMAT_CHANGED = -2,
+    AMEDIACODEC_INFO_TRY_AGAIN_LATER = -1
+};
+
+AMediaCodec* AMediaCodec_createCodecByName(const char* name);
+AMediaCodec* AMediaCodec_createDecoderByType(const char* mime_type);
+AMediaCodec* AMediaCodec_createEncoderByType(const char* mime_type);
+media_status_t AMediaCodec_delete(AMediaCodec*);
+
+media_status_t AMediaCodec_configure(AMediaCodec*, const AMediaFormat* format, ANativeWindow* surface, AMediaCrypto* crypto, uint32_t flags);
+media_status_t AMediaCodec_start(AMediaCodec*);
+media_status_t AMediaCodec_stop(AMediaCodec*);
+media_status_t AMediaCodec_flush(AMediaCodec*);
+
+ssize_t AMediaCodec_dequeueInputBuffer(AMediaCodec*, int64_t timeoutUs);
+uint8_t* AMediaCodec_getInputBuffer(AMediaCodec*, size_t idx, size_t* out_size);
+media_status_t AMediaCodec_queueInputBuffer(AMediaCodec*, size_t idx, off_t offset, size_t size, uint64_t time, uint32_t flags);
+
+ssize_t AMediaCodec_dequeueOutputBuffer(AMediaCodec*, AMediaCodecBufferInfo* info, int64_t timeoutUs);
+uint8_t* AMediaCodec_getOutputBuffer(AMediaCodec*, size_t idx, size_t* out_size);
+AMediaFormat* AMediaCodec_getOutputFormat(AMediaCodec*);
+media_status_t AMediaCodec_releaseOutputBuffer(AMediaCodec*, size_t idx, bool render);
+
+media_status_t AMediaCodec_setParameters(AMediaCodec*, const AMediaFormat* params);
+media_status_t AMediaCodec_signalEndOfInputStream(AMediaCodec*);
+
+#if __ANDROID_API__ >= 28
+typedef void (*AMediaCodecOnAsyncInputAvailable)(AMediaCodec* codec, void* userdata, int32_t index);
+typedef void (*AMediaCodecOnAsyncOutputAvailable)(AMediaCodec* codec, void* userdata, int32_t index, AMediaCodecBufferInfo* bufferInfo);
+typedef void (*AMediaCodecOnAsyncFormatChanged)(AMediaCodec* codec, void* userdata, AMediaFormat* format);
+typedef void (*AMediaCodecOnAsyncError)(AMediaCodec* codec, void* userdata, media_status_t error, int32_t actionCode, const char* detail);
+
+typedef struct AMediaCodecOnAsyncNotifyCallback {
+    AMediaCodecOnAsyncInputAvailable onAsyncInputAvailable;
+    AMediaCodecOnAsyncOutputAvailable onAsyncOutputAvailable;
+    AMediaCodecOnAsyncFormatChanged onAsyncFormatChanged;
+    AMediaCodecOnAsyncError onAsyncError;
+} AMediaCodecOnAsyncNotifyCallback;
+
+media_status_t AMediaCodec_setAsyncNotifyCallback(AMediaCodec*, AMediaCodecOnAsyncNotifyCallback callback, void* userdata);
+media_status_t AMediaCodec_getName(AMediaCodec*, char** out_name);
+void AMediaCodec_releaseName(AMediaCodec*, char* name);
+AMediaFormat* AMediaCodec_getInputFormat(AMediaCodec*);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _NDK_MEDIA_CODEC_H
@@ -0,0 +1,11 @@
+#ifndef _NDK_MEDIA_CRYPTO_H
+#define _NDK_MEDIA_CRYPTO_H
+
+/*
+ * Host stand-in for the NDK's media/NdkMediaCrypto.h, only for building the benchmark off-device (see syntheticmedia.h).
+ */
+
+struct AMediaCrypto;
+typedef struct AMediaCrypto AMediaCrypto;
+
+#endif // _NDK_MEDIA_CRYPTO_H
@@ -0,0 +1,38 @@
+#ifndef _NDK_MEDIA_DATASOURCE_H
+#define _NDK_MEDIA_DATASOURCE_H
+
+/*
+ * Host stand-in for the NDK's media/NdkMediaDataSource.h, only for building the benchmark off-device (see syntheticmedia.h).
+ */
+
+#include <sys/types.h>
+
+#include "NdkMediaError.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if __ANDROID_API__ >= 28
+
+struct AMediaDataSource;
+typedef struct AMediaDataSource AMediaDataSource;
+
+typedef ssize_t (*AMediaDataSourceReadAt)(void* userdata, off64_t offset, void* buffer, size_t size);
+typedef ssize_t (*AMediaDataSourceGetSize)(void* userdata);
+typedef void (*AMediaDataSourceClose)(void* userdata);
+
+AMediaDataSource* AMediaDataSource_new();
+void AMediaDataSource_delete(AMediaDataSource*);
+void AMediaDataSource_setUserdata(AMediaDataSource*, void* userdata);
+void AMediaDataSource_setReadAt(AMediaDataSource*, AMediaDataSourceReadAt);
+void AMediaDataSource_setGetSize(AMediaDataSource*, AMediaDataSourceGetSize);
+void AMediaDataSource_setClose(AMediaDataSource*, AMediaDataSourceClose);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _NDK_MEDIA_DATASOURCE_H
@@ -0,0 +1,61 @@
+#ifndef _NDK_MEDIA_EXTRACTOR_H
+#define _NDK_MEDIA_EXTRACTOR_H
+
+/*
+ * Host stand-in for the NDK's media/NdkMediaExtractor.h, only for building the benchmark off-device (see syntheticmedia.h).
+ */
+
+#include <sys/types.h>
+
+#include "NdkMediaError.h"
+#include "NdkMediaFormat.h"
+
+#if __ANDROID_API__ >= 28
+#include "NdkMediaDataSource.h"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct AMediaExtractor;
+typedef struct AMediaExtractor AMediaExtractor;
+
+typedef enum {
+    AMEDIAEXTRACTOR_SEEK_PREVIOUS_SYNC,
+    AMEDIAEXTRACTOR_SEEK_NEXT_SYNC,
+    AMEDIAEXTRACTOR_SEEK_CLOSEST_SYNC
+} SeekMode;
+
+enum {
+    AMEDIAEXTRACTOR_SAMPLE_FLAG_SYNC = 1,
+    AMEDIAEXTRACTOR_SAMPLE_FLAG_ENCRYPTED = 2
+};
+
+AMediaExtractor* AMediaExtractor_new();
+media_status_t AMediaExtractor_delete(AMediaExtractor*);
+media_status_t AMediaExtractor_setDataSourceFd(AMediaExtractor*, int fd, off64_t offset, off64_t length);
+media_status_t AMediaExtractor_setDataSource(AMediaExtractor*, const char* location);
+
+size_t AMediaExtractor_getTrackCount(AMediaExtractor*);
+AMediaFormat* AMediaExtractor_getTrackFormat(AMediaExtractor*, size_t idx);
+media_status_t AMediaExtractor_selectTrack(AMediaExtractor*, size_t idx);
+media_status_t AMediaExtractor_unselectTrack(AMediaExtractor*, size_t idx);
+
+ssize_t AMediaExtractor_readSampleData(AMediaExtractor*, uint8_t* buffer, size_t capacity);
+uint32_t AMediaExtractor_getSampleFlags(AMediaExtractor*);
+int AMediaExtractor_getSampleTrackIndex(AMediaExtractor*);
+int64_t AMediaExtractor_getSampleTime(AMediaExtractor*);
+bool AMediaExtractor_advance(AMediaExtractor*);
+media_status_t AMediaExtractor_seekTo(AMediaExtractor*, int64_t seekPosUs, SeekMode mode);
+
+#if __ANDROID_API__ >= 28
+media_status_t AMediaExtractor_setDataSourceCustom(AMediaExtractor*, AMediaDataSource* src);
+ssize_t AMediaExtractor_getSampleSize(AMediaExtractor*);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _NDK_MEDIA_EXTRACTOR_H
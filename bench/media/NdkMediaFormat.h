@@ -0,0 +1,56 @@
+#ifndef _NDK_MEDIA_FORMAT_H
+#define _NDK_MEDIA_FORMAT_H
+
+/*
+ * Host stand-in for the NDK's media/NdkMediaFormat.h, only for building the benchmark off-device (see syntheticmedia.h).
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "NdkMediaError.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct AMediaFormat;
+typedef struct AMediaFormat AMediaFormat;
+
+AMediaFormat* AMediaFormat_new();
+media_status_t AMediaFormat_delete(AMediaFormat*);
+const char* AMediaFormat_toString(AMediaFormat*);
+
+bool AMediaFormat_getInt32(AMediaFormat*, const char* name, int32_t* out);
+bool AMediaFormat_getInt64(AMediaFormat*, const char* name, int64_t* out);
+bool AMediaFormat_getFloat(AMediaFormat*, const char* name, float* out);
+bool AMediaFormat_getString(AMediaFormat*, const char* name, const char** out);
+bool AMediaFormat_getBuffer(AMediaFormat*, const char* name, void** data, size_t* size);
+bool AMediaFormat_getRect(AMediaFormat*, const char* name, int32_t* left, int32_t* top, int32_t* right, int32_t* bottom);
+
+void AMediaFormat_setInt32(AMediaFormat*, const char* name, int32_t value);
+void AMediaFormat_setInt64(AMediaFormat*, const char* name, int64_t value);
+void AMediaFormat_setFloat(AMediaFormat*, const char* name, float value);
+void AMediaFormat_setString(AMediaFormat*, const char* name, const char* value);
+void AMediaFormat_setBuffer(AMediaFormat*, const char* name, const void* data, size_t size);
+void AMediaFormat_setRect(AMediaFormat*, const char* name, int32_t left, int32_t top, int32_t right, int32_t bottom);
+
+extern const char* AMEDIAFORMAT_KEY_BIT_RATE;
+extern const char* AMEDIAFORMAT_KEY_COLOR_FORMAT;
+extern const char* AMEDIAFORMAT_KEY_DISPLAY_CROP;
+extern const char* AMEDIAFORMAT_KEY_DURATION;
+extern const char* AMEDIAFORMAT_KEY_FRAME_RATE;
+extern const char* AMEDIAFORMAT_KEY_HEIGHT;
+extern const char* AMEDIAFORMAT_KEY_I_FRAME_INTERVAL;
+extern const char* AMEDIAFORMAT_KEY_MAX_HEIGHT;
+extern const char* AMEDIAFORMAT_KEY_MAX_INPUT_SIZE;
+extern const char* AMEDIAFORMAT_KEY_MAX_WIDTH;
+extern const char* AMEDIAFORMAT_KEY_MIME;
+extern const char* AMEDIAFORMAT_KEY_STRIDE;
+extern const char* AMEDIAFORMAT_KEY_WIDTH;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _NDK_MEDIA_FORMAT_H
@@ -0,0 +1,37 @@
+#ifndef _NDK_MEDIA_MUXER_H
+#define _NDK_MEDIA_MUXER_H
+
+/*
+ * Host stand-in for the NDK's media/NdkMediaMuxer.h, only for building the benchmark off-device (see syntheticmedia.h).
+ */
+
+#include <sys/types.h>
+
+#include "NdkMediaCodec.h"
+#include "NdkMediaError.h"
+#include "NdkMediaFormat.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct AMediaMuxer;
+typedef struct AMediaMuxer AMediaMuxer;
+
+typedef enum {
+    AMEDIAMUXER_OUTPUT_FORMAT_MPEG_4 = 0,
+    AMEDIAMUXER_OUTPUT_FORMAT_WEBM   = 1
+} OutputFormat;
+
+AMediaMuxer* AMediaMuxer_new(int fd, OutputFormat format);
+media_status_t AMediaMuxer_delete(AMediaMuxer*);
+ssize_t AMediaMuxer_addTrack(AMediaMuxer*, const AMediaFormat* format);
+media_status_t AMediaMuxer_start(AMediaMuxer*);
+media_status_t AMediaMuxer_stop(AMediaMuxer*);
+media_status_t AMediaMuxer_writeSampleData(AMediaMuxer* muxer, size_t trackIdx, const uint8_t* data, const AMediaCodecBufferInfo* info);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _NDK_MEDIA_MUXER_H
@@ -0,0 +1,1033 @@
+#include "syntheticmedia.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "media/NdkMediaCodec.h"
+#include "media/NdkMediaExtractor.h"
+#include "media/NdkMediaFormat.h"
+#include "media/NdkMediaMuxer.h"
+
+
+const char* AMEDIAFORMAT_KEY_BIT_RATE = "bitrate";
+const char* AMEDIAFORMAT_KEY_COLOR_FORMAT = "color-format";
+const char* AMEDIAFORMAT_KEY_DISPLAY_CROP = "crop";
+const char* AMEDIAFORMAT_KEY_DURATION = "durationUs";
+const char* AMEDIAFORMAT_KEY_FRAME_RATE = "frame-rate";
+const char* AMEDIAFORMAT_KEY_HEIGHT = "height";
+const char* AMEDIAFORMAT_KEY_I_FRAME_INTERVAL = "i-frame-interval";
+const char* AMEDIAFORMAT_KEY_MAX_HEIGHT = "max-height";
+const char* AMEDIAFORMAT_KEY_MAX_INPUT_SIZE = "max-input-size";
+const char* AMEDIAFORMAT_KEY_MAX_WIDTH = "max-width";
+const char* AMEDIAFORMAT_KEY_MIME = "mime";
+const char* AMEDIAFORMAT_KEY_STRIDE = "stride";
+const char* AMEDIAFORMAT_KEY_WIDTH = "width";
+
+
+SyntheticMediaConfig::SyntheticMediaConfig()
+    :width(1280),
+      height(720),
+      stride(0),
+      sliceHeight(0),
+      colorFormat(21),
+      frameCount(300),
+      fps(30),
+      gopLength(30),
+      sampleSize(32 * 1024),
+      decodeLatencyUs(0),
+      encodeLatencyUs(0),
+      inputBuffers(4),
+      outputBuffers(4),
+      hardwareCodecs(0),
+      softwareLatencyFactor(3)
+{
+}
+
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+std::mutex gConfigMutex;
+SyntheticMediaConfig gConfig;
+
+std::atomic<uint64_t> gDecodedFrames(0);
+std::atomic<uint64_t> gEncodedFrames(0);
+std::atomic<uint64_t> gMuxedBytes(0);
+std::atomic<int> gEncoderBitrate(0);
+std::atomic<uint64_t> gSyncFrameRequests(0);
+std::atomic<int> gHardwareCodecs(0);
+std::atomic<int> gHardwareInstances[2] = {{0}, {0}};   // decoders, encoders
+std::atomic<int> gPeakHardwareCodecs(0);
+std::atomic<uint64_t> gRefusedCodecs(0);
+
+/**
+ * Number of distinct frames the decoder produces, frame n is the pattern shifted by n % PATTERN_FRAMES bytes.
+ */
+const int PATTERN_FRAMES = 64;
+
+/**
+ * BUFFER_FLAG_KEY_FRAME, marks sync frames in encoder output.
+ */
+const uint32_t SYNC_FRAME_FLAG = 1;
+
+int64_t frameTimeUs(const SyntheticMediaConfig& config, int64_t frame){
+    return frame * 1000000 / config.fps;
+}
+
+size_t sampleSize(const SyntheticMediaConfig& config, int64_t frame){
+    return static_cast<size_t>(config.sampleSize) * (frame % config.gopLength == 0 ? 4 : 1);
+}
+
+/**
+ * A luma gradient and slowly varying chroma, long enough for every frame's shift.
+ */
+void makePattern(std::vector<uint8_t>& pattern, size_t frameBytes, int stride){
+    pattern.resize(frameBytes + PATTERN_FRAMES);
+    for(size_t i = 0; i < pattern.size(); i++){
+        pattern[i] = static_cast<uint8_t>((i * 7 + i / stride) & 0xff);
+    }
+}
+
+} // namespace
+
+void syntheticMediaSetConfig(const SyntheticMediaConfig& config){
+    std::lock_guard<std::mutex> lock(gConfigMutex);
+    gConfig = config;
+    gConfig.fps = std::max(gConfig.fps, 1);
+    gConfig.gopLength = std::max(gConfig.gopLength, 1);
+    gConfig.inputBuffers = std::max(gConfig.inputBuffers, 1);
+    gConfig.outputBuffers = std::max(gConfig.outputBuffers, 1);
+}
+
+SyntheticMediaConfig syntheticMediaConfig(){
+    std::lock_guard<std::mutex> lock(gConfigMutex);
+    return gConfig;
+}
+
+void syntheticMediaDecodedFrame(int64_t frame, std::vector<uint8_t>& buffer, int& stride, int& sliceHeight){
+    const SyntheticMediaConfig config = syntheticMediaConfig();
+    stride = std::max((config.width + 1) & ~1, config.stride);
+    sliceHeight = std::max((config.height + 1) & ~1, config.sliceHeight);
+    const size_t frameBytes = static_cast<size_t>(stride) * sliceHeight * 3 / 2;
+
+    std::vector<uint8_t> pattern;
+    makePattern(pattern, frameBytes, stride);
+    const size_t shift = static_cast<size_t>(frame % PATTERN_FRAMES);
+    buffer.assign(pattern.begin() + shift, pattern.begin() + shift + frameBytes);
+}
+
+SyntheticMediaCounters syntheticMediaCounters(){
+    SyntheticMediaCounters counters;
+    counters.decodedFrames = gDecodedFrames.load();
+    counters.encodedFrames = gEncodedFrames.load();
+    counters.muxedBytes = gMuxedBytes.load();
+    counters.encoderBitrate = gEncoderBitrate.load();
+    counters.syncFrameRequests = gSyncFrameRequests.load();
+    counters.hardwareCodecs = gHardwareCodecs.load();
+    counters.peakHardwareCodecs = gPeakHardwareCodecs.load();
+    counters.refusedCodecs = gRefusedCodecs.load();
+    return counters;
+}
+
+void syntheticMediaResetCounters(){
+    gDecodedFrames.store(0);
+    gEncodedFrames.store(0);
+    gMuxedBytes.store(0);
+    gEncoderBitrate.store(0);
+    gSyncFrameRequests.store(0);
+    gPeakHardwareCodecs.store(gHardwareCodecs.load());
+    gRefusedCodecs.store(0);
+}
+
+
+// ---------------------------------------------------------------------------------------------------------------------
+// AMediaFormat
+
+struct AMediaFormat {
+    struct Value {
+        enum Type { INT32, INT64, FLOAT, STRING, RECT, BUFFER } type;
+        int64_t integer;
+        float real;
+        std::string string;     ///< also the bytes of a BUFFER
+        int32_t rect[4];
+    };
+
+    std::map<std::string, Value> values;
+    std::string description;
+
+    Value* find(const char* name, Value::Type type){
+        auto it = values.find(name);
+        return it != values.end() && it->second.type == type ? &it->second : nullptr;
+    }
+
+    Value& set(const char* name, Value::Type type){
+        Value& value = values[name];
+        value.type = type;
+        return value;
+    }
+};
+
+AMediaFormat* AMediaFormat_new(){
+    return new AMediaFormat();
+}
+
+media_status_t AMediaFormat_delete(AMediaFormat* format){
+    delete format;
+    return AMEDIA_OK;
+}
+
+const char* AMediaFormat_toString(AMediaFormat* format){
+    std::ostringstream out;
+    out << "AMediaFormat:";
+    for(const auto& entry : format->values){
+        out << " " << entry.first << ": ";
+        switch(entry.second.type){
+        case AMediaFormat::Value::INT32:
+        case AMediaFormat::Value::INT64: out << entry.second.integer; break;
+        case AMediaFormat::Value::FLOAT: out << entry.second.real; break;
+        case AMediaFormat::Value::STRING: out << entry.second.string; break;
+        case AMediaFormat::Value::BUFFER: out << entry.second.string.size() << " bytes"; break;
+        case AMediaFormat::Value::RECT:
+            out << entry.second.rect[0] << "," << entry.second.rect[1] << "," << entry.second.rect[2] << "," << entry.second.rect[3];
+            break;
+        }
+    }
+    format->description = out.str();
+    return format->description.c_str();
+}
+
+bool AMediaFormat_getInt32(AMediaFormat* format, const char* name, int32_t* out){
+    AMediaFormat::Value* value = format->find(name, AMediaFormat::Value::INT32);
+    if(value != nullptr){
+        *out = static_cast<int32_t>(value->integer);
+    }
+    return value != nullptr;
+}
+
+bool AMediaFormat_getInt64(AMediaFormat* format, const char* name, int64_t* out){
+    AMediaFormat::Value* value = format->find(name, AMediaFormat::Value::INT64);
+    if(value != nullptr){
+        *out = value->integer;
+    }
+    return value != nullptr;
+}
+
+bool AMediaFormat_getFloat(AMediaFormat* format, const char* name, float* out){
+    AMediaFormat::Value* value = format->find(name, AMediaFormat::Value::FLOAT);
+    if(value != nullptr){
+        *out = value->real;
+    }
+    return value != nullptr;
+}
+
+bool AMediaFormat_getString(AMediaFormat* format, const char* name, const char** out){
+    AMediaFormat::Value* value = format->find(name, AMediaFormat::Value::STRING);
+    if(value != nullptr){
+        *out = value->string.c_str();
+    }
+    return value != nullptr;
+}
+
+bool AMediaFormat_getRect(AMediaFormat* format, const char* name, int32_t* left, int32_t* top, int32_t* right, int32_t* bottom){
+    AMediaFormat::Value* value = format->find(name, AMediaFormat::Value::RECT);
+    if(value != nullptr){
+        *left = value->rect[0];
+        *top = value->rect[1];
+        *right = value->rect[2];
+        *bottom = value->rect[3];
+    }
+    return value != nullptr;
+}
+
+bool AMediaFormat_getBuffer(AMediaFormat* format, const char* name, void** data, size_t* size){
+    AMediaFormat::Value* value = format->find(name, AMediaFormat::Value::BUFFER);
+    if(value != nullptr){
+        *data = &value->string[0];
+        *size = value->string.size();
+    }
+    return value != nullptr;
+}
+
+void AMediaFormat_setInt32(AMediaFormat* format, const char* name, int32_t value){
+    format->set(name, AMediaFormat::Value::INT32).integer = value;
+}
+
+void AMediaFormat_setInt64(AMediaFormat* format, const char* name, int64_t value){
+    format->set(name, AMediaFormat::Value::INT64).integer = value;
+}
+
+void AMediaFormat_setFloat(AMediaFormat* format, const char* name, float value){
+    format->set(name, AMediaFormat::Value::FLOAT).real = value;
+}
+
+void AMediaFormat_setString(AMediaFormat* format, const char* name, const char* value){
+    format->set(name, AMediaFormat::Value::STRING).string = value;
+}
+
+void AMediaFormat_setBuffer(AMediaFormat* format, const char* name, const void* data, size_t size){
+    format->set(name, AMediaFormat::Value::BUFFER).string.assign(static_cast<const char*>(data), size);
+}
+
+void AMediaFormat_setRect(AMediaFormat* format, const char* name, int32_t left, int32_t top, int32_t right, int32_t bottom){
+    AMediaFormat::Value& value = format->set(name, AMediaFormat::Value::RECT);
+    value.rect[0] = left;
+    value.rect[1] = top;
+    value.rect[2] = right;
+    value.rect[3] = bottom;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------------------
+// AMediaExtractor
+
+struct AMediaExtractor {
+    SyntheticMediaConfig config;
+    int64_t position;
+    bool selected;
+};
+
+AMediaExtractor* AMediaExtractor_new(){
+    AMediaExtractor* extractor = new AMediaExtractor();
+    extractor->config = syntheticMediaConfig();
+    extractor->position = 0;
+    extractor->selected = false;
+    return extractor;
+}
+
+media_status_t AMediaExtractor_delete(AMediaExtractor* extractor){
+    delete extractor;
+    return AMEDIA_OK;
+}
+
+media_status_t AMediaExtractor_setDataSourceFd(AMediaExtractor*, int, off64_t, off64_t){
+    return AMEDIA_OK;
+}
+
+media_status_t AMediaExtractor_setDataSource(AMediaExtractor*, const char*){
+    return AMEDIA_OK;
+}
+
+size_t AMediaExtractor_getTrackCount(AMediaExtractor*){
+    return 1;
+}
+
+AMediaFormat* AMediaExtractor_getTrackFormat(AMediaExtractor* extractor, size_t idx){
+    if(idx != 0){
+        return nullptr;
+    }
+    const SyntheticMediaConfig& config = extractor->config;
+    AMediaFormat* format = AMediaFormat_new();
+    AMediaFormat_setString(format, AMEDIAFORMAT_KEY_MIME, "video/avc");
+    AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_WIDTH, config.width);
+    AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_HEIGHT, config.height);
+    AMediaFormat_setInt64(format, AMEDIAFORMAT_KEY_DURATION, frameTimeUs(config, config.frameCount));
+    AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_FRAME_RATE, config.fps);
+    AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_MAX_INPUT_SIZE, config.sampleSize * 4);
+    return format;
+}
+
+media_status_t AMediaExtractor_selectTrack(AMediaExtractor* extractor, size_t idx){
+    if(idx != 0){
+        return AMEDIA_ERROR_INVALID_PARAMETER;
+    }
+    extractor->selected = true;
+    return AMEDIA_OK;
+}
+
+media_status_t AMediaExtractor_unselectTrack(AMediaExtractor* extractor, size_t){
+    extractor->selected = false;
+    return AMEDIA_OK;
+}
+
+ssize_t AMediaExtractor_readSampleData(AMediaExtractor* extractor, uint8_t* buffer, size_t capacity){
+    const SyntheticMediaConfig& config = extractor->config;
+    if(!extractor->selected || extractor->position >= config.frameCount){
+        return -1;
+    }
+    const size_t size = sampleSize(config, extractor->position);
+    if(capacity < size || size < sizeof(int64_t)){
+        return -1;
+    }
+    // the decoder learns from the first bytes which frame it is decoding
+    memset(buffer, static_cast<int>(extractor->position & 0xff), size);
+    memcpy(buffer, &extractor->position, sizeof(int64_t));
+    return static_cast<ssize_t>(size);
+}
+
+uint32_t AMediaExtractor_getSampleFlags(AMediaExtractor* extractor){
+    if(extractor->position >= extractor->config.frameCount){
+        return 0;
+    }
+    return extractor->position % extractor->config.gopLength == 0 ? AMEDIAEXTRACTOR_SAMPLE_FLAG_SYNC : 0;
+}
+
+int AMediaExtractor_getSampleTrackIndex(AMediaExtractor* extractor){
+    return extractor->selected && extractor->position < extractor->config.frameCount ? 0 : -1;
+}
+
+int64_t AMediaExtractor_getSampleTime(AMediaExtractor* extractor){
+    if(!extractor->selected || extractor->position >= extractor->config.frameCount){
+        return -1;
+    }
+    return frameTimeUs(extractor->config, extractor->position);
+}
+
+bool AMediaExtractor_advance(AMediaExtractor* extractor){
+    if(extractor->position < extractor->config.frameCount){
+        extractor->position++;
+    }
+    return extractor->position < extractor->config.frameCount;
+}
+
+#if __ANDROID_API__ >= 28
+media_status_t AMediaExtractor_setDataSourceCustom(AMediaExtractor*, AMediaDataSource* src){
+    return src != nullptr ? AMEDIA_OK : AMEDIA_ERROR_INVALID_PARAMETER;
+}
+
+ssize_t AMediaExtractor_getSampleSize(AMediaExtractor* extractor){
+    if(!extractor->selected || extractor->position >= extractor->config.frameCount){
+        return -1;
+    }
+    return static_cast<ssize_t>(sampleSize(extractor->config, extractor->position));
+}
+#endif
+
+media_status_t AMediaExtractor_seekTo(AMediaExtractor* extractor, int64_t seekPosUs, SeekMode mode){
+    const SyntheticMediaConfig& config = extractor->config;
+    int64_t frame = std::max<int64_t>(0, seekPosUs) * config.fps / 1000000;
+    // frame times are rounded down, so the frame presented at seekPosUs may be the next one
+    if(frame + 1 < config.frameCount && frameTimeUs(config, frame + 1) <= seekPosUs){
+        frame++;
+    }
+    frame = std::min<int64_t>(frame, config.frameCount - 1);
+
+    const int64_t previous = frame - frame % config.gopLength;
+    const int64_t next = std::min<int64_t>(previous + (frame == previous ? 0 : config.gopLength), config.frameCount - 1);
+    switch(mode){
+    case AMEDIAEXTRACTOR_SEEK_PREVIOUS_SYNC: frame = previous; break;
+    case AMEDIAEXTRACTOR_SEEK_NEXT_SYNC: frame = next; break;
+    case AMEDIAEXTRACTOR_SEEK_CLOSEST_SYNC: frame = frame - previous <= next - frame ? previous : next; break;
+    }
+    extractor->position = std::max<int64_t>(0, frame);
+    return AMEDIA_OK;
+}
+
+
+#if __ANDROID_API__ >= 28
+
+// ---------------------------------------------------------------------------------------------------------------------
+// AMediaDataSource, only kept around: the extractor serves its synthetic video whatever the source
+
+struct AMediaDataSource {
+    void* userdata;
+    AMediaDataSourceReadAt readAt;
+    AMediaDataSourceGetSize getSize;
+    AMediaDataSourceClose close;
+};
+
+AMediaDataSource* AMediaDataSource_new(){
+    return new AMediaDataSource();
+}
+
+void AMediaDataSource_delete(AMediaDataSource* source){
+    if(source != nullptr && source->close != nullptr){
+        source->close(source->userdata);
+    }
+    delete source;
+}
+
+void AMediaDataSource_setUserdata(AMediaDataSource* source, void* userdata){
+    source->userdata = userdata;
+}
+
+void AMediaDataSource_setReadAt(AMediaDataSource* source, AMediaDataSourceReadAt readAt){
+    source->readAt = readAt;
+}
+
+void AMediaDataSource_setGetSize(AMediaDataSource* source, AMediaDataSourceGetSize getSize){
+    source->getSize = getSize;
+}
+
+void AMediaDataSource_setClose(AMediaDataSource* source, AMediaDataSourceClose close){
+    source->close = close;
+}
+
+#endif
+
+
+// ---------------------------------------------------------------------------------------------------------------------
+// AMediaCodec
+
+struct AMediaCodec {
+    struct Pending {
+        int64_t frame;
+        int64_t presentationTimeUs;
+        uint32_t flags;
+        Clock::time_point ready;
+    };
+
+    std::string name;
+    bool encoder;
+    bool hardware;
+    bool started;
+    bool formatReported;
+    SyntheticMediaConfig config;
+    std::chrono::microseconds latency;
+    int32_t configuredBitrate;
+    bool syncFrameRequested;
+
+    AMediaFormat inputFormat;
+    AMediaFormat outputFormat;
+    size_t frameBytes;
+    std::vector<uint8_t> pattern;
+
+    std::vector<std::vector<uint8_t> > inputs;
+    std::vector<std::vector<uint8_t> > outputs;
+    std::deque<size_t> freeInputs;
+    std::vector<bool> outputBusy;
+    std::deque<Pending> pending;
+    Clock::time_point busyUntil;
+    int64_t encodedFrames;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+
+#if __ANDROID_API__ >= 28
+    /**
+     * @brief callbacks set: a thread of the codec calls them from start() to stop() instead of the dequeue*Buffer() calls
+     */
+    bool async;
+    AMediaCodecOnAsyncNotifyCallback callbacks;
+    void* userdata;
+    std::thread callbackThread;
+#endif
+};
+
+namespace {
+
+AMediaCodec* createCodec(const std::string& name, bool encoder, bool hardware){
+    const SyntheticMediaConfig config = syntheticMediaConfig();
+    if(hardware){
+        // like on a device, decoders and encoders have limits of their own
+        std::atomic<int>& kind = gHardwareInstances[encoder ? 1 : 0];
+        if(kind.fetch_add(1) + 1 > config.hardwareCodecs && config.hardwareCodecs > 0){
+            kind.fetch_sub(1);
+            gRefusedCodecs.fetch_add(1);
+            return nullptr;
+        }
+        const int instances = gHardwareCodecs.fetch_add(1) + 1;
+        int peak = gPeakHardwareCodecs.load();
+        while(instances > peak && !gPeakHardwareCodecs.compare_exchange_weak(peak, instances)){
+        }
+    }
+
+    AMediaCodec* codec = new AMediaCodec();
+    codec->name = name;
+    codec->encoder = encoder;
+    codec->hardware = hardware;
+    codec->started = false;
+    codec->formatReported = false;
+    codec->config = config;
+    if(!hardware){
+        codec->config.decodeLatencyUs *= config.softwareLatencyFactor;
+        codec->config.encodeLatencyUs *= config.softwareLatencyFactor;
+    }
+    codec->latency = std::chrono::microseconds(encoder ? codec->config.encodeLatencyUs : codec->config.decodeLatencyUs);
+    codec->configuredBitrate = 0;
+    codec->syncFrameRequested = false;
+    codec->frameBytes = 0;
+    codec->encodedFrames = 0;
+#if __ANDROID_API__ >= 28
+    codec->async = false;
+    codec->userdata = nullptr;
+#endif
+    return codec;
+}
+
+/**
+ * Waits on the codec until predicate holds or timeoutUs passed (forever if negative). Returns the predicate.
+ */
+template<typename Predicate>
+bool waitFor(AMediaCodec* codec, std::unique_lock<std::mutex>& lock, int64_t timeoutUs, Predicate predicate){
+    if(timeoutUs < 0){
+        codec->changed.wait(lock, predicate);
+        return true;
+    }
+    return codec->changed.wait_for(lock, std::chrono::microseconds(timeoutUs), predicate);
+}
+
+void resetBuffers(AMediaCodec* codec){
+    codec->freeInputs.clear();
+    for(size_t i = 0; i < codec->inputs.size(); i++){
+        codec->freeInputs.push_back(i);
+    }
+    codec->outputBusy.assign(codec->outputs.size(), false);
+    codec->pending.clear();
+    codec->busyUntil = Clock::now();
+}
+
+/**
+ * Takes the next finished frame into a free output buffer and describes it in info. Returns the buffer index, -1 if nothing is ready.
+ */
+ssize_t takeOutput(AMediaCodec* codec, AMediaCodecBufferInfo* info, Clock::time_point now){
+    auto freeOutput = std::find(codec->outputBusy.begin(), codec->outputBusy.end(), false);
+    if(codec->pending.empty() || codec->pending.front().ready > now || freeOutput == codec->outputBusy.end()){
+        return -1;
+    }
+    const AMediaCodec::Pending pending = codec->pending.front();
+    codec->pending.pop_front();
+    const size_t index = static_cast<size_t>(freeOutput - codec->outputBusy.begin());
+    codec->outputBusy[index] = true;
+    codec->changed.notify_all();
+
+    info->offset = 0;
+    info->presentationTimeUs = pending.presentationTimeUs;
+    info->flags = pending.flags;
+    info->size = 0;
+    if(pending.frame >= 0){
+        if(codec->encoder){
+            const size_t size = sampleSize(codec->config, pending.frame);
+            memset(codec->outputs[index].data(), static_cast<int>(pending.frame & 0xff), size);
+            info->size = static_cast<int32_t>(size);
+            gEncodedFrames++;
+        }
+        else{
+            memcpy(codec->outputs[index].data(), codec->pattern.data() + pending.frame % PATTERN_FRAMES, codec->frameBytes);
+            info->size = static_cast<int32_t>(codec->frameBytes);
+            gDecodedFrames++;
+        }
+    }
+    return static_cast<ssize_t>(index);
+}
+
+/**
+ * When the next pending frame is due, or a second from now if nothing can come out yet.
+ */
+Clock::time_point nextWakeUp(AMediaCodec* codec, Clock::time_point now){
+    Clock::time_point wakeUp = now + std::chrono::seconds(1);
+    if(!codec->pending.empty() && std::find(codec->outputBusy.begin(), codec->outputBusy.end(), false) != codec->outputBusy.end()){
+        wakeUp = std::min(wakeUp, codec->pending.front().ready);
+    }
+    return wakeUp;
+}
+
+bool formatDue(AMediaCodec* codec){
+    // decoders announce their output format before the first frame, encoders once they have seen one
+    return !codec->formatReported && (!codec->encoder || !codec->pending.empty());
+}
+
+bool inputAvailable(AMediaCodec* codec){
+    // a codec only accepts as much work as it has buffers for
+    return !codec->freeInputs.empty() && codec->pending.size() < codec->inputs.size() + codec->outputs.size();
+}
+
+#if __ANDROID_API__ >= 28
+/**
+ * The codec thread of asynchronous mode: hands out input buffers, format changes and finished frames through the callbacks,
+ * which are called without holding the codec's lock, like the real ones they may queue and release buffers right away.
+ */
+void runCallbacks(AMediaCodec* codec){
+    std::unique_lock<std::mutex> lock(codec->mutex);
+    while(codec->started){
+        if(formatDue(codec)){
+            codec->formatReported = true;
+            AMediaFormat format;
+            format.values = codec->outputFormat.values;
+            lock.unlock();
+            codec->callbacks.onAsyncFormatChanged(codec, codec->userdata, &format);
+            lock.lock();
+            continue;
+        }
+        if(inputAvailable(codec)){
+            const size_t index = codec->freeInputs.front();
+            codec->freeInputs.pop_front();
+            lock.unlock();
+            codec->callbacks.onAsyncInputAvailable(codec, codec->userdata, static_cast<int32_t>(index));
+            lock.lock();
+            continue;
+        }
+        AMediaCodecBufferInfo info;
+        const Clock::time_point now = Clock::now();
+        const ssize_t index = takeOutput(codec, &info, now);
+        if(index >= 0){
+            lock.unlock();
+            codec->callbacks.onAsyncOutputAvailable(codec, codec->userdata, static_cast<int32_t>(index), &info);
+            lock.lock();
+            continue;
+        }
+        codec->changed.wait_until(lock, nextWakeUp(codec, now));
+    }
+}
+
+/**
+ * Ends the codec thread unless called from it (a callback stopping the codec), in which case it ends on its own.
+ */
+void joinCallbackThread(AMediaCodec* codec){
+    if(codec->callbackThread.joinable()){
+        if(codec->callbackThread.get_id() == std::this_thread::get_id()){
+            codec->callbackThread.detach();
+        }
+        else{
+            codec->callbackThread.join();
+        }
+    }
+}
+#endif
+
+} // namespace
+
+AMediaCodec* AMediaCodec_createCodecByName(const char* name){
+    const bool software = strncmp(name, "c2.android.", 11) == 0 || strncmp(name, "OMX.google.", 11) == 0;
+    return createCodec(name, strstr(name, "encoder") != nullptr, !software);
+}
+
+AMediaCodec* AMediaCodec_createDecoderByType(const char*){
+    return createCodec("c2.synthetic.avc.decoder", false, true);
+}
+
+AMediaCodec* AMediaCodec_createEncoderByType(const char*){
+    return createCodec("c2.synthetic.avc.encoder", true, true);
+}
+
+media_status_t AMediaCodec_delete(AMediaCodec* codec){
+    AMediaCodec_stop(codec);
+    if(codec->hardware){
+        gHardwareInstances[codec->encoder ? 1 : 0].fetch_sub(1);
+        gHardwareCodecs.fetch_sub(1);
+    }
+    delete codec;
+    return AMEDIA_OK;
+}
+
+media_status_t AMediaCodec_configure(AMediaCodec* codec, const AMediaFormat* format, ANativeWindow*, AMediaCrypto*, uint32_t flags){
+    if(codec->encoder != ((flags & AMEDIACODEC_CONFIGURE_FLAG_ENCODE) != 0)){
+        return AMEDIA_ERROR_INVALID_PARAMETER;
+    }
+    AMediaFormat* input = const_cast<AMediaFormat*>(format);
+    int32_t width = 0;
+    int32_t height = 0;
+    if(!AMediaFormat_getInt32(input, AMEDIAFORMAT_KEY_WIDTH, &width) || !AMediaFormat_getInt32(input, AMEDIAFORMAT_KEY_HEIGHT, &height)
+            || width <= 0 || height <= 0){
+        return AMEDIA_ERROR_INVALID_PARAMETER;
+    }
+
+    const SyntheticMediaConfig& config = codec->config;
+    int32_t stride = (width + 1) & ~1;
+    int32_t sliceHeight = (height + 1) & ~1;
+    int32_t colorFormat = 21;
+    codec->formatReported = false;
+    codec->inputFormat.values = input->values;
+    if(codec->encoder){
+        AMediaFormat_getInt32(input, AMEDIAFORMAT_KEY_COLOR_FORMAT, &colorFormat);
+        AMediaFormat_setInt32(&codec->inputFormat, AMEDIAFORMAT_KEY_STRIDE, stride);
+        AMediaFormat_setInt32(&codec->inputFormat, "slice-height", sliceHeight);
+    }
+    else{
+        stride = std::max(stride, config.stride);
+        sliceHeight = std::max(sliceHeight, config.sliceHeight);
+        colorFormat = config.colorFormat;
+    }
+    codec->frameBytes = static_cast<size_t>(stride) * sliceHeight * 3 / 2;
+
+    AMediaFormat_setString(&codec->outputFormat, AMEDIAFORMAT_KEY_MIME, codec->encoder ? "video/avc" : "video/raw");
+    AMediaFormat_setInt32(&codec->outputFormat, AMEDIAFORMAT_KEY_WIDTH, width);
+    AMediaFormat_setInt32(&codec->outputFormat, AMEDIAFORMAT_KEY_HEIGHT, height);
+    if(codec->encoder){
+        // stands in for SPS / PPS, which only depend on the stream's parameters, not the encoder instance
+        const std::string parameterSets = "sps " + std::to_string(width) + "x" + std::to_string(height) + " pps";
+        AMediaFormat_setBuffer(&codec->outputFormat, "csd-0", parameterSets.data(), parameterSets.size());
+    }
+    else{
+        AMediaFormat_setInt32(&codec->outputFormat, AMEDIAFORMAT_KEY_STRIDE, stride);
+        AMediaFormat_setInt32(&codec->outputFormat, "slice-height", sliceHeight);
+        AMediaFormat_setInt32(&codec->outputFormat, AMEDIAFORMAT_KEY_COLOR_FORMAT, colorFormat);
+        AMediaFormat_setInt32(&codec->outputFormat, "crop-left", 0);
+        AMediaFormat_setInt32(&codec->outputFormat, "crop-top", 0);
+        AMediaFormat_setInt32(&codec->outputFormat, "crop-right", width - 1);
+        AMediaFormat_setInt32(&codec->outputFormat, "crop-bottom", height - 1);
+
+        makePattern(codec->pattern, codec->frameBytes, stride);
+    }
+
+    if(codec->encoder && AMediaFormat_getInt32(input, AMEDIAFORMAT_KEY_BIT_RATE, &codec->configuredBitrate)){
+        gEncoderBitrate.store(codec->configuredBitrate);
+    }
+
+    const size_t inputSize = codec->encoder ? codec->frameBytes : static_cast<size_t>(config.sampleSize) * 4;
+    const size_t outputSize = codec->encoder ? static_cast<size_t>(config.sampleSize) * 4 : codec->frameBytes;
+    codec->inputs.assign(config.inputBuffers, std::vector<uint8_t>(inputSize));
+    codec->outputs.assign(config.outputBuffers, std::vector<uint8_t>(outputSize));
+    resetBuffers(codec);
+    return AMEDIA_OK;
+}
+
+media_status_t AMediaCodec_start(AMediaCodec* codec){
+    std::lock_guard<std::mutex> lock(codec->mutex);
+    if(codec->inputs.empty() || codec->started){
+        return AMEDIA_ERROR_INVALID_OPERATION;
+    }
+    codec->started = true;
+#if __ANDROID_API__ >= 28
+    if(codec->async){
+        codec->callbackThread = std::thread(&runCallbacks, codec);
+    }
+#endif
+    return AMEDIA_OK;
+}
+
+media_status_t AMediaCodec_stop(AMediaCodec* codec){
+    {
+        std::lock_guard<std::mutex> lock(codec->mutex);
+        codec->started = false;
+        codec->changed.notify_all();
+    }
+#if __ANDROID_API__ >= 28
+    // no callback runs anymore once stop() returns
+    joinCallbackThread(codec);
+#endif
+    std::lock_guard<std::mutex> lock(codec->mutex);
+    resetBuffers(codec);
+    return AMEDIA_OK;
+}
+
+media_status_t AMediaCodec_flush(AMediaCodec* codec){
+    std::lock_guard<std::mutex> lock(codec->mutex);
+    resetBuffers(codec);
+    codec->changed.notify_all();
+    return AMEDIA_OK;
+}
+
+ssize_t AMediaCodec_dequeueInputBuffer(AMediaCodec* codec, int64_t timeoutUs){
+    std::unique_lock<std::mutex> lock(codec->mutex);
+    bool available = waitFor(codec, lock, timeoutUs, [codec]{
+        return !codec->started || inputAvailable(codec);
+    });
+    if(!available || !codec->started){
+        return AMEDIACODEC_INFO_TRY_AGAIN_LATER;
+    }
+    size_t index = codec->freeInputs.front();
+    codec->freeInputs.pop_front();
+    return static_cast<ssize_t>(index);
+}
+
+uint8_t* AMediaCodec_getInputBuffer(AMediaCodec* codec, size_t idx, size_t* out_size){
+    if(idx >= codec->inputs.size()){
+        return nullptr;
+    }
+    *out_size = codec->inputs[idx].size();
+    return codec->inputs[idx].data();
+}
+
+media_status_t AMediaCodec_queueInputBuffer(AMediaCodec* codec, size_t idx, off_t offset, size_t size, uint64_t time, uint32_t flags){
+    std::lock_guard<std::mutex> lock(codec->mutex);
+    if(idx >= codec->inputs.size() || offset < 0 || static_cast<size_t>(offset) + size > codec->inputs[idx].size()){
+        return AMEDIA_ERROR_INVALID_PARAMETER;
+    }
+
+    AMediaCodec::Pending pending;
+    pending.presentationTimeUs = static_cast<int64_t>(time);
+    pending.flags = flags & AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM;
+    pending.frame = -1;
+    if(size > 0 && !(flags & AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM)){
+        if(codec->encoder){
+            pending.frame = codec->encodedFrames++;
+            // encoders start a GOP every gopLength frames too, or when asked to
+            if(pending.frame % codec->config.gopLength == 0 || codec->syncFrameRequested){
+                pending.flags |= SYNC_FRAME_FLAG;
+                codec->syncFrameRequested = false;
+            }
+        }
+        else if(size >= sizeof(int64_t)){
+            memcpy(&pending.frame, codec->inputs[idx].data() + offset, sizeof(int64_t));
+        }
+    }
+    // one frame after another, each taking the configured latency
+    codec->busyUntil = std::max(codec->busyUntil, Clock::now()) + codec->latency;
+    pending.ready = codec->busyUntil;
+    codec->pending.push_back(pending);
+    codec->freeInputs.push_back(idx);
+    codec->changed.notify_all();
+    return AMEDIA_OK;
+}
+
+ssize_t AMediaCodec_dequeueOutputBuffer(AMediaCodec* codec, AMediaCodecBufferInfo* info, int64_t timeoutUs){
+    std::unique_lock<std::mutex> lock(codec->mutex);
+    const Clock::time_point deadline = Clock::now() + std::chrono::microseconds(std::max<int64_t>(timeoutUs, 0));
+    while(codec->started){
+        const Clock::time_point now = Clock::now();
+        if(formatDue(codec)){
+            codec->formatReported = true;
+            return AMEDIACODEC_INFO_OUTPUT_FORMAT_CHANGED;
+        }
+        const ssize_t index = takeOutput(codec, info, now);
+        if(index >= 0){
+            return index;
+        }
+        if(timeoutUs >= 0 && now >= deadline){
+            break;
+        }
+        codec->changed.wait_until(lock, timeoutUs >= 0 ? std::min(deadline, nextWakeUp(codec, now)) : nextWakeUp(codec, now));
+    }
+    return AMEDIACODEC_INFO_TRY_AGAIN_LATER;
+}
+
+uint8_t* AMediaCodec_getOutputBuffer(AMediaCodec* codec, size_t idx, size_t* out_size){
+    if(idx >= codec->outputs.size()){
+        return nullptr;
+    }
+    *out_size = codec->outputs[idx].size();
+    return codec->outputs[idx].data();
+}
+
+AMediaFormat* AMediaCodec_getOutputFormat(AMediaCodec* codec){
+    std::lock_guard<std::mutex> lock(codec->mutex);
+    AMediaFormat* format = AMediaFormat_new();
+    format->values = codec->outputFormat.values;
+    return format;
+}
+
+media_status_t AMediaCodec_releaseOutputBuffer(AMediaCodec* codec, size_t idx, bool){
+    std::lock_guard<std::mutex> lock(codec->mutex);
+    if(idx >= codec->outputBusy.size() || !codec->outputBusy[idx]){
+        return AMEDIA_ERROR_INVALID_PARAMETER;
+    }
+    codec->outputBusy[idx] = false;
+    codec->changed.notify_all();
+    return AMEDIA_OK;
+}
+
+media_status_t AMediaCodec_setParameters(AMediaCodec* codec, const AMediaFormat* params){
+    std::lock_guard<std::mutex> lock(codec->mutex);
+    AMediaFormat* format = const_cast<AMediaFormat*>(params);
+    int32_t value = 0;
+    if(codec->encoder && AMediaFormat_getInt32(format, "video-bitrate", &value) && value > 0){
+        // the encoder gets faster or slower in proportion to the bitrate
+        if(codec->configuredBitrate > 0){
+            codec->latency = std::chrono::microseconds(static_cast<int64_t>(codec->config.encodeLatencyUs) * value / codec->configuredBitrate);
+        }
+        gEncoderBitrate.store(value);
+    }
+    if(AMediaFormat_getInt32(format, "request-sync", &value)){
+        codec->syncFrameRequested = true;
+        gSyncFrameRequests++;
+    }
+    return AMEDIA_OK;
+}
+
+#if __ANDROID_API__ >= 28
+media_status_t AMediaCodec_setAsyncNotifyCallback(AMediaCodec* codec, AMediaCodecOnAsyncNotifyCallback callback, void* userdata){
+    std::lock_guard<std::mutex> lock(codec->mutex);
+    if(codec->started || callback.onAsyncInputAvailable == nullptr || callback.onAsyncOutputAvailable == nullptr
+            || callback.onAsyncFormatChanged == nullptr || callback.onAsyncError == nullptr){
+        return AMEDIA_ERROR_INVALID_OPERATION;
+    }
+    codec->async = true;
+    codec->callbacks = callback;
+    codec->userdata = userdata;
+    return AMEDIA_OK;
+}
+
+media_status_t AMediaCodec_getName(AMediaCodec* codec, char** out_name){
+    *out_name = strdup(codec->name.c_str());
+    return *out_name != nullptr ? AMEDIA_OK : AMEDIA_ERROR_UNKNOWN;
+}
+
+void AMediaCodec_releaseName(AMediaCodec*, char* name){
+    free(name);
+}
+
+AMediaFormat* AMediaCodec_getInputFormat(AMediaCodec* codec){
+    std::lock_guard<std::mutex> lock(codec->mutex);
+    AMediaFormat* format = AMediaFormat_new();
+    format->values = codec->inputFormat.values;
+    return format;
+}
+#endif
+
+media_status_t AMediaCodec_signalEndOfInputStream(AMediaCodec* codec){
+    std::lock_guard<std::mutex> lock(codec->mutex);
+    AMediaCodec::Pending pending;
+    pending.frame = -1;
+    pending.presentationTimeUs = 0;
+    pending.flags = AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM;
+    pending.ready = std::max(codec->busyUntil, Clock::now());
+    codec->pending.push_back(pending);
+    codec->changed.notify_all();
+    return AMEDIA_OK;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------------------
+// AMediaMuxer
+
+struct AMediaMuxer {
+    int fd;
+    bool started;
+    size_t tracks;
+};
+
+AMediaMuxer* AMediaMuxer_new(int fd, OutputFormat){
+    // like the real one, keep our own descriptor
+    int ownFd = fd >= 0 ? dup(fd) : -1;
+    if(ownFd < 0){
+        return nullptr;
+    }
+    AMediaMuxer* muxer = new AMediaMuxer();
+    muxer->fd = ownFd;
+    muxer->started = false;
+    muxer->tracks = 0;
+    return muxer;
+}
+
+media_status_t AMediaMuxer_delete(AMediaMuxer* muxer){
+    if(muxer != nullptr){
+        close(muxer->fd);
+        delete muxer;
+    }
+    return AMEDIA_OK;
+}
+
+ssize_t AMediaMuxer_addTrack(AMediaMuxer* muxer, const AMediaFormat*){
+    if(muxer->started){
+        return AMEDIA_ERROR_INVALID_OPERATION;
+    }
+    return static_cast<ssize_t>(muxer->tracks++);
+}
+
+media_status_t AMediaMuxer_start(AMediaMuxer* muxer){
+    if(muxer->tracks == 0){
+        return AMEDIA_ERROR_INVALID_OPERATION;
+    }
+    muxer->started = true;
+    return AMEDIA_OK;
+}
+
+media_status_t AMediaMuxer_stop(AMediaMuxer* muxer){
+    muxer->started = false;
+    return AMEDIA_OK;
+}
+
+media_status_t AMediaMuxer_writeSampleData(AMediaMuxer* muxer, size_t trackIdx, const uint8_t* data, const AMediaCodecBufferInfo* info){
+    if(!muxer->started || trackIdx >= muxer->tracks){
+        return AMEDIA_ERROR_INVALID_OPERATION;
+    }
+    if(info->size > 0 && write(muxer->fd, data + info->offset, static_cast<size_t>(info->size)) != info->size){
+        return AMEDIA_ERROR_IO;
+    }
+    gMuxedBytes += static_cast<uint64_t>(std::max(info->size, 0));
+    return AMEDIA_OK;
+}
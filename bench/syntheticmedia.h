@@ -0,0 +1,85 @@
+#ifndef SYNTHETICMEDIA_H
+#define SYNTHETICMEDIA_H
+
+/*
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * A host side stand-in for the AMediaCodec / AMediaExtractor / AMediaMuxer calls nativecodecvideo.cpp makes,
+ * so the reader and writer can be built and benchmarked on a plain Linux box (the headers in bench/media replace the NDK ones).
+ *
+ * The extractor serves a synthetic video of the configured size, frame count, frame rate and GOP length, whatever the data source.
+ * The decoder turns every sample into a deterministic YUV frame after the configured latency, the encoder swallows frames
+ * and produces fixed size samples after its latency, and the muxer writes them to its file descriptor.
+ * Codecs have a fixed number of input and output buffers and block in dequeue*Buffer() like the real ones,
+ * so the polling and backpressure behavior of the reader and writer shows up in the numbers.
+ * Like on a device, only so many hardware codecs can exist at once; software codecs are unlimited but slower.
+ * Nothing here depends on Qt or OpenCV.
+ */
+
+#include <cstdint>
+#include <vector>
+
+
+struct SyntheticMediaConfig {
+    int width;
+    int height;
+    int stride;             ///< of decoded frames, 0 for the width
+    int sliceHeight;        ///< of decoded frames, 0 for the height
+    int colorFormat;        ///< of decoded frames, MediaCodecInfo.CodecCapabilities (21: NV12)
+
+    int frameCount;
+    int fps;
+    int gopLength;
+    int sampleSize;         ///< compressed size of a non-sync sample, sync samples are 4 times as large
+
+    int decodeLatencyUs;    ///< from queueing a sample until its frame can be dequeued, frames are decoded one after another
+    int encodeLatencyUs;    ///< scales with the bitrate set through AMediaCodec_setParameters(), relative to the configured one
+    int inputBuffers;
+    int outputBuffers;
+
+    int hardwareCodecs;         ///< hardware decoders and, separately, hardware encoders (created by type or by a name that is not a software one) that can exist at once, 0 for no limit
+    int softwareLatencyFactor;  ///< software codecs ("c2.android.*", "OMX.google.*") take this many times the configured latency
+
+    SyntheticMediaConfig();
+};
+
+/**
+ * Configures all extractors and codecs created from now on.
+ */
+void syntheticMediaSetConfig(const SyntheticMediaConfig& config);
+SyntheticMediaConfig syntheticMediaConfig();
+
+/**
+ * The decoded frame n exactly as the decoder hands it out under the current configuration (in its color format, padded to
+ * stride x sliceHeight, which are set to the values the decoder reports), so what a reader makes of it can be checked.
+ */
+void syntheticMediaDecodedFrame(int64_t frame, std::vector<uint8_t>& buffer, int& stride, int& sliceHeight);
+
+struct SyntheticMediaCounters {
+    uint64_t decodedFrames;
+    uint64_t encodedFrames;
+    uint64_t muxedBytes;
+    int encoderBitrate;         ///< configured or last set through AMediaCodec_setParameters()
+    uint64_t syncFrameRequests;
+    int hardwareCodecs;         ///< hardware decoders and encoders alive right now
+    int peakHardwareCodecs;
+    uint64_t refusedCodecs;     ///< hardware codecs not created because of the limit
+};
+
+SyntheticMediaCounters syntheticMediaCounters();
+void syntheticMediaResetCounters();
+
+#endif // SYNTHETICMEDIA_H
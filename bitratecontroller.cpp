@@ -0,0 +1,83 @@
+#include "bitratecontroller.h"
+
+#include <algorithm>
+
+
+// step sizes: back off quickly, recover slowly
+static const double DECREASE_FACTOR = 0.75;
+static const double INCREASE_FACTOR = 1.1;
+
+// mean queue fill / share of the frame period spent blocked that count as falling behind, resp. as headroom
+static const double PRESSURE_QUEUE_FILL = 0.5;
+static const double PRESSURE_BUSY = 0.5;
+static const double CALM_QUEUE_FILL = 0.2;
+static const double CALM_BUSY = 0.25;
+
+
+BitrateController::BitrateController()
+{
+    reset(0, 0, 0, 0);
+}
+
+void BitrateController::reset(int bitrate, int minBitrate, int maxBitrate, double framePeriodUs){
+    mMinBitrate = std::max(minBitrate, 1);
+    mMaxBitrate = std::max(maxBitrate, mMinBitrate);
+    mBitrate = std::min(std::max(bitrate, mMinBitrate), mMaxBitrate);
+    mFramePeriodUs = framePeriodUs;
+    mFrames = 0;
+    mQueueFillSum = 0;
+    mDropped = 0;
+    mBusySum = 0;
+    mCalmWindows = 0;
+}
+
+int BitrateController::setBitrate(int bitrate){
+    mBitrate = std::min(std::max(bitrate, mMinBitrate), mMaxBitrate);
+    mFrames = 0;
+    mQueueFillSum = 0;
+    mDropped = 0;
+    mBusySum = 0;
+    mCalmWindows = 0;
+    return mBitrate;
+}
+
+int BitrateController::addFrame(double queueFill, uint64_t dropped, double busyUs){
+    mFrames++;
+    mQueueFillSum += queueFill;
+    mDropped += dropped;
+    mBusySum += busyUs;
+
+    // drops cannot wait for the end of the window
+    if(mFrames < WINDOW_FRAMES && mDropped == 0){
+        return 0;
+    }
+
+    double meanQueueFill = mQueueFillSum / mFrames;
+    double busyShare = mFramePeriodUs > 0 ? mBusySum / mFrames / mFramePeriodUs : 0;
+    bool pressure = mDropped > 0 || meanQueueFill > PRESSURE_QUEUE_FILL || busyShare > PRESSURE_BUSY;
+    bool calm = meanQueueFill < CALM_QUEUE_FILL && busyShare < CALM_BUSY;
+
+    mFrames = 0;
+    mQueueFillSum = 0;
+    mDropped = 0;
+    mBusySum = 0;
+
+    int bitrate = mBitrate;
+    if(pressure){
+        mCalmWindows = 0;
+        bitrate = std::max(static_cast<int>(mBitrate * DECREASE_FACTOR), mMinBitrate);
+    }
+    else if(calm && ++mCalmWindows >= CALM_WINDOWS){
+        mCalmWindows = 0;
+        bitrate = std::min(static_cast<int>(mBitrate * INCREASE_FACTOR), mMaxBitrate);
+    }
+    else if(!calm){
+        mCalmWindows = 0;
+    }
+
+    if(bitrate == mBitrate){
+        return 0;
+    }
+    mBitrate = bitrate;
+    return bitrate;
+}
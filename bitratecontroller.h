@@ -0,0 +1,78 @@
+#ifndef BITRATECONTROLLER_H
+#define BITRATECONTROLLER_H
+
+/*
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * BitrateController picks an encoder bitrate from how well the encoding pipeline keeps up.
+ * It is fed one observation per encoded frame (queue fill, dropped frames, time spent waiting for the encoder and in the muxer)
+ * and decides once per window of frames: under pressure it cuts the bitrate right away, with headroom for a few windows in a row
+ * it raises it again step by step, within [minBitrate, maxBitrate].
+ * Pure bookkeeping, no codec calls, so it does not need to be thread safe.
+ */
+
+#include <cstdint>
+
+
+class BitrateController
+{
+public:
+    BitrateController();
+
+    /**
+     * Starts over at bitrate, framePeriodUs being the time the pipeline has per frame at the nominal frame rate.
+     */
+    void reset(int bitrate, int minBitrate, int maxBitrate, double framePeriodUs);
+
+    /**
+     * Records one encoded frame. queueFill is the fraction of the frame queue in use (0..1), dropped the frames lost since the last call,
+     * busyUs the time the encoding thread spent waiting for encoder input buffers and writing to the muxer for this frame.
+     * Returns the new bitrate if it should change, 0 otherwise.
+     */
+    int addFrame(double queueFill, uint64_t dropped, double busyUs);
+
+    /**
+     * Takes over a bitrate chosen elsewhere, clamped to [minBitrate, maxBitrate], and starts a new window from there.
+     * Returns the bitrate it settled on.
+     */
+    int setBitrate(int bitrate);
+
+    int bitrate() const { return mBitrate; }
+
+    /**
+     * @brief WINDOW_FRAMES frames per decision
+     */
+    const static int WINDOW_FRAMES = 15;
+
+    /**
+     * @brief CALM_WINDOWS windows in a row with headroom before the bitrate goes up again
+     */
+    const static int CALM_WINDOWS = 3;
+
+private:
+    int mBitrate;
+    int mMinBitrate;
+    int mMaxBitrate;
+    double mFramePeriodUs;
+
+    int mFrames;
+    double mQueueFillSum;
+    uint64_t mDropped;
+    double mBusySum;
+    int mCalmWindows;
+};
+
+#endif // BITRATECONTROLLER_H
@@ -0,0 +1,53 @@
+#include "codecprobe.h"
+
+#include <cstring>
+#include <vector>
+
+#include <QDebug>
+
+
+bool isSoftwareCodecName(const char* name){
+    return name != nullptr && (strncmp(name, "c2.android.", 11) == 0 || strncmp(name, "OMX.google.", 11) == 0);
+}
+
+int probeHardwareCodecs(AMediaFormat* format, uint32_t configureFlags, int maxInstances, const std::string& codecName){
+    const char* mime = nullptr;
+    if(format == nullptr || !AMediaFormat_getString(format, AMEDIAFORMAT_KEY_MIME, &mime)){
+        qWarning() << "No mime type to probe codecs with";
+        return 0;
+    }
+    const bool encoder = (configureFlags & AMEDIACODEC_CONFIGURE_FLAG_ENCODE) != 0;
+
+    std::vector<AMediaCodec*> codecs;
+    int instances = 0;
+    while(instances < maxInstances){
+        AMediaCodec* codec = !codecName.empty() ? AMediaCodec_createCodecByName(codecName.c_str())
+                                                : encoder ? AMediaCodec_createEncoderByType(mime) : AMediaCodec_createDecoderByType(mime);
+        if(codec == nullptr){
+            break;
+        }
+        codecs.push_back(codec);
+        if(AMediaCodec_configure(codec, format, nullptr, nullptr, configureFlags) != AMEDIA_OK || AMediaCodec_start(codec) != AMEDIA_OK){
+            break;
+        }
+#if __ANDROID_API__ >= 28
+        // once the hardware ones are used up the platform quietly moves on to its software codec
+        char* name = nullptr;
+        bool software = false;
+        if(AMediaCodec_getName(codec, &name) == AMEDIA_OK && name != nullptr){
+            software = isSoftwareCodecName(name);
+            AMediaCodec_releaseName(codec, name);
+        }
+        if(software){
+            break;
+        }
+#endif
+        instances++;
+    }
+
+    for(AMediaCodec* codec : codecs){
+        AMediaCodec_stop(codec);
+        AMediaCodec_delete(codec);
+    }
+    return instances;
+}
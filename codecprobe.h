@@ -0,0 +1,44 @@
+#ifndef CODECPROBE_H
+#define CODECPROBE_H
+
+/*
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Finds out how many hardware codec instances a device allows at once. There is no API for it, the only way is to
+ * create codecs until the platform refuses, which DecodeScheduler (decoders) and ParallelTranscoder (encoders) both need.
+ */
+
+#include <cstdint>
+#include <string>
+
+#include "media/NdkMediaCodec.h"
+#include "media/NdkMediaFormat.h"
+
+
+/**
+ * Whether name is one of the platform's software codecs ("c2.android.*", "OMX.google.*"), which do not use up hardware instances.
+ */
+bool isSoftwareCodecName(const char* name);
+
+/**
+ * Counts the hardware codecs the platform lets exist at once for format, by creating, configuring (with configureFlags,
+ * AMEDIACODEC_CONFIGURE_FLAG_ENCODE for encoders) and starting them until it refuses, at most maxInstances.
+ * From API 28 on a software codec handed out instead ends the count too. All of them are released again.
+ * The codecs are created by the format's mime type, or by codecName if it is set.
+ */
+int probeHardwareCodecs(AMediaFormat* format, uint32_t configureFlags, int maxInstances, const std::string& codecName = std::string());
+
+#endif // CODECPROBE_H
@@ -0,0 +1,176 @@
+#include "codecprofiler.h"
+
+#include <algorithm>
+#include <functional>
+#include <thread>
+
+#include <QByteArray>
+#include <QDebug>
+#include <QSaveFile>
+
+
+StageStats::StageStats()
+    :count(0),
+      totalNs(0),
+      maxNs(0)
+{
+    histogram.fill(0);
+}
+
+double StageStats::percentileUs(double percentile) const{
+    if(count == 0){
+        return 0;
+    }
+    const uint64_t rank = static_cast<uint64_t>(std::max(1.0, percentile / 100.0 * count + 0.5));
+    uint64_t seen = 0;
+    for(int i = 0; i < HISTOGRAM_BUCKETS; i++){
+        seen += histogram[i];
+        if(seen >= rank){
+            return static_cast<double>(uint64_t(1) << i);
+        }
+    }
+    return maxNs / 1000.0;
+}
+
+CodecStats::CodecStats()
+    :queueSamples(0),
+      queueDepthSum(0),
+      maxQueueDepth(0)
+{
+}
+
+const char* CodecStats::stageName(CodecStage stage){
+    switch(stage){
+    case STAGE_INPUT_DEQUEUE: return "input dequeue";
+    case STAGE_EXTRACTOR_READ: return "extractor read";
+    case STAGE_OUTPUT_DEQUEUE: return "output dequeue";
+    case STAGE_COPY: return "copy";
+    case STAGE_CONVERSION: return "color conversion";
+    case STAGE_MUXER_WRITE: return "muxer write";
+    default: return "unknown";
+    }
+}
+
+
+CodecProfiler::CodecProfiler()
+    :mEnabled(false),
+      mTracing(false),
+      mMaxTraceEvents(DEFAULT_MAX_TRACE_EVENTS),
+      mTraceStart(std::chrono::steady_clock::now())
+{
+    reset();
+}
+
+void CodecProfiler::startTrace(size_t maxEvents){
+    std::lock_guard<std::mutex> lock(mTraceMutex);
+    mTrace.clear();
+    mTrace.reserve(std::min<size_t>(maxEvents, DEFAULT_MAX_TRACE_EVENTS));
+    mMaxTraceEvents = maxEvents;
+    mTraceStart = std::chrono::steady_clock::now();
+    mTracing.store(true);
+    setEnabled(true);
+}
+
+void CodecProfiler::stopTrace(){
+    mTracing.store(false);
+}
+
+bool CodecProfiler::writeTrace(const QString& path) const{
+    QByteArray json("{\"traceEvents\":[\n");
+    {
+        std::lock_guard<std::mutex> lock(mTraceMutex);
+        for(size_t i = 0; i < mTrace.size(); i++){
+            const TraceEvent& event = mTrace[i];
+            json += "{\"name\":\"";
+            json += CodecStats::stageName(event.stage);
+            json += "\",\"cat\":\"codec\",\"ph\":\"X\",\"pid\":1,\"tid\":" + QByteArray::number(event.thread)
+                    + ",\"ts\":" + QByteArray::number(event.startNs / 1000.0, 'f', 3)
+                    + ",\"dur\":" + QByteArray::number(event.durationNs / 1000.0, 'f', 3) + "}";
+            json += i + 1 < mTrace.size() ? ",\n" : "\n";
+        }
+    }
+    json += "]}\n";
+
+    QSaveFile file(path);
+    if(!file.open(QIODevice::WriteOnly)){
+        qWarning() << "Cannot write trace" << path;
+        return false;
+    }
+    file.write(json);
+    return file.commit();
+}
+
+void CodecProfiler::record(CodecStage stage, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end){
+    const uint64_t ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+    StageCounters& counters = mStages[stage];
+    counters.count.fetch_add(1, std::memory_order_relaxed);
+    counters.totalNs.fetch_add(ns, std::memory_order_relaxed);
+    updateMax(counters.maxNs, ns);
+
+    int bucket = 0;
+    for(uint64_t us = ns / 1000; us > 0 && bucket < StageStats::HISTOGRAM_BUCKETS - 1; us >>= 1){
+        bucket++;
+    }
+    counters.histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+
+    if(mTracing.load(std::memory_order_relaxed)){
+        std::lock_guard<std::mutex> lock(mTraceMutex);
+        if(mTrace.size() < mMaxTraceEvents){
+            TraceEvent event;
+            event.stage = stage;
+            event.thread = static_cast<uint32_t>(std::hash<std::thread::id>()(std::this_thread::get_id()) % 100000);
+            event.startNs = std::chrono::duration_cast<std::chrono::nanoseconds>(start - mTraceStart).count();
+            event.durationNs = static_cast<int64_t>(ns);
+            mTrace.push_back(event);
+        }
+    }
+}
+
+void CodecProfiler::recordQueueDepth(size_t depth){
+    if(!enabled()){
+        return;
+    }
+    mQueueSamples.fetch_add(1, std::memory_order_relaxed);
+    mQueueDepthSum.fetch_add(depth, std::memory_order_relaxed);
+    updateMax(mMaxQueueDepth, depth);
+}
+
+CodecStats CodecProfiler::stats() const{
+    CodecStats stats;
+    for(int s = 0; s < STAGE_COUNT; s++){
+        stats.stages[s].count = mStages[s].count.load(std::memory_order_relaxed);
+        stats.stages[s].totalNs = mStages[s].totalNs.load(std::memory_order_relaxed);
+        stats.stages[s].maxNs = mStages[s].maxNs.load(std::memory_order_relaxed);
+        for(int i = 0; i < StageStats::HISTOGRAM_BUCKETS; i++){
+            stats.stages[s].histogram[i] = mStages[s].histogram[i].load(std::memory_order_relaxed);
+        }
+    }
+    stats.queueSamples = mQueueSamples.load(std::memory_order_relaxed);
+    stats.queueDepthSum = mQueueDepthSum.load(std::memory_order_relaxed);
+    stats.maxQueueDepth = mMaxQueueDepth.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void CodecProfiler::reset(){
+    for(int s = 0; s < STAGE_COUNT; s++){
+        mStages[s].count.store(0);
+        mStages[s].totalNs.store(0);
+        mStages[s].maxNs.store(0);
+        for(int i = 0; i < StageStats::HISTOGRAM_BUCKETS; i++){
+            mStages[s].histogram[i].store(0);
+        }
+    }
+    mQueueSamples.store(0);
+    mQueueDepthSum.store(0);
+    mMaxQueueDepth.store(0);
+
+    std::lock_guard<std::mutex> lock(mTraceMutex);
+    mTrace.clear();
+    mTraceStart = std::chrono::steady_clock::now();
+}
+
+void CodecProfiler::updateMax(std::atomic<uint64_t>& max, uint64_t value){
+    uint64_t current = max.load(std::memory_order_relaxed);
+    while(value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed)){
+    }
+}
@@ -0,0 +1,177 @@
+#ifndef CODECPROFILER_H
+#define CODECPROFILER_H
+
+/*
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * CodecProfiler times the stages of the decode / encode hot paths and keeps per stage counters and latency histograms,
+ * optionally along with a Chrome trace (chrome://tracing, Perfetto) of every single stage run.
+ * It is off by default: a disabled ScopedStage costs one relaxed atomic load and no clock reads.
+ * Recording is lock-free, only the trace buffer takes a mutex, so codec callback threads and the encoding thread can record concurrently.
+ */
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include <QString>
+
+
+/**
+ * @brief The CodecStage enum lists the timed stages.
+ */
+enum CodecStage {
+    STAGE_INPUT_DEQUEUE,    ///< waiting for a codec input buffer
+    STAGE_EXTRACTOR_READ,   ///< reading a sample from the extractor into an input buffer
+    STAGE_OUTPUT_DEQUEUE,   ///< waiting for a codec output buffer
+    STAGE_COPY,             ///< copying a written frame into the writer's queue
+    STAGE_CONVERSION,       ///< color conversion between the codec buffer and cv::Mat
+    STAGE_MUXER_WRITE,      ///< handing an encoded sample to the muxer
+    STAGE_COUNT
+};
+
+/**
+ * @brief The StageStats struct summarizes all runs of one stage.
+ * Bucket i of the histogram counts runs that took less than 2^i microseconds (and at least 2^(i-1)), the last one everything slower.
+ */
+struct StageStats {
+    const static int HISTOGRAM_BUCKETS = 24;
+
+    uint64_t count;
+    uint64_t totalNs;
+    uint64_t maxNs;
+    std::array<uint64_t, HISTOGRAM_BUCKETS> histogram;
+
+    StageStats();
+
+    double meanUs() const { return count > 0 ? totalNs / 1000.0 / count : 0; }
+
+    /**
+     * Upper bound of the histogram bucket the given percentile (0..100) falls into, in microseconds.
+     */
+    double percentileUs(double percentile) const;
+};
+
+/**
+ * @brief The CodecStats struct is a snapshot of everything a CodecProfiler recorded.
+ */
+struct CodecStats {
+    std::array<StageStats, STAGE_COUNT> stages;
+
+    uint64_t queueSamples;      ///< how often the frame queue depth was sampled
+    uint64_t queueDepthSum;
+    uint64_t maxQueueDepth;
+
+    CodecStats();
+
+    double meanQueueDepth() const { return queueSamples > 0 ? static_cast<double>(queueDepthSum) / queueSamples : 0; }
+
+    static const char* stageName(CodecStage stage);
+};
+
+
+class CodecProfiler
+{
+public:
+    CodecProfiler();
+
+    void setEnabled(bool enabled){ mEnabled.store(enabled, std::memory_order_relaxed); }
+    bool enabled() const { return mEnabled.load(std::memory_order_relaxed); }
+
+    /**
+     * Also keeps every stage run (up to maxEvents) for writeTrace(). Implies setEnabled(true).
+     */
+    void startTrace(size_t maxEvents = DEFAULT_MAX_TRACE_EVENTS);
+    void stopTrace();
+
+    /**
+     * Writes the traced events as Chrome trace event JSON.
+     */
+    bool writeTrace(const QString& path) const;
+
+    void record(CodecStage stage, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+    void recordQueueDepth(size_t depth);
+
+    CodecStats stats() const;
+    void reset();
+
+    const static size_t DEFAULT_MAX_TRACE_EVENTS = 100000;
+
+private:
+    struct StageCounters {
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> totalNs;
+        std::atomic<uint64_t> maxNs;
+        std::atomic<uint64_t> histogram[StageStats::HISTOGRAM_BUCKETS];
+    };
+
+    struct TraceEvent {
+        CodecStage stage;
+        uint32_t thread;
+        int64_t startNs;
+        int64_t durationNs;
+    };
+
+    std::atomic<bool> mEnabled;
+    std::atomic<bool> mTracing;
+    StageCounters mStages[STAGE_COUNT];
+    std::atomic<uint64_t> mQueueSamples;
+    std::atomic<uint64_t> mQueueDepthSum;
+    std::atomic<uint64_t> mMaxQueueDepth;
+
+    mutable std::mutex mTraceMutex;
+    std::vector<TraceEvent> mTrace;
+    size_t mMaxTraceEvents;
+    std::chrono::steady_clock::time_point mTraceStart;
+
+    static void updateMax(std::atomic<uint64_t>& max, uint64_t value);
+};
+
+
+/**
+ * @brief The ScopedStage class times the enclosing scope as one run of a stage, if the profiler is enabled.
+ */
+class ScopedStage
+{
+public:
+    ScopedStage(CodecProfiler& profiler, CodecStage stage)
+        :mProfiler(profiler.enabled() ? &profiler : nullptr),
+          mStage(stage)
+    {
+        if(mProfiler != nullptr){
+            mStart = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~ScopedStage(){
+        if(mProfiler != nullptr){
+            mProfiler->record(mStage, mStart, std::chrono::steady_clock::now());
+        }
+    }
+
+private:
+    ScopedStage(const ScopedStage&) = delete;
+    ScopedStage& operator=(const ScopedStage&) = delete;
+
+    CodecProfiler* mProfiler;
+    CodecStage mStage;
+    std::chrono::steady_clock::time_point mStart;
+};
+
+#endif // CODECPROFILER_H
@@ -0,0 +1,306 @@
+#include "decodescheduler.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <QDebug>
+
+#include "codecprobe.h"
+
+#include "media/NdkMediaCodec.h"
+#include "media/NdkMediaExtractor.h"
+#include "media/NdkMediaFormat.h"
+
+
+DecodeScheduler::DecodeScheduler(int workers)
+    :QObject(nullptr),
+      mWorkerCount(workers > 0 ? workers : std::max<int>(std::thread::hardware_concurrency(), 1)),
+      mHardwareLimit(0),
+      mSoftwareFallback(true),
+      mNextJob(0),
+      mRunningWorkers(0),
+      mStopRequested(false),
+      mHardwareInUse(0),
+      mHardwareSlots(0),
+      mFrames(0)
+{
+}
+
+DecodeScheduler::~DecodeScheduler(){
+    stop();
+    waitForFinished();
+}
+
+void DecodeScheduler::setHardwareLimit(int instances){
+    mHardwareLimit = std::max(instances, 0);
+}
+
+void DecodeScheduler::setSoftwareFallback(bool enabled){
+    mSoftwareFallback = enabled;
+}
+
+void DecodeScheduler::setFrameCallback(FrameCallback callback){
+    mFrameCallback = callback;
+}
+
+void DecodeScheduler::setReaderSetup(ReaderSetup setup){
+    mReaderSetup = setup;
+}
+
+int DecodeScheduler::addJob(const MediaSource& source){
+    std::lock_guard<std::mutex> lock(mMutex);
+    Job job;
+    job.number = mNextJob++;
+    job.source = source;
+    mJobs.push_back(job);
+    return job.number;
+}
+
+bool DecodeScheduler::start(){
+    if(isRunning()){
+        qWarning() << "The decode scheduler is already running";
+        return false;
+    }
+    waitForFinished();
+
+    MediaSource first;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if(mJobs.empty()){
+            qWarning() << "Nothing to decode";
+            return false;
+        }
+        first = mJobs.front().source;
+    }
+    if(mHardwareLimit == 0){
+        // a device without any hardware decoder still has its default one, count that as a slot
+        mHardwareLimit = std::max(probeHardwareDecoders(first), 1);
+        qDebug() << "Probed" << mHardwareLimit << "hardware decoder instances";
+    }
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    mStopRequested = false;
+    mStats = DecodeSchedulerStats();
+    mHardwareSlots = mHardwareLimit;
+    mStats.hardwareLimit = mHardwareSlots;
+    mFrames = 0;
+    mStartTime = Clock::now();
+    mEndTime = mStartTime;
+
+    const int workers = std::min<int>(mWorkerCount, mJobs.size());
+    mRunningWorkers = workers;
+    for(int i = 0; i < workers; i++){
+        mWorkers.emplace_back(&DecodeScheduler::runWorker, this);
+    }
+    return true;
+}
+
+void DecodeScheduler::stop(){
+    std::lock_guard<std::mutex> lock(mMutex);
+    mStopRequested = true;
+    mJobs.clear();
+    mSlotFreed.notify_all();
+}
+
+void DecodeScheduler::waitForFinished(){
+    for(std::thread& worker : mWorkers){
+        if(worker.joinable()){
+            worker.join();
+        }
+    }
+    mWorkers.clear();
+}
+
+DecodeSchedulerStats DecodeScheduler::stats() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    DecodeSchedulerStats stats = mStats;
+    stats.frames = mFrames.load();
+    const Clock::time_point end = mRunningWorkers.load() > 0 ? Clock::now() : mEndTime;
+    stats.seconds = std::chrono::duration<double>(end - mStartTime).count();
+    return stats;
+}
+
+void DecodeScheduler::runWorker(){
+    while(true){
+        Job job;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if(mJobs.empty() || mStopRequested){
+                break;
+            }
+            job = mJobs.front();
+            mJobs.pop_front();
+        }
+
+        const long long frames = runJob(job);
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if(frames >= 0){
+                mStats.jobsDone++;
+            }
+            else{
+                mStats.jobsFailed++;
+            }
+        }
+        emit jobFinished(job.number, frames >= 0, std::max(frames, 0LL));
+    }
+
+    bool last;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        last = --mRunningWorkers == 0;
+        if(last){
+            mEndTime = Clock::now();
+        }
+    }
+    if(last){
+        emit finished();
+    }
+}
+
+long long DecodeScheduler::runJob(const Job& job){
+    std::unique_ptr<NativeCodecReader> reader;
+    bool hardware = false;
+    while(true){
+        hardware = acquireHardware(!mSoftwareFallback);
+        if(mStopRequested){
+            if(hardware){
+                releaseHardware();
+            }
+            return -1;
+        }
+
+        DecoderConfig config;
+        config.software = !hardware;
+        reader.reset(new NativeCodecReader(job.source, config));
+        if(reader->isOpen() || !hardware){
+            break;
+        }
+
+        // our count said there was room, but something else (another app, an encoder) holds the instances
+        reader.reset();
+        hardware = false;
+        const bool othersRunning = refuseHardware();
+        qWarning() << "No hardware decoder for job" << job.number << "despite a free slot, hardware slots lowered to" << hardwareSlots();
+        if(mSoftwareFallback){
+            config.software = true;
+            reader.reset(new NativeCodecReader(job.source, config));
+            break;
+        }
+        if(!othersRunning){
+            // none of our decoders is there to give an instance back, waiting would not end
+            break;
+        }
+        // wait for one of our decoders to finish and try again
+    }
+    if(!reader || !reader->isOpen()){
+        qWarning() << "Unable to decode job" << job.number << job.source.description();
+        return -1;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if(hardware){
+            mStats.hardwareJobs++;
+        }
+        else{
+            mStats.softwareJobs++;
+        }
+    }
+
+    if(mReaderSetup){
+        mReaderSetup(job.number, *reader);
+    }
+
+    long long frames = 0;
+    int idleReads = 0;
+    cv::Mat frame;
+    while(!mStopRequested && !reader->isFinished()){
+        if(!reader->read(frame)){
+            if(++idleReads > MAX_IDLE_READS){
+                qWarning() << "Decoding job" << job.number << "got stuck after" << frames << "frames";
+                frames = -1;
+                break;
+            }
+            continue;
+        }
+        idleReads = 0;
+        frames++;
+        mFrames.fetch_add(1, std::memory_order_relaxed);
+        if(mFrameCallback){
+            mFrameCallback(job.number, frame, reader->lastPresentationTimeUs());
+        }
+    }
+
+    // the codec has to be gone before somebody else gets the slot
+    reader.reset();
+    if(hardware){
+        releaseHardware();
+    }
+    return frames;
+}
+
+bool DecodeScheduler::acquireHardware(bool wait){
+    std::unique_lock<std::mutex> lock(mMutex);
+    while(mHardwareInUse >= mHardwareSlots){
+        if(!wait || mStopRequested){
+            return false;
+        }
+        mSlotFreed.wait(lock);
+    }
+    mHardwareInUse++;
+    mStats.peakHardwareInstances = std::max(mStats.peakHardwareInstances, mHardwareInUse);
+    return true;
+}
+
+void DecodeScheduler::releaseHardware(){
+    std::lock_guard<std::mutex> lock(mMutex);
+    mHardwareInUse--;
+    mSlotFreed.notify_one();
+}
+
+bool DecodeScheduler::refuseHardware(){
+    std::lock_guard<std::mutex> lock(mMutex);
+    mStats.refusedHardware++;
+    mHardwareInUse--;
+    // the platform has no more instances for us than the ones we already hold, keep one slot so jobs can still run
+    mHardwareSlots = std::max(std::min(mHardwareSlots, mHardwareInUse), 1);
+    mStats.hardwareLimit = mHardwareSlots;
+    return mHardwareInUse > 0;
+}
+
+int DecodeScheduler::hardwareSlots() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mHardwareSlots;
+}
+
+int DecodeScheduler::probeHardwareDecoders(const MediaSource& source, int maxInstances){
+    AMediaExtractor* extractor = AMediaExtractor_new();
+    if(extractor == nullptr || source.attach(extractor) != AMEDIA_OK){
+        qWarning() << "Unable to open" << source.description() << "to probe decoders";
+        if(extractor != nullptr){
+            AMediaExtractor_delete(extractor);
+        }
+        return 0;
+    }
+
+    AMediaFormat* format = nullptr;
+    const char* mime = nullptr;
+    for(size_t track = 0; track < AMediaExtractor_getTrackCount(extractor); track++){
+        format = AMediaExtractor_getTrackFormat(extractor, track);
+        if(AMediaFormat_getString(format, AMEDIAFORMAT_KEY_MIME, &mime) && strncmp(mime, "video/", 6) == 0){
+            break;
+        }
+        AMediaFormat_delete(format);
+        format = nullptr;
+    }
+    if(format == nullptr){
+        qWarning() << "No video track in" << source.description() << "to probe decoders with";
+        AMediaExtractor_delete(extractor);
+        return 0;
+    }
+
+    const int instances = probeHardwareCodecs(format, 0, maxInstances);
+    AMediaFormat_delete(format);
+    AMediaExtractor_delete(extractor);
+    return instances;
+}
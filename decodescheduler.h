@@ -0,0 +1,211 @@
+#ifndef DECODESCHEDULER_H
+#define DECODESCHEDULER_H
+
+/*
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * DecodeScheduler decodes a batch of media files on a pool of worker threads, one NativeCodecReader per file.
+ * Devices only have a handful of hardware decoder instances; opening more readers than that makes creating the codec fail.
+ * The scheduler hands out hardware slots up to a limit (set, or probed on start by opening decoders until the platform refuses)
+ * and, when all of them are taken, opens the next file with the platform's software decoder instead of waiting,
+ * so the remaining cores are used too. Without software fallback jobs wait for a free hardware slot.
+ * Should the platform refuse a hardware decoder despite a free slot (someone else holds instances), the number of slots is lowered
+ * to the decoders the scheduler already has, and the job falls back to software or waits for one of them to finish.
+ * Frames go to a callback on the worker threads, stats() adds up frames, jobs and throughput.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <QObject>
+
+#include <opencv2/opencv.hpp>
+
+#include "mediasource.h"
+#include "nativecodecvideo.h"
+
+
+/**
+ * @brief The DecodeSchedulerStats struct sums up a batch, as far as it got.
+ */
+struct DecodeSchedulerStats {
+    int jobsDone;
+    int jobsFailed;             ///< files that could not be opened or decoded
+    int hardwareJobs;           ///< jobs decoded on a hardware slot
+    int softwareJobs;           ///< jobs decoded by a software decoder because all hardware slots were taken
+    int refusedHardware;        ///< times the platform refused a hardware decoder although the scheduler had a slot free
+    int peakHardwareInstances;
+    int hardwareLimit;          ///< hardware slots handed out, lowered whenever the platform refused one
+    uint64_t frames;
+    double seconds;             ///< since start()
+
+    DecodeSchedulerStats()
+        : jobsDone(0), jobsFailed(0), hardwareJobs(0), softwareJobs(0), refusedHardware(0),
+          peakHardwareInstances(0), hardwareLimit(0), frames(0), seconds(0) {}
+
+    double framesPerSecond() const { return seconds > 0 ? frames / seconds : 0; }
+};
+
+
+class DecodeScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    /**
+     * Receives every decoded frame of job (the number addJob() returned). Runs on a worker thread, several run at the same time.
+     */
+    typedef std::function<void(int job, const cv::Mat& frame, int64 presentationTimeUs)> FrameCallback;
+
+    /**
+     * Called for every reader right after it was opened, before the first frame is read, e.g. to set an output size or format.
+     */
+    typedef std::function<void(int job, NativeCodecReader& reader)> ReaderSetup;
+
+    /**
+     * workers threads decode at the same time, 0 for one per core.
+     */
+    DecodeScheduler(int workers = 0);
+    ~DecodeScheduler();
+
+    /**
+     * Caps the hardware decoders in use at instances, 0 (the default) probes the limit on start() with the first job's video.
+     * Set it before start().
+     */
+    void setHardwareLimit(int instances);
+    int hardwareLimit() const { return mHardwareLimit; }
+
+    /**
+     * Whether jobs that find all hardware slots taken use a software decoder (the default) or wait for a slot.
+     */
+    void setSoftwareFallback(bool enabled);
+
+    void setFrameCallback(FrameCallback callback);
+    void setReaderSetup(ReaderSetup setup);
+
+    /**
+     * Queues a file, returns its job number. Add jobs before start().
+     */
+    int addJob(const MediaSource& source);
+    int addJob(const QString& filename) { return addJob(MediaSource::file(filename)); }
+
+    /**
+     * Starts the workers, they run until the queue is empty.
+     */
+    bool start();
+
+    /**
+     * Drops the jobs not started yet and makes the running ones stop after their current frame.
+     */
+    void stop();
+
+    /**
+     * Blocks until all workers are done.
+     */
+    void waitForFinished();
+
+    bool isRunning() const { return mRunningWorkers.load() > 0; }
+
+    DecodeSchedulerStats stats() const;
+
+    /**
+     * Counts the hardware decoders the platform lets exist at once for source's video, by creating and starting them
+     * until it refuses (or hands out a software one), at most maxInstances. All of them are released again.
+     */
+    static int probeHardwareDecoders(const MediaSource& source, int maxInstances = PROBE_LIMIT);
+
+    /**
+     * @brief PROBE_LIMIT probing stops here, devices rarely have more instances than that
+     */
+    const static int PROBE_LIMIT = 16;
+
+    /**
+     * @brief MAX_IDLE_READS how many read() calls in a row may come back empty before a job counts as stuck
+     */
+    const static int MAX_IDLE_READS = 1000;
+
+signals:
+    void jobFinished(int job, bool ok, long long frames);
+    void finished();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Job {
+        int number;
+        MediaSource source;
+    };
+
+    int mWorkerCount;
+    int mHardwareLimit;
+    bool mSoftwareFallback;
+    FrameCallback mFrameCallback;
+    ReaderSetup mReaderSetup;
+
+    std::deque<Job> mJobs;
+    int mNextJob;
+    std::vector<std::thread> mWorkers;
+    std::atomic<int> mRunningWorkers;
+    std::atomic<bool> mStopRequested;
+    Clock::time_point mStartTime;
+    Clock::time_point mEndTime;
+
+    /**
+     * @brief mMutex guards the job queue, the hardware slots and the stats
+     */
+    mutable std::mutex mMutex;
+    std::condition_variable mSlotFreed;
+    int mHardwareInUse;
+
+    /**
+     * @brief mHardwareSlots hardware decoders handed out at most, starts at mHardwareLimit and drops when the platform refuses one
+     */
+    int mHardwareSlots;
+    DecodeSchedulerStats mStats;
+
+    /**
+     * @brief mFrames counted outside of mStats, every worker adds to it for every frame
+     */
+    std::atomic<uint64_t> mFrames;
+
+    void runWorker();
+
+    /**
+     * Decodes one job to the end, returns the frame count or -1 if the file could not be decoded.
+     */
+    long long runJob(const Job& job);
+
+    /**
+     * Takes a hardware slot, waiting for one if wait is set. Returns false if none is free (or the scheduler is stopping).
+     */
+    bool acquireHardware(bool wait);
+    void releaseHardware();
+
+    /**
+     * Gives back a slot the platform had no decoder for and lowers the slots to what is in use. Returns whether other jobs
+     * still hold hardware decoders (which a waiting job can get once they finish).
+     */
+    bool refuseHardware();
+    int hardwareSlots() const;
+};
+
+#endif // DECODESCHEDULER_H
@@ -0,0 +1,64 @@
+#include "framecache.h"
+
+
+FrameCache::FrameCache(size_t budgetBytes)
+    :mBudget(budgetBytes),
+      mBytes(0),
+      mHits(0),
+      mMisses(0)
+{
+}
+
+void FrameCache::setBudget(size_t budgetBytes){
+    mBudget = budgetBytes;
+    evict(mBudget);
+}
+
+bool FrameCache::lookup(int64_t frameNo, cv::Mat& frame){
+    auto it = mLookup.find(frameNo);
+    if(it == mLookup.end()){
+        mMisses++;
+        return false;
+    }
+    mEntries.splice(mEntries.begin(), mEntries, it->second);
+    frame = it->second->second;
+    mHits++;
+    return true;
+}
+
+bool FrameCache::contains(int64_t frameNo) const{
+    return mLookup.find(frameNo) != mLookup.end();
+}
+
+void FrameCache::insert(int64_t frameNo, const cv::Mat& frame){
+    const size_t bytes = frameBytes(frame);
+    if(frame.empty() || bytes > mBudget){
+        return;
+    }
+
+    auto it = mLookup.find(frameNo);
+    if(it != mLookup.end()){
+        mBytes -= frameBytes(it->second->second);
+        mEntries.erase(it->second);
+        mLookup.erase(it);
+    }
+
+    evict(mBudget - bytes);
+    mEntries.push_front(Entry(frameNo, frame));
+    mLookup[frameNo] = mEntries.begin();
+    mBytes += bytes;
+}
+
+void FrameCache::clear(){
+    mEntries.clear();
+    mLookup.clear();
+    mBytes = 0;
+}
+
+void FrameCache::evict(size_t budgetBytes){
+    while(mBytes > budgetBytes && !mEntries.empty()){
+        mBytes -= frameBytes(mEntries.back().second);
+        mLookup.erase(mEntries.back().first);
+        mEntries.pop_back();
+    }
+}
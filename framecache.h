@@ -0,0 +1,87 @@
+#ifndef FRAMECACHE_H
+#define FRAMECACHE_H
+
+/*
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * FrameCache keeps recently decoded frames, keyed by frame number, within a byte budget.
+ * The least recently used frames are evicted first. Frames are stored and handed out as cv::Mat headers,
+ * so a hit costs no copy: the pixels are shared between the cache and everybody who looked the frame up.
+ * Not thread safe, it lives next to the pull-style decoder.
+ */
+
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+#include <opencv2/opencv.hpp>
+
+
+class FrameCache
+{
+public:
+    FrameCache(size_t budgetBytes = 0);
+
+    /**
+     * Changes the byte budget, evicting frames if needed. 0 disables the cache.
+     */
+    void setBudget(size_t budgetBytes);
+    size_t budget() const { return mBudget; }
+    bool enabled() const { return mBudget > 0; }
+
+    /**
+     * Looks frameNo up and marks it as most recently used. Counts as a hit or a miss.
+     */
+    bool lookup(int64_t frameNo, cv::Mat& frame);
+
+    /**
+     * Like lookup(), but neither touches the usage order nor the counters.
+     */
+    bool contains(int64_t frameNo) const;
+
+    /**
+     * Adds or replaces frameNo. Frames larger than the whole budget are not cached.
+     */
+    void insert(int64_t frameNo, const cv::Mat& frame);
+
+    void clear();
+
+    size_t size() const { return mEntries.size(); }
+    size_t bytes() const { return mBytes; }
+    uint64_t hits() const { return mHits; }
+    uint64_t misses() const { return mMisses; }
+
+    static size_t frameBytes(const cv::Mat& frame) { return frame.total() * frame.elemSize(); }
+
+private:
+    typedef std::pair<int64_t, cv::Mat> Entry;
+
+    /**
+     * @brief mEntries most recently used first
+     */
+    std::list<Entry> mEntries;
+    std::unordered_map<int64_t, std::list<Entry>::iterator> mLookup;
+
+    size_t mBudget;
+    size_t mBytes;
+    uint64_t mHits;
+    uint64_t mMisses;
+
+    void evict(size_t budgetBytes);
+};
+
+#endif // FRAMECACHE_H
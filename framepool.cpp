@@ -0,0 +1,98 @@
+#include "framepool.h"
+
+
+FramePool::FramePool(size_t maxFrames)
+    :mMaxFrames(maxFrames),
+      mRequests(0),
+      mReused(0),
+      mAllocations(0),
+      mAdopted(0)
+{
+}
+
+cv::Mat FramePool::acquire(const cv::Size& size, int type){
+    std::lock_guard<std::mutex> lock(mMutex);
+    mRequests++;
+
+    int spare = -1;
+    for(size_t i = 0; i < mFrames.size(); i++){
+        if(!isFree(mFrames[i])){
+            continue;
+        }
+        if(mFrames[i].size() == size && mFrames[i].type() == type){
+            mReused++;
+            return mFrames[i];
+        }
+        spare = static_cast<int>(i);
+    }
+
+    mAllocations++;
+    cv::Mat frame(size, type);
+    if(mFrames.size() < mMaxFrames){
+        mFrames.push_back(frame);
+    }
+    else if(spare >= 0){
+        // frames of a size nobody asks for anymore (e.g. after a format change) make room
+        mFrames[spare] = frame;
+    }
+    return frame;
+}
+
+void FramePool::recycle(const cv::Mat& frame){
+    if(!FramePool::isExclusive(frame)){
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mMutex);
+    if(mFrames.size() < mMaxFrames){
+        mFrames.push_back(frame);
+        mAdopted++;
+    }
+}
+
+bool FramePool::isWritable(const cv::Mat& frame) const{
+    if(FramePool::isExclusive(frame)){
+        return true;
+    }
+    if(frame.u == nullptr || frame.u->refcount != 2){
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mMutex);
+    for(const cv::Mat& pooled : mFrames){
+        if(pooled.u == frame.u){
+            return true;
+        }
+    }
+    return false;
+}
+
+void FramePool::setMaxFrames(size_t maxFrames){
+    std::lock_guard<std::mutex> lock(mMutex);
+    mMaxFrames = maxFrames;
+    if(mFrames.size() > mMaxFrames){
+        mFrames.resize(mMaxFrames);
+    }
+}
+
+void FramePool::clear(){
+    std::lock_guard<std::mutex> lock(mMutex);
+    mFrames.clear();
+}
+
+FramePool::Stats FramePool::stats() const{
+    std::lock_guard<std::mutex> lock(mMutex);
+    Stats stats;
+    stats.requests = mRequests;
+    stats.reused = mReused;
+    stats.allocations = mAllocations;
+    stats.adopted = mAdopted;
+    stats.pooledFrames = mFrames.size();
+    stats.pooledBytes = 0;
+    stats.framesInUse = 0;
+    for(const cv::Mat& frame : mFrames){
+        stats.pooledBytes += frame.total() * frame.elemSize();
+        if(!isFree(frame)){
+            stats.framesInUse++;
+        }
+    }
+    return stats;
+}
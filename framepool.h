@@ -0,0 +1,98 @@
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+/*
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * FramePool recycles cv::Mat storage so decoding and encoding do not allocate per frame.
+ * The pool keeps a reference to every frame it handed out; a frame is free again as soon as nobody else references it
+ * (OpenCV's reference count drops back to the pool's own), no explicit giving back needed.
+ * Thread safe, so a reader and a writer (and their codec / encoding threads) can share one pool.
+ */
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+
+class FramePool
+{
+public:
+    /**
+     * @brief The Stats struct is a snapshot of how well the pool is doing.
+     */
+    struct Stats {
+        uint64_t requests;      ///< acquire() calls
+        uint64_t reused;        ///< requests served from a free pooled frame
+        uint64_t allocations;   ///< requests that had to allocate
+        uint64_t adopted;       ///< foreign frames taken over by recycle()
+        size_t pooledFrames;
+        size_t pooledBytes;
+        size_t framesInUse;     ///< pooled frames referenced outside of the pool right now
+    };
+
+    FramePool(size_t maxFrames = DEFAULT_MAX_FRAMES);
+
+    /**
+     * Returns a frame of size and type, free pooled storage if there is some. The content is undefined.
+     */
+    cv::Mat acquire(const cv::Size& size, int type);
+
+    /**
+     * Takes over the storage of a frame that is about to be dropped, if nobody else references it and there is room.
+     */
+    void recycle(const cv::Mat& frame);
+
+    /**
+     * Limits how many frames the pool keeps, frames in use beyond that are just let go.
+     */
+    void setMaxFrames(size_t maxFrames);
+
+    /**
+     * Forgets all pooled frames, frames in use stay valid.
+     */
+    void clear();
+
+    Stats stats() const;
+
+    /**
+     * Whether frame is referenced by nobody but the caller, i.e. may be written to without affecting anyone else.
+     */
+    static bool isExclusive(const cv::Mat& frame){ return frame.u != nullptr && frame.u->refcount == 1; }
+
+    /**
+     * Whether the caller may write into frame: it is exclusive, or shared with nobody but this pool.
+     */
+    bool isWritable(const cv::Mat& frame) const;
+
+    const static size_t DEFAULT_MAX_FRAMES = 16;
+
+private:
+    mutable std::mutex mMutex;
+    std::vector<cv::Mat> mFrames;
+    size_t mMaxFrames;
+
+    uint64_t mRequests;
+    uint64_t mReused;
+    uint64_t mAllocations;
+    uint64_t mAdopted;
+
+    static bool isFree(const cv::Mat& pooled){ return pooled.u != nullptr && pooled.u->refcount == 1; }
+};
+
+#endif // FRAMEPOOL_H
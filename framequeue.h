@@ -0,0 +1,273 @@
+#ifndef FRAMEQUEUE_H
+#define FRAMEQUEUE_H
+
+/*
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * BoundedFrameQueue hands frames from a codec thread to a consumer thread.
+ * Pushing and popping is lock-free (a ring of slots with per-slot sequence numbers), the mutex / condition
+ * variables are only touched when one side actually has to wait.
+ * The producer may also pop, which is how the drop-oldest policy makes room without a lock.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+
+/**
+ * @brief The BackpressurePolicy enum decides what happens when a frame arrives at a full queue.
+ */
+enum BackpressurePolicy {
+    BACKPRESSURE_BLOCK,         ///< wait until the consumer made room
+    BACKPRESSURE_DROP_OLDEST,   ///< throw away the oldest queued frame
+    BACKPRESSURE_DROP_NEWEST    ///< throw away the arriving frame
+};
+
+
+template<typename T>
+class BoundedFrameQueue
+{
+public:
+    BoundedFrameQueue(size_t capacity, BackpressurePolicy policy = BACKPRESSURE_BLOCK)
+        :mCapacity(capacity > 0 ? capacity : 1),
+          mSlots(new Slot[mCapacity]),
+          mPolicy(policy),
+          mEnqueuePos(0),
+          mDequeuePos(0),
+          mClosed(false),
+          mWaitingConsumers(0),
+          mWaitingProducers(0),
+          mDroppedOldest(0),
+          mDroppedNewest(0)
+    {
+        for(size_t i = 0; i < mCapacity; i++){
+            mSlots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * Adds an item according to the backpressure policy.
+     * Returns false if the item was dropped or the queue has been closed.
+     */
+    bool push(T& item){
+        return push(item, mPolicy);
+    }
+
+    /**
+     * Adds an item according to policy instead of the queue's own, e.g. BACKPRESSURE_BLOCK for an item that must not get lost.
+     */
+    bool push(T& item, BackpressurePolicy policy){
+        while(!tryPush(item)){
+            if(mClosed.load()){
+                return false;
+            }
+            switch(policy){
+            case BACKPRESSURE_DROP_NEWEST:
+                mDroppedNewest++;
+                return false;
+            case BACKPRESSURE_DROP_OLDEST: {
+                T oldest;
+                if(tryPop(oldest)){
+                    mDroppedOldest++;
+                }
+                break;
+            }
+            case BACKPRESSURE_BLOCK: {
+                std::unique_lock<std::mutex> lock(mWaitMutex);
+                mWaitingProducers++;
+                // Re-check after announcing ourselves, a pop in between would have missed us.
+                if(!full() || mClosed.load()){
+                    mWaitingProducers--;
+                    break;
+                }
+                mNotFull.wait_for(lock, std::chrono::milliseconds(WAIT_SLICE_MS));
+                mWaitingProducers--;
+                break;
+            }
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Adds an item if there is room, never blocks and never drops queued items.
+     */
+    bool tryPush(T& item){
+        if(mClosed.load(std::memory_order_relaxed)){
+            return false;
+        }
+        size_t pos = mEnqueuePos.load(std::memory_order_relaxed);
+        Slot* slot;
+        for(;;){
+            slot = &mSlots[pos % mCapacity];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if(diff == 0){
+                if(mEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                    break;
+                }
+            }
+            else if(diff < 0){
+                return false;
+            }
+            else{
+                pos = mEnqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        slot->value = std::move(item);
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        wake(mWaitingConsumers, mNotEmpty);
+        return true;
+    }
+
+    /**
+     * Takes the oldest item if there is one, never blocks.
+     */
+    bool tryPop(T& item){
+        size_t pos = mDequeuePos.load(std::memory_order_relaxed);
+        Slot* slot;
+        for(;;){
+            slot = &mSlots[pos % mCapacity];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+            if(diff == 0){
+                if(mDequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                    break;
+                }
+            }
+            else if(diff < 0){
+                return false;
+            }
+            else{
+                pos = mDequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+        item = std::move(slot->value);
+        slot->value = T();
+        slot->sequence.store(pos + mCapacity, std::memory_order_release);
+        wake(mWaitingProducers, mNotFull);
+        return true;
+    }
+
+    /**
+     * Takes the oldest item, waiting up to timeoutMs (forever if negative) for one to arrive.
+     * Returns false on timeout or once the queue is closed and drained.
+     */
+    bool pop(T& item, int timeoutMs = -1){
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+        while(!tryPop(item)){
+            if(mClosed.load()){
+                // a push may have completed right before closing
+                return tryPop(item);
+            }
+            auto slice = std::chrono::milliseconds(WAIT_SLICE_MS);
+            if(timeoutMs >= 0){
+                auto now = std::chrono::steady_clock::now();
+                if(now >= deadline){
+                    return false;
+                }
+                slice = std::min(slice, std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now) + std::chrono::milliseconds(1));
+            }
+            std::unique_lock<std::mutex> lock(mWaitMutex);
+            mWaitingConsumers++;
+            if(empty() && !mClosed.load()){
+                mNotEmpty.wait_for(lock, slice);
+            }
+            mWaitingConsumers--;
+        }
+        return true;
+    }
+
+    /**
+     * Stops accepting items and wakes everybody up. Queued items can still be popped.
+     */
+    void close(){
+        mClosed.store(true);
+        std::lock_guard<std::mutex> lock(mWaitMutex);
+        mNotEmpty.notify_all();
+        mNotFull.notify_all();
+    }
+
+    /**
+     * Drops all queued items and accepts new ones again.
+     */
+    void reset(){
+        T item;
+        while(tryPop(item)){
+        }
+        mClosed.store(false);
+    }
+
+    bool isClosed() const { return mClosed.load(); }
+    bool empty() const { return size() == 0; }
+    bool full() const { return size() >= mCapacity; }
+    size_t capacity() const { return mCapacity; }
+
+    size_t size() const {
+        size_t enqueued = mEnqueuePos.load();
+        size_t dequeued = mDequeuePos.load();
+        return enqueued > dequeued ? enqueued - dequeued : 0;
+    }
+
+    uint64_t droppedOldest() const { return mDroppedOldest.load(); }
+    uint64_t droppedNewest() const { return mDroppedNewest.load(); }
+    uint64_t dropped() const { return droppedOldest() + droppedNewest(); }
+
+    BackpressurePolicy policy() const { return mPolicy; }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    /**
+     * Waits are sliced so a missed notification costs at most this much latency.
+     */
+    const static int WAIT_SLICE_MS = 10;
+
+    void wake(std::atomic<int>& waiters, std::condition_variable& condition){
+        if(waiters.load() > 0){
+            std::lock_guard<std::mutex> lock(mWaitMutex);
+            condition.notify_all();
+        }
+    }
+
+    const size_t mCapacity;
+    std::unique_ptr<Slot[]> mSlots;
+    const BackpressurePolicy mPolicy;
+
+    std::atomic<size_t> mEnqueuePos;
+    std::atomic<size_t> mDequeuePos;
+    std::atomic<bool> mClosed;
+
+    std::mutex mWaitMutex;
+    std::condition_variable mNotEmpty;
+    std::condition_variable mNotFull;
+    std::atomic<int> mWaitingConsumers;
+    std::atomic<int> mWaitingProducers;
+
+    std::atomic<uint64_t> mDroppedOldest;
+    std::atomic<uint64_t> mDroppedNewest;
+};
+
+#endif // FRAMEQUEUE_H
@@ -0,0 +1,208 @@
+#include "mediasource.h"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include <QDebug>
+#include <QFile>
+
+#if __ANDROID_API__ >= 28
+#include "media/NdkMediaDataSource.h"
+#endif
+
+
+/**
+ * What copies of a MediaSource share: the open file, the bytes the source serves and the data sources handed to extractors.
+ */
+struct MediaSource::Backing {
+    QFile file;
+    QByteArray array;           ///< keeps byteArray() data alive
+    const uint8_t* data;        ///< mapped or in memory bytes, nullptr for file ranges
+    size_t size;
+
+#if __ANDROID_API__ >= 28
+    std::mutex mutex;
+    std::vector<AMediaDataSource*> dataSources;
+#endif
+
+    Backing() : data(nullptr), size(0) {}
+
+    ~Backing(){
+#if __ANDROID_API__ >= 28
+        for(AMediaDataSource* dataSource : dataSources){
+            AMediaDataSource_delete(dataSource);
+        }
+#endif
+        // the mapping goes with the file
+    }
+
+#if __ANDROID_API__ >= 28
+    static ssize_t readAt(void* userdata, off64_t offset, void* buffer, size_t size){
+        const Backing* backing = static_cast<const Backing*>(userdata);
+        if(offset < 0){
+            return -1;
+        }
+        if(static_cast<size_t>(offset) >= backing->size){
+            return size == 0 ? 0 : -1;  // -1 tells the extractor the end is reached
+        }
+        const size_t available = std::min(size, backing->size - static_cast<size_t>(offset));
+        memcpy(buffer, backing->data + offset, available);
+        return static_cast<ssize_t>(available);
+    }
+
+    static ssize_t getSize(void* userdata){
+        return static_cast<ssize_t>(static_cast<const Backing*>(userdata)->size);
+    }
+#endif
+};
+
+
+MediaSource::MediaSource()
+    :mType(SOURCE_NONE),
+      mOffset(0),
+      mLength(-1)
+{
+}
+
+MediaSource MediaSource::file(const QString& path){
+    MediaSource source;
+    source.mType = SOURCE_FILE;
+    source.mPath = path;
+    return source;
+}
+
+MediaSource MediaSource::fileRange(const QString& path, qint64 offset, qint64 length){
+    MediaSource source;
+    source.mType = SOURCE_FILE_RANGE;
+    source.mPath = path;
+    source.mOffset = offset;
+    source.mBacking = std::make_shared<Backing>();
+
+    QFile& file = source.mBacking->file;
+    file.setFileName(path);
+    if(!file.open(QIODevice::ReadOnly)){
+        qWarning() << "Cannot open video file" << path << file.errorString();
+        return source;
+    }
+    if(offset < 0 || offset > file.size() || (length >= 0 && offset + length > file.size())){
+        qWarning() << "Range" << offset << "+" << length << "lies outside of" << path << "(" << file.size() << "bytes)";
+        file.close();
+        return source;
+    }
+    source.mLength = length < 0 ? file.size() - offset : length;
+    return source;
+}
+
+MediaSource MediaSource::mappedFile(const QString& path, qint64 offset, qint64 length){
+    MediaSource source = fileRange(path, offset, length);
+    source.mType = SOURCE_MAPPED_FILE;
+#if __ANDROID_API__ >= 28
+    Backing& backing = *source.mBacking;
+    if(backing.file.isOpen() && source.mLength > 0){
+        backing.data = backing.file.map(offset, source.mLength);
+        if(backing.data == nullptr){
+            qWarning() << "Unable to map" << path << backing.file.errorString() << ", reading it through its descriptor";
+            source.mType = SOURCE_FILE_RANGE;
+        }
+        else{
+            backing.size = static_cast<size_t>(source.mLength);
+        }
+    }
+#endif
+    return source;
+}
+
+MediaSource MediaSource::memory(const void* data, size_t size){
+    MediaSource source;
+    source.mType = SOURCE_MEMORY;
+    source.mLength = static_cast<qint64>(size);
+    source.mBacking = std::make_shared<Backing>();
+    source.mBacking->data = static_cast<const uint8_t*>(data);
+    source.mBacking->size = size;
+    return source;
+}
+
+MediaSource MediaSource::byteArray(const QByteArray& data){
+    MediaSource source = memory(data.constData(), static_cast<size_t>(data.size()));
+    source.mBacking->array = data;
+    return source;
+}
+
+bool MediaSource::isValid() const {
+    switch(mType){
+    case SOURCE_FILE:
+        return !mPath.isEmpty();
+    case SOURCE_FILE_RANGE:
+        return mBacking->file.isOpen();
+    case SOURCE_MAPPED_FILE:
+#if __ANDROID_API__ >= 28
+        return mBacking->data != nullptr;
+#else
+        return mBacking->file.isOpen();
+#endif
+    case SOURCE_MEMORY:
+        return mBacking->data != nullptr && mBacking->size > 0;
+    default:
+        return false;
+    }
+}
+
+QString MediaSource::description() const {
+    switch(mType){
+    case SOURCE_FILE:
+        return mPath;
+    case SOURCE_FILE_RANGE:
+    case SOURCE_MAPPED_FILE:
+        return QString("%1 [%2 +%3]").arg(mPath).arg(mOffset).arg(mLength);
+    case SOURCE_MEMORY:
+        return QString("memory [%1 bytes]").arg(mLength);
+    default:
+        return QString("no source");
+    }
+}
+
+media_status_t MediaSource::attach(AMediaExtractor* extractor) const {
+    if(extractor == nullptr || !isValid()){
+        return AMEDIA_ERROR_INVALID_PARAMETER;
+    }
+
+    switch(mType){
+    case SOURCE_FILE:
+        return AMediaExtractor_setDataSource(extractor, mPath.toStdString().c_str());
+
+#if __ANDROID_API__ >= 28
+    case SOURCE_MAPPED_FILE:
+    case SOURCE_MEMORY: {
+        AMediaDataSource* dataSource = AMediaDataSource_new();
+        if(dataSource == nullptr){
+            return AMEDIA_ERROR_UNKNOWN;
+        }
+        AMediaDataSource_setUserdata(dataSource, mBacking.get());
+        AMediaDataSource_setReadAt(dataSource, &Backing::readAt);
+        AMediaDataSource_setGetSize(dataSource, &Backing::getSize);
+        // deleted with the backing, the extractor may call into it until it is deleted itself
+        {
+            std::lock_guard<std::mutex> lock(mBacking->mutex);
+            mBacking->dataSources.push_back(dataSource);
+        }
+        return AMediaExtractor_setDataSourceCustom(extractor, dataSource);
+    }
+#else
+    case SOURCE_MAPPED_FILE:
+#endif
+    case SOURCE_FILE_RANGE:
+        // the extractor dups the descriptor, the range is all it gets to see
+        return AMediaExtractor_setDataSourceFd(extractor, mBacking->file.handle(), mOffset, mLength);
+
+#if __ANDROID_API__ < 28
+    case SOURCE_MEMORY:
+        qWarning() << "Reading from memory needs AMediaDataSource (API 28)";
+        return AMEDIA_ERROR_UNSUPPORTED;
+#endif
+
+    default:
+        return AMEDIA_ERROR_INVALID_PARAMETER;
+    }
+}
@@ -0,0 +1,112 @@
+#ifndef MEDIASOURCE_H
+#define MEDIASOURCE_H
+
+/*
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * MediaSource describes where an extractor reads a media file from: a path, a byte range of a file (a clip stored inside
+ * a larger container), a memory mapped file (range) or a buffer already in memory.
+ * Memory and mapped sources are served through AMediaDataSource (API 28) straight from memory, without temp files or read syscalls.
+ * Below API 28 file ranges and mapped files fall back to AMediaExtractor_setDataSourceFd() with offset and length,
+ * memory buffers cannot be read there.
+ *
+ * MediaSource is a cheap to copy value; copies share the open file, the mapping and the data sources handed to extractors,
+ * which stay valid until the last copy is gone. Keep a copy around as long as an extractor attached to it is alive.
+ */
+
+#include <cstddef>
+#include <memory>
+
+#include <QByteArray>
+#include <QString>
+
+#include "media/NdkMediaError.h"
+#include "media/NdkMediaExtractor.h"
+
+
+class MediaSource
+{
+public:
+    enum Type {
+        SOURCE_NONE,
+        SOURCE_FILE,            ///< a path, opened by the framework
+        SOURCE_FILE_RANGE,      ///< offset and length within a file, read through its descriptor
+        SOURCE_MAPPED_FILE,     ///< offset and length within a file, mapped into memory
+        SOURCE_MEMORY           ///< a buffer in memory
+    };
+
+    MediaSource();
+
+    static MediaSource file(const QString& path);
+
+    /**
+     * length bytes of path starting at offset, -1 for the rest of the file.
+     */
+    static MediaSource fileRange(const QString& path, qint64 offset, qint64 length = -1);
+
+    /**
+     * Like fileRange(), but mapped into memory once and read from there (API 28, a file range below).
+     */
+    static MediaSource mappedFile(const QString& path, qint64 offset = 0, qint64 length = -1);
+
+    /**
+     * size bytes at data, which is not copied: it has to stay valid as long as the source is used.
+     */
+    static MediaSource memory(const void* data, size_t size);
+
+    /**
+     * The bytes of data; the array is shared (implicitly), not copied.
+     */
+    static MediaSource byteArray(const QByteArray& data);
+
+    Type type() const { return mType; }
+
+    /**
+     * @brief isPlainFile whether this is a whole file by path, the only kind a sample index can be cached for
+     */
+    bool isPlainFile() const { return mType == SOURCE_FILE; }
+
+    /**
+     * @brief isValid whether the source was set up, i.e. the file could be opened (and mapped)
+     */
+    bool isValid() const;
+
+    /**
+     * @brief path of the file, empty for memory sources
+     */
+    QString path() const { return mPath; }
+
+    /**
+     * @brief description for log messages
+     */
+    QString description() const;
+
+    /**
+     * Sets the source as the data source of extractor.
+     */
+    media_status_t attach(AMediaExtractor* extractor) const;
+
+private:
+    struct Backing;
+
+    Type mType;
+    QString mPath;
+    qint64 mOffset;
+    qint64 mLength;
+    std::shared_ptr<Backing> mBacking;
+};
+
+#endif // MEDIASOURCE_H
@@ -0,0 +1,150 @@
+#include "multirenditionwriter.h"
+
+#include <QDebug>
+
+#include "yuvconvert.h"
+
+
+MultiRenditionWriter::MultiRenditionWriter(const int fps, const cv::Size& size)
+    :mFPS(fps),
+      mSize(size),
+      mFramePool(std::make_shared<FramePool>()),
+      mPrepared(false)
+{
+}
+
+MultiRenditionWriter::~MultiRenditionWriter(){
+    if(mPrepared){
+        // nobody ended the recording, finish the files rather than leave them without an index
+        end();
+    }
+    // the conversion thread writes to the renditions until it is gone, so it has to go first
+    if(mConversionThread.joinable()){
+        mConversionThread.join();
+    }
+}
+
+int MultiRenditionWriter::addRendition(const QString& filename, const cv::Size& size, const EncoderConfig& config){
+    if(mPrepared){
+        qWarning() << "Renditions have to be added before preparing the encoders";
+        return -1;
+    }
+    if(size.width <= 0 || size.height <= 0 || size.width > mSize.width || size.height > mSize.height){
+        qWarning() << "A rendition of" << size.width << "x" << size.height << "does not fit into the input of" << mSize.width << "x" << mSize.height;
+        return -1;
+    }
+    std::unique_ptr<NativeCodecWriter> writer(new NativeCodecWriter(filename, mFPS, size, config));
+    writer->setFramePool(mFramePool);
+    mRenditions.push_back(std::move(writer));
+    return renditionCount() - 1;
+}
+
+void MultiRenditionWriter::setTimestampMode(TimestampMode mode, long long ticksPerSecond){
+    for(std::unique_ptr<NativeCodecWriter>& rendition : mRenditions){
+        rendition->setTimestampMode(mode, ticksPerSecond);
+    }
+}
+
+void MultiRenditionWriter::prepareEncoder(){
+    if(mRenditions.empty()){
+        qWarning() << "No renditions to record";
+        return;
+    }
+    if(mPrepared){
+        qWarning() << "The renditions are already recording, end() them first";
+        return;
+    }
+    // the previous recording may still be finishing
+    waitForFinished();
+
+    // the written copies, the converted frames and every rendition's queue
+    mFramePool->setMaxFrames(FramePool::DEFAULT_MAX_FRAMES * (mRenditions.size() + 1));
+    for(std::unique_ptr<NativeCodecWriter>& rendition : mRenditions){
+        rendition->prepareEncoder();
+    }
+    mFrameQueue.reset(new BoundedFrameQueue<PendingFrame>(QUEUE_CAPACITY, BACKPRESSURE_BLOCK));
+    mConversionThread = std::thread(&MultiRenditionWriter::conversionLoop, this);
+    mPrepared = true;
+}
+
+bool MultiRenditionWriter::write(const cv::Mat& mat, const long long timestamp){
+    if(mat.empty()) return false;
+
+    if(!mPrepared){
+        qWarning() << "Encoders have not been prepared, dropping frame";
+        return false;
+    }
+    if(mat.size() != mSize || mat.depth() != CV_8U || (mat.channels() != 3 && mat.channels() != 1)){
+        qWarning() << "Frame does not match the input size:" << mat.cols << "x" << mat.rows << "with" << mat.channels() << "channels";
+        return false;
+    }
+
+    // The caller may reuse its buffer as soon as we return, so the queue gets its own copy.
+    PendingFrame frame;
+    frame.image = mFramePool->acquire(mat.size(), mat.type());
+    mat.copyTo(frame.image);
+    frame.timestamp = timestamp;
+    return mFrameQueue->push(frame);
+}
+
+void MultiRenditionWriter::conversionLoop(){
+    PendingFrame frame;
+    while(mFrameQueue->pop(frame)){
+        feedRenditions(frame);
+        frame = PendingFrame();
+    }
+    for(std::unique_ptr<NativeCodecWriter>& rendition : mRenditions){
+        rendition->end();
+    }
+}
+
+void MultiRenditionWriter::feedRenditions(const PendingFrame& frame){
+    // converted once, into a frame the renditions of the input size queue as it is
+    cv::Mat converted = mFramePool->acquire(NativeCodecWriter::i420MatSize(mSize), CV_8UC1);
+    YUVPlanes planes;
+    yuvResolvePlanes(converted.data, converted.total(), NativeCodecWriter::i420Layout(mSize), planes);
+    {
+        ScopedStage stage(mProfiler, STAGE_CONVERSION);
+        if(frame.image.channels() == 3){
+            bgrToYUV420(frame.image.data, frame.image.step, planes);
+        }
+        else{
+            grayToYUV420(frame.image.data, frame.image.step, planes);
+        }
+    }
+
+    for(std::unique_ptr<NativeCodecWriter>& rendition : mRenditions){
+        const cv::Size size = rendition->frameSize();
+        if(size == mSize){
+            rendition->writeYUV(converted, frame.timestamp);
+            continue;
+        }
+        cv::Mat scaled = mFramePool->acquire(NativeCodecWriter::i420MatSize(size), CV_8UC1);
+        YUVPlanes scaledPlanes;
+        yuvResolvePlanes(scaled.data, scaled.total(), NativeCodecWriter::i420Layout(size), scaledPlanes);
+        {
+            ScopedStage stage(mProfiler, STAGE_CONVERSION);
+            yuv420Scale(planes, scaledPlanes);
+        }
+        rendition->writeYUV(scaled, frame.timestamp);
+    }
+}
+
+void MultiRenditionWriter::end(){
+    if(!mPrepared){
+        qWarning() << "No recording to end";
+        return;
+    }
+    // the conversion thread works through what is queued and then ends the renditions
+    mFrameQueue->close();
+    mPrepared = false;
+}
+
+void MultiRenditionWriter::waitForFinished(){
+    if(mConversionThread.joinable()){
+        mConversionThread.join();
+    }
+    for(std::unique_ptr<NativeCodecWriter>& rendition : mRenditions){
+        rendition->waitForFinished();
+    }
+}
@@ -0,0 +1,140 @@
+#ifndef MULTIRENDITIONWRITER_H
+#define MULTIRENDITIONWRITER_H
+
+/*
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * MultiRenditionWriter records the same frames into several files at once, e.g. a full resolution archive and a low bitrate preview.
+ * Every rendition is a NativeCodecWriter with its own size, encoder configuration, muxer and encoding thread,
+ * but the color conversion happens once per frame: a conversion thread turns every written frame into a pooled I420 frame,
+ * hands it as it is to the renditions of the input's size and downscales it (luma and chroma separately, no BGR round trip)
+ * for the others. All renditions get their frames through NativeCodecWriter::writeYUV(), so their encoding threads only copy
+ * planes into their encoder's input layout, and a frame one of them loses shows up in its own droppedFrames().
+ * The thread calling write() only copies the frame.
+ */
+
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <QObject>
+#include <QString>
+
+#include <opencv2/opencv.hpp>
+
+#include "codecprofiler.h"
+#include "framepool.h"
+#include "framequeue.h"
+#include "nativecodecvideo.h"
+
+
+class MultiRenditionWriter
+{
+public:
+    /**
+     * size is the size of the frames passed to write().
+     */
+    MultiRenditionWriter(const int fps, const cv::Size& size);
+    ~MultiRenditionWriter();
+
+    /**
+     * Adds a rendition written to filename, at most as large as the input.
+     * Needs to be called before prepareEncoder(). Returns the rendition's number.
+     */
+    int addRendition(const QString& filename, const cv::Size& size, const EncoderConfig& config = EncoderConfig());
+
+    int renditionCount() const { return static_cast<int>(mRenditions.size()); }
+
+    /**
+     * The writer of rendition, e.g. for its queue, segmentation or adaptive bitrate before prepareEncoder(),
+     * or its signals and stats.
+     */
+    NativeCodecWriter& rendition(int index) { return *mRenditions[index]; }
+
+    /**
+     * Sets the timestamp mode of all renditions, see NativeCodecWriter::setTimestampMode().
+     */
+    void setTimestampMode(TimestampMode mode, long long ticksPerSecond = 1000000);
+
+    /**
+     * Times the conversion to I420 and the downscaling for the smaller renditions, both on the conversion thread, as STAGE_CONVERSION.
+     */
+    CodecProfiler& profiler() { return mProfiler; }
+
+    /**
+     * The pool the converted frames come from, shared by all renditions.
+     */
+    std::shared_ptr<FramePool> framePool() const { return mFramePool; }
+
+    void prepareEncoder();
+
+    /**
+     * Queues a copy of mat (BGR or gray, of the input size) for the conversion thread, waiting while QUEUE_CAPACITY frames
+     * are ahead of it. Returns false if the frame does not fit or nothing is recording.
+     * Frames a rendition loses on the way (see its queue policy) show up in its droppedFrames().
+     */
+    bool write(const cv::Mat& mat, const long long timestamp);
+
+    /**
+     * @brief QUEUE_CAPACITY frames written but not converted yet
+     */
+    const static int QUEUE_CAPACITY = 4;
+
+    /**
+     * Ends the recording of all renditions without blocking, see NativeCodecWriter::end().
+     * The renditions end once the conversion thread has handed them the last frame.
+     */
+    void end();
+
+    /**
+     * Blocks until all renditions are finished.
+     */
+    void waitForFinished();
+
+private:
+    int mFPS;
+    cv::Size mSize;
+    std::vector<std::unique_ptr<NativeCodecWriter> > mRenditions;
+    std::shared_ptr<FramePool> mFramePool;
+    CodecProfiler mProfiler;
+    bool mPrepared;
+
+    struct PendingFrame {
+        cv::Mat image;
+        long long timestamp;
+
+        PendingFrame() : timestamp(0) {}
+    };
+
+    /**
+     * @brief mFrameQueue written frames on their way to the conversion thread, closed by end()
+     */
+    std::unique_ptr<BoundedFrameQueue<PendingFrame> > mFrameQueue;
+    std::thread mConversionThread;
+
+    /**
+     * Runs on the conversion thread until the queue is closed and empty, then ends all renditions.
+     */
+    void conversionLoop();
+
+    /**
+     * Converts frame to I420 once and writes it to every rendition, scaled where needed.
+     */
+    void feedRenditions(const PendingFrame& frame);
+};
+
+#endif // MULTIRENDITIONWRITER_H
@@ -0,0 +1,203 @@
+#include "multistreamreader.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include <QDebug>
+
+
+MultiStreamReader::MultiStreamReader()
+    :mReferenceStream(0),
+      mToleranceUs(0),
+      mMissingPolicy(MISSING_REPEAT_LAST),
+      mStarted(false),
+      mStopRequested(false),
+      mSets(0),
+      mSkippedSets(0)
+{
+}
+
+MultiStreamReader::~MultiStreamReader(){
+    stop();
+}
+
+int MultiStreamReader::addStream(const MediaSource& source, int64 offsetUs, const DecoderConfig& decoder){
+    if(mStarted){
+        qWarning() << "Streams have to be added before starting";
+        return -1;
+    }
+    std::unique_ptr<Stream> stream(new Stream());
+    stream->reader.reset(new NativeCodecReader(source, decoder));
+    stream->offsetUs = offsetUs;
+    mStreams.push_back(std::move(stream));
+    return static_cast<int>(mStreams.size()) - 1;
+}
+
+void MultiStreamReader::setReferenceStream(int stream){
+    mReferenceStream = stream;
+}
+
+void MultiStreamReader::setTolerance(int64 toleranceUs){
+    mToleranceUs = std::max<int64>(toleranceUs, 0);
+}
+
+void MultiStreamReader::setMissingFramePolicy(MissingFramePolicy policy){
+    mMissingPolicy = policy;
+}
+
+bool MultiStreamReader::start(size_t queueCapacity){
+    if(mStarted){
+        qWarning() << "The multi stream reader has already been started";
+        return false;
+    }
+    if(mStreams.empty() || mReferenceStream < 0 || mReferenceStream >= streamCount()){
+        qWarning() << "No streams or no such reference stream" << mReferenceStream;
+        return false;
+    }
+    for(const std::unique_ptr<Stream>& stream : mStreams){
+        if(!stream->reader->isOpen()){
+            qWarning() << "Not all streams could be opened";
+            return false;
+        }
+    }
+    if(mToleranceUs == 0){
+        const double fps = mStreams[mReferenceStream]->reader->fps();
+        mToleranceUs = static_cast<int64>(500000 / (fps > 0 ? fps : NativeCodecReader::dst_fps));
+    }
+
+    mStopRequested = false;
+    mStarted = true;
+    for(const std::unique_ptr<Stream>& stream : mStreams){
+        stream->queue.reset(new BoundedFrameQueue<DecodedFrame>(queueCapacity, BACKPRESSURE_BLOCK));
+        stream->thread = std::thread(&MultiStreamReader::decodeStream, this, stream.get());
+    }
+    return true;
+}
+
+void MultiStreamReader::stop(){
+    mStopRequested = true;
+    for(const std::unique_ptr<Stream>& stream : mStreams){
+        if(stream->queue){
+            // wakes a decoder thread blocked on a full queue
+            stream->queue->close();
+        }
+        if(stream->thread.joinable()){
+            stream->thread.join();
+        }
+    }
+}
+
+void MultiStreamReader::decodeStream(Stream* stream){
+    DecodedFrame frame;
+    int idleReads = 0;
+    while(!mStopRequested && !stream->reader->isFinished()){
+        if(!stream->reader->read(frame.image)){
+            if(++idleReads > MAX_IDLE_READS){
+                qWarning() << "Decoding a stream got stuck, ending it";
+                break;
+            }
+            continue;
+        }
+        idleReads = 0;
+        frame.presentationTimeUs = stream->reader->lastPresentationTimeUs();
+        if(!stream->queue->push(frame)){
+            break;
+        }
+    }
+    stream->queue->close();
+}
+
+bool MultiStreamReader::fill(Stream& stream, size_t count){
+    while(stream.lookahead.size() < count){
+        Pending pending;
+        if(!stream.queue->pop(pending.frame)){
+            return false;
+        }
+        pending.delivered = false;
+        stream.lookahead.push_back(std::move(pending));
+    }
+    return true;
+}
+
+void MultiStreamReader::popFront(Stream& stream){
+    if(!stream.lookahead.front().delivered){
+        stream.stats.dropped++;
+    }
+    stream.lookahead.pop_front();
+}
+
+bool MultiStreamReader::read(FrameSet& set){
+    if(!mStarted){
+        return false;
+    }
+    Stream& reference = *mStreams[mReferenceStream];
+    const int count = streamCount();
+
+    while(!mStopRequested){
+        if(!fill(reference, 1)){
+            return false;
+        }
+        const int64 timeUs = reference.lookahead.front().frame.presentationTimeUs + reference.offsetUs;
+
+        std::vector<const DecodedFrame*> matches(count, nullptr);
+        matches[mReferenceStream] = &reference.lookahead.front().frame;
+        bool complete = true;
+        for(int i = 0; i < count && complete; i++){
+            if(i == mReferenceStream){
+                continue;
+            }
+            Stream& stream = *mStreams[i];
+            if(!fill(stream, 1)){
+                return false;
+            }
+            // move on to the frame nearest to the reference frame, the ones before it are of no use anymore
+            while(fill(stream, 2)
+                  && std::llabs(stream.lookahead[1].frame.presentationTimeUs + stream.offsetUs - timeUs)
+                  <= std::llabs(stream.lookahead[0].frame.presentationTimeUs + stream.offsetUs - timeUs)){
+                popFront(stream);
+            }
+
+            Pending& nearest = stream.lookahead.front();
+            if(std::llabs(nearest.frame.presentationTimeUs + stream.offsetUs - timeUs) <= mToleranceUs){
+                if(nearest.delivered){
+                    stream.stats.duplicated++;
+                }
+                matches[i] = &nearest.frame;
+            }
+            else if(mMissingPolicy == MISSING_REPEAT_LAST && !stream.last.image.empty()){
+                stream.stats.duplicated++;
+                matches[i] = &stream.last;
+            }
+            else{
+                complete = false;
+            }
+        }
+
+        if(!complete){
+            popFront(reference);
+            mSkippedSets++;
+            continue;
+        }
+
+        set.frames.resize(count);
+        set.presentationTimesUs.resize(count);
+        set.presentationTimeUs = timeUs;
+        for(int i = 0; i < count; i++){
+            Stream& stream = *mStreams[i];
+            set.frames[i] = matches[i]->image;
+            set.presentationTimesUs[i] = matches[i]->presentationTimeUs;
+            if(matches[i] != &stream.last){
+                if(!stream.lookahead.front().delivered){
+                    stream.stats.delivered++;
+                    stream.lookahead.front().delivered = true;
+                }
+                stream.last = stream.lookahead.front().frame;
+            }
+        }
+        // reference frames go out once
+        reference.lookahead.pop_front();
+        mSets++;
+        return true;
+    }
+    return false;
+}
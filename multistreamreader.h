@@ -0,0 +1,186 @@
+#ifndef MULTISTREAMREADER_H
+#define MULTISTREAMREADER_H
+
+/*
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * MultiStreamReader reads several videos of the same scene (stereo pairs, multi camera rigs recorded to separate files)
+ * and hands out matched frame sets: for every frame of the reference stream the frame of each other stream
+ * whose presentation time is nearest, if it lies within a tolerance.
+ * Every stream decodes on a thread of its own into a small queue, so the slowest stream sets the pace, not the sum of all.
+ * Matching works on the microsecond presentation times of the frames (plus a per stream offset for clocks that started apart).
+ * Frames of the other streams that no reference frame picked are dropped, frames picked by more than one are duplicated;
+ * both are counted per stream (see StreamSyncStats).
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "framequeue.h"
+#include "mediasource.h"
+#include "nativecodecvideo.h"
+
+
+/**
+ * @brief The MissingFramePolicy enum decides what happens when a stream has no frame within the tolerance of a reference frame.
+ */
+enum MissingFramePolicy {
+    MISSING_REPEAT_LAST,        ///< the stream's previous frame fills the gap (counted as duplicate), until it has one there is no set
+    MISSING_SKIP_SET            ///< no set for this reference frame
+};
+
+
+/**
+ * @brief The FrameSet struct holds one frame per stream, in the order the streams were added.
+ */
+struct FrameSet {
+    std::vector<cv::Mat> frames;
+    std::vector<int64> presentationTimesUs;     ///< of each frame, on its own stream's timeline (without offset)
+    int64 presentationTimeUs;                   ///< of the reference frame, plus the reference stream's offset
+
+    FrameSet() : presentationTimeUs(-1) {}
+};
+
+
+/**
+ * @brief The StreamSyncStats struct counts what matching did to the frames of one stream.
+ */
+struct StreamSyncStats {
+    uint64_t delivered;         ///< distinct frames that went out in a set
+    uint64_t dropped;           ///< frames that went out in no set
+    uint64_t duplicated;        ///< extra times a frame went out in another set
+
+    StreamSyncStats() : delivered(0), dropped(0), duplicated(0) {}
+};
+
+
+class MultiStreamReader
+{
+public:
+    MultiStreamReader();
+    ~MultiStreamReader();
+
+    /**
+     * Adds a stream, before start(). offsetUs is added to its presentation times before matching,
+     * e.g. to make up for cameras that started recording at different times. Returns the stream's number.
+     */
+    int addStream(const MediaSource& source, int64 offsetUs = 0, const DecoderConfig& decoder = DecoderConfig());
+    int addStream(const QString& filename, int64 offsetUs = 0) { return addStream(MediaSource::file(filename), offsetUs); }
+
+    int streamCount() const { return static_cast<int>(mStreams.size()); }
+
+    /**
+     * The reader of stream, e.g. to set its output format or size before start().
+     */
+    NativeCodecReader& reader(int stream) { return *mStreams[stream]->reader; }
+
+    /**
+     * Selects the stream whose frames set the timeline, stream 0 by default.
+     */
+    void setReferenceStream(int stream);
+
+    /**
+     * Frames further apart than toleranceUs do not match. 0 (the default) takes half the reference stream's frame period.
+     */
+    void setTolerance(int64 toleranceUs);
+    int64 tolerance() const { return mToleranceUs; }
+
+    void setMissingFramePolicy(MissingFramePolicy policy);
+
+    /**
+     * Starts decoding all streams, each into a queue of queueCapacity frames.
+     */
+    bool start(size_t queueCapacity = 4);
+
+    /**
+     * Blocks until the next set is complete. Returns false once the reference stream ended or another stream ran out of frames.
+     */
+    bool read(FrameSet& set);
+
+    /**
+     * Stops the decoding threads. Also done by the destructor.
+     */
+    void stop();
+
+    /**
+     * Matching counters of stream, only valid on the thread calling read().
+     */
+    StreamSyncStats streamStats(int stream) const { return mStreams[stream]->stats; }
+
+    uint64_t sets() const { return mSets; }
+
+    /**
+     * @brief skippedSets reference frames that did not make it into a set because another stream had no frame for them
+     */
+    uint64_t skippedSets() const { return mSkippedSets; }
+
+    /**
+     * @brief MAX_IDLE_READS how many read() calls in a row may come back empty before a stream counts as ended
+     */
+    const static int MAX_IDLE_READS = 1000;
+
+private:
+    /**
+     * @brief The Pending struct is a decoded frame waiting to be matched.
+     */
+    struct Pending {
+        DecodedFrame frame;
+        bool delivered;
+    };
+
+    struct Stream {
+        std::unique_ptr<NativeCodecReader> reader;
+        int64 offsetUs;
+        std::unique_ptr<BoundedFrameQueue<DecodedFrame> > queue;
+        std::thread thread;
+
+        /**
+         * @brief lookahead frames taken from the queue but not matched yet, the first one may have gone out already
+         */
+        std::deque<Pending> lookahead;
+        DecodedFrame last;
+        StreamSyncStats stats;
+    };
+
+    std::vector<std::unique_ptr<Stream> > mStreams;
+    int mReferenceStream;
+    int64 mToleranceUs;
+    MissingFramePolicy mMissingPolicy;
+    bool mStarted;
+    std::atomic<bool> mStopRequested;
+    uint64_t mSets;
+    uint64_t mSkippedSets;
+
+    void decodeStream(Stream* stream);
+
+    /**
+     * Makes sure stream has count frames in its lookahead, waiting for its decoder. False if the stream ends before.
+     */
+    bool fill(Stream& stream, size_t count);
+
+    /**
+     * Drops the first frame of stream's lookahead, counting it if it never went out.
+     */
+    void popFront(Stream& stream);
+};
+
+#endif // MULTISTREAMREADER_H
@@ -3,7 +3,10 @@
 #include <opencv2/opencv.hpp>
 #include <QDebug>
 #include <QString>
+#include <QDir>
 #include <QFile>
+#include <QFileInfo>
+#include <QPointer>
 #include <QStandardPaths>
 
 
@@ -14,22 +17,137 @@
 #include "media/NdkMediaMuxer.h"
 #include "media/NdkMediaExtractor.h"
 
-#include <OMXAL/OpenMAXAL.h>
-#include <OMXAL/OpenMAXAL_Android.h>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
 
 
 
 using std::string;
 
+// Format keys that only got an AMEDIAFORMAT_KEY_* constant in later API levels
+static const char* KEY_SLICE_HEIGHT = "slice-height";
+static const char* KEY_CROP_LEFT = "crop-left";
+static const char* KEY_CROP_TOP = "crop-top";
+static const char* KEY_CROP_RIGHT = "crop-right";
+static const char* KEY_CROP_BOTTOM = "crop-bottom";
+static const char* KEY_BITRATE_MODE = "bitrate-mode";
+static const char* KEY_QUALITY = "quality";
+static const char* KEY_PROFILE = "profile";
+static const char* KEY_LEVEL = "level";
+static const char* KEY_PRIORITY = "priority";
+static const char* KEY_OPERATING_RATE = "operating-rate";
+static const char* KEY_MAX_B_FRAMES = "max-bframes";
+static const char* KEY_LATENCY = "latency";
+static const char* KEY_VIDEO_BITRATE = "video-bitrate";
+static const char* KEY_REQUEST_SYNC_FRAME = "request-sync";
+
+// AMEDIACODEC_BUFFER_FLAG_KEY_FRAME only got a name in API 34
+static const uint32_t BUFFER_FLAG_KEY_FRAME = 1;
+
+/**
+ * The platform's software decoders: Codec2 names from Android 10 on, OMX ones before (later kept as aliases).
+ */
+static const struct {
+    const char* mime;
+    const char* names[2];
+} SOFTWARE_DECODERS[] = {
+    {"video/avc", {"c2.android.avc.decoder", "OMX.google.h264.decoder"}},
+    {"video/hevc", {"c2.android.hevc.decoder", "OMX.google.hevc.decoder"}},
+    {"video/x-vnd.on2.vp8", {"c2.android.vp8.decoder", "OMX.google.vp8.decoder"}},
+    {"video/x-vnd.on2.vp9", {"c2.android.vp9.decoder", "OMX.google.vp9.decoder"}},
+    {"video/mp4v-es", {"c2.android.mpeg4.decoder", "OMX.google.mpeg4.decoder"}},
+    {"video/3gpp", {"c2.android.h263.decoder", "OMX.google.h263.decoder"}}
+};
+
+const char* EncoderConfig::mime() const{
+    switch(codec){
+    case VIDEO_CODEC_HEVC:
+        return "video/hevc";
+    case VIDEO_CODEC_VP8:
+        return "video/x-vnd.on2.vp8";
+    case VIDEO_CODEC_VP9:
+        return "video/x-vnd.on2.vp9";
+    case VIDEO_CODEC_AVC:
+    default:
+        return "video/avc";
+    }
+}
+
+CodecFrameView::CodecFrameView()
+    :presentationTimeUs(-1),
+      mCodec(nullptr),
+      mBufferIndex(-1)
+{
+}
+
+CodecFrameView::~CodecFrameView(){
+    release();
+}
+
+CodecFrameView::CodecFrameView(CodecFrameView&& other)
+    :CodecFrameView()
+{
+    *this = std::move(other);
+}
+
+CodecFrameView& CodecFrameView::operator=(CodecFrameView&& other){
+    if(this != &other){
+        release();
+        image = other.image;
+        presentationTimeUs = other.presentationTimeUs;
+        mCodec = other.mCodec;
+        mBufferIndex = other.mBufferIndex;
+        mBufferToken = other.mBufferToken;
+        other.image = cv::Mat();
+        other.mCodec = nullptr;
+        other.mBufferIndex = -1;
+        other.mBufferToken.reset();
+    }
+    return *this;
+}
+
+void CodecFrameView::release(){
+    image = cv::Mat();
+    // after a flush the index refers to nothing (or worse, somebody else's buffer)
+    if(mCodec != nullptr && mBufferIndex >= 0 && !mBufferToken.expired()){
+        AMediaCodec_releaseOutputBuffer(mCodec, mBufferIndex, false);
+    }
+    mCodec = nullptr;
+    mBufferIndex = -1;
+    mBufferToken.reset();
+}
+
 NativeCodecReader::NativeCodecReader(QString filename)
-    :QObject(nullptr)
+    :NativeCodecReader(MediaSource::file(filename))
+{
+}
+
+NativeCodecReader::NativeCodecReader(const MediaSource& source, const DecoderConfig& decoder)
+    :QObject(nullptr),
+      mSource(source),
+      mDecoderConfig(decoder)
 {
-    mFilename = filename;
     mTotalTimeBuffer = -1;
+    mAsync = false;
+    mAsyncRunning = false;
+    mLastPresentationTimeUs = -1;
+    mDecoderPresentationTimeUs = -1;
+    mOutputFormat = FRAME_FORMAT_BGR;
+    mBufferToken = std::make_shared<int>(0);
+    mFramePool = std::make_shared<FramePool>();
+    mPacketExtractor = nullptr;
+    mMaxPacketSize = 0;
+    mFormat = nullptr;
+    mTrackIndex = 0;
 
-    prepareDecoder();
+    if(!prepareDecoder()){
+        // nothing to select or index, isOpen() tells the caller
+        return;
+    }
 
-    Q_ASSERT(mExtractor != nullptr);
     size_t numberOfTracks = AMediaExtractor_getTrackCount(mExtractor);
     qDebug() << "Found " << numberOfTracks << " tracks.";
 
@@ -39,39 +157,151 @@ NativeCodecReader::NativeCodecReader(QString filename)
         qWarning() << "AMediaExtractor_selectTrack failed.";
     }
 
+    loadSampleIndex();
 }
 
 NativeCodecReader::~NativeCodecReader(){
+    stopAsync();
     releaseDecoder();
-    AMediaFormat_delete(mFormat);
+    if(mPacketExtractor != nullptr){
+        AMediaExtractor_delete(mPacketExtractor);
+    }
+    if(mFormat != nullptr){
+        AMediaFormat_delete(mFormat);
+    }
+}
+
+bool NativeCodecReader::openPacketExtractor(){
+    if(mPacketExtractor != nullptr){
+        return true;
+    }
+    mPacketExtractor = AMediaExtractor_new();
+    if(mPacketExtractor == nullptr){
+        qWarning() << "Unable to get a media extractor for packets!";
+        return false;
+    }
+    media_status_t status = mSource.attach(mPacketExtractor);
+    if(status == AMEDIA_OK){
+        status = AMediaExtractor_selectTrack(mPacketExtractor, mTrackIndex);
+    }
+    if(status != AMEDIA_OK){
+        qWarning() << "Unable to open" << mSource.description() << "for reading packets:" << status;
+        AMediaExtractor_delete(mPacketExtractor);
+        mPacketExtractor = nullptr;
+        return false;
+    }
+
+    // the largest sample of the track, for when the exact size cannot be asked for
+    mMaxPacketSize = 0;
+    for(const SampleIndex::Sample& sample : mIndex.samples()){
+        mMaxPacketSize = std::max(mMaxPacketSize, static_cast<size_t>(sample.size));
+    }
+    int32_t maxInputSize = 0;
+    if(mMaxPacketSize == 0){
+        std::lock_guard<std::mutex> lock(mFormatMutex);
+        mMaxPacketSize = AMediaFormat_getInt32(mFormat, AMEDIAFORMAT_KEY_MAX_INPUT_SIZE, &maxInputSize) && maxInputSize > 0 ? maxInputSize : 4 * 1024 * 1024;
+    }
+    return true;
+}
+
+size_t NativeCodecReader::packetSize(){
+#if __ANDROID_API__ >= 28
+    ssize_t sampleSize = AMediaExtractor_getSampleSize(mPacketExtractor);
+    if(sampleSize >= 0){
+        return static_cast<size_t>(sampleSize);
+    }
+#endif
+    return mMaxPacketSize;
+}
+
+bool NativeCodecReader::readPacket(MediaPacket& packet){
+    if(!openPacketExtractor() || AMediaExtractor_getSampleTime(mPacketExtractor) < 0){
+        return false;
+    }
+    size_t needed = packetSize();
+    if(packet.buffer.size() < needed){
+        packet.buffer.resize(needed);
+    }
+    return readPacket(packet.buffer.data(), packet.buffer.size(), packet.size, packet.presentationTimeUs, packet.sync);
+}
+
+bool NativeCodecReader::readPacket(uint8_t* buffer, size_t capacity, size_t& size, int64& presentationTimeUs, bool& sync){
+    if(!openPacketExtractor()){
+        return false;
+    }
+    presentationTimeUs = AMediaExtractor_getSampleTime(mPacketExtractor);
+    if(presentationTimeUs < 0){
+        size = 0;
+        return false;
+    }
+#if __ANDROID_API__ >= 28
+    size_t needed = packetSize();
+    if(capacity < needed){
+        size = needed;
+        return false;
+    }
+#endif
+
+    ScopedStage stage(mProfiler, STAGE_EXTRACTOR_READ);
+    ssize_t sampleSize = AMediaExtractor_readSampleData(mPacketExtractor, buffer, capacity);
+    if(sampleSize < 0){
+        // only tells the size is wrong, the track's largest sample is sure to fit
+        size = packetSize();
+        return false;
+    }
+    size = static_cast<size_t>(sampleSize);
+    sync = (AMediaExtractor_getSampleFlags(mPacketExtractor) & AMEDIAEXTRACTOR_SAMPLE_FLAG_SYNC) != 0;
+    AMediaExtractor_advance(mPacketExtractor);
+    return true;
+}
+
+bool NativeCodecReader::seekPacket(int64 timeUs){
+    if(!openPacketExtractor()){
+        return false;
+    }
+    return AMediaExtractor_seekTo(mPacketExtractor, timeUs, AMEDIAEXTRACTOR_SEEK_PREVIOUS_SYNC) == AMEDIA_OK;
 }
 
 cv::Mat NativeCodecReader::performRead(){
 
     //qDebug() << "performRead";
 
-    if(mSize.empty() || mSize.width == -1 || mSize.height == -1){
-        int frameWidth = -1;
-        int frameHeight = -1;
-        bool ok = AMediaFormat_getInt32(mFormat, AMEDIAFORMAT_KEY_WIDTH, &frameWidth);
-        ok = ok && AMediaFormat_getInt32(mFormat, AMEDIAFORMAT_KEY_HEIGHT, &frameHeight);
-        if(!ok){
-            qWarning() << "Asking format for frame width / height failed.";
-            return cv::Mat();
-        }
-        else{
-            qDebug() << "Setting OpenCv Buffer size" << frameWidth << "x" << frameHeight;
-            mSize = cv::Size(frameWidth, frameHeight);
+    cv::Mat colImg;
+    int64 presentationTimeUs;
+    decodeStep(std::numeric_limits<int64>::min(), colImg, presentationTimeUs);
+    return colImg;
+}
+
+bool NativeCodecReader::decodeStep(int64 convertFromUs, cv::Mat& frame, int64& presentationTimeUs, CodecFrameView* view){
+    presentationTimeUs = -1;
+
+    if(mCodec == nullptr){
+        frame = cv::Mat();
+        return false;
+    }
+
+    if(mSize.empty()){
+        updateOutputLayout();
+        if(mSize.empty()){
+            frame = cv::Mat();
+            return false;
         }
     }
 
+    // whatever the caller handed in is only storage, it goes back to the pool if no frame gets converted into it
+    cv::Mat target;
+    std::swap(target, frame);
 
 
-    if (mTrackIndex >=0) {
+
+    if (mTrackIndex >=0 && !sawInputEOS) {
 
         ssize_t bufidx;
 
-        bufidx = AMediaCodec_dequeueInputBuffer(mCodec, TIMEOUT_USEC);
+        {
+            ScopedStage stage(mProfiler, STAGE_INPUT_DEQUEUE);
+            bufidx = AMediaCodec_dequeueInputBuffer(mCodec, TIMEOUT_USEC);
+        }
         //qDebug() << "AMediaCodec_dequeueInputBuffer: " << bufidx;
 
         //ALOGV("track %d, input buffer %zd", t, bufidx);
@@ -80,54 +310,45 @@ cv::Mat NativeCodecReader::performRead(){
 
             uint8_t *buf = AMediaCodec_getInputBuffer(mCodec, bufidx, &bufsize);
             //qDebug() << "AMediaCodec_getInputBuffer size" << bufsize;
-            int sampleSize = AMediaExtractor_readSampleData(mExtractor, buf, bufsize);
+            int sampleSize;
+            {
+                ScopedStage stage(mProfiler, STAGE_EXTRACTOR_READ);
+                sampleSize = AMediaExtractor_readSampleData(mExtractor, buf, bufsize);
+            }
             //qDebug() << "AMediaExtractor_readSampleData: " << sampleSize;
             if (sampleSize < 0) {
-                sampleSize = 0;
+                // we ran out of samples, signal EOS to the codec so it hands out the frames it still holds
                 sawInputEOS = true;
                 qDebug() << "Extracting EOS";
-                return cv::Mat();
+                AMediaCodec_queueInputBuffer(mCodec, bufidx, 0, 0, 0, AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM);
             }
-
-
-            int64_t presentationTimeUs = AMediaExtractor_getSampleTime(mExtractor);
-            AMediaCodec_queueInputBuffer(mCodec, bufidx, 0, sampleSize, presentationTimeUs, sawInputEOS ? AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM : 0);
-            //qDebug() << "Pushing new input sample: " << bufidx << " @ " << presentationTimeUs;
-            bool ok = AMediaExtractor_advance(mExtractor);
-            if(!ok){
-                //qWarning() << "Unable to advance extractor";
-                // This actually happens regularly and is nothig to worry about
+            else{
+                int64_t sampleTimeUs = AMediaExtractor_getSampleTime(mExtractor);
+                AMediaCodec_queueInputBuffer(mCodec, bufidx, 0, sampleSize, sampleTimeUs, 0);
+                //qDebug() << "Pushing new input sample: " << bufidx << " @ " << sampleTimeUs;
+                bool ok = AMediaExtractor_advance(mExtractor);
+                if(!ok){
+                    //qWarning() << "Unable to advance extractor";
+                    // This actually happens regularly and is nothig to worry about
+                }
             }
         }
         else{
             qWarning() << "AMediaCodec_dequeueInputBuffer returned invalid buffer idx";
         }
-    } else {
-        qDebug() << "@@@@ no more input samples";
-        if (!sawInputEOS) {
-            // we ran out of samples without ever signaling EOS to the codec,
-            // so do that now
-            int bufidx;
-            bufidx = AMediaCodec_dequeueInputBuffer(mCodec, TIMEOUT_USEC);
-            if (bufidx >= 0) {
-                AMediaCodec_queueInputBuffer(mCodec, bufidx, 0, 0, 0, AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM);
-                sawInputEOS = true;
-                return cv::Mat();
-            }
-
-        }
-
     }
 
 
 
     // check all codecs for available data
     AMediaCodecBufferInfo info;
-    AMediaFormat *outputFormat;
     if (!sawOutputEOS) {
         int status;
 
-        status = AMediaCodec_dequeueOutputBuffer(mCodec, &info, 1);
+        {
+            ScopedStage stage(mProfiler, STAGE_OUTPUT_DEQUEUE);
+            status = AMediaCodec_dequeueOutputBuffer(mCodec, &info, 1);
+        }
 
         if (status >= 0) {
             if (info.flags & AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM) {
@@ -135,21 +356,40 @@ cv::Mat NativeCodecReader::performRead(){
                 sawOutputEOS = true;
             }
             //qDebug() << "got decoded buffer for track";
-            cv::Mat colImg;
+            bool gotFrame = false;
             if (info.size > 0) {
-                size_t bufsize;
-                uint8_t *buf = AMediaCodec_getOutputBuffer(mCodec, status, &bufsize);
-
-                //qDebug() << "Converting frame data to OpenCV::Mat (" << bufsize << ")";
-                //qDebug() << "Allocating OpenCV buffer " << mSize.width << "x" << mSize.height;
-                cv::Mat YUVframe(cv::Size(mSize.width, mSize.height*1.5), CV_8UC1);
-                colImg = cv::Mat(mSize, CV_8UC3);
-                //qDebug() << "Copying frame data";
-                memcpy(YUVframe.data, buf, bufsize);
-
-                //qDebug() << "Color conversion";
-                cv::cvtColor(YUVframe, colImg, CV_YUV2BGR_I420, 3);
-                //qDebug() << "Conversion done.";
+                gotFrame = true;
+                presentationTimeUs = info.presentationTimeUs;
+                mLastPresentationTimeUs = info.presentationTimeUs;
+                mDecoderPresentationTimeUs = info.presentationTimeUs;
+                // frames we are only decoding to get to another one are not worth a color conversion
+                if(view != nullptr){
+                    // no conversion at all, the view keeps the buffer until it is released
+                    size_t bufsize;
+                    uint8_t *buf = AMediaCodec_getOutputBuffer(mCodec, status, &bufsize);
+                    YUVPlanes planes;
+                    if(buf != nullptr && yuvResolvePlanes(buf + info.offset, bufsize - info.offset, mOutputLayout, planes)
+                            && (mOutputRegion.area() <= 0 || yuvCropPlanes(planes, mOutputRegion.x, mOutputRegion.y, mOutputRegion.width, mOutputRegion.height))){
+                        view->release();
+                        view->image = cv::Mat(planes.height, planes.width, CV_8UC1, planes.y, planes.yStride);
+                        view->presentationTimeUs = info.presentationTimeUs;
+                        view->mCodec = mCodec;
+                        view->mBufferIndex = status;
+                        view->mBufferToken = mBufferToken;
+                        mFramePool->recycle(target);
+                        return true;
+                    }
+                    qWarning() << "Decoded buffer of size" << bufsize << "does not match the output format";
+                }
+                else if(info.presentationTimeUs >= convertFromUs){
+                    size_t bufsize;
+                    uint8_t *buf = AMediaCodec_getOutputBuffer(mCodec, status, &bufsize);
+                    std::swap(frame, target);
+                    convertOutputBuffer(buf, bufsize, info, frame);
+                    if(!frame.empty() && mFrameCache.enabled() && !mIndex.empty()){
+                        mFrameCache.insert(mIndex.frameAt(info.presentationTimeUs), frame);
+                    }
+                }
                 // right here we have the raw frame data available!
 
 
@@ -157,7 +397,8 @@ cv::Mat NativeCodecReader::performRead(){
                 //sizes.add(adler);
             }
             AMediaCodec_releaseOutputBuffer(mCodec, status, false);
-            return colImg;
+            mFramePool->recycle(target);
+            return gotFrame;
         } else if (status == AMEDIACODEC_INFO_OUTPUT_BUFFERS_CHANGED) {
             qDebug() << "output buffers changed";
         } else if (status == AMEDIACODEC_INFO_OUTPUT_FORMAT_CHANGED) {
@@ -167,10 +408,7 @@ cv::Mat NativeCodecReader::performRead(){
 
             mFormat = AMediaCodec_getOutputFormat(mCodec);
             qDebug() << "format changed " << AMediaFormat_toString(mFormat);
-
-            //int colorCode = -1;
-            //AMediaFormat_getInt32(mFormat, AMEDIAFORMAT_KEY_COLOR_FORMAT, &colorCode);
-            //qDebug() << "Color code was: " << colorCode;
+            updateOutputLayout();
 
         } else if (status == AMEDIACODEC_INFO_TRY_AGAIN_LATER) {
             qWarning() << "no output buffer right now";
@@ -182,174 +420,1268 @@ cv::Mat NativeCodecReader::performRead(){
     }
 
 
-    return cv::Mat();
+    return false;
+}
+
+
+
+bool NativeCodecReader::convertOutputBuffer(uint8_t* buf, size_t bufsize, const AMediaCodecBufferInfo& info, cv::Mat& frame, const cv::Size& requestedSize){
+    // Convert straight out of the codec buffer, the output format tells us about stride / padding / crop
+    YUVFrameLayout layout;
+    {
+        std::lock_guard<std::mutex> lock(mFormatMutex);
+        layout = mOutputLayout;
+    }
+    YUVPlanes planes;
+    if(buf == nullptr || !yuvResolvePlanes(buf + info.offset, bufsize - info.offset, layout, planes)){
+        qWarning() << "Decoded buffer of size" << bufsize << "does not match the output format";
+        frame = cv::Mat();
+        return false;
+    }
+    if(mOutputRegion.area() > 0 && !yuvCropPlanes(planes, mOutputRegion.x, mOutputRegion.y, mOutputRegion.width, mOutputRegion.height)){
+        qWarning() << "Output region lies outside of the decoded frame";
+        frame = cv::Mat();
+        return false;
+    }
+
+    const cv::Size size = requestedSize.area() > 0 ? requestedSize : (mOutputSize.area() > 0 ? mOutputSize : cv::Size(planes.width, planes.height));
+    const int type = mOutputFormat == FRAME_FORMAT_GRAY ? CV_8UC1 : CV_8UC3;
+    if(frame.size() != size || frame.type() != type || !mFramePool->isWritable(frame)){
+        mFramePool->recycle(frame);
+        frame = mFramePool->acquire(size, type);
+    }
+
+    ScopedStage stage(mProfiler, STAGE_CONVERSION);
+    if(mOutputFormat == FRAME_FORMAT_GRAY){
+        yuv420ToGrayScaled(planes, frame.data, frame.step, size.width, size.height);
+    }
+    else{
+        yuv420ToBGRScaled(planes, frame.data, frame.step, size.width, size.height);
+    }
+    return true;
+}
+
+void NativeCodecReader::flushDecoder(){
+    //For decoders that do not support adaptive playback (including when not decoding onto a Surface)
+    // In order to start decoding data that is not adjacent to previously submitted data (i.e. after a seek) you MUST flush the decoder.
+    AMediaCodec_flush(mCodec);
+    mBufferToken = std::make_shared<int>(0);
+    sawInputEOS = false;
+    sawOutputEOS = false;
+    mDecoderPresentationTimeUs = -1;
+}
+
+
+
+bool NativeCodecReader::prepareDecoder(){
+    mCodec = nullptr;
+    mExtractor = AMediaExtractor_new();
+    mTotalTimeBuffer = -1;
+    if(mExtractor == nullptr){
+        qWarning() << "Unable to get a media extractor!";
+        return false;
+    }
+
+    //PsshInfo* info = AMediaExtractor_getPsshInfo(mExtractor);
+    media_status_t status = mSource.attach(mExtractor);
+    if(status != AMEDIA_OK){
+        qWarning() << "Unable to set" << mSource.description() << "as data source:" << status;
+        return false;
+    }
+
+    int numtracks = AMediaExtractor_getTrackCount(mExtractor);
+    if(numtracks != 1){
+        qWarning() << "Strange number of tracks";
+    }
+    mTrackIndex = 0;
+
+    sawInputEOS = false;
+    sawOutputEOS = false;
+
+
+    mFormat = AMediaExtractor_getTrackFormat(mExtractor, mTrackIndex);
+    if(mFormat == nullptr){
+        qWarning() << "No track format in" << mSource.description();
+        return false;
+    }
+    qDebug() << "Media format detected: " << AMediaFormat_toString(mFormat);
+
+    // find out the video duration here (it is not possible later on!)
+    int64_t durationUs = -1;
+    if(AMediaFormat_getInt64(mFormat, AMEDIAFORMAT_KEY_DURATION, &durationUs)){
+        mTotalTimeBuffer = durationUs / 1000;
+    }
+
+
+    const char *mime;
+    if (!AMediaFormat_getString(mFormat, AMEDIAFORMAT_KEY_MIME, &mime)) {
+        qWarning() << "Mime type cannot be determined!";
+    } else
+        if (!strncmp(mime, "video/", 6)) {
+            createDecoder(mime);
+            sawInputEOS = false;
+            sawOutputEOS = false;
+        } else {
+            qWarning() << "expected audio or video mime type, got "<< mime;
+
+        }
+
+    qDebug() << (mCodec != nullptr ? "Decoder ready!" : "No decoder!");
+    return true;
+}
+
+void NativeCodecReader::createDecoder(const char* mime){
+    mCodec = nullptr;
+    if(!mDecoderConfig.codecName.empty()){
+        mCodec = AMediaCodec_createCodecByName(mDecoderConfig.codecName.c_str());
+        if(mCodec == nullptr){
+            qWarning() << "Unable to create decoder" << mDecoderConfig.codecName.c_str() << ", falling back to the default one for" << mime;
+        }
+    }
+    else if(mDecoderConfig.software){
+        for(const auto& decoders : SOFTWARE_DECODERS){
+            if(strcmp(decoders.mime, mime) != 0){
+                continue;
+            }
+            for(const char* name : decoders.names){
+                mCodec = AMediaCodec_createCodecByName(name);
+                if(mCodec != nullptr){
+                    break;
+                }
+            }
+        }
+        if(mCodec == nullptr){
+            // the default one would most likely take a hardware instance that whoever asked for software counts on being free
+            qWarning() << "No software decoder for" << mime;
+            return;
+        }
+    }
+    if(mCodec == nullptr){
+        mCodec = AMediaCodec_createDecoderByType(mime);
+    }
+    if(mCodec == nullptr){
+        qWarning() << "Unable to create a decoder for" << mime;
+        return;
+    }
+
+    media_status_t err = AMediaCodec_configure(mCodec, mFormat, nullptr /* surface */, nullptr /* crypto */, 0);
+    if(err == AMEDIA_OK){
+        err = AMediaCodec_start(mCodec);
+    }
+    if(err != AMEDIA_OK){
+        // out of hardware resources usually shows here rather than on creation
+        qWarning() << "Unable to start the decoder for" << mime << ":" << err;
+        AMediaCodec_delete(mCodec);
+        mCodec = nullptr;
+    }
+}
+
+
+
+void NativeCodecReader::loadSampleIndex(){
+    // only whole files have a path and modification time to key the cache by
+    if(mSource.isPlainFile() && mIndex.load(mSource.path(), mTrackIndex)){
+        qDebug() << "Loaded cached sample index with" << mIndex.frameCount() << "frames";
+    }
+    else{
+        int32_t maxInputSize = 0;
+        if(!AMediaFormat_getInt32(mFormat, AMEDIAFORMAT_KEY_MAX_INPUT_SIZE, &maxInputSize) || maxInputSize <= 0){
+            maxInputSize = 4 * 1024 * 1024;
+        }
+        std::lock_guard<std::mutex> lock(mExtractorMutex);
+        if(mIndex.build(mExtractor, maxInputSize)){
+            if(mSource.isPlainFile()){
+                mIndex.save(mSource.path(), mTrackIndex);
+            }
+        }
+        else{
+            qWarning() << "Unable to index samples, frame numbers are estimated from" << dst_fps << "fps";
+        }
+    }
+
+    if(!mIndex.empty()){
+        mTotalTimeBuffer = mIndex.durationUs() / 1000;
+    }
+}
+
+void NativeCodecReader::updateOutputLayout(){
+    std::lock_guard<std::mutex> lock(mFormatMutex);
+    YUVFrameLayout layout;
+    bool ok = AMediaFormat_getInt32(mFormat, AMEDIAFORMAT_KEY_WIDTH, &layout.width);
+    ok = ok && AMediaFormat_getInt32(mFormat, AMEDIAFORMAT_KEY_HEIGHT, &layout.height);
+    if(!ok){
+        qWarning() << "Asking format for frame width / height failed.";
+        return;
+    }
+
+    if(!AMediaFormat_getInt32(mFormat, AMEDIAFORMAT_KEY_STRIDE, &layout.stride)){
+        layout.stride = layout.width;
+    }
+    if(!AMediaFormat_getInt32(mFormat, KEY_SLICE_HEIGHT, &layout.sliceHeight)){
+        layout.sliceHeight = layout.height;
+    }
+
+    bool hasCrop = false;
+#if __ANDROID_API__ >= 28
+    hasCrop = AMediaFormat_getRect(mFormat, AMEDIAFORMAT_KEY_DISPLAY_CROP, &layout.cropLeft, &layout.cropTop, &layout.cropRight, &layout.cropBottom);
+#endif
+    if(!hasCrop){
+        hasCrop = AMediaFormat_getInt32(mFormat, KEY_CROP_LEFT, &layout.cropLeft);
+        hasCrop = hasCrop && AMediaFormat_getInt32(mFormat, KEY_CROP_TOP, &layout.cropTop);
+        hasCrop = hasCrop && AMediaFormat_getInt32(mFormat, KEY_CROP_RIGHT, &layout.cropRight);
+        hasCrop = hasCrop && AMediaFormat_getInt32(mFormat, KEY_CROP_BOTTOM, &layout.cropBottom);
+    }
+    if(!hasCrop){
+        layout.cropLeft = 0;
+        layout.cropTop = 0;
+        layout.cropRight = layout.width - 1;
+        layout.cropBottom = layout.height - 1;
+    }
+
+    // Without a color format we stay with what we always assumed: tightly packed I420
+    int colorFormat = 19;
+    AMediaFormat_getInt32(mFormat, AMEDIAFORMAT_KEY_COLOR_FORMAT, &colorFormat);
+    if(!yuvLayoutFromColorFormat(colorFormat, layout.layout)){
+        qWarning() << "Unsupported decoder color format" << colorFormat << "- treating it as NV12";
+        layout.layout = YUV_LAYOUT_NV12;
+    }
+
+    mOutputLayout = layout;
+    mSize = cv::Size(std::min(layout.cropWidth(), layout.width), std::min(layout.cropHeight(), layout.height));
+    qDebug() << "Decoder output" << mSize.width << "x" << mSize.height << "stride" << layout.stride << "slice height" << layout.sliceHeight << "color format" << colorFormat;
+}
+
+/**
+     * Releases decoder resources.  May be called after partial / failed initialization.
+     */
+void NativeCodecReader::releaseDecoder() {
+    qDebug() << "releasing encoder objects";
+    mBufferToken.reset();
+    if (mCodec != nullptr) {
+        AMediaCodec_stop(mCodec);
+        AMediaCodec_delete(mCodec);
+        mCodec = nullptr;
+    }
+    /*
+    if (mInputSurface != null) {
+    mInputSurface.release();
+    mInputSurface = null;
+    }
+    */
+    if (mExtractor != nullptr) {
+        AMediaExtractor_delete(mExtractor);
+        mExtractor = nullptr;
+    }
+}
+
+int64 NativeCodecReader::nFrames(){
+    if(!mIndex.empty()){
+        return mIndex.frameCount();
+    }
+    return totalTime() * dst_fps / 1000;
+
+}
+
+int64 NativeCodecReader::currentFrame(){
+    if(!mIndex.empty()){
+        // the frame the next read() is going to return
+        return mLastPresentationTimeUs < 0 ? 0 : mIndex.frameAt(mLastPresentationTimeUs) + 1;
+    }
+    return currentTime() * dst_fps / 1000;
+}
+
+double NativeCodecReader::fps(){
+    double indexFps = mIndex.averageFps();
+    return indexFps > 0 ? indexFps : dst_fps;
+}
+
+int64 NativeCodecReader::currentTime(){
+    if(mExtractor == nullptr){
+        return -1;
+    }
+    std::lock_guard<std::mutex> lock(mExtractorMutex);
+    int64 time = AMediaExtractor_getSampleTime(mExtractor);
+    return time / 1000;
+}
+
+int64 NativeCodecReader::totalTime(){
+
+
+    return mTotalTimeBuffer;
+
+}
+
+bool NativeCodecReader::seek(cv::Mat& mat, int64 frameNumber){
+    if(mAsync){
+        qWarning() << "Seeking is not supported in asynchronous mode";
+        mat = cv::Mat();
+        return false;
+    }
+    if(mCodec == nullptr){
+        mat = cv::Mat();
+        return false;
+    }
+
+    if(mIndex.empty()){
+        // No idea where the sync frames are, let the extractor pick one and take whatever comes next
+        int64 pos = frame2Time(frameNumber);
+        AMediaExtractor_seekTo(mExtractor, pos, SeekMode::AMEDIAEXTRACTOR_SEEK_CLOSEST_SYNC);
+        flushDecoder();
+        return read(mat);
+    }
+
+    frameNumber = std::max<int64>(0, std::min<int64>(frameNumber, nFrames() - 1));
+    const int64 targetUs = mIndex.frameTime(frameNumber);
+    const int64 previousFrame = currentFrame() - 1;
+
+    if(mFrameCache.enabled() && mFrameCache.lookup(frameNumber, mat)){
+        mLastPresentationTimeUs = targetUs;
+        return true;
+    }
+
+    const int64 syncFrame = mIndex.syncFrameBefore(frameNumber);
+    const int64 decoderFrame = mDecoderPresentationTimeUs < 0 ? 0 : mIndex.frameAt(mDecoderPresentationTimeUs) + 1;
+
+    // As long as no sync frame lies between the decoder's position and the target, decoding on is cheaper than seeking + flushing.
+    bool decodeOn = !sawOutputEOS && decoderFrame <= frameNumber && syncFrame <= decoderFrame;
+    if(!decodeOn){
+        AMediaExtractor_seekTo(mExtractor, mIndex.frameTime(syncFrame), SeekMode::AMEDIAEXTRACTOR_SEEK_PREVIOUS_SYNC);
+        flushDecoder();
+    }
+
+    // Scrubbing around the previous frame: we are decoding this GOP anyway, so convert and cache all of it
+    // as long as it takes no more than half of the cache.
+    const int64 gopEnd = mIndex.syncFrameAfter(frameNumber);
+    const size_t channels = mOutputFormat == FRAME_FORMAT_GRAY ? 1 : 3;
+    const size_t gopBytes = static_cast<size_t>(outputSize().area()) * channels * static_cast<size_t>(gopEnd - syncFrame);
+    const bool prefetch = !decodeOn && mFrameCache.enabled() && std::abs(frameNumber - previousFrame) <= PREFETCH_DISTANCE
+            && gopBytes <= mFrameCache.budget() / 2;
+    const int64 convertFromUs = prefetch ? mIndex.frameTime(syncFrame) : targetUs;
+    const int64 decodeUntilUs = prefetch ? mIndex.frameTime(gopEnd - 1) : targetUs;
+
+    // Decode up to the target (or the end of its GOP), frames before convertFromUs are not converted.
+    // The caller's frame is the storage for the first conversion.
+    cv::Mat frame;
+    std::swap(frame, mat);
+    int idleSteps = 0;
+    while(idleSteps < MAX_IDLE_STEPS){
+        int64 presentationTimeUs;
+        if(decodeStep(convertFromUs, frame, presentationTimeUs)){
+            if(presentationTimeUs >= targetUs && mat.empty()){
+                mat = frame;
+            }
+            if(presentationTimeUs >= decodeUntilUs){
+                break;
+            }
+            idleSteps = 0;
+        }
+        else if(sawOutputEOS){
+            break;
+        }
+        else{
+            idleSteps++;
+        }
+    }
+
+    if(mat.empty()){
+        qWarning() << "Unable to decode frame" << frameNumber;
+        return false;
+    }
+    mLastPresentationTimeUs = targetUs;
+    return true;
+}
+
+bool NativeCodecReader::readThumbnails(int count, const cv::Size& size, std::vector<DecodedFrame>& thumbnails){
+    thumbnails.clear();
+    if(mAsync){
+        qWarning() << "Thumbnails are only available for pull-style decoding";
+        return false;
+    }
+    if(mCodec == nullptr || mIndex.empty() || count <= 0 || size.width <= 0){
+        qWarning() << "No thumbnails without a decoder, a sample index and a size";
+        return false;
+    }
+    if(mSize.empty()){
+        updateOutputLayout();
+    }
+
+    cv::Size thumbnailSize = size;
+    const cv::Size fullSize = outputSize();
+    if(thumbnailSize.height <= 0 && fullSize.width > 0){
+        thumbnailSize.height = std::max(1, static_cast<int>(std::lround(static_cast<double>(size.width) * fullSize.height / fullSize.width)));
+    }
+
+    // the sync frame closest to the middle of each stretch, each one only once
+    std::vector<int64> syncFrames;
+    const int64 firstUs = mIndex.frameTime(0);
+    const int64 durationUs = mIndex.durationUs();
+    for(int i = 0; i < count; i++){
+        const int64 frame = mIndex.frameAt(firstUs + durationUs * (2 * i + 1) / (2 * count));
+        const int64 before = mIndex.syncFrameBefore(frame);
+        const int64 after = mIndex.syncFrameAfter(frame);
+        const int64 sync = after < mIndex.frameCount() && after - frame < frame - before ? after : before;
+        if(syncFrames.empty() || syncFrames.back() < sync){
+            syncFrames.push_back(sync);
+        }
+    }
+
+    const int64 resumeFrame = currentFrame();
+
+    // Sync frames decode on their own, so they can follow each other without a flush. Only the extractor jumps, which is cheap.
+    flushDecoder();
+    size_t fed = 0;
+    int idleSteps = 0;
+    std::chrono::steady_clock::time_point drainDeadline;
+    while(!sawOutputEOS){
+        if(sawInputEOS ? std::chrono::steady_clock::now() >= drainDeadline : idleSteps >= MAX_IDLE_STEPS){
+            break;
+        }
+        bool progress = false;
+        if(!sawInputEOS){
+            ssize_t bufidx;
+            {
+                ScopedStage stage(mProfiler, STAGE_INPUT_DEQUEUE);
+                bufidx = AMediaCodec_dequeueInputBuffer(mCodec, TIMEOUT_USEC);
+            }
+            if(bufidx >= 0){
+                size_t bufsize;
+                uint8_t* buf = AMediaCodec_getInputBuffer(mCodec, bufidx, &bufsize);
+                ssize_t sampleSize = -1;
+                int64 sampleTimeUs = 0;
+                if(fed < syncFrames.size()){
+                    ScopedStage stage(mProfiler, STAGE_EXTRACTOR_READ);
+                    AMediaExtractor_seekTo(mExtractor, mIndex.frameTime(syncFrames[fed]), SeekMode::AMEDIAEXTRACTOR_SEEK_PREVIOUS_SYNC);
+                    sampleSize = AMediaExtractor_readSampleData(mExtractor, buf, bufsize);
+                    sampleTimeUs = AMediaExtractor_getSampleTime(mExtractor);
+                    fed++;
+                }
+                if(sampleSize < 0){
+                    // all sync samples are in, the end of stream makes the decoder hand out the frames it still holds
+                    sawInputEOS = true;
+                    AMediaCodec_queueInputBuffer(mCodec, bufidx, 0, 0, 0, AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM);
+                    drainDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(DRAIN_TIMEOUT_MS);
+                }
+                else{
+                    AMediaCodec_queueInputBuffer(mCodec, bufidx, 0, sampleSize, sampleTimeUs, 0);
+                }
+                progress = true;
+            }
+        }
+
+        AMediaCodecBufferInfo info;
+        ssize_t status;
+        {
+            ScopedStage stage(mProfiler, STAGE_OUTPUT_DEQUEUE);
+            // while feeding only peek, once everything is in the decoder has nothing else to do than hand out frames
+            status = AMediaCodec_dequeueOutputBuffer(mCodec, &info, sawInputEOS ? TIMEOUT_USEC : 1);
+        }
+        if(status >= 0){
+            if(info.flags & AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM){
+                sawOutputEOS = true;
+            }
+            if(info.size > 0){
+                size_t bufsize;
+                uint8_t* buf = AMediaCodec_getOutputBuffer(mCodec, status, &bufsize);
+                DecodedFrame thumbnail;
+                if(convertOutputBuffer(buf, bufsize, info, thumbnail.image, thumbnailSize)){
+                    thumbnail.presentationTimeUs = info.presentationTimeUs;
+                    thumbnails.push_back(thumbnail);
+                }
+            }
+            AMediaCodec_releaseOutputBuffer(mCodec, status, false);
+            progress = true;
+        }
+        else if(status == AMEDIACODEC_INFO_OUTPUT_FORMAT_CHANGED){
+            if(mFormat != nullptr){
+                AMediaFormat_delete(mFormat);
+            }
+            mFormat = AMediaCodec_getOutputFormat(mCodec);
+            updateOutputLayout();
+            progress = true;
+        }
+        idleSteps = progress ? 0 : idleSteps + 1;
+    }
+    if(thumbnails.size() < syncFrames.size()){
+        qWarning() << "Decoded" << thumbnails.size() << "of" << syncFrames.size() << "thumbnails";
+    }
+
+    // back to where the caller was, the next read() returns resumeFrame
+    AMediaExtractor_seekTo(mExtractor, 0, SeekMode::AMEDIAEXTRACTOR_SEEK_PREVIOUS_SYNC);
+    flushDecoder();
+    mLastPresentationTimeUs = -1;
+    if(resumeFrame > 0){
+        cv::Mat previous;
+        if(!seek(previous, resumeFrame - 1)){
+            qWarning() << "Could not return to frame" << resumeFrame << "after the thumbnails";
+        }
+    }
+    return !thumbnails.empty();
+}
+
+bool NativeCodecReader::read(cv::Mat& mat){
+    if(mAsync){
+        DecodedFrame frame;
+        if(mFrameQueue->pop(frame, ASYNC_READ_TIMEOUT_MS)){
+            mat = frame.image;
+            mLastPresentationTimeUs = frame.presentationTimeUs;
+        }
+        else{
+            mat = cv::Mat();
+        }
+        return !mat.empty();
+    }
+    if(mFrameCache.enabled() && !mIndex.empty()){
+        const int64 next = currentFrame();
+        if(next >= nFrames()){
+            mat = cv::Mat();
+            return false;
+        }
+        if(mFrameCache.lookup(next, mat)){
+            mLastPresentationTimeUs = mIndex.frameTime(next);
+            return true;
+        }
+        // after cache hits the decoder is somewhere else
+        const int64 decoderFrame = mDecoderPresentationTimeUs < 0 ? 0 : mIndex.frameAt(mDecoderPresentationTimeUs) + 1;
+        if(decoderFrame != next){
+            return seek(mat, next);
+        }
+    }
+    int64 presentationTimeUs;
+    decodeStep(std::numeric_limits<int64>::min(), mat, presentationTimeUs);
+    return !mat.empty();
+}
+
+void NativeCodecReader::setFramePool(std::shared_ptr<FramePool> pool){
+    mFramePool = pool ? pool : std::make_shared<FramePool>();
+}
+
+bool NativeCodecReader::readLumaView(CodecFrameView& view){
+    view.release();
+    if(mAsync){
+        qWarning() << "Luma views are only available for pull-style decoding";
+        return false;
+    }
+    cv::Mat frame;
+    int64 presentationTimeUs;
+    decodeStep(std::numeric_limits<int64>::min(), frame, presentationTimeUs, &view);
+    return view.valid();
+}
+
+void NativeCodecReader::setOutputFormat(FrameFormat format){
+    if(format != mOutputFormat){
+        mOutputFormat = format;
+        mFrameCache.clear();
+    }
+}
+
+void NativeCodecReader::setOutputRegion(const cv::Rect& region){
+    mOutputRegion = region;
+    mFrameCache.clear();
+}
+
+void NativeCodecReader::setOutputSize(const cv::Size& size){
+    mOutputSize = size;
+    mFrameCache.clear();
+}
+
+cv::Size NativeCodecReader::outputSize() const{
+    if(mOutputSize.area() > 0){
+        return mOutputSize;
+    }
+    std::lock_guard<std::mutex> lock(mFormatMutex);
+    if(mOutputRegion.area() > 0){
+        cv::Rect region(mOutputRegion.x & ~1, mOutputRegion.y & ~1, mOutputRegion.width, mOutputRegion.height);
+        return (region & cv::Rect(cv::Point(0, 0), mSize)).size();
+    }
+    return mSize;
+}
+
+void NativeCodecReader::setFrameCache(size_t budgetBytes){
+    mFrameCache.setBudget(budgetBytes);
+}
+
+bool NativeCodecReader::startAsync(size_t queueCapacity, BackpressurePolicy policy, FrameCallback callback){
+#if __ANDROID_API__ >= 28
+    if(mAsync){
+        qWarning() << "Asynchronous decoding has already been started";
+        return false;
+    }
+    if(mCodec == nullptr || mExtractor == nullptr){
+        qWarning() << "No decoder to run asynchronously";
+        return false;
+    }
+
+    mFrameQueue.reset(new BoundedFrameQueue<DecodedFrame>(queueCapacity, policy));
+    mFrameCallback = callback;
+
+    // The callback can only be installed on a codec that is not configured, so we go through stop / configure / start again.
+    // Stopping takes the output buffers away, outstanding CodecFrameViews must not touch them anymore.
+    mBufferToken = std::make_shared<int>(0);
+    AMediaCodec_stop(mCodec);
+
+    AMediaCodecOnAsyncNotifyCallback handlers;
+    handlers.onAsyncInputAvailable = &NativeCodecReader::onAsyncInputAvailable;
+    handlers.onAsyncOutputAvailable = &NativeCodecReader::onAsyncOutputAvailable;
+    handlers.onAsyncFormatChanged = &NativeCodecReader::onAsyncFormatChanged;
+    handlers.onAsyncError = &NativeCodecReader::onAsyncError;
+    media_status_t err = AMediaCodec_setAsyncNotifyCallback(mCodec, handlers, this);
+    if(err != AMEDIA_OK){
+        qWarning() << "AMediaCodec_setAsyncNotifyCallback failed: " << err;
+    }
+
+    AMediaFormat* trackFormat = AMediaExtractor_getTrackFormat(mExtractor, mTrackIndex);
+    media_status_t configured = AMediaCodec_configure(mCodec, trackFormat, nullptr /* surface */, nullptr /* crypto */, 0);
+    AMediaFormat_delete(trackFormat);
+    if(configured != AMEDIA_OK){
+        qWarning() << "Error occurred: " << configured;
+        return false;
+    }
+
+    mAsync = (err == AMEDIA_OK);
+    mAsyncRunning = mAsync;
+    sawInputEOS = false;
+    sawOutputEOS = false;
+
+    // Callbacks start firing right away
+    configured = AMediaCodec_start(mCodec);
+    if(configured != AMEDIA_OK){
+        qWarning() << "Error occurred: " << configured;
+        mAsyncRunning = false;
+    }
+    return mAsync && mAsyncRunning;
+#else
+    Q_UNUSED(queueCapacity);
+    Q_UNUSED(policy);
+    Q_UNUSED(callback);
+    qWarning() << "Asynchronous decoding needs API 28";
+    return false;
+#endif
+}
+
+void NativeCodecReader::stopAsync(){
+    if(!mAsync || !mAsyncRunning){
+        return;
+    }
+    mAsyncRunning = false;
+    // wakes up an output callback waiting for room in the queue
+    mFrameQueue->close();
+    AMediaCodec_stop(mCodec);
+}
+
+uint64_t NativeCodecReader::droppedFrames() const{
+    return mFrameQueue ? mFrameQueue->dropped() : 0;
+}
+
+void NativeCodecReader::onAsyncInputAvailable(AMediaCodec* codec, void* userdata, int32_t index){
+    NativeCodecReader* reader = static_cast<NativeCodecReader*>(userdata);
+    if(!reader->mAsyncRunning || reader->sawInputEOS){
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(reader->mExtractorMutex);
+    size_t bufsize;
+    uint8_t* buf = AMediaCodec_getInputBuffer(codec, index, &bufsize);
+    ssize_t sampleSize;
+    {
+        ScopedStage stage(reader->mProfiler, STAGE_EXTRACTOR_READ);
+        sampleSize = AMediaExtractor_readSampleData(reader->mExtractor, buf, bufsize);
+    }
+    if(sampleSize < 0){
+        qDebug() << "Extracting EOS";
+        reader->sawInputEOS = true;
+        AMediaCodec_queueInputBuffer(codec, index, 0, 0, 0, AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM);
+        return;
+    }
+
+    int64_t presentationTimeUs = AMediaExtractor_getSampleTime(reader->mExtractor);
+    AMediaCodec_queueInputBuffer(codec, index, 0, sampleSize, presentationTimeUs, 0);
+    AMediaExtractor_advance(reader->mExtractor);
+}
+
+void NativeCodecReader::onAsyncOutputAvailable(AMediaCodec* codec, void* userdata, int32_t index, AMediaCodecBufferInfo* info){
+    NativeCodecReader* reader = static_cast<NativeCodecReader*>(userdata);
+
+    DecodedFrame frame;
+    if(reader->mAsyncRunning && info->size > 0){
+        size_t bufsize;
+        uint8_t* buf = AMediaCodec_getOutputBuffer(codec, index, &bufsize);
+        reader->convertOutputBuffer(buf, bufsize, *info, frame.image);
+        frame.presentationTimeUs = info->presentationTimeUs;
+    }
+    // hand the buffer back before we possibly wait for the consumer
+    AMediaCodec_releaseOutputBuffer(codec, index, false);
+
+    if(!frame.image.empty()){
+        if(reader->mFrameCallback){
+            reader->mFrameCallback(frame.image, frame.presentationTimeUs);
+        }
+        else if(reader->mFrameQueue->push(frame)){
+            reader->mProfiler.recordQueueDepth(reader->mFrameQueue->size());
+            emit reader->frameAvailable();
+        }
+    }
+
+    if(info->flags & AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM){
+        qDebug() << "EOS on track";
+        reader->sawOutputEOS = true;
+        reader->mFrameQueue->close();
+        emit reader->decodingFinished();
+    }
+}
+
+void NativeCodecReader::onAsyncFormatChanged(AMediaCodec* codec, void* userdata, AMediaFormat* format){
+    Q_UNUSED(format);
+    NativeCodecReader* reader = static_cast<NativeCodecReader*>(userdata);
+    // take our own copy instead of holding on to the callback's argument
+    AMediaFormat* outputFormat = AMediaCodec_getOutputFormat(codec);
+    qDebug() << "format changed " << AMediaFormat_toString(outputFormat);
+    {
+        std::lock_guard<std::mutex> lock(reader->mFormatMutex);
+        std::swap(reader->mFormat, outputFormat);
+    }
+    if(outputFormat != nullptr){
+        AMediaFormat_delete(outputFormat);
+    }
+    reader->updateOutputLayout();
+}
+
+void NativeCodecReader::onAsyncError(AMediaCodec* codec, void* userdata, media_status_t error, int32_t actionCode, const char* detail){
+    Q_UNUSED(codec);
+    Q_UNUSED(userdata);
+    qWarning() << "Asynchronous decoder error" << error << "action" << actionCode << detail;
+}
+
+int64 NativeCodecReader::frame2Time(int64 frameNo){
+    if(!mIndex.empty()){
+        return mIndex.frameTime(frameNo);
+    }
+    return (frameNo*1000000)/dst_fps;
+}
+
+
+
+NativeCodecWriter::NativeCodecWriter(QString filename, const int fps, const cv::Size& size, const EncoderConfig& config)
+    :QObject(nullptr),
+      mFilename(filename),
+      mFPS(fps),
+      mSize(size),
+      mConfig(config),
+      mColorFormat(21), // #21 COLOR_FormatYUV420SemiPlanar (NV12)
+      isRunning(false),
+      mTimestampMode(TIMESTAMP_FRAME_COUNTER),
+      mTicksPerSecond(1000000),
+      mFirstTimestamp(-1),
+      mLastPresentationTimeUs(-1),
+      mDuplicateThreshold(-1),
+      mMaxSkipped(30),
+      mSkippedInRow(0),
+      mSkippedFrames(0),
+      mLastSkippedTimestamp(-1),
+      mBitrate(config.bitrate),
+      mRequestedBitrate(-1),
+      mManualBitrate(-1),
+      mSyncFrameRequested(false),
+      mAdaptiveBitrate(false),
+      mMinBitrate(0),
+      mMaxBitrate(0),
+      mDroppedSeen(0),
+      mBusyUs(0),
+      mOutputFormat(nullptr),
+      mSegmentDurationUs(0),
+      mSegmentBytes(0),
+      mSegmentIndex(0),
+      mSegmentStartUs(-1),
+      mSegmentLastUs(-1),
+      mSegmentWrittenBytes(0),
+      mSegmentFrameDeltaUs(-1),
+      mSegmentFull(false),
+      mQueueCapacity(4),
+      mQueuePolicy(BACKPRESSURE_BLOCK),
+      mEncoderDroppedFrames(0),
+      mSpareInputBuffer(-1),
+      mFramePool(std::make_shared<FramePool>()),
+      mEndRequested(false),
+      mMuxerFailed(false),
+      mFinishTimeoutMs(DEFAULT_FINISH_TIMEOUT_MS),
+      mTailFrames(0)
+{
+}
+
+NativeCodecWriter::~NativeCodecWriter(){
+    if(isRunning && !mEndRequested){
+        // nobody ended the recording, finish the file rather than leave it without an index
+        end();
+    }
+    stopEncodingThread();
+    if(isRunning && !mEncodingThread.joinable()){
+        // the encoding thread gave up without finishing
+        releaseEncoder();
+    }
+}
+
+void NativeCodecWriter::setQueue(size_t capacity, BackpressurePolicy policy){
+    if(isRunning){
+        qWarning() << "The frame queue cannot be changed while recording";
+        return;
+    }
+    mQueueCapacity = capacity;
+    mQueuePolicy = policy;
+}
+
+void NativeCodecWriter::setFramePool(std::shared_ptr<FramePool> pool){
+    if(isRunning){
+        qWarning() << "Cannot change the frame pool of a running encoder";
+        return;
+    }
+    mFramePool = pool ? pool : std::make_shared<FramePool>();
+}
+
+uint64_t NativeCodecWriter::droppedFrames() const{
+    return (mFrameQueue ? mFrameQueue->dropped() : 0) + mEncoderDroppedFrames;
+}
+
+size_t NativeCodecWriter::queuedFrames() const{
+    return mFrameQueue ? mFrameQueue->size() : 0;
+}
+
+void NativeCodecWriter::setTimestampMode(TimestampMode mode, long long ticksPerSecond){
+    if(isRunning){
+        qWarning() << "The timestamp mode cannot be changed while recording";
+        return;
+    }
+    if(ticksPerSecond <= 0){
+        qWarning() << "Invalid timestamp rate" << ticksPerSecond;
+        return;
+    }
+    mTimestampMode = mode;
+    mTicksPerSecond = ticksPerSecond;
+}
+
+void NativeCodecWriter::setSkipDuplicates(double maxMeanDifference, int maxSkipped){
+    mDuplicateThreshold = maxMeanDifference;
+    mMaxSkipped = std::max(maxSkipped, 0);
+}
+
+bool NativeCodecWriter::setBitrate(int bitsPerSecond){
+#if __ANDROID_API__ >= 26
+    if(!isRunning || bitsPerSecond <= 0){
+        return false;
+    }
+    mManualBitrate = bitsPerSecond;
+    return true;
+#else
+    qWarning() << "Changing the bitrate of a running encoder needs API 26";
+    return false;
+#endif
+}
+
+bool NativeCodecWriter::requestSyncFrame(){
+#if __ANDROID_API__ >= 26
+    if(!isRunning){
+        return false;
+    }
+    mSyncFrameRequested = true;
+    return true;
+#else
+    qWarning() << "Requesting a sync frame needs API 26";
+    return false;
+#endif
+}
+
+void NativeCodecWriter::setAdaptiveBitrate(bool enabled, int minBitrate, int maxBitrate){
+    if(isRunning){
+        qWarning() << "The adaptive bitrate cannot be changed while recording";
+        return;
+    }
+#if __ANDROID_API__ < 26
+    if(enabled){
+        qWarning() << "The adaptive bitrate needs API 26";
+        return;
+    }
+#endif
+    mAdaptiveBitrate = enabled;
+    mMinBitrate = minBitrate;
+    mMaxBitrate = maxBitrate;
+}
+
+void NativeCodecWriter::setSegmentation(long long segmentDurationUs, long long segmentBytes){
+    if(isRunning){
+        qWarning() << "Segmenting cannot be changed while recording";
+        return;
+    }
+    mSegmentDurationUs = std::max(segmentDurationUs, 0LL);
+    mSegmentBytes = std::max(segmentBytes, 0LL);
+}
+
+void NativeCodecWriter::setPacketSink(PacketSink sink){
+    if(isRunning){
+        qWarning() << "The packet sink cannot be changed while recording";
+        return;
+    }
+    mPacketSink = sink;
 }
 
+QString NativeCodecWriter::segmentFilename(int index) const{
+    QFileInfo info(mFilename);
+    QString name = info.completeBaseName() + "_" + QString::number(index).rightJustified(3, '0');
+    if(!info.suffix().isEmpty()){
+        name += "." + info.suffix();
+    }
+    return QDir(info.path()).filePath(name);
+}
 
+AMediaMuxer* NativeCodecWriter::createMuxer(const QString& filename){
+    QFile outFile(filename);
+    if(!outFile.open(QIODevice::WriteOnly)){
+        qWarning() << "Cannot open file: " << filename;
+        return nullptr;
+    }
+    qDebug() << "Writing video to file:" << filename;
 
-void  NativeCodecReader::prepareDecoder(){
-    mExtractor = AMediaExtractor_new();
-    mTotalTimeBuffer = -1;
-    if(mExtractor == nullptr){
-        qWarning() << "Unable to get a media extractor!";
+    // VP8 / VP9 do not go into mp4
+    bool webm = mConfig.codec == VIDEO_CODEC_VP8 || mConfig.codec == VIDEO_CODEC_VP9;
+    // the muxer keeps its own duplicate of the file descriptor
+    AMediaMuxer* muxer = AMediaMuxer_new(outFile.handle(), webm ? AMEDIAMUXER_OUTPUT_FORMAT_WEBM : AMEDIAMUXER_OUTPUT_FORMAT_MPEG_4);
+    if(muxer == nullptr){
+        qWarning() << "Unable to create Muxer";
     }
+    return muxer;
+}
 
-    //PsshInfo* info = AMediaExtractor_getPsshInfo(mExtractor);
-    QString inputPath = mFilename;
+bool NativeCodecWriter::startNextSegment(){
+    finishMuxer();
 
-    QFile infile(inputPath);
-    //if(!infile.open(QIODevice::ReadOnly)){
-    //    qWarning() << "Cannot open video file " << inputPath;
-    //}
+    mSegmentIndex++;
+    mSegmentFilename = segmentFilename(mSegmentIndex);
+    mSegmentStartUs = -1;
+    mSegmentLastUs = -1;
+    mSegmentWrittenBytes = 0;
+    mSegmentFull = false;
 
+    mMuxer = createMuxer(mSegmentFilename);
+    mMuxerStarted = false;
+    if(mMuxer != nullptr && mOutputFormat != nullptr){
+        mTrackIndex = AMediaMuxer_addTrack(mMuxer, mOutputFormat);
+        mMuxerStarted = AMediaMuxer_start(mMuxer) == AMEDIA_OK;
+    }
+    if(mMuxerStarted){
+        return true;
+    }
 
-    //qDebug() << "AMediaExtractor_setDataSourceFd "<< 0 << " " << infile.size();
-    //media_status_t status = AMediaExtractor_setDataSourceFd(mExtractor, infile.handle(), 0, infile.size());
-    media_status_t status = AMediaExtractor_setDataSource(mExtractor, inputPath.toStdString().c_str());
+    // every further sample would be lost, stop instead of encoding into the void
+    QString reason = QString("Unable to start the muxer of segment %1 (%2)").arg(mSegmentIndex).arg(mSegmentFilename);
+    qWarning() << reason;
+    finishMuxer();
+    QFile::remove(mSegmentFilename);
+    mMuxerFailed = true;
+    mFrameQueue->close();
+    emit recordingFailed(reason);
+    return false;
+}
 
-    if(status != AMEDIA_OK){
-        qWarning() << "AMediaExtractor_setDataSourceFd failed: " << status;
+void NativeCodecWriter::finishMuxer(){
+    if(mMuxer == nullptr){
+        return;
     }
-
-    int numtracks = AMediaExtractor_getTrackCount(mExtractor);
-    if(numtracks != 1){
-        qWarning() << "Strange number of tracks";
+    if(mMuxerStarted){
+        AMediaMuxer_stop(mMuxer);
     }
-    mTrackIndex = 0;
-
-    sawInputEOS = false;
-    sawOutputEOS = false;
+    AMediaMuxer_delete(mMuxer);
+    mMuxer = nullptr;
+    mMuxerStarted = false;
 
+    if(isSegmented() && mSegmentStartUs >= 0){
+        // the last frame lasts as long as the ones before it, the nominal frame rate only stands in before there were two
+        long long lastFrameUs = mSegmentFrameDeltaUs > 0 ? mSegmentFrameDeltaUs : static_cast<long long>(1000000.0 / mFPS);
+        long long durationUs = mSegmentLastUs - mSegmentStartUs + lastFrameUs;
+        emit segmentFinished(mSegmentFilename, mSegmentIndex, durationUs, mSegmentWrittenBytes);
+    }
+}
 
-    mFormat = AMediaExtractor_getTrackFormat(mExtractor, mTrackIndex);
-    qDebug() << "Media format detected: " << AMediaFormat_toString(mFormat);
+void NativeCodecWriter::applyParameters(){
+#if __ANDROID_API__ >= 26
+    int bitrate = mRequestedBitrate.exchange(-1);
+    const int manualBitrate = mManualBitrate.exchange(-1);
+    if(manualBitrate > 0){
+        // the caller's choice wins, the controller goes on from there
+        bitrate = mAdaptiveBitrate ? mBitrateController.setBitrate(manualBitrate) : manualBitrate;
+    }
+    bool syncFrame = mSyncFrameRequested.exchange(false);
+    if(bitrate <= 0 && !syncFrame){
+        return;
+    }
 
-    // find out the vuideo duration here (it is not possible later on!)
-    qDebug() << "Recalculating totalTime";
-    const char* formatDescription = AMediaFormat_toString(mFormat);
-    QStringList entries = QString::fromLocal8Bit(formatDescription).split(", ");
-    qDebug() << formatDescription;
-    for(int i=0; i < entries.size(); i++){
-        if(entries[i].startsWith("durationUs:")){
-            qDebug() << "Found duration";
-            QString crop = entries[i].right(entries[i].length()- QString("durationUs: int64(").length()).chopped(1);
-            qDebug() << "Parsing " << entries[i] << " to " << crop << " result " << crop.toLong();
-            mTotalTimeBuffer = crop.toLong() /1000;
-            break;
-        }
+    AMediaFormat* params = AMediaFormat_new();
+    if(bitrate > 0){
+        AMediaFormat_setInt32(params, KEY_VIDEO_BITRATE, bitrate);
     }
+    if(syncFrame){
+        AMediaFormat_setInt32(params, KEY_REQUEST_SYNC_FRAME, 0);
+    }
+    media_status_t status = AMediaCodec_setParameters(mEncoder, params);
+    AMediaFormat_delete(params);
 
+    if(status != AMEDIA_OK){
+        qWarning() << "Unable to change encoder parameters:" << status;
+    }
+    else if(bitrate > 0 && bitrate != mBitrate){
+        mBitrate = bitrate;
+        emit bitrateChanged(bitrate);
+    }
+#endif
+}
 
-    const char *mime;
-    if (!AMediaFormat_getString(mFormat, AMEDIAFORMAT_KEY_MIME, &mime)) {
-        qWarning() << "Mime type cannot be determined!";
-    } else
-        if (!strncmp(mime, "video/", 6)) {
-            mCodec = AMediaCodec_createDecoderByType(mime);
+void NativeCodecWriter::updateAdaptiveBitrate(bool frameLost){
+    uint64_t dropped = mFrameQueue->dropped();
+    uint64_t newlyDropped = dropped - mDroppedSeen + (frameLost ? 1 : 0);
+    mDroppedSeen = dropped;
+
+    double queueFill = static_cast<double>(mFrameQueue->size()) / std::max<size_t>(mQueueCapacity, 1);
+    int bitrate = mBitrateController.addFrame(queueFill, newlyDropped, mBusyUs);
+    mBusyUs = 0;
+    if(bitrate > 0){
+        // not through setBitrate(), the controller already knows
+        mRequestedBitrate = bitrate;
+    }
+}
 
-            media_status_t err =AMediaCodec_configure(mCodec, mFormat, nullptr /* surface */, nullptr /* crypto */, 0);
-            if(err != AMEDIA_OK){
-                qWarning() << "Error occurred: " << err;
+bool NativeCodecWriter::isDuplicate(const cv::Mat& mat, bool yuv) const{
+    if(mPreviousFrame.empty() || mPreviousFrame.size() != mat.size() || mPreviousFrame.type() != mat.type()){
+        return false;
+    }
+    if(mDuplicateThreshold == 0){
+        // exact comparison, stops at the first difference
+        const size_t rowBytes = mat.cols * mat.elemSize();
+        for(int y = 0; y < mat.rows; y++){
+            if(memcmp(mat.ptr(y), mPreviousFrame.ptr(y), rowBytes) != 0){
+                return false;
             }
+        }
+        return true;
+    }
 
-            err =AMediaCodec_start(mCodec);
-            if(err != AMEDIA_OK){
-                qWarning() << "Error occurred: " << err;
+    // luma on a sparse grid, the rows of an I420 frame below the luma plane hold chroma
+    const int rows = yuv ? mSize.height : mat.rows;
+    const bool bgr = mat.channels() == 3;
+    uint64_t difference = 0;
+    uint64_t samples = 0;
+    for(int y = DUPLICATE_GRID_STEP / 2; y < rows; y += DUPLICATE_GRID_STEP){
+        const uint8_t* current = mat.ptr(y);
+        const uint8_t* previous = mPreviousFrame.ptr(y);
+        for(int x = DUPLICATE_GRID_STEP / 2; x < mat.cols; x += DUPLICATE_GRID_STEP){
+            int a, b;
+            if(bgr){
+                const uint8_t* p = current + 3 * x;
+                const uint8_t* q = previous + 3 * x;
+                a = (29 * p[0] + 150 * p[1] + 77 * p[2] + 128) >> 8;
+                b = (29 * q[0] + 150 * q[1] + 77 * q[2] + 128) >> 8;
             }
-            sawInputEOS = false;
-            sawOutputEOS = false;
-        } else {
-            qWarning() << "expected audio or video mime type, got "<< mime;
-
+            else{
+                a = current[x];
+                b = previous[x];
+            }
+            difference += std::abs(a - b);
+            samples++;
         }
-
-    qDebug() << "Decoder ready!";
+    }
+    return samples > 0 && static_cast<double>(difference) / samples <= mDuplicateThreshold;
 }
 
+bool NativeCodecWriter::write(const cv::Mat& mat, const long long timestamp){
+    if(mat.empty()) return false;
 
-
-/**
-     * Releases decoder resources.  May be called after partial / failed initialization.
-     */
-void NativeCodecReader::releaseDecoder() {
-    qDebug() << "releasing encoder objects";
-    if (mCodec != nullptr) {
-        AMediaCodec_stop(mCodec);
-        AMediaCodec_delete(mCodec);
-        mCodec = nullptr;
+    if(mMuxerFailed){
+        // recordingFailed() already said so
+        return false;
     }
-    /*
-    if (mInputSurface != null) {
-    mInputSurface.release();
-    mInputSurface = null;
+    if(!isRunning){
+        qWarning() << "Encoder has not been prepared, dropping frame";
+        return false;
     }
-    */
-    if (mExtractor != nullptr) {
-        AMediaExtractor_delete(mExtractor);
-        mExtractor = nullptr;
+
+    if(mat.size() != mSize || mat.depth() != CV_8U || (mat.channels() != 3 && mat.channels() != 1)){
+        qWarning() << "Frame does not match the encoder configuration:" << mat.cols << "x" << mat.rows << "with" << mat.channels() << "channels";
+        return false;
     }
+
+    return queueFrame(mat, timestamp, false);
 }
 
-int64 NativeCodecReader::nFrames(){
-    return totalTime() * dst_fps / 1000;
+bool NativeCodecWriter::writeYUV(const cv::Mat& frame, const long long timestamp){
+    if(frame.empty()) return false;
+
+    if(mMuxerFailed){
+        // recordingFailed() already said so
+        return false;
+    }
+    if(!isRunning){
+        qWarning() << "Encoder has not been prepared, dropping frame";
+        return false;
+    }
 
+    if(frame.size() != i420MatSize(mSize) || frame.type() != CV_8UC1 || !frame.isContinuous()){
+        qWarning() << "YUV frame does not match the encoder configuration:" << frame.cols << "x" << frame.rows;
+        return false;
+    }
+    return queueFrame(frame, timestamp, true);
 }
 
-int64 NativeCodecReader::currentFrame(){
-    return currentTime() * dst_fps / 1000;
+YUVFrameLayout NativeCodecWriter::i420Layout(const cv::Size& size){
+    YUVFrameLayout layout;
+    layout.layout = YUV_LAYOUT_I420;
+    layout.width = size.width;
+    layout.height = size.height;
+    // even, so both chroma planes fill whole rows of the Mat
+    layout.stride = (size.width + 1) & ~1;
+    layout.sliceHeight = size.height;
+    return layout;
 }
 
-int64 NativeCodecReader::currentTime(){
-    Q_ASSERT(mExtractor != nullptr);
-    int64 time = AMediaExtractor_getSampleTime(mExtractor);
-    return time / 1000;
+cv::Size NativeCodecWriter::i420MatSize(const cv::Size& size){
+    return cv::Size((size.width + 1) & ~1, size.height + (size.height + 1) / 2);
 }
 
-int64 NativeCodecReader::totalTime(){
+bool NativeCodecWriter::queueFrame(const cv::Mat& image, const long long timestamp, bool yuv){
+    if(mTimestampMode == TIMESTAMP_CALLER && mDuplicateThreshold >= 0 && mSkippedInRow < mMaxSkipped && isDuplicate(image, yuv)){
+        mSkippedInRow++;
+        mSkippedFrames++;
+        mLastSkippedTimestamp = timestamp;
+        return true;
+    }
 
+    PendingFrame frame;
+    if(yuv){
+        frame.image = image;
+    }
+    else{
+        // The caller may reuse its buffer as soon as we return, so the queue gets its own copy.
+        ScopedStage stage(mProfiler, STAGE_COPY);
+        frame.image = mFramePool->acquire(image.size(), image.type());
+        image.copyTo(frame.image);
+    }
+    frame.timestamp = timestamp;
+    frame.yuv = yuv;
+    mProfiler.recordQueueDepth(mFrameQueue->size());
+    const cv::Mat queued = frame.image;
+    if(!mFrameQueue->push(frame)){
+        return false;
+    }
+    // only what actually went into the queue can stand in for skipped frames
+    if(mDuplicateThreshold >= 0){
+        mPreviousFrame = queued;
+        mSkippedInRow = 0;
+    }
+    return true;
+}
 
-    return mTotalTimeBuffer;
+void NativeCodecWriter::encodingLoop(){
+    PendingFrame frame;
+    while(true){
+        if(mMuxerFailed){
+            // whatever is still queued cannot be written
+            break;
+        }
+        if(mEndRequested && std::chrono::steady_clock::now() >= mFinishDeadline){
+            // out of time, whatever is still queued is lost
+            break;
+        }
+        if(mFrameQueue->pop(frame, QUEUE_POLL_MS)){
+            bool encoded = encodeFrame(frame);
+            frame = PendingFrame();
+            if(mAdaptiveBitrate){
+                updateAdaptiveBitrate(!encoded);
+            }
+        }
+        else if(mFrameQueue->isClosed()){
+            break;
+        }
+        else{
+            // Nothing to encode, but the encoder may still have output for the muxer.
+            drainEncoder(false);
+        }
+    }
 
+    if(mEndRequested || mMuxerFailed){
+        finishRecording();
+    }
 }
 
-bool NativeCodecReader::seek(cv::Mat& mat, int64 frameNumber){
-    int64 pos = frame2Time(frameNumber);
-    AMediaExtractor_seekTo(mExtractor, pos, SeekMode::AMEDIAEXTRACTOR_SEEK_CLOSEST_SYNC);
-    //For decoders that do not support adaptive playback (including when not decoding onto a Surface)
-    // In order to start decoding data that is not adjacent to previously submitted data (i.e. after a seek) you MUST flush the decoder.
-    AMediaCodec_flush(mCodec);
-}
+void NativeCodecWriter::finishRecording(){
+    bool complete = false;
+    long long elapsedMs = 0;
+    if(mMuxerFailed){
+        // the encoder's remaining output has nowhere to go
+        releaseEncoder();
+    }
+    else{
+        size_t abandonedFrames = mFrameQueue->size();
+        if(abandonedFrames > 0){
+            qWarning() << "Finishing the recording took too long," << abandonedFrames << "frames were not encoded";
+        }
 
-bool NativeCodecReader::read(cv::Mat& mat){
-    mat =  performRead();
-    return !mat.empty();
+        complete = queueEndOfStream() && drainEncoder(true) && abandonedFrames == 0;
+        releaseEncoder();
+        elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - mEndTime).count();
+    }
+    qDebug() << "Recording finished" << (complete ? "completely" : "incompletely") << "with" << mTailFrames << "tail frames in" << elapsedMs << "ms";
+    // a slot may delete the writer
+    QPointer<NativeCodecWriter> self(this);
+    emit recordingFinished(complete, mTailFrames, elapsedMs);
+    if(self){
+        emit recordingFinished();
+    }
 }
 
-int64 NativeCodecReader::frame2Time(int64 frameNo){
-    return (frameNo*1000000)/dst_fps;
+bool NativeCodecWriter::queueEndOfStream(){
+    // AMediaCodec_signalEndOfInputStream() (API 26) only works for encoders fed from an input surface. We fill
+    // input buffers ourselves, so the end of stream goes in as an empty buffer with the flag set.
+    while(true){
+        ssize_t inBufferIdx = mSpareInputBuffer >= 0 ? mSpareInputBuffer : AMediaCodec_dequeueInputBuffer(mEncoder, TIMEOUT_USEC);
+        mSpareInputBuffer = -1;
+        if(inBufferIdx >= 0){
+            qDebug() << "Sending EOS";
+            media_status_t status = AMediaCodec_queueInputBuffer(mEncoder, inBufferIdx, 0, 0, computePresentationTimeUs(-1), AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM);
+            if(status != AMEDIA_OK){
+                qWarning() << "Unable to queue the end of stream:" << status;
+                return false;
+            }
+            return true;
+        }
+        if(std::chrono::steady_clock::now() >= mFinishDeadline){
+            qWarning() << "No encoder input buffer for the end of stream in time";
+            return false;
+        }
+        // all input buffers taken, make room by taking output
+        drainEncoder(false);
+    }
 }
 
-
-
-NativeCodecWriter::NativeCodecWriter(QString filename, const int fps, const cv::Size& size)
-    :QObject(nullptr),
-      mFilename(filename),
-      mFPS(fps),
-      mSize(size),
-      isRunning(false)
-{
+void NativeCodecWriter::stopEncodingThread(){
+    if(mFrameQueue){
+        mFrameQueue->close();
+    }
+    waitForFinished();
 }
 
-NativeCodecWriter::~NativeCodecWriter(){
-
+void NativeCodecWriter::waitForFinished(){
+    if(!mEncodingThread.joinable()){
+        return;
+    }
+    if(mEncodingThread.get_id() == std::this_thread::get_id()){
+        // e.g. deleted from a slot directly connected to recordingFinished(), the thread is about to end anyway
+        mEncodingThread.detach();
+        return;
+    }
+    mEncodingThread.join();
 }
 
-bool NativeCodecWriter::write(const cv::Mat& mat, const long long timestamp){
+bool NativeCodecWriter::encodeFrame(const PendingFrame& frame){
+    const cv::Mat& mat = frame.image;
+    applyParameters();
+
     // Feed any pending encoder output into the muxer.
     drainEncoder(false);
 
-    if(mat.empty()) return false;
-
     // Generate a new frame of input.
 
     /**
@@ -357,7 +1689,26 @@ bool NativeCodecWriter::write(const cv::Mat& mat, const long long timestamp){
                   * getInputBuffer() to get a pointer to the buffer, then copy the data to be encoded or decoded
                   * into the buffer before passing it to the codec.
                   */
-    ssize_t inBufferIdx = AMediaCodec_dequeueInputBuffer(mEncoder, TIMEOUT_USEC);
+    ssize_t inBufferIdx = mSpareInputBuffer;
+    mSpareInputBuffer = -1;
+    while(inBufferIdx < 0){
+        {
+            ScopedStage stage(mProfiler, STAGE_INPUT_DEQUEUE);
+            std::chrono::steady_clock::time_point waitStart = std::chrono::steady_clock::now();
+            inBufferIdx = AMediaCodec_dequeueInputBuffer(mEncoder, TIMEOUT_USEC);
+            mBusyUs += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - waitStart).count();
+        }
+        if(inBufferIdx != AMEDIACODEC_INFO_TRY_AGAIN_LATER || mQueuePolicy != BACKPRESSURE_BLOCK || encodingAbandoned()){
+            break;
+        }
+        // BACKPRESSURE_BLOCK promises not to lose frames, so wait for the encoder and make room by taking its output
+        drainEncoder(false);
+    }
+    if(inBufferIdx < 0){
+        qWarning() << "No encoder input buffer available, dropping frame";
+        mEncoderDroppedFrames++;
+        return false;
+    }
 
     /**
                   * Get an input buffer. The specified buffer index must have been previously obtained from
@@ -366,38 +1717,45 @@ bool NativeCodecWriter::write(const cv::Mat& mat, const long long timestamp){
     size_t out_size;
     uint8_t* inBuffer = AMediaCodec_getInputBuffer(mEncoder, inBufferIdx, &out_size);
 
-    // Make sure the image is colorful (later on we can try encoding grayscale somehow...)
-    cv::Mat colorImg;
+    // Convert straight into the codec buffer, in the color format and stride / slice height the encoder expects.
+    YUVPlanes planes;
+    if(!yuvResolvePlanes(inBuffer, out_size, mInputLayout, planes)){
+        qWarning() << "Encoder input buffer of size" << out_size << "is too small for a frame, dropping it";
+        // queueing the buffer empty would still put a frame with a made up time into the stream, keep it for later instead
+        mSpareInputBuffer = inBufferIdx;
+        mEncoderDroppedFrames++;
+        return false;
+    }
 
-    cv::cvtColor(mat, colorImg, CV_BGR2YUV_I420); // COLOR_FormatYUV420SemiPlanar
-    // All video codecs support flexible YUV 4:2:0 buffers since Build.VERSION_CODES.LOLLIPOP_MR1.
-    /*
-        if(mat.channels() == 3){
-            cv::cvtColor(mat, colorImg, CV_BGR2YUV_I420);
-            }
+    {
+        ScopedStage stage(mProfiler, STAGE_CONVERSION);
+        YUVPlanes source;
+        if(frame.yuv && yuvResolvePlanes(mat.data, mat.total(), i420Layout(mSize), source)){
+            // converted once for all renditions, only the plane layout may differ
+            yuv420Scale(source, planes);
+        }
+        else if(mat.channels() == 3){
+            bgrToYUV420(mat.data, mat.step, planes);
+        }
         else{
-            cv::cvtColor(mat, colorImg, CV_GRAY2BGR);
-            cv::cvtColor(colorImg, colorImg, CV_BGR2YUV_I420);
+            grayToYUV420(mat.data, mat.step, planes);
         }
-        */
-    //    colorImg = mat;
-
-    // here we actually copy the data.
-    memcpy(inBuffer, colorImg.data, out_size);
+    }
+    size_t frameSize = std::min(yuvFrameSize(mInputLayout), out_size);
 
     /**
           * Send the specified buffer to the codec for processing.
           */
-    //int64_t presentationTimeNs = timestamp;
-    int64_t presentationTimeNs = computePresentationTimeNsec();
+    int64_t presentationTimeUs = computePresentationTimeUs(frame.timestamp);
 
-    media_status_t status = AMediaCodec_queueInputBuffer(mEncoder, inBufferIdx, 0, out_size, presentationTimeNs, mat.empty() ? AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM : 0);
+    media_status_t status = AMediaCodec_queueInputBuffer(mEncoder, inBufferIdx, 0, frameSize, presentationTimeUs, 0);
 
     if(status == AMEDIA_OK){
         //qDebug() << "Successfully pushed frame to input buffer";
     }
     else{
         qWarning() << "Something went wrong while pushing frame to input buffer";
+        mEncoderDroppedFrames++;
         return false;
     }
 
@@ -412,46 +1770,116 @@ bool NativeCodecWriter::write(const cv::Mat& mat, const long long timestamp){
 }
 
 
+bool NativeCodecWriter::encodingAbandoned() const{
+    if(mEndRequested){
+        return std::chrono::steady_clock::now() >= mFinishDeadline;
+    }
+    return mFrameQueue->isClosed();
+}
+
 void NativeCodecWriter::end(){
     qDebug() << "End of recording called!";
-    // Send the termination frame
-    ssize_t inBufferIdx = AMediaCodec_dequeueInputBuffer(mEncoder, TIMEOUT_USEC);
-    size_t out_size;
-    uint8_t* inBuffer = AMediaCodec_getInputBuffer(mEncoder, inBufferIdx, &out_size);
-    int64_t presentationTimeNs = computePresentationTimeNsec();
-    qDebug() << "Sending EOS";
-    media_status_t status = AMediaCodec_queueInputBuffer(mEncoder, inBufferIdx, 0, out_size, presentationTimeNs, AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM);
-    // send end-of-stream to encoder, and drain remaining output
+    if(!isRunning || mEndRequested){
+        qWarning() << "No recording to end";
+        return;
+    }
 
-    drainEncoder(true);
+    if(mSkippedInRow > 0){
+        // the recording ended on skipped frames, show the last image until the last of them
+        PendingFrame frame;
+        frame.image = mPreviousFrame;
+        frame.timestamp = mLastSkippedTimestamp;
+        // an I420 Mat has half as many rows again as the frame, so it cannot be mistaken for a BGR / gray one
+        frame.yuv = mPreviousFrame.size() == i420MatSize(mSize) && mPreviousFrame.type() == CV_8UC1;
+        // the queue's policy could drop it, and with it the time the skipped frames stood for
+        mFrameQueue->push(frame, BACKPRESSURE_BLOCK);
+    }
+    mPreviousFrame.release();
+    mSkippedInRow = 0;
 
-    releaseEncoder();
+    // The encoding thread works through everything that has been written, sends the end of stream,
+    // drains the encoder and finishes the file, all within the finish timeout. recordingFinished() tells when it is done.
+    mEndTime = std::chrono::steady_clock::now();
+    mFinishDeadline = mEndTime + std::chrono::milliseconds(mFinishTimeoutMs);
+    mTailFrames = 0;
+    mEndRequested = true;
+    mFrameQueue->close();
 
     // To test the result, open the file with MediaExtractor, and get the format.  Pass
     // that into the MediaCodec decoder configuration, along with a SurfaceTexture surface,
     // and examine the output with glReadPixels.
 }
 
+void NativeCodecWriter::setFinishTimeout(int timeoutMs){
+    mFinishTimeoutMs = std::max(timeoutMs, 0);
+}
+
 
 void NativeCodecWriter::prepareEncoder(){
+    if(isRunning && !mEndRequested){
+        qWarning() << "The encoder is already recording, end() it first";
+        return;
+    }
+    // the previous recording may still be finishing
+    waitForFinished();
 
 
     AMediaFormat* format = AMediaFormat_new();
     AMediaFormat_setInt32(format,AMEDIAFORMAT_KEY_WIDTH,mSize.width);
     AMediaFormat_setInt32(format,AMEDIAFORMAT_KEY_HEIGHT,mSize.height);
 
-    AMediaFormat_setString(format,AMEDIAFORMAT_KEY_MIME,"video/avc"); // H.264 Advanced Video Coding
-    AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_COLOR_FORMAT, 21); // #21 COLOR_FormatYUV420SemiPlanar (NV12)
-    AMediaFormat_setInt32(format,AMEDIAFORMAT_KEY_BIT_RATE,500000);
+    AMediaFormat_setString(format,AMEDIAFORMAT_KEY_MIME,mConfig.mime());
+    AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_COLOR_FORMAT, mColorFormat);
+    AMediaFormat_setInt32(format,AMEDIAFORMAT_KEY_BIT_RATE,mConfig.bitrate);
     AMediaFormat_setFloat(format,AMEDIAFORMAT_KEY_FRAME_RATE,mFPS);
-    AMediaFormat_setInt32(format,AMEDIAFORMAT_KEY_I_FRAME_INTERVAL,5);
+    if(mConfig.iFrameInterval == static_cast<int>(mConfig.iFrameInterval)){
+        // encoders before API 25 only read an integer interval
+        AMediaFormat_setInt32(format,AMEDIAFORMAT_KEY_I_FRAME_INTERVAL,static_cast<int>(mConfig.iFrameInterval));
+    }
+    else{
+        AMediaFormat_setFloat(format,AMEDIAFORMAT_KEY_I_FRAME_INTERVAL,mConfig.iFrameInterval);
+    }
+
+    if(mConfig.bitrateMode != BITRATE_MODE_DEFAULT){
+        AMediaFormat_setInt32(format,KEY_BITRATE_MODE,mConfig.bitrateMode);
+    }
+    if(mConfig.quality >= 0){
+        AMediaFormat_setInt32(format,KEY_QUALITY,mConfig.quality);
+    }
+    if(mConfig.profile >= 0){
+        AMediaFormat_setInt32(format,KEY_PROFILE,mConfig.profile);
+    }
+    if(mConfig.level >= 0){
+        AMediaFormat_setInt32(format,KEY_LEVEL,mConfig.level);
+    }
+    if(mConfig.priority >= 0){
+        AMediaFormat_setInt32(format,KEY_PRIORITY,mConfig.priority);
+    }
+    if(mConfig.operatingRate > 0){
+        AMediaFormat_setFloat(format,KEY_OPERATING_RATE,mConfig.operatingRate);
+    }
+    if(mConfig.maxBFrames >= 0){
+        AMediaFormat_setInt32(format,KEY_MAX_B_FRAMES,mConfig.maxBFrames);
+    }
+    if(mConfig.latency >= 0){
+        AMediaFormat_setInt32(format,KEY_LATENCY,mConfig.latency);
+    }
 
 
     //AMediaFormat_setInt32(format,AMEDIAFORMAT_KEY_STRIDE,mSize.width);
     //AMediaFormat_setInt32(format,AMEDIAFORMAT_KEY_M  AX_WIDTH,mSize.width);
     //AMediaFormat_setInt32(format,AMEDIAFORMAT_KEY_MAX_HEIGHT,mSize.height);
 
-    mEncoder = AMediaCodec_createEncoderByType("video/avc");
+    mEncoder = nullptr;
+    if(!mConfig.codecName.empty()){
+        mEncoder = AMediaCodec_createCodecByName(mConfig.codecName.c_str());
+        if(mEncoder == nullptr){
+            qWarning() << "Unable to create encoder" << mConfig.codecName.c_str() << ", falling back to the default one for" << mConfig.mime();
+        }
+    }
+    if(mEncoder == nullptr){
+        mEncoder = AMediaCodec_createEncoderByType(mConfig.mime());
+    }
     if(mEncoder == nullptr){
         qWarning() << "Unable to create encoder";
     }
@@ -467,18 +1895,8 @@ void NativeCodecWriter::prepareEncoder(){
         qWarning() << "Error occurred: " << err;
     }
 
-    if(err != AMEDIA_OK){
-        qWarning() << "Error occurred: " << err;
-    }
-
+    updateInputLayout();
 
-    QFile outFile(mFilename);
-    if(!outFile.open(QIODevice::WriteOnly)){
-        qWarning() << "Cannot open file: " << mFilename;
-    }
-    else{
-        qDebug() << "Writing video to file:" << mFilename;
-    }
 
     // Create a MediaMuxer.  We can't add the video track and start() the muxer here,
     // because our MediaFormat doesn't have the Magic Goodies.  These can only be
@@ -486,15 +1904,45 @@ void NativeCodecWriter::prepareEncoder(){
     //
     // We're not actually interested in multiplexing audio.  We just want to convert
     // the raw H.264 elementary stream we get from MediaCodec into a .mp4 file.
-    mMuxer = AMediaMuxer_new(outFile.handle(), AMEDIAMUXER_OUTPUT_FORMAT_MPEG_4);
-
-    if(mMuxer == nullptr){
-        qWarning() << "Unable to create Muxer";
-    }
+    mSegmentIndex = 0;
+    mSegmentFilename = isSegmented() ? segmentFilename(0) : mFilename;
+    mSegmentStartUs = -1;
+    mSegmentLastUs = -1;
+    mSegmentWrittenBytes = 0;
+    mSegmentFrameDeltaUs = -1;
+    mSegmentFull = false;
+    mMuxer = mPacketSink ? nullptr : createMuxer(mSegmentFilename);
 
     mTrackIndex = -1;
     mMuxerStarted = false;
     mFrameCounter = 0;
+    mFirstTimestamp = -1;
+    mLastPresentationTimeUs = -1;
+    mSkippedInRow = 0;
+    mSkippedFrames = 0;
+    mPreviousFrame.release();
+
+    mEndRequested = false;
+    mMuxerFailed = false;
+    mTailFrames = 0;
+    mEncoderDroppedFrames = 0;
+    mSpareInputBuffer = -1;
+
+    mBitrate = mConfig.bitrate;
+    mRequestedBitrate = -1;
+    mManualBitrate = -1;
+    mSyncFrameRequested = false;
+    mDroppedSeen = 0;
+    mBusyUs = 0;
+    if(mAdaptiveBitrate){
+        mBitrateController.reset(mConfig.bitrate,
+                                 mMinBitrate > 0 ? mMinBitrate : mConfig.bitrate / 4,
+                                 mMaxBitrate > 0 ? mMaxBitrate : mConfig.bitrate,
+                                 1000000.0 / mFPS);
+    }
+
+    mFrameQueue.reset(new BoundedFrameQueue<PendingFrame>(mQueueCapacity, mQueuePolicy));
+    mEncodingThread = std::thread(&NativeCodecWriter::encodingLoop, this);
     isRunning = true;
     qDebug() << "Encoder ready!";
 }
@@ -506,33 +1954,34 @@ void NativeCodecWriter::prepareEncoder(){
      * is set, we send EOS to the encoder, and then iterate until we see EOS on the output.
      * Calling this with endOfStream set should be done once, right before stopping the muxer.
      */
-void NativeCodecWriter::drainEncoder(bool endOfStream) {
+bool NativeCodecWriter::drainEncoder(bool endOfStream) {
+
+    if (mMuxerFailed) {
+        return false;
+    }
 
     if (endOfStream) {
         qDebug() << "Draining encoder to EOS";
-        // only API >= 26
-        // Send an empty frame with the end-of-stream flag set.
-        // AMediaCodec_signalEndOfInputStream();
-        // Instead, we construct that frame manually.
     }
 
-
-
-
     while (true) {
-        ssize_t encoderStatus = AMediaCodec_dequeueOutputBuffer(mEncoder, &mBufferInfo, TIMEOUT_USEC);
+        ssize_t encoderStatus;
+        {
+            ScopedStage stage(mProfiler, STAGE_OUTPUT_DEQUEUE);
+            encoderStatus = AMediaCodec_dequeueOutputBuffer(mEncoder, &mBufferInfo, TIMEOUT_USEC);
+        }
 
 
         if (encoderStatus == AMEDIACODEC_INFO_TRY_AGAIN_LATER) {
             // no output available yet
             if (!endOfStream) {
-                return;
-                //break;      // out of while
+                return false;
             }
-            if(endOfStream){
-                qDebug() << "no output available, spinning to await EOS";
-                return;
+            if (std::chrono::steady_clock::now() >= mFinishDeadline) {
+                qWarning() << "Encoder did not reach the end of stream in time";
+                return false;
             }
+            // spinning to await EOS
 
         } else if (encoderStatus == AMEDIACODEC_INFO_OUTPUT_BUFFERS_CHANGED) {
             // not expected for an encoder
@@ -546,18 +1995,28 @@ void NativeCodecWriter::drainEncoder(bool endOfStream) {
             if(newFormat == nullptr){
                 qWarning() << "Unable to set new format.";
             }
+            if(mOutputFormat != nullptr){
+                AMediaFormat_delete(mOutputFormat);
+            }
+            mOutputFormat = newFormat;
 
             qDebug() << "encoder output format changed: " + QString::fromStdString(AMediaFormat_toString(newFormat));
 
-            // now that we have the Magic Goodies, start the muxer
-            mTrackIndex = AMediaMuxer_addTrack(mMuxer, newFormat);
-            media_status_t err = AMediaMuxer_start(mMuxer);
-
-            if(err != AMEDIA_OK){
-                qWarning() << "Error occurred: " << err;
+            if (mPacketSink) {
+                // the sink gets the format with every sample
+                mMuxerStarted = true;
             }
+            else if (mMuxer != nullptr) {
+                // now that we have the Magic Goodies, start the muxer
+                mTrackIndex = AMediaMuxer_addTrack(mMuxer, newFormat);
+                media_status_t err = AMediaMuxer_start(mMuxer);
+
+                if(err != AMEDIA_OK){
+                    qWarning() << "Error occurred: " << err;
+                }
 
-            mMuxerStarted = true;
+                mMuxerStarted = true;
+            }
         } else if (encoderStatus < 0) {
             qWarning() << "unexpected result from encoder.dequeueOutputBuffer: " + QString::number(encoderStatus);
             // let's ignore it
@@ -582,17 +2041,49 @@ void NativeCodecWriter::drainEncoder(bool endOfStream) {
                 mBufferInfo.size = 0;
             }
 
+            if (mBufferInfo.size != 0 && isSegmented()) {
+                if (mSegmentLastUs >= 0 && mBufferInfo.presentationTimeUs > mSegmentLastUs) {
+                    mSegmentFrameDeltaUs = mBufferInfo.presentationTimeUs - mSegmentLastUs;
+                }
+                if (mSegmentFull && (mBufferInfo.flags & BUFFER_FLAG_KEY_FRAME) != 0 && !startNextSegment()) {
+                    AMediaCodec_releaseOutputBuffer(mEncoder, encoderStatus, false);
+                    return false;
+                }
+                if (mSegmentStartUs < 0) {
+                    mSegmentStartUs = mBufferInfo.presentationTimeUs;
+                }
+                mSegmentLastUs = mBufferInfo.presentationTimeUs;
+                mSegmentWrittenBytes += mBufferInfo.size;
+                if (!mSegmentFull && ((mSegmentDurationUs > 0 && mSegmentLastUs - mSegmentStartUs >= mSegmentDurationUs)
+                                      || (mSegmentBytes > 0 && mSegmentWrittenBytes >= mSegmentBytes))) {
+                    // the next segment has to start with a sync frame, ask for one right away
+                    mSegmentFull = true;
+                    mSyncFrameRequested = true;
+                }
+            }
+
             if (mBufferInfo.size != 0) {
                 if (!mMuxerStarted) {
                     qWarning() << "muxer hasn't started";
                 }
-
-
-                // adjust the ByteBuffer values to match BufferInfo (not needed?)
-                //encodedData.position(mBufferInfo.offset);
-                //encodedData.limit(mBufferInfo.offset + mBufferInfo.size);
-
-                AMediaMuxer_writeSampleData(mMuxer, mTrackIndex, encodedData, &mBufferInfo);
+                else{
+                    // adjust the ByteBuffer values to match BufferInfo (not needed?)
+                    //encodedData.position(mBufferInfo.offset);
+                    //encodedData.limit(mBufferInfo.offset + mBufferInfo.size);
+
+                    ScopedStage stage(mProfiler, STAGE_MUXER_WRITE);
+                    std::chrono::steady_clock::time_point writeStart = std::chrono::steady_clock::now();
+                    if (mPacketSink) {
+                        mPacketSink(mOutputFormat, encodedData + mBufferInfo.offset, mBufferInfo);
+                    }
+                    else {
+                        AMediaMuxer_writeSampleData(mMuxer, mTrackIndex, encodedData, &mBufferInfo);
+                    }
+                    mBusyUs += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - writeStart).count();
+                    if (mEndRequested) {
+                        mTailFrames++;
+                    }
+                }
                 //qDebug() << "sent " + QString::number(mBufferInfo.size) + " bytes to muxer";
             }
             else{
@@ -608,7 +2099,7 @@ void NativeCodecWriter::drainEncoder(bool endOfStream) {
                     qDebug() << "end of stream reached";
 
                 }
-                break;      // out of while
+                return true;
             }
         }
     }
@@ -623,32 +2114,81 @@ void NativeCodecWriter::releaseEncoder() {
         AMediaCodec_stop(mEncoder);
     }
 
-    if (mMuxer != nullptr) {
-        AMediaMuxer_stop(mMuxer);
-    }
+    finishMuxer();
 
     if (mEncoder != nullptr) {
         AMediaCodec_delete(mEncoder);
         mEncoder = nullptr;
     }
 
-    if (mMuxer != nullptr) {
-        AMediaMuxer_delete(mMuxer);
-        mMuxer = nullptr;
+    if (mOutputFormat != nullptr) {
+        AMediaFormat_delete(mOutputFormat);
+        mOutputFormat = nullptr;
     }
 
     isRunning = false;
-    emit recordingFinished();
+}
+
+void NativeCodecWriter::updateInputLayout(){
+    YUVFrameLayout layout;
+    layout.width = mSize.width;
+    layout.height = mSize.height;
+    layout.stride = mSize.width;
+    layout.sliceHeight = mSize.height;
+    layout.cropRight = mSize.width - 1;
+    layout.cropBottom = mSize.height - 1;
+
+#if __ANDROID_API__ >= 28
+    // Encoders may want padded rows / planes, only the input format tells us.
+    AMediaFormat* inputFormat = AMediaCodec_getInputFormat(mEncoder);
+    if(inputFormat != nullptr){
+        int32_t value = 0;
+        if(AMediaFormat_getInt32(inputFormat, AMEDIAFORMAT_KEY_STRIDE, &value) && value >= layout.width){
+            layout.stride = value;
+        }
+        if(AMediaFormat_getInt32(inputFormat, KEY_SLICE_HEIGHT, &value) && value >= layout.height){
+            layout.sliceHeight = value;
+        }
+        AMediaFormat_delete(inputFormat);
+    }
+#endif
+
+    if(!yuvLayoutFromColorFormat(mColorFormat, layout.layout)){
+        qWarning() << "Unsupported encoder color format" << mColorFormat << "- writing NV12";
+        layout.layout = YUV_LAYOUT_NV12;
+    }
+
+    mInputLayout = layout;
+    qDebug() << "Encoder input stride" << layout.stride << "slice height" << layout.sliceHeight;
 }
 
 /**
-         * Generates the presentation time for frame N, in nanoseconds.
+         * Generates the presentation time of the next frame, in microseconds.
          */
 
-long long NativeCodecWriter::computePresentationTimeNsec() {
+long long NativeCodecWriter::computePresentationTimeUs(long long timestamp) {
     mFrameCounter++;
     double timePerFrame = 1000000.0/mFPS;
-    return static_cast<long long>(mFrameCounter*timePerFrame);
+    long long presentationTimeUs;
+    if(mTimestampMode == TIMESTAMP_CALLER && timestamp >= 0){
+        if(mFirstTimestamp < 0){
+            mFirstTimestamp = timestamp;
+        }
+        presentationTimeUs = static_cast<long long>((timestamp - mFirstTimestamp) * (1000000.0 / mTicksPerSecond));
+    }
+    else if(mTimestampMode == TIMESTAMP_CALLER){
+        presentationTimeUs = mLastPresentationTimeUs + static_cast<long long>(timePerFrame);
+    }
+    else{
+        presentationTimeUs = static_cast<long long>(mFrameCounter*timePerFrame);
+    }
+
+    // the muxer wants strictly increasing times, late or repeated timestamps go right after the previous frame
+    if(presentationTimeUs <= mLastPresentationTimeUs){
+        presentationTimeUs = mLastPresentationTimeUs + 1;
+    }
+    mLastPresentationTimeUs = presentationTimeUs;
+    return presentationTimeUs;
 }
 
 
@@ -19,23 +19,29 @@
 /**
  * NativeCodecReader opens and decodes a media file (such as mp4 with h264 or webm)
  * You can query OpenCV's cv::Mat via read()
- * Frame counts are calculated from video duration / current sample timestamps and the framerate.
- * TODO Might be worth having a look at the asynchronous functions so that we can actually push the frames out instead of querying them, which might allow for faster playback without a buffering layer.
+ * Frame counts and frame times come from a sample index (presentation time, size and sync flag of every sample)
+ * that is built by walking the file once on open and cached in a sidecar file, so they are exact even for variable frame rates.
+ * With startAsync() (API 28) the decoder pushes frames out as fast as it can into a bounded queue or a callback instead.
  */
 
 /**
  * NativeCodecWriter encodes frames to a video and muxes them to a media file (such as mp4 with h264 or webm)
  * You can push OpenCV's cv::Mat via write()
- * After recording you need to call end() to finish the writing process and to flush the remaining buffers. This might take a while.
- * The object can be deleted once the recordingFinished() signal is emitted (and no earlier!)
+ * After recording you need to call end() to finish the writing process and to flush the remaining buffers. end() returns right away,
+ * the encoding thread finishes the file within the finish timeout (see setFinishTimeout()).
+ * The object can be deleted once the recordingFinished() signal is emitted. Deleting it earlier ends the recording
+ * and blocks until the file is finished.
  *
- * You might want to run the encoding in a separate thread, e.g.
- *           QThread* mEncodingThread = new QThread();
+ * Encoding runs on a thread owned by the writer: write() only copies the frame into a bounded queue and returns.
+ * When the encoder falls behind, the backpressure policy (see setQueue()) decides whether write() blocks or frames get dropped, e.g.
  *           NativeCodecWriter* videoWriter = new NativeCodecWriter(videofile, fps, Size(data.input.cols, data.input.rows));
- *           videoWriter->moveToThread(mEncodingThread);
- *           mEncodingThread->start();
- *           QMetaObject::invokeMethod(videoWriter, &NativeCodecWriter::prepareEncoder);
- *           connect(this, &DataRecorder::pushFrame, videoWriter, &NativeCodecWriter::write);
+ *           videoWriter->setQueue(8, BACKPRESSURE_DROP_OLDEST);
+ *           videoWriter->prepareEncoder();
+ *           connect(this, &DataRecorder::pushFrame, videoWriter, &NativeCodecWriter::write, Qt::DirectConnection);
+ *
+ * By default frames are spaced evenly at the configured fps and the timestamps passed to write() are ignored.
+ * With setTimestampMode(TIMESTAMP_CALLER) they become the presentation times instead (variable frame rate),
+ * and setSkipDuplicates() can leave out frames that do not differ from the previous one.
  */
 
 
@@ -44,6 +50,14 @@
 // With some lookup from https://android.googlesource.com/platform/cts/+/master/tests/tests/media/libmediandkjni/native-media-jni.cpp
 // Also interesting https://android.googlesource.com/platform/cts/+/master/tests/tests/media/libmediandkjni/native_media_encoder_jni.cpp
 
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include <opencv2/opencv.hpp>
 #include <QDebug>
 #include <QString>
@@ -58,32 +72,288 @@
 #include "media/NdkMediaMuxer.h"
 #include "media/NdkMediaExtractor.h"
 
+#include "bitratecontroller.h"
+#include "codecprofiler.h"
+#include "framecache.h"
+#include "framepool.h"
+#include "framequeue.h"
+#include "mediasource.h"
+#include "sampleindex.h"
+#include "yuvconvert.h"
+
 
 using std::string;
 
 
+/**
+ * @brief The FrameFormat enum selects what the reader turns decoded frames into.
+ */
+enum FrameFormat {
+    FRAME_FORMAT_BGR,   ///< CV_8UC3, full color conversion
+    FRAME_FORMAT_GRAY   ///< CV_8UC1, just the luma plane, no chroma work at all
+};
+
+
+/**
+ * @brief The CodecFrameView class is the luma plane of a decoded frame that still sits in the codec's output buffer.
+ * image points right into that buffer, which goes back to the codec when the view is released or destroyed.
+ * While a view is held the decoder has one output buffer less to work with, so release views promptly.
+ * Views held across seek() or the reader's destruction are invalidated and merely drop their image.
+ */
+class CodecFrameView
+{
+public:
+    CodecFrameView();
+    ~CodecFrameView();
+
+    CodecFrameView(CodecFrameView&& other);
+    CodecFrameView& operator=(CodecFrameView&& other);
+
+    /**
+     * Hands the buffer back to the codec. image must not be used afterwards.
+     */
+    void release();
+
+    bool valid() const { return !image.empty(); }
+
+    cv::Mat image;
+    int64 presentationTimeUs;
+
+private:
+    CodecFrameView(const CodecFrameView&) = delete;
+    CodecFrameView& operator=(const CodecFrameView&) = delete;
+
+    friend class NativeCodecReader;
+    AMediaCodec* mCodec;
+    ssize_t mBufferIndex;
+
+    /**
+     * @brief mBufferToken expires when the codec's buffers become invalid (flush, release)
+     */
+    std::weak_ptr<void> mBufferToken;
+};
+
+
+/**
+ * @brief The DecodedFrame struct is a frame together with its presentation time, as queued by the asynchronous mode.
+ */
+struct DecodedFrame {
+    cv::Mat image;
+    int64 presentationTimeUs;
+
+    DecodedFrame() : presentationTimeUs(-1) {}
+};
+
+
+/**
+ * @brief The MediaPacket struct is one compressed sample of the video track, as read by NativeCodecReader::readPacket().
+ * buffer is reused from call to call and only grows, so reading packets into the same MediaPacket does not allocate.
+ */
+struct MediaPacket {
+    std::vector<uint8_t> buffer;
+    size_t size;                ///< bytes of the sample at the start of buffer
+    int64 presentationTimeUs;
+    bool sync;
+
+    MediaPacket() : size(0), presentationTimeUs(-1), sync(false) {}
+
+    const uint8_t* data() const { return buffer.data(); }
+};
+
+
+/**
+ * @brief The DecoderConfig struct selects the decoder a NativeCodecReader creates.
+ * By default that is the platform's first choice for the video's type, usually a hardware decoder.
+ */
+struct DecoderConfig {
+    string codecName;           ///< a specific decoder, e.g. "c2.android.avc.decoder" (AMediaCodec_createCodecByName), empty for the default
+    bool software;              ///< take the platform's software decoder for the video's type (unless codecName is set), it does not use up hardware instances.
+                                ///< Without one the reader does not open rather than fall back to a hardware decoder
+
+    DecoderConfig() : software(false) {}
+};
+
+
 class NativeCodecReader : public QObject
 {
     Q_OBJECT
 
 public:
     NativeCodecReader(QString filename);
+
+    /**
+     * Reads from source instead of a path: a file range, a memory mapped file or a buffer in memory (see MediaSource).
+     * The sample index of anything but a whole file is built on open and not cached.
+     * decoder picks the decoder. A named one (codecName) that cannot be created falls back to the default, but software mode
+     * never does: without a software decoder for the video's type the reader stays closed, so check isOpen().
+     */
+    NativeCodecReader(const MediaSource& source, const DecoderConfig& decoder = DecoderConfig());
     ~NativeCodecReader();
 
+    /**
+     * @brief isOpen whether a decoder could be created, configured and started.
+     * Hardware decoders are a limited resource, with too many of them around creating another one fails.
+     */
+    bool isOpen() const { return mCodec != nullptr; }
+
+    /**
+     * @brief isFinished whether the decoder handed out its last frame, read() will not return any more
+     * (in asynchronous mode frames may still be queued)
+     */
+    bool isFinished() const { return sawOutputEOS; }
+
     int64 nFrames();
     int64 currentFrame();
     int64 currentTime();
     int64 totalTime();
 
+    /**
+     * Decodes exactly frame frameNumber into mat, the next read() continues after it.
+     * Decoding starts from the closest preceding sync frame, or just goes on if no sync frame lies between the current position
+     * and the target. Frames on the way are decoded but not color converted.
+     */
     bool seek(cv::Mat& mat, int64 frameNumber);
+
+    /**
+     * Decodes count thumbnails spread evenly over the video in a single pass, e.g. for a thumbnail strip or scrub previews.
+     * For each of count equal stretches the sync frame closest to its middle is taken; only those sync samples go to the decoder,
+     * back to back without a flush in between, and each comes out converted straight to size (a height of 0 keeps the aspect ratio).
+     * Output format and region apply as for read(). Videos with fewer sync frames than count yield fewer thumbnails.
+     * Needs the sample index, pull-style decoding only. Afterwards the next read() returns the frame it would have returned before.
+     */
+    bool readThumbnails(int count, const cv::Size& size, std::vector<DecodedFrame>& thumbnails);
+
+    /**
+     * Decodes the next frame into mat. If mat already has the output size and type and nobody else references it,
+     * the frame is converted right into it, otherwise the storage comes from the frame pool.
+     */
     bool read(cv::Mat& mat);
 
-    const static int dst_fps = 30; //TODO read this from codec
+    /**
+     * Like read(), but hands out the luma plane of the next frame without any copy: view.image points into the codec's output buffer.
+     * Pull-style decoding only, bypasses the frame cache.
+     */
+    bool readLumaView(CodecFrameView& view);
+
+    /**
+     * Reads the next compressed sample of the video track in decode order, without decoding it, into packet (see MediaPacket).
+     * Packets come from an extractor of their own, so reading them does not disturb read() / seek() and vice versa.
+     * Returns false at the end of the track. For metadata only (times, sizes, sync flags) sampleIndex() already has everything.
+     */
+    bool readPacket(MediaPacket& packet);
+
+    /**
+     * Like readPacket(MediaPacket&), but into a caller provided buffer. If capacity is too small nothing is read,
+     * size is set to what is needed and false is returned; the same packet comes again on the next call.
+     */
+    bool readPacket(uint8_t* buffer, size_t capacity, size_t& size, int64& presentationTimeUs, bool& sync);
+
+    /**
+     * Moves the packet position to the closest sync sample at or before timeUs.
+     */
+    bool seekPacket(int64 timeUs);
+
+    /**
+     * Selects what read(), seek() and the asynchronous mode produce, FRAME_FORMAT_BGR by default.
+     * FRAME_FORMAT_GRAY returns the luma plane as a single stride aware copy.
+     * Set it before reading / starting the asynchronous mode, it clears the frame cache.
+     */
+    void setOutputFormat(FrameFormat format);
+    FrameFormat outputFormat() const { return mOutputFormat; }
+
+    /**
+     * Restricts the output to region (in frame pixels), an empty rect means the whole frame.
+     * The origin is rounded down to even coordinates. Only the region gets converted, and readLumaView() narrows its view to it.
+     */
+    void setOutputRegion(const cv::Rect& region);
+
+    /**
+     * Scales the output (after cropping to the output region) to size in the same pass as the color conversion,
+     * averaging the covered samples when shrinking. An empty size keeps the size of the region.
+     * Does not apply to readLumaView().
+     */
+    void setOutputSize(const cv::Size& size);
+
+    /**
+     * @brief outputSize size of the frames read() / seek() return with the current region and size settings
+     */
+    cv::Size outputSize() const;
+
+    const static int dst_fps = 30; // fallback if the sample index cannot be built
+
+    /**
+     * Mean frame rate of the video according to the sample index.
+     */
+    double fps();
+
+    /**
+     * Presentation time of the frame most recently returned by read(), -1 before the first one.
+     */
+    int64 lastPresentationTimeUs() const { return mLastPresentationTimeUs; }
+
+    const SampleIndex& sampleIndex() const { return mIndex; }
+
+    /**
+     * Keeps up to budgetBytes of decoded frames around, so going back to recently seen frames needs no decoding (0 disables, the default).
+     * When seek() misses close to the previous frame, the rest of the target's GOP is converted and cached along the way.
+     * Needs the sample index and only applies to pull-style decoding.
+     * Cached frames share their pixels with what read() / seek() return, clone a frame before modifying it.
+     */
+    void setFrameCache(size_t budgetBytes);
+
+    /**
+     * @brief frameCache the decoded frame cache, e.g. for its hit / miss counters
+     */
+    const FrameCache& frameCache() const { return mFrameCache; }
+
+    /**
+     * Replaces the pool output frames are allocated from, e.g. to share one with a NativeCodecWriter.
+     * Set it before reading / starting the asynchronous mode.
+     */
+    void setFramePool(std::shared_ptr<FramePool> pool);
+    std::shared_ptr<FramePool> framePool() const { return mFramePool; }
+
+    /**
+     * Per stage timing of the decode path, off until profiler().setEnabled(true) or profiler().startTrace().
+     * The queue depth is sampled for every frame queued in asynchronous mode.
+     */
+    CodecProfiler& profiler() { return mProfiler; }
+    CodecStats stats() const { return mProfiler.stats(); }
+
+    /**
+     * Receives frames in asynchronous mode. Runs on the codec's callback thread, so it stalls the decoder while it runs.
+     */
+    typedef std::function<void(const cv::Mat& frame, int64 presentationTimeUs)> FrameCallback;
+
+    /**
+     * Switches to asynchronous decoding (API 28), starting at the current extractor position.
+     * Input buffers are filled from the extractor as soon as the codec hands them out. Decoded frames go to callback if given,
+     * otherwise into a queue of queueCapacity frames that read() takes from; frameAvailable() is emitted for every queued frame.
+     * policy decides what happens when the queue is full, BACKPRESSURE_BLOCK stalls the decoder until there is room.
+     * There is no way back to pull-style decoding for this reader.
+     */
+    bool startAsync(size_t queueCapacity = 8, BackpressurePolicy policy = BACKPRESSURE_BLOCK, FrameCallback callback = FrameCallback());
+
+    /**
+     * Stops asynchronous decoding. Frames still queued can be read afterwards.
+     */
+    void stopAsync();
+
+    bool isAsync() const { return mAsync; }
+
+    /**
+     * @brief droppedFrames frames thrown away by the backpressure policy of the asynchronous mode
+     */
+    uint64_t droppedFrames() const;
 
 
 public slots:
     cv::Mat performRead();
 
+signals:
+    void frameAvailable();
+    void decodingFinished();
+
 private:
     AMediaExtractor* mExtractor;
     AMediaFormat* mFormat;
@@ -93,17 +363,92 @@ private:
     bool mMuxerStarted;
     const static int TIMEOUT_USEC = 10000;
 
+    /**
+     * @brief mPacketExtractor separate extractor for readPacket(), opened on first use
+     */
+    AMediaExtractor* mPacketExtractor;
+    size_t mMaxPacketSize;
+
+    /**
+     * Opens mPacketExtractor if needed.
+     */
+    bool openPacketExtractor();
+
+    /**
+     * Size of the sample mPacketExtractor is at, or the largest sample size of the track (mMaxPacketSize) where the API level cannot tell exactly.
+     */
+    size_t packetSize();
+
     int mFPS;
-    QString mFilename;
+    MediaSource mSource;
+    DecoderConfig mDecoderConfig;
     cv::Size mSize;
 
-    bool sawInputEOS;
-    bool sawOutputEOS;
+    /**
+     * @brief sawInputEOS / sawOutputEOS set by the codec thread in asynchronous mode
+     */
+    std::atomic<bool> sawInputEOS;
+    std::atomic<bool> sawOutputEOS;
 
     int64 mTotalTimeBuffer;
 
+    SampleIndex mIndex;
+    int64 mLastPresentationTimeUs;
+
+    /**
+     * @brief mDecoderPresentationTimeUs last frame that came out of the decoder, runs apart from mLastPresentationTimeUs on cache hits
+     */
+    int64 mDecoderPresentationTimeUs;
+
+    FrameCache mFrameCache;
+    std::shared_ptr<FramePool> mFramePool;
+    CodecProfiler mProfiler;
+
+    /**
+     * @brief PREFETCH_DISTANCE how close to the previous frame a seek() has to be to count as scrubbing and prefetch the GOP
+     */
+    const static int PREFETCH_DISTANCE = 2;
+
+    /**
+     * @brief mOutputLayout how decoded frames are laid out in the codec's output buffers
+     */
+    YUVFrameLayout mOutputLayout;
+
+    /**
+     * @brief mFormatMutex guards mFormat, mOutputLayout and mSize, which the codec thread replaces on format changes in asynchronous mode
+     */
+    mutable std::mutex mFormatMutex;
+
+    FrameFormat mOutputFormat;
+    cv::Rect mOutputRegion;
+    cv::Size mOutputSize;
+
+    /**
+     * @brief mBufferToken handed to CodecFrameViews, replaced whenever the codec's output buffers become invalid
+     */
+    std::shared_ptr<void> mBufferToken;
+
+
+    /**
+     * Opens the source and creates the decoder. Returns false if the source could not be opened or has no track format,
+     * the reader stays closed then (isOpen() is false).
+     */
+    bool prepareDecoder();
+
+    /**
+     * Creates, configures and starts mCodec for mime according to mDecoderConfig. Leaves mCodec at nullptr on failure.
+     */
+    void createDecoder(const char* mime);
+
+    /**
+     * Loads the cached sample index or builds (and caches) it by walking the extractor.
+     */
+    void loadSampleIndex();
 
-    void  prepareDecoder();
+    /**
+     * Reads stride, slice height, crop rect and color format from mFormat into mOutputLayout and updates mSize.
+     */
+    void updateOutputLayout();
 
     /**
      * Releases decoder resources.  May be called after partial / failed initialization.
@@ -112,6 +457,51 @@ private:
 
     int64 frame2Time(int64 frameNo);
 
+    /**
+     * One round of pull decoding: queues the next sample if an input buffer is free and takes a decoded frame if there is one.
+     * Frames presented before convertFromUs come out empty, they are not worth a color conversion.
+     * frame comes in as storage to convert into (see read()) and goes out as the converted frame.
+     * Returns true if a frame came out of the decoder.
+     */
+    bool decodeStep(int64 convertFromUs, cv::Mat& frame, int64& presentationTimeUs, CodecFrameView* view = nullptr);
+
+    /**
+     * Resets the decoder after a jump of the extractor and invalidates outstanding CodecFrameViews.
+     */
+    void flushDecoder();
+
+    /**
+     * @brief MAX_IDLE_STEPS how many decode steps in a row may pass without a frame before seek() gives up
+     */
+    const static int MAX_IDLE_STEPS = 500;
+
+    /**
+     * @brief DRAIN_TIMEOUT_MS how long readThumbnails() waits for the frames the decoder still holds after the end of stream
+     */
+    const static int DRAIN_TIMEOUT_MS = 2000;
+
+    /**
+     * Converts a filled output buffer of the codec into frame, in the format / region / size requested (requestedSize overrides the output size if set).
+     * frame is reused if it fits and is writable, otherwise replaced by one from the pool. Comes out empty if the buffer does not fit the output format.
+     */
+    bool convertOutputBuffer(uint8_t* buf, size_t bufsize, const AMediaCodecBufferInfo& info, cv::Mat& frame, const cv::Size& requestedSize = cv::Size());
+
+    bool mAsync;
+    std::atomic<bool> mAsyncRunning;
+    std::unique_ptr<BoundedFrameQueue<DecodedFrame> > mFrameQueue;
+    FrameCallback mFrameCallback;
+    const static int ASYNC_READ_TIMEOUT_MS = 100;
+
+    /**
+     * @brief mExtractorMutex the extractor is driven from the codec thread in asynchronous mode
+     */
+    std::mutex mExtractorMutex;
+
+    static void onAsyncInputAvailable(AMediaCodec* codec, void* userdata, int32_t index);
+    static void onAsyncOutputAvailable(AMediaCodec* codec, void* userdata, int32_t index, AMediaCodecBufferInfo* info);
+    static void onAsyncFormatChanged(AMediaCodec* codec, void* userdata, AMediaFormat* format);
+    static void onAsyncError(AMediaCodec* codec, void* userdata, media_status_t error, int32_t actionCode, const char* detail);
+
 
 };
 
@@ -121,21 +511,265 @@ private:
 
 
 
+/**
+ * @brief The VideoCodec enum lists the encoders NativeCodecWriter can be configured for.
+ * VP8 / VP9 are muxed to webm, AVC / HEVC to mp4.
+ */
+enum VideoCodec {
+    VIDEO_CODEC_AVC,    ///< video/avc, H.264
+    VIDEO_CODEC_HEVC,   ///< video/hevc, H.265
+    VIDEO_CODEC_VP8,    ///< video/x-vnd.on2.vp8
+    VIDEO_CODEC_VP9     ///< video/x-vnd.on2.vp9
+};
+
+/**
+ * @brief The BitrateMode enum mirrors MediaCodecInfo.EncoderCapabilities.BITRATE_MODE_*.
+ */
+enum BitrateMode {
+    BITRATE_MODE_DEFAULT = -1,  ///< leave it to the encoder
+    BITRATE_MODE_CQ = 0,        ///< constant quality, see EncoderConfig::quality
+    BITRATE_MODE_VBR = 1,       ///< variable bitrate around EncoderConfig::bitrate
+    BITRATE_MODE_CBR = 2        ///< constant bitrate, best for streaming
+};
+
+/**
+ * @brief The EncoderConfig struct holds the encoder settings of a NativeCodecWriter.
+ * The defaults are what the writer always used: H.264 at 500 kbit/s with a sync frame every 5 s, everything else up to the encoder.
+ * Hints (-1 / 0 means unset) are passed on as format keys, encoders that do not support one usually ignore it,
+ * but some refuse to configure, so only set what you need.
+ */
+struct EncoderConfig {
+    VideoCodec codec;
+    string codecName;           ///< a specific encoder, e.g. "c2.android.avc.encoder" (AMediaCodec_createCodecByName), empty picks the default for codec
+    int bitrate;                ///< bits per second
+    BitrateMode bitrateMode;
+    int quality;                ///< encoder specific quality for BITRATE_MODE_CQ, -1 unset
+    int profile;                ///< MediaCodecInfo.CodecProfileLevel profile, -1 unset, set level with it
+    int level;                  ///< MediaCodecInfo.CodecProfileLevel level, -1 unset
+    float iFrameInterval;       ///< seconds between sync frames, fractions need API 25 encoders
+    int priority;               ///< 0 realtime, 1 best effort, -1 unset
+    float operatingRate;        ///< frames per second the encoder should be clocked for (can exceed fps for faster than realtime encoding), 0 unset
+    int maxBFrames;             ///< 0 disables B-frames, -1 unset
+    int latency;                ///< frames the encoder may hold back before producing output, -1 unset
+
+    EncoderConfig()
+        : codec(VIDEO_CODEC_AVC),
+          bitrate(500000),
+          bitrateMode(BITRATE_MODE_DEFAULT),
+          quality(-1),
+          profile(-1),
+          level(-1),
+          iFrameInterval(5),
+          priority(-1),
+          operatingRate(0),
+          maxBFrames(-1),
+          latency(-1)
+    {}
+
+    /**
+     * @brief mime mime type of codec
+     */
+    const char* mime() const;
+};
+
+
+/**
+ * @brief The TimestampMode enum selects where the writer's presentation times come from.
+ */
+enum TimestampMode {
+    TIMESTAMP_FRAME_COUNTER,    ///< frame number / fps, the timestamps passed to write() are ignored
+    TIMESTAMP_CALLER            ///< the timestamps passed to write(), relative to the first one (variable frame rate)
+};
+
+
 class NativeCodecWriter: public QObject
 {
     Q_OBJECT
 public:
-    NativeCodecWriter(QString filename, const int fps, const cv::Size& size);
+    NativeCodecWriter(QString filename, const int fps, const cv::Size& size, const EncoderConfig& config = EncoderConfig());
+
+    /**
+     * Finishes a recording that is still going like end() and waitForFinished() would.
+     */
     ~NativeCodecWriter();
 
+    const EncoderConfig& encoderConfig() const { return mConfig; }
+    cv::Size frameSize() const { return mSize; }
+
+    /**
+     * Sets up the frame queue between write() and the encoding thread. Needs to be called before prepareEncoder().
+     * Defaults to 4 frames with BACKPRESSURE_BLOCK.
+     */
+    void setQueue(size_t capacity, BackpressurePolicy policy);
+
+    /**
+     * @brief droppedFrames frames lost so far, thrown away by the backpressure policy or because the encoder had no input buffer for them
+     * (which only happens with the dropping policies)
+     */
+    uint64_t droppedFrames() const;
+
+    /**
+     * Replaces the pool the queued copies of written frames come from, e.g. to share one with a NativeCodecReader.
+     * Needs to be called before prepareEncoder().
+     */
+    void setFramePool(std::shared_ptr<FramePool> pool);
+    std::shared_ptr<FramePool> framePool() const { return mFramePool; }
+
+    /**
+     * Per stage timing of the encode path (queue copy, conversion, codec waits, muxer), off until profiler().setEnabled(true)
+     * or profiler().startTrace(). The queue depth is sampled on every write().
+     */
+    CodecProfiler& profiler() { return mProfiler; }
+    CodecStats stats() const { return mProfiler.stats(); }
+
+    /**
+     * @brief queuedFrames frames waiting for the encoder right now
+     */
+    size_t queuedFrames() const;
+
+    /**
+     * Selects where presentation times come from, TIMESTAMP_FRAME_COUNTER by default. Needs to be called before prepareEncoder().
+     * With TIMESTAMP_CALLER the timestamps passed to write() count ticksPerSecond per second (microseconds by default),
+     * the first frame starts at 0 and times that do not increase are bumped to just after the previous frame, as the muxer requires.
+     */
+    void setTimestampMode(TimestampMode mode, long long ticksPerSecond = 1000000);
+    TimestampMode timestampMode() const { return mTimestampMode; }
+
+    /**
+     * Leaves out frames whose mean absolute luma difference to the previously written frame is at most maxMeanDifference,
+     * sampled on a grid of every DUPLICATE_GRID_STEP-th pixel of every DUPLICATE_GRID_STEP-th row so write() stays cheap
+     * (0 only skips exact duplicates and compares all of the frame, a negative value turns skipping off, the default).
+     * Skipping only applies in TIMESTAMP_CALLER mode, where the previous frame simply stays on screen longer;
+     * after maxSkipped frames in a row one is encoded anyway. If the recording ends on skipped frames, end() encodes
+     * the last written image once more at the time of the last skipped frame, so the video keeps its length.
+     */
+    void setSkipDuplicates(double maxMeanDifference, int maxSkipped = 30);
+    const static int DUPLICATE_GRID_STEP = 8;
+
+    /**
+     * @brief skippedFrames frames left out by setSkipDuplicates() so far
+     */
+    uint64_t skippedFrames() const { return mSkippedFrames; }
+
+    /**
+     * Changes the bitrate of the running encoder (API 26), taking effect with the next frame it encodes.
+     * Returns false if the encoder is not running or the API level does not allow it.
+     * With the adaptive bitrate on, the controller keeps adjusting from there, and the bitrate is clamped to its limits.
+     */
+    bool setBitrate(int bitsPerSecond);
+
+    /**
+     * @brief bitrate the bitrate the encoder currently runs at
+     */
+    int bitrate() const { return mBitrate; }
+
+    /**
+     * Makes the encoder produce a sync frame as soon as possible (API 26), e.g. when a new viewer joins a stream.
+     */
+    bool requestSyncFrame();
+
+    /**
+     * Lets a BitrateController adapt the bitrate to how well encoder and muxer keep up: it is lowered when the frame queue fills up,
+     * frames get dropped or the encoding thread spends most of its time waiting on encoder input buffers or muxer writes,
+     * and raised again while there is headroom. 0 for minBitrate / maxBitrate means a quarter of / the configured bitrate.
+     * Needs to be called before prepareEncoder(), needs API 26. bitrateChanged() is emitted on every change.
+     */
+    void setAdaptiveBitrate(bool enabled, int minBitrate = 0, int maxBitrate = 0);
+
+    /**
+     * Splits the recording into segments of about segmentDurationUs of video and / or segmentBytes of samples (0: no limit),
+     * without stopping the encoder: once a segment is full a sync frame is requested (API 26, otherwise the next regular one is used)
+     * and the muxer is swapped for a new one right before it, so no frame gets lost between segments.
+     * Segment n is written to <name>_<nnn>.<suffix> next to the filename given to the constructor, counting from 0.
+     * segmentFinished() is emitted for every completed segment. Needs to be called before prepareEncoder(), 0 / 0 turns segmenting off.
+     */
+    void setSegmentation(long long segmentDurationUs, long long segmentBytes = 0);
+
+    /**
+     * Receives the encoded samples instead of a muxer: format is the encoder's output format (with the codec config data),
+     * data / info one sample as the encoder handed it out. Runs on the encoding thread, data is only valid during the call.
+     */
+    typedef std::function<void(AMediaFormat* format, const uint8_t* data, const AMediaCodecBufferInfo& info)> PacketSink;
+
+    /**
+     * Hands the encoded samples to sink instead of writing a file, e.g. to mux them together with other streams.
+     * The filename given to the constructor is not used then and segmentation does not apply. Needs to be called before prepareEncoder().
+     */
+    void setPacketSink(PacketSink sink);
+
+    /**
+     * How long end() may take to finish the file: encoding what is still queued, draining the encoder to the end of stream
+     * and finalizing the muxer. Frames not through by then are lost and recordingFinished() reports the recording as incomplete.
+     * Defaults to DEFAULT_FINISH_TIMEOUT_MS.
+     */
+    void setFinishTimeout(int timeoutMs);
+    const static int DEFAULT_FINISH_TIMEOUT_MS = 5000;
+
+    /**
+     * Blocks until the recording ended with end() is finished (recordingFinished() has been emitted).
+     */
+    void waitForFinished();
+
+    /**
+     * Writes a frame that is already YUV 4:2:0, as I420 in an 8 bit single channel Mat laid out by i420Layout(), of the writer's size.
+     * The encoding thread only copies the planes into the encoder's input layout, there is no color conversion.
+     * The frame is queued as it is, without a copy, so it must not be written to afterwards (take a fresh one from a FramePool).
+     */
+    bool writeYUV(const cv::Mat& frame, const long long timestamp);
+
+    /**
+     * @brief i420Layout tightly packed I420 frame of size, the layout writeYUV() expects
+     */
+    static YUVFrameLayout i420Layout(const cv::Size& size);
+
+    /**
+     * @brief i420MatSize size of an 8 bit single channel Mat that holds an I420 frame of size (luma rows followed by the chroma planes)
+     */
+    static cv::Size i420MatSize(const cv::Size& size);
+
 public slots:
     bool write(const cv::Mat& mat, const long long timestamp);
+
+    /**
+     * Ends the recording without blocking: frames written so far still get encoded and the file is finished
+     * on the encoding thread, which emits recordingFinished() when done.
+     */
     void end();
+
+    /**
+     * Starts a recording. Waits for the previous one if it is still finishing, does nothing while one is running.
+     */
     void prepareEncoder();
 
 signals:
+    /**
+     * Emitted from the encoding thread once the file is finished after end().
+     * complete is false if the finish timeout cut the recording short, tailFrames is the number of frames
+     * that were written to the file after end() was called, elapsedMs the time finishing took.
+     */
+    void recordingFinished(bool complete, int tailFrames, long long elapsedMs);
+
+    /**
+     * Emitted right after recordingFinished(bool, int, long long), for connections that do not need the details.
+     */
     void recordingFinished();
 
+    /**
+     * Emitted from the encoding thread when a new bitrate took effect.
+     */
+    void bitrateChanged(int bitsPerSecond);
+
+    /**
+     * Emitted when a segment file is complete (see setSegmentation()), from the encoding thread or end().
+     */
+    void segmentFinished(QString filename, int index, long long durationUs, long long bytes);
+
+    /**
+     * Emitted from the encoding thread when the muxer of a new segment could not be started. The recording stops right away,
+     * write() refuses further frames and recordingFinished() follows with complete set to false. Segments finished before are intact.
+     */
+    void recordingFailed(QString reason);
+
 
 private:
     AMediaCodec* mEncoder;
@@ -148,6 +782,17 @@ private:
     QString mFilename;
     int mFPS;
     cv::Size mSize;
+    EncoderConfig mConfig;
+
+    /**
+     * @brief mColorFormat color format the encoder is configured for (MediaCodecInfo.CodecCapabilities)
+     */
+    int mColorFormat;
+
+    /**
+     * @brief mInputLayout how the encoder expects frames in its input buffers
+     */
+    YUVFrameLayout mInputLayout;
 
     /**
      * @brief mFrameCounter We need to count frames written in order to be able to compute a presentation time for each frame
@@ -157,7 +802,192 @@ private:
     /**
      * @brief isRunning has the preparation code been run and not reset?
      */
-    bool isRunning;
+    std::atomic<bool> isRunning;
+
+    TimestampMode mTimestampMode;
+    long long mTicksPerSecond;
+
+    /**
+     * @brief mFirstTimestamp caller timestamp presentation times are relative to, -1 until the first frame
+     */
+    long long mFirstTimestamp;
+    long long mLastPresentationTimeUs;
+
+    double mDuplicateThreshold;
+    int mMaxSkipped;
+    int mSkippedInRow;
+    std::atomic<uint64_t> mSkippedFrames;
+
+    /**
+     * @brief mPreviousFrame last frame queued for encoding (shared with the queue, not a copy) and the timestamp of the last skipped one
+     */
+    cv::Mat mPreviousFrame;
+    long long mLastSkippedTimestamp;
+
+    /**
+     * Checks mat (I420 if yuv) against mPreviousFrame with the setSkipDuplicates() threshold.
+     */
+    bool isDuplicate(const cv::Mat& mat, bool yuv) const;
+
+    std::atomic<int> mBitrate;
+
+    /**
+     * @brief mRequestedBitrate / mSyncFrameRequested parameter changes waiting for the encoding thread, -1 / false if none.
+     * mManualBitrate is one from setBitrate(), which the bitrate controller has to take over, mRequestedBitrate one of the controller's.
+     */
+    std::atomic<int> mRequestedBitrate;
+    std::atomic<int> mManualBitrate;
+    std::atomic<bool> mSyncFrameRequested;
+
+    bool mAdaptiveBitrate;
+    int mMinBitrate;
+    int mMaxBitrate;
+    BitrateController mBitrateController;
+
+    /**
+     * @brief mDroppedSeen / mBusyUs what the bitrate controller has not been told yet, encoding thread only
+     */
+    uint64_t mDroppedSeen;
+    double mBusyUs;
+
+    /**
+     * Hands pending bitrate / sync frame requests to the encoder, called on the encoding thread before each frame.
+     */
+    void applyParameters();
+
+    /**
+     * Feeds the bitrate controller with the observations for the frame just encoded (or lost).
+     */
+    void updateAdaptiveBitrate(bool frameLost);
+
+    /**
+     * @brief mOutputFormat the encoder's output format, kept to set up the muxers of later segments
+     */
+    AMediaFormat* mOutputFormat;
+
+    long long mSegmentDurationUs;
+    long long mSegmentBytes;
+    int mSegmentIndex;
+    QString mSegmentFilename;
+    long long mSegmentStartUs;
+    long long mSegmentLastUs;
+    long long mSegmentWrittenBytes;
+
+    /**
+     * @brief mSegmentFrameDeltaUs last measured distance between consecutive samples, the duration of a segment's last frame (-1: none yet)
+     */
+    long long mSegmentFrameDeltaUs;
+
+    /**
+     * @brief mSegmentFull the current segment reached its limit, the next sync frame starts a new one
+     */
+    bool mSegmentFull;
+
+    PacketSink mPacketSink;
+
+    bool isSegmented() const { return !mPacketSink && (mSegmentDurationUs > 0 || mSegmentBytes > 0); }
+    QString segmentFilename(int index) const;
+
+    /**
+     * Creates a muxer writing to filename, nullptr on failure.
+     */
+    AMediaMuxer* createMuxer(const QString& filename);
+
+    /**
+     * Finishes the current segment and continues in a new file, whose first sample is the next sync frame.
+     * Returns false if the new muxer could not be started, the recording is stopped then (see recordingFailed()).
+     */
+    bool startNextSegment();
+
+    /**
+     * Stops and deletes the muxer. If segmenting, reports the segment as finished.
+     */
+    void finishMuxer();
+
+    /**
+     * @brief The PendingFrame struct is a copy of a written frame waiting for the encoding thread.
+     */
+    struct PendingFrame {
+        cv::Mat image;
+        long long timestamp;
+        bool yuv;           ///< image is I420 (writeYUV()), not BGR / gray
+
+        PendingFrame() : timestamp(0), yuv(false) {}
+    };
+
+    /**
+     * Skips duplicates and queues image for the encoding thread, as a copy from the pool unless it is shared read only (yuv).
+     */
+    bool queueFrame(const cv::Mat& image, const long long timestamp, bool yuv);
+
+    size_t mQueueCapacity;
+    BackpressurePolicy mQueuePolicy;
+    std::unique_ptr<BoundedFrameQueue<PendingFrame> > mFrameQueue;
+
+    /**
+     * @brief mEncoderDroppedFrames frames the encoding thread took from the queue but could not hand to the encoder
+     */
+    std::atomic<uint64_t> mEncoderDroppedFrames;
+
+    /**
+     * @brief mSpareInputBuffer input buffer taken for a frame that did not fit into it, -1 if none.
+     * The codec cannot take a buffer back unqueued, so it is used for the next frame (or the end of stream) instead of dequeuing another.
+     */
+    ssize_t mSpareInputBuffer;
+    std::shared_ptr<FramePool> mFramePool;
+    CodecProfiler mProfiler;
+    std::thread mEncodingThread;
+    const static int QUEUE_POLL_MS = 10;
+
+    /**
+     * Runs on mEncodingThread: feeds queued frames to the encoder and its output to the muxer until the queue is closed and empty.
+     */
+    void encodingLoop();
+
+    /**
+     * Converts one frame (or copies the planes of an I420 one) into an encoder input buffer and queues it.
+     * With BACKPRESSURE_BLOCK it waits for an input buffer as long as the recording goes on, otherwise the frame is dropped
+     * when the encoder has none. Returns false and counts the frame as dropped if it did not get to the encoder.
+     */
+    bool encodeFrame(const PendingFrame& frame);
+
+    /**
+     * The encoding thread should give up on frames: end() ran out of time or the queue was closed without end().
+     */
+    bool encodingAbandoned() const;
+
+    /**
+     * Closes the frame queue and waits for the encoding thread to work through it.
+     */
+    void stopEncodingThread();
+
+    /**
+     * @brief mEndRequested end() has been called, the encoding thread finishes the recording once the queue is empty
+     */
+    std::atomic<bool> mEndRequested;
+
+    /**
+     * @brief mMuxerFailed nothing can be written any more, the encoding thread stops without finishing the file
+     */
+    std::atomic<bool> mMuxerFailed;
+    std::chrono::steady_clock::time_point mEndTime;
+    std::chrono::steady_clock::time_point mFinishDeadline;
+    int mFinishTimeoutMs;
+
+    /**
+     * @brief mTailFrames samples muxed since end() was called
+     */
+    int mTailFrames;
+
+    /**
+     * Runs on the encoding thread after end(): sends the end of stream, drains the encoder, releases everything and emits recordingFinished().
+     */
+    void finishRecording();
+
+    /**
+     * Queues an empty input buffer flagged end of stream, waiting for a free input buffer until the finish deadline.
+     */
+    bool queueEndOfStream();
 
 
 
@@ -168,8 +998,9 @@ private:
      * If endOfStream is not set, this returns when there is no more data to drain.  If it
      * is set, we send EOS to the encoder, and then iterate until we see EOS on the output.
      * Calling this with endOfStream set should be done once, right before stopping the muxer.
+     * Waiting for the end of stream gives up at the finish deadline. Returns whether the end of stream came out.
      */
-    void drainEncoder(bool endOfStream);
+    bool drainEncoder(bool endOfStream);
 
     /**
      * Releases encoder resources.  May be called after partial / failed initialization.
@@ -177,9 +1008,15 @@ private:
     void releaseEncoder();
 
     /**
-     * Generates the presentation time for frame N, in nanoseconds.
+     * Queries stride and slice height the started encoder expects and updates mInputLayout.
+     */
+    void updateInputLayout();
+
+    /**
+     * Generates the presentation time of the next frame, in microseconds, from the frame counter or timestamp (see setTimestampMode()).
+     * A negative timestamp stands for none, e.g. for the end of stream buffer, which then lands one frame after the previous one.
      */
-    long long computePresentationTimeNsec();
+    long long computePresentationTimeUs(long long timestamp);
 
 
 };
@@ -0,0 +1,322 @@
+#include "paralleltranscoder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <thread>
+
+#include <QDebug>
+#include <QFile>
+
+#include "codecprobe.h"
+#include "decodescheduler.h"
+
+
+// sample buffer size for indexing if the track does not tell its maximum
+static const size_t DEFAULT_SAMPLE_BUFFER = 4 * 1024 * 1024;
+
+// codec config data keys of an output format, H.264 puts SPS / PPS in the first two, HEVC everything in the first
+static const char* CODEC_CONFIG_KEYS[] = {"csd-0", "csd-1", "csd-2"};
+
+
+ParallelTranscoder::ParallelTranscoder(const MediaSource& input, const EncoderConfig& config)
+    :mInput(input),
+      mConfig(config),
+      mFps(NativeCodecReader::dst_fps),
+      mInstances(0),
+      mSegmentDurationUs(0),
+      mNextSegment(0),
+      mMuxedSegments(0),
+      mAhead(0),
+      mFailed(false)
+{
+    AMediaExtractor* extractor = AMediaExtractor_new();
+    if(extractor == nullptr || mInput.attach(extractor) != AMEDIA_OK){
+        qWarning() << "Unable to open" << mInput.description() << "for transcoding";
+        if(extractor != nullptr){
+            AMediaExtractor_delete(extractor);
+        }
+        return;
+    }
+
+    // the reader decodes the first track, so that is the one to plan with
+    const int track = 0;
+    AMediaFormat* format = AMediaExtractor_getTrackFormat(extractor, track);
+    int32_t width = 0;
+    int32_t height = 0;
+    int32_t maxInputSize = 0;
+    if(format != nullptr){
+        AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_WIDTH, &width);
+        AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_HEIGHT, &height);
+        if(!AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_MAX_INPUT_SIZE, &maxInputSize) || maxInputSize <= 0){
+            maxInputSize = DEFAULT_SAMPLE_BUFFER;
+        }
+        AMediaFormat_delete(format);
+    }
+    mOutputSize = cv::Size(width, height);
+
+    AMediaExtractor_selectTrack(extractor, track);
+    if(!mInput.isPlainFile() || !mIndex.load(mInput.path(), track)){
+        if(mIndex.build(extractor, maxInputSize) && mInput.isPlainFile()){
+            mIndex.save(mInput.path(), track);
+        }
+    }
+    AMediaExtractor_delete(extractor);
+
+    if(mIndex.empty()){
+        qWarning() << "Unable to index" << mInput.description();
+        return;
+    }
+    if(mIndex.averageFps() > 0){
+        mFps = static_cast<int>(std::lround(mIndex.averageFps()));
+    }
+}
+
+void ParallelTranscoder::setInstances(int instances){
+    mInstances = std::max(instances, 0);
+}
+
+void ParallelTranscoder::setSegmentDuration(int64 durationUs){
+    mSegmentDurationUs = std::max<int64>(durationUs, 0);
+}
+
+void ParallelTranscoder::setOutputSize(const cv::Size& size){
+    mOutputSize = size;
+}
+
+int ParallelTranscoder::probeHardwareEncoders(const EncoderConfig& config, const cv::Size& size, int maxInstances){
+    AMediaFormat* format = AMediaFormat_new();
+    AMediaFormat_setString(format, AMEDIAFORMAT_KEY_MIME, config.mime());
+    AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_WIDTH, size.width);
+    AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_HEIGHT, size.height);
+    AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_COLOR_FORMAT, 21); // COLOR_FormatYUV420SemiPlanar, as NativeCodecWriter asks for
+    AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_BIT_RATE, config.bitrate);
+    AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_FRAME_RATE, NativeCodecReader::dst_fps);
+    AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_I_FRAME_INTERVAL, std::max(static_cast<int>(config.iFrameInterval), 1));
+
+    const int instances = probeHardwareCodecs(format, AMEDIACODEC_CONFIGURE_FLAG_ENCODE, maxInstances, config.codecName);
+    AMediaFormat_delete(format);
+    return instances;
+}
+
+void ParallelTranscoder::planSegments(int instances){
+    mSegments.clear();
+    int64 durationUs = mSegmentDurationUs;
+    if(durationUs == 0){
+        const int64 minimumUs = MIN_SEGMENT_US;
+        durationUs = std::max(minimumUs, mIndex.durationUs() / (instances * SEGMENTS_PER_INSTANCE));
+    }
+
+    const int64 frames = mIndex.frameCount();
+    int64 first = 0;
+    while(first < frames){
+        // the segment runs at least durationUs, up to the next sync frame
+        const int64 target = mIndex.frameAt(mIndex.frameTime(first) + durationUs);
+        Segment segment;
+        segment.firstFrame = first;
+        segment.endFrame = mIndex.syncFrameAfter(std::max(target - 1, first));
+        segment.startUs = mIndex.frameTime(first) - mIndex.frameTime(0);
+        segment.done = false;
+        segment.ok = false;
+        mSegments.push_back(std::move(segment));
+        first = mSegments.back().endFrame;
+    }
+}
+
+bool ParallelTranscoder::transcode(const QString& outputFilename){
+    mStats = TranscodeStats();
+    if(!isOpen() || mOutputSize.area() <= 0){
+        qWarning() << "Nothing to transcode";
+        return false;
+    }
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    int instances = mInstances;
+    if(instances == 0){
+        // every instance holds a decoder and an encoder, whichever runs out first sets the limit
+        const int decoders = DecodeScheduler::probeHardwareDecoders(mInput, std::max<int>(std::thread::hardware_concurrency(), 1));
+        const int encoders = probeHardwareEncoders(mConfig, mOutputSize, std::max(decoders, 1));
+        qDebug() << "Probed" << decoders << "decoder and" << encoders << "encoder instances";
+        instances = std::max(std::min(decoders, encoders), 1);
+    }
+    planSegments(instances);
+    instances = std::min<int>(instances, mSegments.size());
+    mStats.segments = static_cast<int>(mSegments.size());
+    mStats.instances = instances;
+    qDebug() << "Transcoding" << mSegments.size() << "segments on" << instances << "instances";
+
+    QFile outFile(outputFilename);
+    if(!outFile.open(QIODevice::WriteOnly)){
+        qWarning() << "Cannot open file: " << outputFilename;
+        return false;
+    }
+    const bool webm = mConfig.codec == VIDEO_CODEC_VP8 || mConfig.codec == VIDEO_CODEC_VP9;
+    AMediaMuxer* muxer = AMediaMuxer_new(outFile.handle(), webm ? AMEDIAMUXER_OUTPUT_FORMAT_WEBM : AMEDIAMUXER_OUTPUT_FORMAT_MPEG_4);
+    if(muxer == nullptr){
+        qWarning() << "Unable to create Muxer";
+        return false;
+    }
+
+    mNextSegment = 0;
+    mMuxedSegments = 0;
+    mAhead = static_cast<size_t>(instances * AHEAD_PER_INSTANCE);
+    mFailed = false;
+    std::vector<std::thread> workers;
+    for(int i = 0; i < instances; i++){
+        workers.emplace_back(&ParallelTranscoder::runWorker, this);
+    }
+
+    // mux in order while the workers go on
+    ssize_t track = -1;
+    bool ok = true;
+    for(size_t i = 0; i < mSegments.size() && ok; i++){
+        Segment& segment = mSegments[i];
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mChanged.wait(lock, [&]{ return segment.done || mFailed; });
+            ok = segment.done && segment.ok;
+        }
+        ok = ok && muxSegment(muxer, track, segment);
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        mMuxedSegments = i + 1;
+        mFailed = mFailed || !ok;
+        mChanged.notify_all();
+    }
+
+    for(std::thread& worker : workers){
+        worker.join();
+    }
+    if(track >= 0){
+        AMediaMuxer_stop(muxer);
+    }
+    AMediaMuxer_delete(muxer);
+
+    mStats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    qDebug() << "Transcoded" << mStats.frames << "frames in" << mStats.seconds << "s," << mStats.framesPerSecond() << "fps";
+    return ok;
+}
+
+void ParallelTranscoder::runWorker(){
+    std::unique_ptr<NativeCodecReader> reader;
+    while(true){
+        Segment* segment = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            // do not run too far ahead of the muxer, finished segments wait in memory
+            mChanged.wait(lock, [&]{ return mFailed || mNextSegment >= mSegments.size() || mNextSegment < mMuxedSegments + mAhead; });
+            if(mFailed || mNextSegment >= mSegments.size()){
+                return;
+            }
+            segment = &mSegments[mNextSegment++];
+        }
+
+        if(!reader){
+            reader.reset(new NativeCodecReader(mInput));
+        }
+        const bool ok = reader->isOpen() && transcodeSegment(*reader, *segment);
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        segment->done = true;
+        segment->ok = ok;
+        mFailed = mFailed || !ok;
+        mChanged.notify_all();
+    }
+}
+
+bool ParallelTranscoder::transcodeSegment(NativeCodecReader& reader, Segment& segment){
+    NativeCodecWriter writer(QString(), mFps, mOutputSize, mConfig);
+    writer.setTimestampMode(TIMESTAMP_CALLER, 1000000);
+    writer.setFramePool(reader.framePool());
+    writer.setPacketSink([&segment](AMediaFormat* format, const uint8_t* data, const AMediaCodecBufferInfo& info){
+        if(segment.samples.empty() && format != nullptr){
+            const char* mime = nullptr;
+            if(AMediaFormat_getString(format, AMEDIAFORMAT_KEY_MIME, &mime)){
+                segment.mime = mime;
+            }
+            for(const char* key : CODEC_CONFIG_KEYS){
+                void* config = nullptr;
+                size_t size = 0;
+                if(!AMediaFormat_getBuffer(format, key, &config, &size)){
+                    break;
+                }
+                segment.codecConfig.emplace_back(static_cast<uint8_t*>(config), static_cast<uint8_t*>(config) + size);
+            }
+        }
+        AMediaCodecBufferInfo sample = info;
+        sample.offset = static_cast<int32_t>(segment.data.size());
+        segment.data.insert(segment.data.end(), data, data + info.size);
+        segment.samples.push_back(sample);
+    });
+    reader.setOutputSize(mOutputSize);
+    writer.prepareEncoder();
+
+    cv::Mat frame;
+    bool ok = reader.seek(frame, segment.firstFrame);
+    int64 frames = 0;
+    for(int64 n = segment.firstFrame; ok && n < segment.endFrame; n++){
+        if(n > segment.firstFrame){
+            ok = false;
+            for(int attempt = 0; attempt < MAX_READ_ATTEMPTS && !ok; attempt++){
+                ok = reader.read(frame);
+            }
+        }
+        if(ok){
+            writer.write(frame, reader.lastPresentationTimeUs());
+            frames++;
+        }
+    }
+    writer.end();
+    writer.waitForFinished();
+
+    if(!ok){
+        qWarning() << "Decoding frames" << segment.firstFrame << "-" << segment.endFrame << "failed";
+        return false;
+    }
+    if(static_cast<int64>(segment.samples.size()) != frames){
+        qWarning() << "Segment at frame" << segment.firstFrame << "has" << segment.samples.size() << "samples for" << frames << "frames";
+        return false;
+    }
+    return true;
+}
+
+bool ParallelTranscoder::muxSegment(AMediaMuxer* muxer, ssize_t& track, Segment& segment){
+    if(track < 0){
+        AMediaFormat* format = AMediaFormat_new();
+        AMediaFormat_setString(format, AMEDIAFORMAT_KEY_MIME, segment.mime.empty() ? mConfig.mime() : segment.mime.c_str());
+        AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_WIDTH, mOutputSize.width);
+        AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_HEIGHT, mOutputSize.height);
+        for(size_t i = 0; i < segment.codecConfig.size(); i++){
+            AMediaFormat_setBuffer(format, CODEC_CONFIG_KEYS[i], segment.codecConfig[i].data(), segment.codecConfig[i].size());
+        }
+        track = AMediaMuxer_addTrack(muxer, format);
+        AMediaFormat_delete(format);
+        if(track < 0 || AMediaMuxer_start(muxer) != AMEDIA_OK){
+            qWarning() << "Unable to start the muxer";
+            track = -1;
+            return false;
+        }
+    }
+    else if(segment.codecConfig != mSegments.front().codecConfig){
+        // players only read the track's config data and would show garbage for this segment
+        qWarning() << "Encoder of segment at frame" << segment.firstFrame << "came up with different codec config data";
+        mStats.configMismatches++;
+        return false;
+    }
+
+    for(AMediaCodecBufferInfo& sample : segment.samples){
+        sample.presentationTimeUs += segment.startUs;
+        if(AMediaMuxer_writeSampleData(muxer, track, segment.data.data(), &sample) != AMEDIA_OK){
+            qWarning() << "Unable to write a sample at" << sample.presentationTimeUs;
+            return false;
+        }
+        mStats.frames++;
+    }
+
+    // done with it, keep memory bounded
+    std::vector<uint8_t>().swap(segment.data);
+    std::vector<AMediaCodecBufferInfo>().swap(segment.samples);
+    return true;
+}
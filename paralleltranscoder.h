@@ -0,0 +1,171 @@
+#ifndef PARALLELTRANSCODER_H
+#define PARALLELTRANSCODER_H
+
+/*
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * ParallelTranscoder re-encodes a whole video offline on several codec instances at once.
+ * The input is split at sync frames into segments of a few GOPs; every worker decodes segments with a NativeCodecReader
+ * of its own and encodes each one with a fresh NativeCodecWriter, whose samples go to memory (see NativeCodecWriter::setPacketSink())
+ * instead of a file. Segments are muxed into the single output file in order as soon as they are complete,
+ * shifted to their place on the timeline, so with N instances the wall clock time drops to about 1 / N.
+ * Each segment starts with a sync frame of its own encoder; all encoders get the same configuration,
+ * so their codec config data (SPS / PPS) matches and the segments join into one track. A segment whose encoder comes up with
+ * different config data would not play, transcode() fails then (see TranscodeStats).
+ * Memory use is bounded: workers stay at most a couple of segments per instance ahead of the muxer.
+ * Audio is not copied.
+ */
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include <QString>
+
+#include <opencv2/opencv.hpp>
+
+#include "media/NdkMediaCodec.h"
+#include "media/NdkMediaFormat.h"
+#include "media/NdkMediaMuxer.h"
+
+#include "mediasource.h"
+#include "nativecodecvideo.h"
+#include "sampleindex.h"
+
+
+/**
+ * @brief The TranscodeStats struct describes the last ParallelTranscoder::transcode().
+ */
+struct TranscodeStats {
+    int segments;
+    int instances;
+    uint64_t frames;            ///< encoded samples written to the output
+    double seconds;
+    int configMismatches;       ///< segments whose encoder came up with different codec config data than the first one, transcode() stops at the first
+
+    TranscodeStats() : segments(0), instances(0), frames(0), seconds(0), configMismatches(0) {}
+
+    double framesPerSecond() const { return seconds > 0 ? frames / seconds : 0; }
+};
+
+
+class ParallelTranscoder
+{
+public:
+    ParallelTranscoder(const MediaSource& input, const EncoderConfig& config = EncoderConfig());
+
+    /**
+     * @brief isOpen whether the input could be opened and its video track indexed
+     */
+    bool isOpen() const { return !mIndex.empty(); }
+
+    const SampleIndex& sampleIndex() const { return mIndex; }
+
+    /**
+     * Segments transcoded at the same time, each needing a decoder and an encoder.
+     * 0 (the default) probes the hardware decoder and encoder instances (see DecodeScheduler::probeHardwareDecoders()
+     * and probeHardwareEncoders()) and takes the smaller count, at most one per core.
+     */
+    void setInstances(int instances);
+
+    /**
+     * Counts the hardware encoders for config the platform lets exist at once at size, by creating and starting them
+     * until it refuses (or hands out a software one), at most maxInstances. All of them are released again.
+     */
+    static int probeHardwareEncoders(const EncoderConfig& config, const cv::Size& size, int maxInstances);
+
+    /**
+     * Minimum length of a segment, it ends at the next sync frame after that.
+     * 0 (the default) splits the video into SEGMENTS_PER_INSTANCE segments per instance, at least MIN_SEGMENT_US each.
+     */
+    void setSegmentDuration(int64 durationUs);
+
+    /**
+     * Size of the output, the input's size by default.
+     */
+    void setOutputSize(const cv::Size& size);
+
+    /**
+     * Transcodes the video track into outputFilename (webm for VP8 / VP9, mp4 otherwise), blocks until done.
+     */
+    bool transcode(const QString& outputFilename);
+
+    TranscodeStats stats() const { return mStats; }
+
+    const static int SEGMENTS_PER_INSTANCE = 4;
+    const static int64 MIN_SEGMENT_US = 1000000;
+
+    /**
+     * @brief AHEAD_PER_INSTANCE how many segments per instance workers may finish ahead of the one the muxer waits for
+     */
+    const static int AHEAD_PER_INSTANCE = 2;
+
+    /**
+     * @brief MAX_READ_ATTEMPTS read() is polled, give up on a frame after this many empty calls
+     */
+    const static int MAX_READ_ATTEMPTS = 1000;
+
+private:
+    /**
+     * @brief The Segment struct is a range of frames (presentation order) starting at a sync frame, and what its encoder made of it.
+     */
+    struct Segment {
+        int64 firstFrame;
+        int64 endFrame;                             ///< first frame of the next segment
+        int64 startUs;                              ///< where the segment goes on the output timeline
+
+        std::vector<uint8_t> data;                  ///< encoded samples back to back
+        std::vector<AMediaCodecBufferInfo> samples; ///< offsets into data, times relative to the segment's start
+        std::vector<std::vector<uint8_t> > codecConfig;     ///< csd-0, csd-1, ... of the encoder's output format
+        std::string mime;
+        bool done;
+        bool ok;
+    };
+
+    MediaSource mInput;
+    EncoderConfig mConfig;
+    SampleIndex mIndex;
+    int mFps;
+    cv::Size mOutputSize;
+    int mInstances;
+    int64 mSegmentDurationUs;
+
+    std::vector<Segment> mSegments;
+    std::mutex mMutex;
+    std::condition_variable mChanged;
+    size_t mNextSegment;
+    size_t mMuxedSegments;
+    size_t mAhead;
+    bool mFailed;
+
+    TranscodeStats mStats;
+
+    void planSegments(int instances);
+    void runWorker();
+
+    /**
+     * Decodes the frames of segment with reader and encodes them into the segment's samples.
+     */
+    bool transcodeSegment(NativeCodecReader& reader, Segment& segment);
+
+    /**
+     * Writes the samples of segment to muxer, starting it with the segment's format if this is the first one.
+     */
+    bool muxSegment(AMediaMuxer* muxer, ssize_t& track, Segment& segment);
+};
+
+#endif // PARALLELTRANSCODER_H
@@ -0,0 +1,276 @@
+#include "sampleindex.h"
+
+#include <algorithm>
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+
+namespace {
+
+const quint32 INDEX_MAGIC = 0x4953434e; // "NCSI"
+const quint32 INDEX_VERSION = 1;
+
+/**
+ * How far frameAt() walks from its frame rate based guess before it falls back to a binary search.
+ */
+const int MAX_GUESS_STEPS = 8;
+
+#pragma pack(push, 1)
+struct IndexHeader {
+    quint32 magic;
+    quint32 version;
+    qint64 videoSize;
+    qint64 videoModified;
+    qint32 trackIndex;
+    quint32 sampleCount;
+    qint64 firstPresentationTimeUs;
+};
+
+// Timestamps are stored relative to the previous sample, which keeps an entry at 9 bytes.
+struct PackedSample {
+    qint32 presentationTimeDelta;
+    quint32 size;
+    quint8 flags;
+};
+#pragma pack(pop)
+
+} // namespace
+
+
+SampleIndex::SampleIndex()
+{
+}
+
+bool SampleIndex::build(AMediaExtractor* extractor, size_t maxSampleSize){
+    clear();
+    if(extractor == nullptr){
+        return false;
+    }
+
+    AMediaExtractor_seekTo(extractor, 0, AMEDIAEXTRACTOR_SEEK_PREVIOUS_SYNC);
+#if __ANDROID_API__ < 28
+    // Without AMediaExtractor_getSampleSize we have to read the data to learn its size.
+    std::vector<uint8_t> scratch(maxSampleSize);
+#else
+    Q_UNUSED(maxSampleSize);
+#endif
+
+    while(true){
+        Sample sample;
+        sample.presentationTimeUs = AMediaExtractor_getSampleTime(extractor);
+        if(sample.presentationTimeUs < 0){
+            break;
+        }
+#if __ANDROID_API__ >= 28
+        ssize_t size = AMediaExtractor_getSampleSize(extractor);
+#else
+        ssize_t size = AMediaExtractor_readSampleData(extractor, scratch.data(), scratch.size());
+#endif
+        if(size < 0){
+            break;
+        }
+        sample.size = static_cast<uint32_t>(size);
+        sample.flags = AMediaExtractor_getSampleFlags(extractor);
+        mSamples.push_back(sample);
+
+        // advance() is not reliable about reporting the end, the sample time is
+        if(!AMediaExtractor_advance(extractor) && AMediaExtractor_getSampleTime(extractor) == sample.presentationTimeUs){
+            break;
+        }
+    }
+
+    AMediaExtractor_seekTo(extractor, 0, AMEDIAEXTRACTOR_SEEK_PREVIOUS_SYNC);
+    finish();
+    qDebug() << "Indexed" << mSamples.size() << "samples," << mSyncFrames.size() << "sync frames";
+    return !mSamples.empty();
+}
+
+bool SampleIndex::load(const QString& videoPath, int trackIndex){
+    clear();
+
+    QFileInfo videoInfo(videoPath);
+    QFile file(cachePath(videoPath, trackIndex));
+    if(!videoInfo.exists() || !file.open(QIODevice::ReadOnly)){
+        return false;
+    }
+
+    IndexHeader header;
+    if(file.read(reinterpret_cast<char*>(&header), sizeof(header)) != sizeof(header)
+            || header.magic != INDEX_MAGIC || header.version != INDEX_VERSION
+            || header.videoSize != videoInfo.size()
+            || header.videoModified != videoInfo.lastModified().toMSecsSinceEpoch()
+            || header.trackIndex != trackIndex){
+        return false;
+    }
+
+    // the count comes from the file, check it against the file before allocating for it
+    const qint64 bytes = static_cast<qint64>(header.sampleCount) * static_cast<qint64>(sizeof(PackedSample));
+    if(bytes != file.size() - static_cast<qint64>(sizeof(IndexHeader))){
+        qWarning() << "Sample index cache of" << videoPath << "does not match its sample count";
+        return false;
+    }
+    std::vector<PackedSample> packed(header.sampleCount);
+    if(file.read(reinterpret_cast<char*>(packed.data()), bytes) != bytes){
+        qWarning() << "Sample index cache of" << videoPath << "is truncated";
+        return false;
+    }
+
+    mSamples.resize(packed.size());
+    int64_t presentationTimeUs = header.firstPresentationTimeUs;
+    for(size_t i = 0; i < packed.size(); i++){
+        presentationTimeUs += packed[i].presentationTimeDelta;
+        mSamples[i].presentationTimeUs = presentationTimeUs;
+        mSamples[i].size = packed[i].size;
+        mSamples[i].flags = packed[i].flags;
+    }
+    finish();
+    return !mSamples.empty();
+}
+
+bool SampleIndex::save(const QString& videoPath, int trackIndex) const{
+    if(mSamples.empty()){
+        return false;
+    }
+
+    QFileInfo videoInfo(videoPath);
+    IndexHeader header;
+    header.magic = INDEX_MAGIC;
+    header.version = INDEX_VERSION;
+    header.videoSize = videoInfo.size();
+    header.videoModified = videoInfo.lastModified().toMSecsSinceEpoch();
+    header.trackIndex = trackIndex;
+    header.sampleCount = static_cast<quint32>(mSamples.size());
+    header.firstPresentationTimeUs = mSamples.front().presentationTimeUs;
+
+    std::vector<PackedSample> packed(mSamples.size());
+    int64_t previous = header.firstPresentationTimeUs;
+    for(size_t i = 0; i < mSamples.size(); i++){
+        int64_t delta = mSamples[i].presentationTimeUs - previous;
+        if(delta > INT32_MAX || delta < INT32_MIN){
+            qWarning() << "Sample times of" << videoPath << "are too far apart to be cached";
+            return false;
+        }
+        packed[i].presentationTimeDelta = static_cast<qint32>(delta);
+        packed[i].size = mSamples[i].size;
+        packed[i].flags = static_cast<quint8>(mSamples[i].flags);
+        previous = mSamples[i].presentationTimeUs;
+    }
+
+    QString path = cachePath(videoPath, trackIndex);
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    QSaveFile file(path);
+    if(!file.open(QIODevice::WriteOnly)){
+        qWarning() << "Cannot write sample index cache" << path;
+        return false;
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(packed.data()), static_cast<qint64>(packed.size() * sizeof(PackedSample)));
+    return file.commit();
+}
+
+void SampleIndex::clear(){
+    mSamples.clear();
+    mFrameTimes.clear();
+    mSyncFrames.clear();
+}
+
+int64_t SampleIndex::frameTime(int64_t frameNo) const{
+    if(mFrameTimes.empty()){
+        return -1;
+    }
+    frameNo = std::max<int64_t>(0, std::min<int64_t>(frameNo, frameCount() - 1));
+    return mFrameTimes[frameNo];
+}
+
+int64_t SampleIndex::frameAt(int64_t timeUs) const{
+    if(mFrameTimes.empty() || timeUs <= mFrameTimes.front()){
+        return 0;
+    }
+    const int64_t last = frameCount() - 1;
+    if(timeUs >= mFrameTimes.back()){
+        return last;
+    }
+
+    // Guess from the mean frame interval (exact for constant frame rates) and walk to the right frame.
+    const int64_t span = mFrameTimes.back() - mFrameTimes.front();
+    int64_t frame = span > 0 ? (timeUs - mFrameTimes.front()) * last / span : 0;
+    frame = std::max<int64_t>(0, std::min<int64_t>(frame, last));
+    for(int step = 0; step < MAX_GUESS_STEPS; step++){
+        if(mFrameTimes[frame] > timeUs){
+            frame--;
+        }
+        else if(frame < last && mFrameTimes[frame + 1] <= timeUs){
+            frame++;
+        }
+        else{
+            return frame;
+        }
+    }
+
+    return std::upper_bound(mFrameTimes.begin(), mFrameTimes.end(), timeUs) - mFrameTimes.begin() - 1;
+}
+
+int64_t SampleIndex::syncFrameBefore(int64_t frameNo) const{
+    auto it = std::upper_bound(mSyncFrames.begin(), mSyncFrames.end(), frameNo);
+    if(it == mSyncFrames.begin()){
+        return 0;
+    }
+    return *(it - 1);
+}
+
+int64_t SampleIndex::syncFrameAfter(int64_t frameNo) const{
+    auto it = std::upper_bound(mSyncFrames.begin(), mSyncFrames.end(), frameNo);
+    return it == mSyncFrames.end() ? frameCount() : *it;
+}
+
+bool SampleIndex::isSyncFrame(int64_t frameNo) const{
+    return std::binary_search(mSyncFrames.begin(), mSyncFrames.end(), frameNo);
+}
+
+int64_t SampleIndex::durationUs() const{
+    if(mFrameTimes.empty()){
+        return 0;
+    }
+    // the last frame lasts as long as an average one
+    const int64_t span = mFrameTimes.back() - mFrameTimes.front();
+    const int64_t last = frameCount() - 1;
+    return last > 0 ? span + span / last : 0;
+}
+
+double SampleIndex::averageFps() const{
+    const int64_t span = mFrameTimes.empty() ? 0 : mFrameTimes.back() - mFrameTimes.front();
+    if(span <= 0){
+        return 0;
+    }
+    return (frameCount() - 1) * 1000000.0 / span;
+}
+
+void SampleIndex::finish(){
+    mFrameTimes.resize(mSamples.size());
+    for(size_t i = 0; i < mSamples.size(); i++){
+        mFrameTimes[i] = mSamples[i].presentationTimeUs;
+    }
+    // decode order -> presentation order
+    std::sort(mFrameTimes.begin(), mFrameTimes.end());
+
+    mSyncFrames.clear();
+    for(const Sample& sample : mSamples){
+        if(sample.flags & AMEDIAEXTRACTOR_SAMPLE_FLAG_SYNC){
+            mSyncFrames.push_back(std::lower_bound(mFrameTimes.begin(), mFrameTimes.end(), sample.presentationTimeUs) - mFrameTimes.begin());
+        }
+    }
+    std::sort(mSyncFrames.begin(), mSyncFrames.end());
+}
+
+QString SampleIndex::cachePath(const QString& videoPath, int trackIndex){
+    QByteArray key = QFileInfo(videoPath).absoluteFilePath().toUtf8() + "#" + QByteArray::number(trackIndex);
+    QString name = QString::fromLatin1(QCryptographicHash::hash(key, QCryptographicHash::Sha1).toHex());
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/sampleindex/" + name + ".idx";
+}
@@ -0,0 +1,122 @@
+#ifndef SAMPLEINDEX_H
+#define SAMPLEINDEX_H
+
+/*
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * SampleIndex lists every sample of a video track: presentation time, size and sync flag.
+ * It is built by walking the extractor once and cached in a small sidecar file in the app's cache directory,
+ * keyed by the video's path and validated against its size and modification time.
+ * Frame numbers are in presentation order, so they are exact for variable frame rate content and B-frames.
+ */
+
+#include <vector>
+
+#include <QString>
+
+#include "media/NdkMediaExtractor.h"
+
+
+class SampleIndex
+{
+public:
+    /**
+     * @brief The Sample struct describes one compressed sample, in decode order.
+     */
+    struct Sample {
+        int64_t presentationTimeUs;
+        uint32_t size;
+        uint32_t flags;     ///< AMEDIAEXTRACTOR_SAMPLE_FLAG_*
+    };
+
+    SampleIndex();
+
+    /**
+     * Walks all samples of the extractor's selected track and seeks it back to the start afterwards.
+     */
+    bool build(AMediaExtractor* extractor, size_t maxSampleSize);
+
+    /**
+     * Loads the cached index of videoPath, fails if there is none or the video changed since.
+     */
+    bool load(const QString& videoPath, int trackIndex);
+
+    /**
+     * Caches the index of videoPath so reopening it does not need another walk.
+     */
+    bool save(const QString& videoPath, int trackIndex) const;
+
+    void clear();
+    bool empty() const { return mSamples.empty(); }
+
+    /**
+     * @brief samples all samples in decode order
+     */
+    const std::vector<Sample>& samples() const { return mSamples; }
+
+    int64_t frameCount() const { return static_cast<int64_t>(mFrameTimes.size()); }
+
+    /**
+     * Presentation time of frame number frameNo, clamped to the valid range.
+     */
+    int64_t frameTime(int64_t frameNo) const;
+
+    /**
+     * Number of the last frame presented at or before timeUs (0 if timeUs is before the first frame).
+     */
+    int64_t frameAt(int64_t timeUs) const;
+
+    /**
+     * Number of the closest sync frame at or before frameNo, i.e. where decoding has to start to reach frameNo.
+     */
+    int64_t syncFrameBefore(int64_t frameNo) const;
+
+    /**
+     * Number of the first sync frame after frameNo, or frameCount() if there is none.
+     */
+    int64_t syncFrameAfter(int64_t frameNo) const;
+
+    bool isSyncFrame(int64_t frameNo) const;
+
+    /**
+     * @brief syncFrames numbers of all sync frames, ascending
+     */
+    const std::vector<int64_t>& syncFrames() const { return mSyncFrames; }
+
+    /**
+     * Time from the first frame until the end of the last one.
+     */
+    int64_t durationUs() const;
+
+    /**
+     * Mean frame rate over the whole track, 0 if it cannot be determined.
+     */
+    double averageFps() const;
+
+private:
+    std::vector<Sample> mSamples;
+    std::vector<int64_t> mFrameTimes;
+    std::vector<int64_t> mSyncFrames;
+
+    /**
+     * Derives the presentation order tables from mSamples.
+     */
+    void finish();
+
+    static QString cachePath(const QString& videoPath, int trackIndex);
+};
+
+#endif // SAMPLEINDEX_H
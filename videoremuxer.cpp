@@ -0,0 +1,252 @@
+#include "videoremuxer.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+#include <QDebug>
+#include <QFile>
+
+
+// sample buffer size if no track tells its maximum
+static const size_t DEFAULT_SAMPLE_BUFFER = 1024 * 1024;
+
+// AMEDIACODEC_BUFFER_FLAG_KEY_FRAME, which the muxer reads as sync sample, only got a name in API 34
+static const uint32_t BUFFER_FLAG_KEY_FRAME = 1;
+
+
+VideoRemuxer::VideoRemuxer(QString filename)
+    :mFilename(filename),
+      mVideoTrack(-1),
+      mReordered(false),
+      mClipStartUs(-1),
+      mClipEndUs(-1),
+      mCopiedSamples(0),
+      mCopiedBytes(0)
+{
+    mExtractor = AMediaExtractor_new();
+    if(mExtractor == nullptr){
+        qWarning() << "Unable to get a media extractor!";
+        return;
+    }
+    media_status_t status = AMediaExtractor_setDataSource(mExtractor, filename.toStdString().c_str());
+    if(status != AMEDIA_OK){
+        qWarning() << "AMediaExtractor_setDataSource failed: " << status;
+        AMediaExtractor_delete(mExtractor);
+        mExtractor = nullptr;
+        return;
+    }
+
+    size_t bufferSize = DEFAULT_SAMPLE_BUFFER;
+    size_t numberOfTracks = AMediaExtractor_getTrackCount(mExtractor);
+    for(size_t i = 0; i < numberOfTracks; i++){
+        AMediaFormat* format = AMediaExtractor_getTrackFormat(mExtractor, i);
+        if(format == nullptr){
+            continue;
+        }
+        const char* mime = nullptr;
+        if(mVideoTrack < 0 && AMediaFormat_getString(format, AMEDIAFORMAT_KEY_MIME, &mime) && !strncmp(mime, "video/", 6)){
+            mVideoTrack = static_cast<int>(i);
+        }
+        int32_t maxInputSize = 0;
+        if(AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_MAX_INPUT_SIZE, &maxInputSize) && maxInputSize > 0){
+            bufferSize = std::max(bufferSize, static_cast<size_t>(maxInputSize));
+        }
+        AMediaFormat_delete(format);
+    }
+    if(mVideoTrack < 0){
+        qWarning() << "No video track in" << filename;
+        return;
+    }
+
+    // the index only covers the video track, so that is the only one selected while building it
+    AMediaExtractor_selectTrack(mExtractor, mVideoTrack);
+    if(!mIndex.load(filename, mVideoTrack)){
+        if(mIndex.build(mExtractor, bufferSize)){
+            mIndex.save(filename, mVideoTrack);
+        }
+        else{
+            qWarning() << "Unable to index the video track of" << filename;
+            return;
+        }
+    }
+
+    const std::vector<SampleIndex::Sample>& samples = mIndex.samples();
+    for(size_t i = 1; i < samples.size() && !mReordered; i++){
+        mReordered = samples[i].presentationTimeUs < samples[i - 1].presentationTimeUs;
+    }
+    for(const SampleIndex::Sample& sample : samples){
+        bufferSize = std::max(bufferSize, static_cast<size_t>(sample.size));
+    }
+    mBuffer.resize(bufferSize);
+}
+
+VideoRemuxer::~VideoRemuxer(){
+    if(mExtractor != nullptr){
+        AMediaExtractor_delete(mExtractor);
+    }
+}
+
+int64_t VideoRemuxer::snapStart(int64_t startUs, TrimSnap snap) const{
+    int64_t frame = mIndex.frameAt(startUs);
+    int64_t previous = mIndex.syncFrameBefore(frame);
+    int64_t next = mIndex.isSyncFrame(frame) && mIndex.frameTime(frame) >= startUs ? frame : mIndex.syncFrameAfter(frame);
+    if(next >= mIndex.frameCount()){
+        // no sync frame after the start, the previous one is all there is
+        return previous;
+    }
+    switch(snap){
+    case TRIM_SNAP_NEXT_SYNC:
+        return next;
+    case TRIM_SNAP_CLOSEST_SYNC:
+        return std::llabs(mIndex.frameTime(next) - startUs) < std::llabs(startUs - mIndex.frameTime(previous)) ? next : previous;
+    case TRIM_SNAP_PREVIOUS_SYNC:
+    default:
+        return previous;
+    }
+}
+
+bool VideoRemuxer::trim(const QString& outputFilename, int64_t startUs, int64_t endUs, TrimSnap snap){
+    mCopiedSamples = 0;
+    mCopiedBytes = 0;
+    mClipStartUs = -1;
+    mClipEndUs = -1;
+    if(!isOpen()){
+        qWarning() << "Nothing to remux, the source could not be opened";
+        return false;
+    }
+
+    const int64_t durationUs = mIndex.frameTime(mIndex.frameCount() - 1) + 1;
+    if(endUs < 0 || endUs > durationUs){
+        endUs = durationUs;
+    }
+    mClipStartUs = mIndex.frameTime(snapStart(std::max<int64_t>(startUs, 0), snap));
+    mClipEndUs = endUs;
+    if(mReordered){
+        // frames before the end may reference frames after it, so the clip ends with the GOP
+        int64_t endFrame = mIndex.frameAt(endUs - 1);
+        int64_t nextSync = mIndex.syncFrameAfter(endFrame);
+        mClipEndUs = nextSync < mIndex.frameCount() ? mIndex.frameTime(nextSync) : durationUs;
+    }
+    if(mClipEndUs <= mClipStartUs){
+        qWarning() << "Empty trim range after snapping to sync frames";
+        return false;
+    }
+
+    QFile outFile(outputFilename);
+    if(!outFile.open(QIODevice::WriteOnly)){
+        qWarning() << "Cannot open file: " << outputFilename;
+        return false;
+    }
+
+    // add the video and audio tracks with their source formats
+    std::vector<ssize_t> muxerTracks(AMediaExtractor_getTrackCount(mExtractor), -1);
+    std::vector<bool> trackDone(muxerTracks.size(), true);
+    AMediaMuxer* muxer = nullptr;
+    for(size_t i = 0; i < muxerTracks.size(); i++){
+        AMediaFormat* format = AMediaExtractor_getTrackFormat(mExtractor, i);
+        const char* mime = nullptr;
+        if(format == nullptr || !AMediaFormat_getString(format, AMEDIAFORMAT_KEY_MIME, &mime)
+                || (strncmp(mime, "video/", 6) && strncmp(mime, "audio/", 6)) || (!strncmp(mime, "video/", 6) && static_cast<int>(i) != mVideoTrack)){
+            if(format != nullptr){
+                AMediaFormat_delete(format);
+            }
+            continue;
+        }
+        if(muxer == nullptr){
+            // VP8 / VP9 do not go into mp4
+            bool webm = static_cast<int>(i) == mVideoTrack && (!strcmp(mime, "video/x-vnd.on2.vp8") || !strcmp(mime, "video/x-vnd.on2.vp9"));
+            muxer = AMediaMuxer_new(outFile.handle(), webm ? AMEDIAMUXER_OUTPUT_FORMAT_WEBM : AMEDIAMUXER_OUTPUT_FORMAT_MPEG_4);
+            if(muxer == nullptr){
+                qWarning() << "Unable to create Muxer";
+                AMediaFormat_delete(format);
+                return false;
+            }
+        }
+        muxerTracks[i] = AMediaMuxer_addTrack(muxer, format);
+        AMediaFormat_delete(format);
+        if(muxerTracks[i] < 0){
+            qWarning() << "The muxer does not take track" << i << ", leaving it out";
+            continue;
+        }
+        AMediaExtractor_selectTrack(mExtractor, i);
+        trackDone[i] = false;
+    }
+    if(muxer == nullptr || muxerTracks[mVideoTrack] < 0){
+        qWarning() << "Unable to set up the video track for remuxing";
+        if(muxer != nullptr){
+            AMediaMuxer_delete(muxer);
+        }
+        return false;
+    }
+
+    media_status_t status = AMediaMuxer_start(muxer);
+    if(status != AMEDIA_OK){
+        qWarning() << "Unable to start the muxer: " << status;
+        AMediaMuxer_delete(muxer);
+        return false;
+    }
+
+    // puts every selected track at or before the clip's first sync frame
+    AMediaExtractor_seekTo(mExtractor, mClipStartUs, AMEDIAEXTRACTOR_SEEK_PREVIOUS_SYNC);
+    while(std::find(trackDone.begin(), trackDone.end(), false) != trackDone.end()){
+        int64_t presentationTimeUs = AMediaExtractor_getSampleTime(mExtractor);
+        int track = AMediaExtractor_getSampleTrackIndex(mExtractor);
+        if(presentationTimeUs < 0 || track < 0){
+            break;
+        }
+
+        if(static_cast<size_t>(track) < trackDone.size() && !trackDone[track]){
+            uint32_t sampleFlags = AMediaExtractor_getSampleFlags(mExtractor);
+            if(presentationTimeUs >= mClipEndUs && (!mReordered || track != mVideoTrack || (sampleFlags & AMEDIAEXTRACTOR_SAMPLE_FLAG_SYNC))){
+                trackDone[track] = true;
+            }
+            else if(presentationTimeUs >= mClipStartUs){
+                // samples presented before the start (audio, leading pictures of an open GOP) have nothing to show in the clip
+#if __ANDROID_API__ >= 28
+                ssize_t sampleSize = AMediaExtractor_getSampleSize(mExtractor);
+                if(sampleSize > static_cast<ssize_t>(mBuffer.size())){
+                    mBuffer.resize(sampleSize);
+                }
+#endif
+                ssize_t size = AMediaExtractor_readSampleData(mExtractor, mBuffer.data(), mBuffer.size());
+                if(size < 0){
+                    qWarning() << "Unable to read sample at" << presentationTimeUs << "of track" << track;
+                }
+                else{
+                    AMediaCodecBufferInfo info;
+                    info.offset = 0;
+                    info.size = static_cast<int32_t>(size);
+                    info.presentationTimeUs = presentationTimeUs - mClipStartUs;
+                    info.flags = (sampleFlags & AMEDIAEXTRACTOR_SAMPLE_FLAG_SYNC) ? BUFFER_FLAG_KEY_FRAME : 0;
+                    AMediaMuxer_writeSampleData(muxer, muxerTracks[track], mBuffer.data(), &info);
+                    mCopiedSamples++;
+                    mCopiedBytes += size;
+                }
+            }
+        }
+
+        if(!AMediaExtractor_advance(mExtractor) && AMediaExtractor_getSampleTime(mExtractor) == presentationTimeUs){
+            break;
+        }
+    }
+
+    status = AMediaMuxer_stop(muxer);
+    AMediaMuxer_delete(muxer);
+
+    // back to the state the index was built in
+    for(size_t i = 0; i < muxerTracks.size(); i++){
+        if(static_cast<int>(i) != mVideoTrack && muxerTracks[i] >= 0){
+            AMediaExtractor_unselectTrack(mExtractor, i);
+        }
+    }
+
+    if(status != AMEDIA_OK){
+        qWarning() << "Unable to finish" << outputFilename << ":" << status;
+        return false;
+    }
+    qDebug() << "Remuxed" << mClipStartUs << "-" << mClipEndUs << "us of" << mFilename << "to" << outputFilename << ":"
+             << mCopiedSamples << "samples," << mCopiedBytes << "bytes";
+    return true;
+}
@@ -0,0 +1,110 @@
+#ifndef VIDEOREMUXER_H
+#define VIDEOREMUXER_H
+
+/*
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * VideoRemuxer cuts clips out of a media file without decoding or encoding anything (stream copy):
+ * compressed samples go from AMediaExtractor straight to AMediaMuxer with their flags and presentation times,
+ * using the source tracks' formats. Video and audio tracks are copied, anything else is left out.
+ * Without re-encoding a clip can only start at a sync frame, so the start of a trim range snaps to one (see TrimSnap);
+ * the end is exact unless the video reorders frames (B-frames), then it extends to the next sync frame.
+ * Timestamps are shifted so the clip starts at 0.
+ */
+
+#include <cstdint>
+#include <vector>
+
+#include <QString>
+
+#include "media/NdkMediaExtractor.h"
+#include "media/NdkMediaFormat.h"
+#include "media/NdkMediaMuxer.h"
+
+#include "sampleindex.h"
+
+
+/**
+ * @brief The TrimSnap enum decides which sync frame a clip starts at, mirroring the extractor's seek modes.
+ */
+enum TrimSnap {
+    TRIM_SNAP_PREVIOUS_SYNC,    ///< at or before the requested start, the clip never misses a requested frame (default)
+    TRIM_SNAP_NEXT_SYNC,        ///< at or after the requested start, the clip never has frames before the requested start
+    TRIM_SNAP_CLOSEST_SYNC      ///< whichever of the two is closer
+};
+
+
+class VideoRemuxer
+{
+public:
+    VideoRemuxer(QString filename);
+    ~VideoRemuxer();
+
+    /**
+     * @brief isOpen whether the file could be opened and its video track indexed
+     */
+    bool isOpen() const { return mExtractor != nullptr && !mIndex.empty(); }
+
+    const SampleIndex& sampleIndex() const { return mIndex; }
+
+    /**
+     * Copies what is presented in [startUs, endUs) of the source (endUs < 0 means until the end) to outputFilename,
+     * snapping the start to a sync frame according to snap. VP8 / VP9 sources are written as webm, everything else as mp4.
+     */
+    bool trim(const QString& outputFilename, int64_t startUs, int64_t endUs = -1, TrimSnap snap = TRIM_SNAP_PREVIOUS_SYNC);
+
+    /**
+     * Copies the whole file, e.g. to rewrap it.
+     */
+    bool remux(const QString& outputFilename) { return trim(outputFilename, 0); }
+
+    /**
+     * @brief clipStartUs / clipEndUs the source range the last trim() actually copied, after snapping
+     */
+    int64_t clipStartUs() const { return mClipStartUs; }
+    int64_t clipEndUs() const { return mClipEndUs; }
+
+    /**
+     * @brief copiedSamples / copiedBytes samples of all tracks the last trim() wrote
+     */
+    uint64_t copiedSamples() const { return mCopiedSamples; }
+    uint64_t copiedBytes() const { return mCopiedBytes; }
+
+private:
+    QString mFilename;
+    AMediaExtractor* mExtractor;
+    int mVideoTrack;
+    SampleIndex mIndex;
+
+    /**
+     * @brief mReordered presentation order differs from decode order (B-frames), so the end cannot be cut mid GOP
+     */
+    bool mReordered;
+
+    std::vector<uint8_t> mBuffer;
+
+    int64_t mClipStartUs;
+    int64_t mClipEndUs;
+    uint64_t mCopiedSamples;
+    uint64_t mCopiedBytes;
+
+    /**
+     * Number of the sync frame a clip starting at startUs begins with.
+     */
+    int64_t snapStart(int64_t startUs, TrimSnap snap) const;
+};
+
+#endif // VIDEOREMUXER_H
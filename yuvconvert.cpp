@@ -0,0 +1,1303 @@
+#include "yuvconvert.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define YUVCONVERT_NEON 1
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define YUVCONVERT_SSE2 1
+#if defined(__SSSE3__)
+// Guaranteed by the Android x86 / x86_64 ABIs, optional on desktop builds.
+#include <tmmintrin.h>
+#define YUVCONVERT_SSSE3 1
+#endif
+#endif
+
+
+namespace {
+
+// BT.601 limited range in 6 bit fixed point:
+// R = 1.164 (Y-16) + 1.596 V
+// G = 1.164 (Y-16) - 0.391 U - 0.813 V
+// B = 1.164 (Y-16) + 2.018 U
+// The vector paths saturate at 16 bit, which only ever happens for values that clamp to 255 anyway.
+const int kYScale = 74;
+const int kVToR = 102;
+const int kUToG = 25;
+const int kVToG = 52;
+const int kUToB = 129;
+const int kRound = 32;
+
+inline uint8_t clampByte(int value){
+    return static_cast<uint8_t>(value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+inline int16_t saturate16(int value){
+    return static_cast<int16_t>(value < -32768 ? -32768 : (value > 32767 ? 32767 : value));
+}
+
+inline void yuvPixelToBGR(int y, int u, int v, uint8_t* dst){
+    int y1 = (y - 16) * kYScale + kRound;
+    dst[0] = clampByte(saturate16(y1 + kUToB * u) >> 6);
+    dst[1] = clampByte(saturate16(y1 - (kUToG * u + kVToG * v)) >> 6);
+    dst[2] = clampByte(saturate16(y1 + kVToR * v) >> 6);
+}
+
+/**
+ * Converts the pixels [xStart, planes.width) of one or two luma rows sharing a chroma row.
+ * dst1 / y1 may be null for the last row of a frame with odd height.
+ */
+void convertRowPairScalar(const YUVPlanes& planes, const uint8_t* y0, const uint8_t* y1,
+                          const uint8_t* u, const uint8_t* v,
+                          uint8_t* dst0, uint8_t* dst1, int xStart){
+    for(int x = xStart; x < planes.width; x++){
+        int c = (x >> 1) * planes.uvPixelStride;
+        int cu = u[c] - 128;
+        int cv = v[c] - 128;
+        yuvPixelToBGR(y0[x], cu, cv, dst0 + 3 * x);
+        if(dst1 != nullptr){
+            yuvPixelToBGR(y1[x], cu, cv, dst1 + 3 * x);
+        }
+    }
+}
+
+#if defined(YUVCONVERT_SSE2)
+
+inline void storeBGR(uint8_t* dst, __m128i b, __m128i g, __m128i r){
+#if defined(YUVCONVERT_SSSE3)
+    const __m128i b0 = _mm_setr_epi8(0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5);
+    const __m128i g0 = _mm_setr_epi8(-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1);
+    const __m128i r0 = _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1);
+    const __m128i b1 = _mm_setr_epi8(-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1);
+    const __m128i g1 = _mm_setr_epi8(5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10);
+    const __m128i r1 = _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1);
+    const __m128i b2 = _mm_setr_epi8(-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1);
+    const __m128i g2 = _mm_setr_epi8(-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1);
+    const __m128i r2 = _mm_setr_epi8(10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15);
+
+    __m128i out0 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(b, b0), _mm_shuffle_epi8(g, g0)), _mm_shuffle_epi8(r, r0));
+    __m128i out1 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(b, b1), _mm_shuffle_epi8(g, g1)), _mm_shuffle_epi8(r, r1));
+    __m128i out2 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(b, b2), _mm_shuffle_epi8(g, g2)), _mm_shuffle_epi8(r, r2));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), out0);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16), out1);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 32), out2);
+#else
+    // Plain SSE2 has no byte shuffle, interleaving through the stack is still cheaper than the scalar math.
+    alignas(16) uint8_t tb[16];
+    alignas(16) uint8_t tg[16];
+    alignas(16) uint8_t tr[16];
+    _mm_store_si128(reinterpret_cast<__m128i*>(tb), b);
+    _mm_store_si128(reinterpret_cast<__m128i*>(tg), g);
+    _mm_store_si128(reinterpret_cast<__m128i*>(tr), r);
+    for(int i = 0; i < 16; i++){
+        dst[3 * i] = tb[i];
+        dst[3 * i + 1] = tg[i];
+        dst[3 * i + 2] = tr[i];
+    }
+#endif
+}
+
+/**
+ * Converts 16 luma samples against precomputed (per pixel duplicated) chroma terms.
+ */
+inline void convert16(const uint8_t* y, __m128i buLo, __m128i buHi, __m128i guvLo, __m128i guvHi,
+                      __m128i rvLo, __m128i rvHi, uint8_t* dst){
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i offset = _mm_set1_epi16(16);
+    const __m128i scale = _mm_set1_epi16(kYScale);
+    const __m128i round = _mm_set1_epi16(kRound);
+
+    __m128i luma = _mm_loadu_si128(reinterpret_cast<const __m128i*>(y));
+    __m128i yLo = _mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(luma, zero), offset), scale), round);
+    __m128i yHi = _mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(luma, zero), offset), scale), round);
+
+    __m128i b = _mm_packus_epi16(_mm_srai_epi16(_mm_adds_epi16(yLo, buLo), 6), _mm_srai_epi16(_mm_adds_epi16(yHi, buHi), 6));
+    __m128i g = _mm_packus_epi16(_mm_srai_epi16(_mm_subs_epi16(yLo, guvLo), 6), _mm_srai_epi16(_mm_subs_epi16(yHi, guvHi), 6));
+    __m128i r = _mm_packus_epi16(_mm_srai_epi16(_mm_adds_epi16(yLo, rvLo), 6), _mm_srai_epi16(_mm_adds_epi16(yHi, rvHi), 6));
+    storeBGR(dst, b, g, r);
+}
+
+int convertRowPairSIMD(const YUVPlanes& planes, const uint8_t* y0, const uint8_t* y1,
+                       const uint8_t* u, const uint8_t* v, uint8_t* dst0, uint8_t* dst1){
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias = _mm_set1_epi16(128);
+    const __m128i lowBytes = _mm_set1_epi16(0x00ff);
+    const bool semiPlanar = planes.uvPixelStride == 2;
+    const bool uFirst = u < v;
+
+    int x = 0;
+    for(; x + 16 <= planes.width; x += 16){
+        __m128i cu;
+        __m128i cv;
+        if(semiPlanar){
+            __m128i uv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(uFirst ? u + x : v + x));
+            __m128i first = _mm_and_si128(uv, lowBytes);
+            __m128i second = _mm_srli_epi16(uv, 8);
+            cu = uFirst ? first : second;
+            cv = uFirst ? second : first;
+        }
+        else{
+            cu = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(u + x / 2)), zero);
+            cv = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(v + x / 2)), zero);
+        }
+        cu = _mm_sub_epi16(cu, bias);
+        cv = _mm_sub_epi16(cv, bias);
+
+        __m128i bu = _mm_mullo_epi16(cu, _mm_set1_epi16(kUToB));
+        __m128i guv = _mm_add_epi16(_mm_mullo_epi16(cu, _mm_set1_epi16(kUToG)), _mm_mullo_epi16(cv, _mm_set1_epi16(kVToG)));
+        __m128i rv = _mm_mullo_epi16(cv, _mm_set1_epi16(kVToR));
+
+        // every chroma sample covers two horizontally adjacent pixels
+        __m128i buLo = _mm_unpacklo_epi16(bu, bu);
+        __m128i buHi = _mm_unpackhi_epi16(bu, bu);
+        __m128i guvLo = _mm_unpacklo_epi16(guv, guv);
+        __m128i guvHi = _mm_unpackhi_epi16(guv, guv);
+        __m128i rvLo = _mm_unpacklo_epi16(rv, rv);
+        __m128i rvHi = _mm_unpackhi_epi16(rv, rv);
+
+        convert16(y0 + x, buLo, buHi, guvLo, guvHi, rvLo, rvHi, dst0 + 3 * x);
+        if(dst1 != nullptr){
+            convert16(y1 + x, buLo, buHi, guvLo, guvHi, rvLo, rvHi, dst1 + 3 * x);
+        }
+    }
+    return x;
+}
+
+#elif defined(YUVCONVERT_NEON)
+
+inline void convert16(const uint8_t* y, int16x8_t buLo, int16x8_t buHi, int16x8_t guvLo, int16x8_t guvHi,
+                      int16x8_t rvLo, int16x8_t rvHi, uint8_t* dst){
+    const int16x8_t offset = vdupq_n_s16(16);
+    const int16x8_t round = vdupq_n_s16(kRound);
+
+    uint8x16_t luma = vld1q_u8(y);
+    int16x8_t yLo = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(luma)));
+    int16x8_t yHi = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(luma)));
+    yLo = vaddq_s16(vmulq_n_s16(vsubq_s16(yLo, offset), kYScale), round);
+    yHi = vaddq_s16(vmulq_n_s16(vsubq_s16(yHi, offset), kYScale), round);
+
+    uint8x16x3_t bgr;
+    bgr.val[0] = vcombine_u8(vqmovun_s16(vshrq_n_s16(vqaddq_s16(yLo, buLo), 6)), vqmovun_s16(vshrq_n_s16(vqaddq_s16(yHi, buHi), 6)));
+    bgr.val[1] = vcombine_u8(vqmovun_s16(vshrq_n_s16(vqsubq_s16(yLo, guvLo), 6)), vqmovun_s16(vshrq_n_s16(vqsubq_s16(yHi, guvHi), 6)));
+    bgr.val[2] = vcombine_u8(vqmovun_s16(vshrq_n_s16(vqaddq_s16(yLo, rvLo), 6)), vqmovun_s16(vshrq_n_s16(vqaddq_s16(yHi, rvHi), 6)));
+    vst3q_u8(dst, bgr);
+}
+
+int convertRowPairSIMD(const YUVPlanes& planes, const uint8_t* y0, const uint8_t* y1,
+                       const uint8_t* u, const uint8_t* v, uint8_t* dst0, uint8_t* dst1){
+    const int16x8_t bias = vdupq_n_s16(128);
+    const bool semiPlanar = planes.uvPixelStride == 2;
+    const bool uFirst = u < v;
+
+    int x = 0;
+    for(; x + 16 <= planes.width; x += 16){
+        uint8x8_t u8;
+        uint8x8_t v8;
+        if(semiPlanar){
+            uint8x8x2_t uv = vld2_u8(uFirst ? u + x : v + x);
+            u8 = uFirst ? uv.val[0] : uv.val[1];
+            v8 = uFirst ? uv.val[1] : uv.val[0];
+        }
+        else{
+            u8 = vld1_u8(u + x / 2);
+            v8 = vld1_u8(v + x / 2);
+        }
+        int16x8_t cu = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(u8)), bias);
+        int16x8_t cv = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(v8)), bias);
+
+        int16x8_t bu = vmulq_n_s16(cu, kUToB);
+        int16x8_t guv = vaddq_s16(vmulq_n_s16(cu, kUToG), vmulq_n_s16(cv, kVToG));
+        int16x8_t rv = vmulq_n_s16(cv, kVToR);
+
+        // every chroma sample covers two horizontally adjacent pixels
+        int16x8x2_t buDup = vzipq_s16(bu, bu);
+        int16x8x2_t guvDup = vzipq_s16(guv, guv);
+        int16x8x2_t rvDup = vzipq_s16(rv, rv);
+
+        convert16(y0 + x, buDup.val[0], buDup.val[1], guvDup.val[0], guvDup.val[1], rvDup.val[0], rvDup.val[1], dst0 + 3 * x);
+        if(dst1 != nullptr){
+            convert16(y1 + x, buDup.val[0], buDup.val[1], guvDup.val[0], guvDup.val[1], rvDup.val[0], rvDup.val[1], dst1 + 3 * x);
+        }
+    }
+    return x;
+}
+
+#else
+
+int convertRowPairSIMD(const YUVPlanes&, const uint8_t*, const uint8_t*,
+                       const uint8_t*, const uint8_t*, uint8_t*, uint8_t*){
+    return 0;
+}
+
+#endif
+
+template<bool vectorized>
+void convertFrame(const YUVPlanes& planes, uint8_t* dst, size_t dstStep){
+    for(int row = 0; row < planes.height; row += 2){
+        const uint8_t* y0 = planes.y + static_cast<size_t>(row) * planes.yStride;
+        const uint8_t* y1 = y0 + planes.yStride;
+        const uint8_t* u = planes.u + static_cast<size_t>(row / 2) * planes.uvStride;
+        const uint8_t* v = planes.v + static_cast<size_t>(row / 2) * planes.uvStride;
+        uint8_t* dst0 = dst + static_cast<size_t>(row) * dstStep;
+        uint8_t* dst1 = row + 1 < planes.height ? dst0 + dstStep : nullptr;
+
+        int x = vectorized ? convertRowPairSIMD(planes, y0, y1, u, v, dst0, dst1) : 0;
+        convertRowPairScalar(planes, y0, y1, u, v, dst0, dst1, x);
+    }
+}
+
+
+// BGR -> YUV, BT.601 limited range in 8 bit fixed point:
+// Y = ( 66 R + 129 G +  25 B + 128) / 256 + 16
+// U = (-38 R -  74 G + 112 B + 128) / 256 + 128
+// V = (112 R -  94 G -  18 B + 128) / 256 + 128
+// Luma sums fit into unsigned 16 bit, chroma sums into signed 16 bit.
+const int kRToY = 66;
+const int kGToY = 129;
+const int kBToY = 25;
+const int kRToU = 38;
+const int kGToU = 74;
+const int kBToU = 112;
+const int kRToV = 112;
+const int kGToV = 94;
+const int kBToV = 18;
+
+inline uint8_t bgrToY(int b, int g, int r){
+    return static_cast<uint8_t>(((kRToY * r + kGToY * g + kBToY * b + 128) >> 8) + 16);
+}
+
+inline uint8_t bgrToU(int b, int g, int r){
+    return clampByte(((kBToU * b - kRToU * r - kGToU * g + 128) >> 8) + 128);
+}
+
+inline uint8_t bgrToV(int b, int g, int r){
+    return clampByte(((kRToV * r - kGToV * g - kBToV * b + 128) >> 8) + 128);
+}
+
+/**
+ * Encodes the pixels [xStart, planes.width) of one or two BGR rows sharing a chroma row.
+ * xStart has to be even. src1 / y1 may be null for the last row of a frame with odd height,
+ * in which case the chroma is taken from src0 alone (as if the row was duplicated).
+ */
+void encodeRowPairScalar(const YUVPlanes& planes, const uint8_t* src0, const uint8_t* src1,
+                         uint8_t* y0, uint8_t* y1, uint8_t* u, uint8_t* v, int xStart){
+    const uint8_t* chromaSrc1 = src1 != nullptr ? src1 : src0;
+    for(int x = xStart; x < planes.width; x += 2){
+        const int x1 = x + 1 < planes.width ? x + 1 : x;
+        const uint8_t* p00 = src0 + 3 * x;
+        const uint8_t* p01 = src0 + 3 * x1;
+        const uint8_t* p10 = chromaSrc1 + 3 * x;
+        const uint8_t* p11 = chromaSrc1 + 3 * x1;
+
+        y0[x] = bgrToY(p00[0], p00[1], p00[2]);
+        if(x1 != x){
+            y0[x1] = bgrToY(p01[0], p01[1], p01[2]);
+        }
+        if(src1 != nullptr){
+            y1[x] = bgrToY(p10[0], p10[1], p10[2]);
+            if(x1 != x){
+                y1[x1] = bgrToY(p11[0], p11[1], p11[2]);
+            }
+        }
+
+        int b = (p00[0] + p01[0] + p10[0] + p11[0] + 2) >> 2;
+        int g = (p00[1] + p01[1] + p10[1] + p11[1] + 2) >> 2;
+        int r = (p00[2] + p01[2] + p10[2] + p11[2] + 2) >> 2;
+        int c = (x >> 1) * planes.uvPixelStride;
+        u[c] = bgrToU(b, g, r);
+        v[c] = bgrToV(b, g, r);
+    }
+}
+
+#if defined(YUVCONVERT_SSE2)
+
+inline void loadBGR(const uint8_t* src, __m128i& b, __m128i& g, __m128i& r){
+#if defined(YUVCONVERT_SSSE3)
+    const __m128i in0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    const __m128i in1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16));
+    const __m128i in2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 32));
+
+    const __m128i b0 = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i g0 = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i r0 = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i b1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1);
+    const __m128i g1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1);
+    const __m128i r1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1);
+    const __m128i b2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13);
+    const __m128i g2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14);
+    const __m128i r2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15);
+
+    b = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(in0, b0), _mm_shuffle_epi8(in1, b1)), _mm_shuffle_epi8(in2, b2));
+    g = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(in0, g0), _mm_shuffle_epi8(in1, g1)), _mm_shuffle_epi8(in2, g2));
+    r = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(in0, r0), _mm_shuffle_epi8(in1, r1)), _mm_shuffle_epi8(in2, r2));
+#else
+    alignas(16) uint8_t tb[16];
+    alignas(16) uint8_t tg[16];
+    alignas(16) uint8_t tr[16];
+    for(int i = 0; i < 16; i++){
+        tb[i] = src[3 * i];
+        tg[i] = src[3 * i + 1];
+        tr[i] = src[3 * i + 2];
+    }
+    b = _mm_load_si128(reinterpret_cast<const __m128i*>(tb));
+    g = _mm_load_si128(reinterpret_cast<const __m128i*>(tg));
+    r = _mm_load_si128(reinterpret_cast<const __m128i*>(tr));
+#endif
+}
+
+inline __m128i lumaHalf(__m128i b, __m128i g, __m128i r){
+    __m128i sum = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(kRToY)), _mm_mullo_epi16(g, _mm_set1_epi16(kGToY)));
+    sum = _mm_add_epi16(sum, _mm_mullo_epi16(b, _mm_set1_epi16(kBToY)));
+    sum = _mm_add_epi16(sum, _mm_set1_epi16(128));
+    return _mm_add_epi16(_mm_srli_epi16(sum, 8), _mm_set1_epi16(16));
+}
+
+inline __m128i luma16(__m128i b, __m128i g, __m128i r){
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = lumaHalf(_mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(g, zero), _mm_unpacklo_epi8(r, zero));
+    __m128i hi = lumaHalf(_mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(g, zero), _mm_unpackhi_epi8(r, zero));
+    return _mm_packus_epi16(lo, hi);
+}
+
+/**
+ * Sums horizontally adjacent pixels of two rows, giving 8 16 bit sums of 2x2 blocks.
+ */
+inline __m128i blockSum(__m128i row0, __m128i row1){
+#if defined(YUVCONVERT_SSSE3)
+    const __m128i ones = _mm_set1_epi8(1);
+    return _mm_add_epi16(_mm_maddubs_epi16(row0, ones), _mm_maddubs_epi16(row1, ones));
+#else
+    const __m128i lowBytes = _mm_set1_epi16(0x00ff);
+    __m128i sum0 = _mm_add_epi16(_mm_and_si128(row0, lowBytes), _mm_srli_epi16(row0, 8));
+    __m128i sum1 = _mm_add_epi16(_mm_and_si128(row1, lowBytes), _mm_srli_epi16(row1, 8));
+    return _mm_add_epi16(sum0, sum1);
+#endif
+}
+
+int encodeRowPairSIMD(const YUVPlanes& planes, const uint8_t* src0, const uint8_t* src1,
+                      uint8_t* y0, uint8_t* y1, uint8_t* u, uint8_t* v){
+    const bool semiPlanar = planes.uvPixelStride == 2;
+    const bool uFirst = u < v;
+    const __m128i two = _mm_set1_epi16(2);
+    const __m128i round = _mm_set1_epi16(128);
+
+    int x = 0;
+    for(; x + 16 <= planes.width; x += 16){
+        __m128i b0, g0, r0;
+        __m128i b1, g1, r1;
+        loadBGR(src0 + 3 * x, b0, g0, r0);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(y0 + x), luma16(b0, g0, r0));
+        if(src1 != nullptr){
+            loadBGR(src1 + 3 * x, b1, g1, r1);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(y1 + x), luma16(b1, g1, r1));
+        }
+        else{
+            b1 = b0;
+            g1 = g0;
+            r1 = r0;
+        }
+
+        __m128i b = _mm_srli_epi16(_mm_add_epi16(blockSum(b0, b1), two), 2);
+        __m128i g = _mm_srli_epi16(_mm_add_epi16(blockSum(g0, g1), two), 2);
+        __m128i r = _mm_srli_epi16(_mm_add_epi16(blockSum(r0, r1), two), 2);
+
+        __m128i cu = _mm_sub_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(kBToU)), _mm_mullo_epi16(r, _mm_set1_epi16(kRToU)));
+        cu = _mm_sub_epi16(cu, _mm_mullo_epi16(g, _mm_set1_epi16(kGToU)));
+        cu = _mm_add_epi16(_mm_srai_epi16(_mm_add_epi16(cu, round), 8), round);
+        __m128i cv = _mm_sub_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(kRToV)), _mm_mullo_epi16(g, _mm_set1_epi16(kGToV)));
+        cv = _mm_sub_epi16(cv, _mm_mullo_epi16(b, _mm_set1_epi16(kBToV)));
+        cv = _mm_add_epi16(_mm_srai_epi16(_mm_add_epi16(cv, round), 8), round);
+
+        __m128i u8 = _mm_packus_epi16(cu, cu);
+        __m128i v8 = _mm_packus_epi16(cv, cv);
+        if(semiPlanar){
+            __m128i uv = uFirst ? _mm_unpacklo_epi8(u8, v8) : _mm_unpacklo_epi8(v8, u8);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(uFirst ? u + x : v + x), uv);
+        }
+        else{
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(u + x / 2), u8);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(v + x / 2), v8);
+        }
+    }
+    return x;
+}
+
+#elif defined(YUVCONVERT_NEON)
+
+inline uint8x8_t lumaHalf(uint8x8_t b, uint8x8_t g, uint8x8_t r){
+    uint16x8_t sum = vmull_u8(r, vdup_n_u8(kRToY));
+    sum = vmlal_u8(sum, g, vdup_n_u8(kGToY));
+    sum = vmlal_u8(sum, b, vdup_n_u8(kBToY));
+    return vadd_u8(vshrn_n_u16(vaddq_u16(sum, vdupq_n_u16(128)), 8), vdup_n_u8(16));
+}
+
+inline uint8x16_t luma16(const uint8x16x3_t& bgr){
+    return vcombine_u8(lumaHalf(vget_low_u8(bgr.val[0]), vget_low_u8(bgr.val[1]), vget_low_u8(bgr.val[2])),
+            lumaHalf(vget_high_u8(bgr.val[0]), vget_high_u8(bgr.val[1]), vget_high_u8(bgr.val[2])));
+}
+
+inline int16x8_t blockAverage(uint8x16_t row0, uint8x16_t row1){
+    return vreinterpretq_s16_u16(vrshrq_n_u16(vpadalq_u8(vpaddlq_u8(row0), row1), 2));
+}
+
+int encodeRowPairSIMD(const YUVPlanes& planes, const uint8_t* src0, const uint8_t* src1,
+                      uint8_t* y0, uint8_t* y1, uint8_t* u, uint8_t* v){
+    const bool semiPlanar = planes.uvPixelStride == 2;
+    const bool uFirst = u < v;
+    const int16x8_t round = vdupq_n_s16(128);
+
+    int x = 0;
+    for(; x + 16 <= planes.width; x += 16){
+        uint8x16x3_t row0 = vld3q_u8(src0 + 3 * x);
+        uint8x16x3_t row1 = row0;
+        vst1q_u8(y0 + x, luma16(row0));
+        if(src1 != nullptr){
+            row1 = vld3q_u8(src1 + 3 * x);
+            vst1q_u8(y1 + x, luma16(row1));
+        }
+
+        int16x8_t b = blockAverage(row0.val[0], row1.val[0]);
+        int16x8_t g = blockAverage(row0.val[1], row1.val[1]);
+        int16x8_t r = blockAverage(row0.val[2], row1.val[2]);
+
+        int16x8_t cu = vmlsq_n_s16(vmlsq_n_s16(vmulq_n_s16(b, kBToU), r, kRToU), g, kGToU);
+        int16x8_t cv = vmlsq_n_s16(vmlsq_n_s16(vmulq_n_s16(r, kRToV), g, kGToV), b, kBToV);
+        uint8x8_t u8 = vqmovun_s16(vaddq_s16(vshrq_n_s16(vaddq_s16(cu, round), 8), round));
+        uint8x8_t v8 = vqmovun_s16(vaddq_s16(vshrq_n_s16(vaddq_s16(cv, round), 8), round));
+
+        if(semiPlanar){
+            uint8x8x2_t uv;
+            uv.val[0] = uFirst ? u8 : v8;
+            uv.val[1] = uFirst ? v8 : u8;
+            vst2_u8(uFirst ? u + x : v + x, uv);
+        }
+        else{
+            vst1_u8(u + x / 2, u8);
+            vst1_u8(v + x / 2, v8);
+        }
+    }
+    return x;
+}
+
+#else
+
+int encodeRowPairSIMD(const YUVPlanes&, const uint8_t*, const uint8_t*,
+                      uint8_t*, uint8_t*, uint8_t*, uint8_t*){
+    return 0;
+}
+
+#endif
+
+/**
+ * Source range [start, end) that destination pixel i covers when srcSize pixels are scaled to dstSize.
+ * Shrinking yields boxes, enlarging degenerates to nearest neighbor.
+ */
+inline void scaleSpan(int i, int srcSize, int dstSize, int& start, int& end){
+    start = static_cast<int>(static_cast<int64_t>(i) * srcSize / dstSize);
+    end = static_cast<int>(static_cast<int64_t>(i + 1) * srcSize / dstSize);
+    start = std::min(start, srcSize - 1);
+    end = std::max(end, start + 1);
+}
+
+template<bool vectorized>
+void encodeFrame(const uint8_t* src, size_t srcStep, const YUVPlanes& planes){
+    for(int row = 0; row < planes.height; row += 2){
+        const uint8_t* src0 = src + static_cast<size_t>(row) * srcStep;
+        const uint8_t* src1 = row + 1 < planes.height ? src0 + srcStep : nullptr;
+        uint8_t* y0 = planes.y + static_cast<size_t>(row) * planes.yStride;
+        uint8_t* y1 = y0 + planes.yStride;
+        uint8_t* u = planes.u + static_cast<size_t>(row / 2) * planes.uvStride;
+        uint8_t* v = planes.v + static_cast<size_t>(row / 2) * planes.uvStride;
+
+        int x = vectorized ? encodeRowPairSIMD(planes, src0, src1, y0, y1, u, v) : 0;
+        encodeRowPairScalar(planes, src0, src1, y0, y1, u, v, x);
+    }
+}
+
+
+// Scaled conversion box filters every plane row by row into scratch rows and converts those as 4:4:4.
+// Exact 2:1 and 4:1 reductions (preview and thumbnail sizes) sum in vector registers,
+// any other ratio sums the covered rows per column and then the covered columns, looked up in span tables.
+
+#if defined(YUVCONVERT_SSE2)
+
+/**
+ * Averages 2x2 blocks of two rows into width samples, returns how many were done.
+ */
+int reduceRowsBy2SIMD(const uint8_t* row0, const uint8_t* row1, uint8_t* dst, int width){
+    const __m128i two = _mm_set1_epi16(2);
+    int x = 0;
+    for(; x + 16 <= width; x += 16){
+        const __m128i* in0 = reinterpret_cast<const __m128i*>(row0 + 2 * x);
+        const __m128i* in1 = reinterpret_cast<const __m128i*>(row1 + 2 * x);
+        __m128i lo = blockSum(_mm_loadu_si128(in0), _mm_loadu_si128(in1));
+        __m128i hi = blockSum(_mm_loadu_si128(in0 + 1), _mm_loadu_si128(in1 + 1));
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_packus_epi16(lo, hi));
+    }
+    return x;
+}
+
+/**
+ * Averages 4x4 blocks of four rows into width samples, returns how many were done.
+ */
+int reduceRowsBy4SIMD(const uint8_t* const* rows, uint8_t* dst, int width){
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i eight = _mm_set1_epi16(8);
+    int x = 0;
+    for(; x + 8 <= width; x += 8){
+        __m128i quads[2];
+        for(int half = 0; half < 2; half++){
+            const size_t offset = 4 * static_cast<size_t>(x) + 16 * half;
+            // 2x4 column pairs, then pairs of those
+            __m128i pairs = _mm_add_epi16(
+                        blockSum(_mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[0] + offset)),
+                                 _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[1] + offset))),
+                        blockSum(_mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[2] + offset)),
+                                 _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[3] + offset))));
+            quads[half] = _mm_madd_epi16(pairs, ones);
+        }
+        __m128i sum = _mm_srli_epi16(_mm_add_epi16(_mm_packs_epi32(quads[0], quads[1]), eight), 4);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + x), _mm_packus_epi16(sum, sum));
+    }
+    return x;
+}
+
+/**
+ * Picks every other byte of src into count samples, returns how many were done.
+ * Stops before the last 16 samples so the final loads never read past the last sample.
+ */
+int gatherSamplesSIMD(const uint8_t* src, uint8_t* dst, int count){
+    const __m128i lowBytes = _mm_set1_epi16(0x00ff);
+    int x = 0;
+    for(; x + 16 < count; x += 16){
+        __m128i first = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * x)), lowBytes);
+        __m128i second = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * x + 16)), lowBytes);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_packus_epi16(first, second));
+    }
+    return x;
+}
+
+/**
+ * Adds width samples of a row to 32 bit column sums, returns how many were done.
+ */
+int accumulateRowSIMD(const uint8_t* row, uint32_t* sums, int width){
+    const __m128i zero = _mm_setzero_si128();
+    int x = 0;
+    for(; x + 16 <= width; x += 16){
+        __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+        __m128i halves[2] = {_mm_unpacklo_epi8(in, zero), _mm_unpackhi_epi8(in, zero)};
+        __m128i* out = reinterpret_cast<__m128i*>(sums + x);
+        for(int i = 0; i < 2; i++){
+            __m128i lo = _mm_add_epi32(_mm_loadu_si128(out + 2 * i), _mm_unpacklo_epi16(halves[i], zero));
+            __m128i hi = _mm_add_epi32(_mm_loadu_si128(out + 2 * i + 1), _mm_unpackhi_epi16(halves[i], zero));
+            _mm_storeu_si128(out + 2 * i, lo);
+            _mm_storeu_si128(out + 2 * i + 1, hi);
+        }
+    }
+    return x;
+}
+
+/**
+ * Interleaves count samples of a and b into dst (a0 b0 a1 b1 ...), returns how many were done.
+ */
+int interleaveSamplesSIMD(const uint8_t* a, const uint8_t* b, uint8_t* dst, int count){
+    int x = 0;
+    for(; x + 16 <= count; x += 16){
+        __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + x));
+        __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2 * x), _mm_unpacklo_epi8(first, second));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2 * x + 16), _mm_unpackhi_epi8(first, second));
+    }
+    return x;
+}
+
+/**
+ * Converts width pixels with one chroma sample each, returns how many were done.
+ */
+int convertRow444SIMD(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* dst, int width){
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias = _mm_set1_epi16(128);
+    int x = 0;
+    for(; x + 16 <= width; x += 16){
+        __m128i u8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(u + x));
+        __m128i v8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(v + x));
+        __m128i cuLo = _mm_sub_epi16(_mm_unpacklo_epi8(u8, zero), bias);
+        __m128i cuHi = _mm_sub_epi16(_mm_unpackhi_epi8(u8, zero), bias);
+        __m128i cvLo = _mm_sub_epi16(_mm_unpacklo_epi8(v8, zero), bias);
+        __m128i cvHi = _mm_sub_epi16(_mm_unpackhi_epi8(v8, zero), bias);
+
+        __m128i buLo = _mm_mullo_epi16(cuLo, _mm_set1_epi16(kUToB));
+        __m128i buHi = _mm_mullo_epi16(cuHi, _mm_set1_epi16(kUToB));
+        __m128i guvLo = _mm_add_epi16(_mm_mullo_epi16(cuLo, _mm_set1_epi16(kUToG)), _mm_mullo_epi16(cvLo, _mm_set1_epi16(kVToG)));
+        __m128i guvHi = _mm_add_epi16(_mm_mullo_epi16(cuHi, _mm_set1_epi16(kUToG)), _mm_mullo_epi16(cvHi, _mm_set1_epi16(kVToG)));
+        __m128i rvLo = _mm_mullo_epi16(cvLo, _mm_set1_epi16(kVToR));
+        __m128i rvHi = _mm_mullo_epi16(cvHi, _mm_set1_epi16(kVToR));
+
+        convert16(y + x, buLo, buHi, guvLo, guvHi, rvLo, rvHi, dst + 3 * x);
+    }
+    return x;
+}
+
+#elif defined(YUVCONVERT_NEON)
+
+int reduceRowsBy2SIMD(const uint8_t* row0, const uint8_t* row1, uint8_t* dst, int width){
+    int x = 0;
+    for(; x + 16 <= width; x += 16){
+        const uint8_t* in0 = row0 + 2 * x;
+        const uint8_t* in1 = row1 + 2 * x;
+        uint16x8_t lo = vpadalq_u8(vpaddlq_u8(vld1q_u8(in0)), vld1q_u8(in1));
+        uint16x8_t hi = vpadalq_u8(vpaddlq_u8(vld1q_u8(in0 + 16)), vld1q_u8(in1 + 16));
+        vst1q_u8(dst + x, vcombine_u8(vrshrn_n_u16(lo, 2), vrshrn_n_u16(hi, 2)));
+    }
+    return x;
+}
+
+int reduceRowsBy4SIMD(const uint8_t* const* rows, uint8_t* dst, int width){
+    int x = 0;
+    for(; x + 8 <= width; x += 8){
+        uint16x4_t quads[2];
+        for(int half = 0; half < 2; half++){
+            const size_t offset = 4 * static_cast<size_t>(x) + 16 * half;
+            // 2x4 column pairs, then pairs of those
+            uint16x8_t pairs = vpaddlq_u8(vld1q_u8(rows[0] + offset));
+            pairs = vpadalq_u8(pairs, vld1q_u8(rows[1] + offset));
+            pairs = vpadalq_u8(pairs, vld1q_u8(rows[2] + offset));
+            pairs = vpadalq_u8(pairs, vld1q_u8(rows[3] + offset));
+            quads[half] = vpadd_u16(vget_low_u16(pairs), vget_high_u16(pairs));
+        }
+        vst1_u8(dst + x, vrshrn_n_u16(vcombine_u16(quads[0], quads[1]), 4));
+    }
+    return x;
+}
+
+int gatherSamplesSIMD(const uint8_t* src, uint8_t* dst, int count){
+    int x = 0;
+    for(; x + 16 < count; x += 16){
+        vst1q_u8(dst + x, vld2q_u8(src + 2 * x).val[0]);
+    }
+    return x;
+}
+
+int accumulateRowSIMD(const uint8_t* row, uint32_t* sums, int width){
+    int x = 0;
+    for(; x + 16 <= width; x += 16){
+        uint8x16_t in = vld1q_u8(row + x);
+        uint16x8_t halves[2] = {vmovl_u8(vget_low_u8(in)), vmovl_u8(vget_high_u8(in))};
+        for(int i = 0; i < 2; i++){
+            uint32_t* out = sums + x + 8 * i;
+            vst1q_u32(out, vaddw_u16(vld1q_u32(out), vget_low_u16(halves[i])));
+            vst1q_u32(out + 4, vaddw_u16(vld1q_u32(out + 4), vget_high_u16(halves[i])));
+        }
+    }
+    return x;
+}
+
+int interleaveSamplesSIMD(const uint8_t* a, const uint8_t* b, uint8_t* dst, int count){
+    int x = 0;
+    for(; x + 16 <= count; x += 16){
+        uint8x16x2_t pair;
+        pair.val[0] = vld1q_u8(a + x);
+        pair.val[1] = vld1q_u8(b + x);
+        vst2q_u8(dst + 2 * x, pair);
+    }
+    return x;
+}
+
+int convertRow444SIMD(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* dst, int width){
+    const int16x8_t bias = vdupq_n_s16(128);
+    int x = 0;
+    for(; x + 16 <= width; x += 16){
+        uint8x16_t u8 = vld1q_u8(u + x);
+        uint8x16_t v8 = vld1q_u8(v + x);
+        int16x8_t cuLo = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(u8))), bias);
+        int16x8_t cuHi = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(u8))), bias);
+        int16x8_t cvLo = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(v8))), bias);
+        int16x8_t cvHi = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(v8))), bias);
+
+        convert16(y + x, vmulq_n_s16(cuLo, kUToB), vmulq_n_s16(cuHi, kUToB),
+                  vaddq_s16(vmulq_n_s16(cuLo, kUToG), vmulq_n_s16(cvLo, kVToG)),
+                  vaddq_s16(vmulq_n_s16(cuHi, kUToG), vmulq_n_s16(cvHi, kVToG)),
+                  vmulq_n_s16(cvLo, kVToR), vmulq_n_s16(cvHi, kVToR), dst + 3 * x);
+    }
+    return x;
+}
+
+#else
+
+int reduceRowsBy2SIMD(const uint8_t*, const uint8_t*, uint8_t*, int){
+    return 0;
+}
+
+int reduceRowsBy4SIMD(const uint8_t* const*, uint8_t*, int){
+    return 0;
+}
+
+int gatherSamplesSIMD(const uint8_t*, uint8_t*, int){
+    return 0;
+}
+
+int accumulateRowSIMD(const uint8_t*, uint32_t*, int){
+    return 0;
+}
+
+int interleaveSamplesSIMD(const uint8_t*, const uint8_t*, uint8_t*, int){
+    return 0;
+}
+
+int convertRow444SIMD(const uint8_t*, const uint8_t*, const uint8_t*, uint8_t*, int){
+    return 0;
+}
+
+#endif
+
+template<bool vectorized>
+void reduceRowsBy2(const uint8_t* row0, const uint8_t* row1, uint8_t* dst, int width){
+    int x = vectorized ? reduceRowsBy2SIMD(row0, row1, dst, width) : 0;
+    for(; x < width; x++){
+        dst[x] = static_cast<uint8_t>((row0[2 * x] + row0[2 * x + 1] + row1[2 * x] + row1[2 * x + 1] + 2) >> 2);
+    }
+}
+
+template<bool vectorized>
+void reduceRowsBy4(const uint8_t* const* rows, uint8_t* dst, int width){
+    int x = vectorized ? reduceRowsBy4SIMD(rows, dst, width) : 0;
+    for(; x < width; x++){
+        int sum = 0;
+        for(int r = 0; r < 4; r++){
+            const uint8_t* in = rows[r] + 4 * x;
+            sum += in[0] + in[1] + in[2] + in[3];
+        }
+        dst[x] = static_cast<uint8_t>((sum + 8) >> 4);
+    }
+}
+
+template<bool vectorized>
+void gatherSamples(const uint8_t* src, int pixelStride, uint8_t* dst, int count){
+    int x = vectorized && pixelStride == 2 ? gatherSamplesSIMD(src, dst, count) : 0;
+    for(; x < count; x++){
+        dst[x] = src[x * pixelStride];
+    }
+}
+
+template<bool vectorized>
+void accumulateRow(const uint8_t* row, uint32_t* sums, int width){
+    int x = vectorized ? accumulateRowSIMD(row, sums, width) : 0;
+    for(; x < width; x++){
+        sums[x] += row[x];
+    }
+}
+
+template<bool vectorized>
+void interleaveSamples(const uint8_t* a, const uint8_t* b, uint8_t* dst, int count){
+    int x = vectorized ? interleaveSamplesSIMD(a, b, dst, count) : 0;
+    for(; x < count; x++){
+        dst[2 * x] = a[x];
+        dst[2 * x + 1] = b[x];
+    }
+}
+
+template<bool vectorized>
+void convertRow444(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* dst, int width){
+    int x = vectorized ? convertRow444SIMD(y, u, v, dst, width) : 0;
+    for(; x < width; x++){
+        yuvPixelToBGR(y[x], u[x] - 128, v[x] - 128, dst + 3 * x);
+    }
+}
+
+/**
+ * Ratio 1, 2 or 4 if src is exactly that many times dst in both directions, 0 otherwise.
+ */
+int reductionFactor(int srcWidth, int srcHeight, int dstWidth, int dstHeight){
+    for(int factor = 1; factor <= 4; factor *= 2){
+        if(srcWidth == factor * dstWidth && srcHeight == factor * dstHeight){
+            return factor;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Source range [start, end) of every destination sample along one axis.
+ */
+struct SpanTable {
+    std::vector<int> start;
+    std::vector<int> end;
+    int maxLength;
+
+    void build(int srcSize, int dstSize){
+        resize(dstSize);
+        for(int i = 0; i < dstSize; i++){
+            scaleSpan(i, srcSize, dstSize, start[i], end[i]);
+            maxLength = std::max(maxLength, end[i] - start[i]);
+        }
+    }
+
+    /**
+     * The chroma samples of a 4:2:0 plane with chromaSize samples under each span of luma.
+     */
+    void buildChroma(const SpanTable& luma, int chromaSize){
+        resize(static_cast<int>(luma.start.size()));
+        for(size_t i = 0; i < start.size(); i++){
+            start[i] = luma.start[i] / 2;
+            end[i] = std::min((luma.end[i] + 1) / 2, chromaSize);
+            maxLength = std::max(maxLength, end[i] - start[i]);
+        }
+    }
+
+    void resize(int size){
+        start.resize(size);
+        end.resize(size);
+        maxLength = 0;
+    }
+};
+
+/**
+ * Row buffers of one plane, kept per thread so scaling does not allocate once they have grown.
+ */
+struct PlaneScratch {
+    std::vector<uint8_t> input;     ///< up to four source rows with their samples gathered
+    std::vector<uint32_t> sums;     ///< per source column, over the rows of a span
+    std::vector<uint64_t> reciprocals;  ///< per span length, for the boxes of the current row
+    std::vector<uint8_t> output;
+};
+
+struct ScaleScratch {
+    SpanTable columns;
+    SpanTable rows;
+    SpanTable chromaColumns;
+    SpanTable chromaRows;
+    PlaneScratch planes[3];
+};
+
+ScaleScratch& scaleScratch(){
+    thread_local ScaleScratch scratch;
+    return scratch;
+}
+
+/**
+ * Produces the rows of one plane (one component of an interleaved plane) scaled by factor 1, 2 or 4,
+ * or by the span tables for factor 0.
+ */
+template<bool vectorized>
+class PlaneScaler
+{
+public:
+    PlaneScaler(const uint8_t* plane, int stride, int pixelStride, int srcWidth, int dstWidth, int factor,
+                const SpanTable& columns, const SpanTable& rows, PlaneScratch& scratch)
+        :mPlane(plane),
+          mStride(stride),
+          mPixelStride(pixelStride),
+          mSrcWidth(srcWidth),
+          mDstWidth(dstWidth),
+          mFactor(factor),
+          mColumns(columns),
+          mRows(rows),
+          mScratch(scratch)
+    {
+        if(mPixelStride != 1){
+            mScratch.input.resize(4 * static_cast<size_t>(mSrcWidth));
+        }
+        if(mFactor == 0){
+            mScratch.sums.resize(mSrcWidth);
+            mScratch.reciprocals.resize(mColumns.maxLength + 1);
+        }
+    }
+
+    /**
+     * Row r of the scaled plane, written to out (dstWidth samples) or pointing straight into the plane.
+     */
+    const uint8_t* row(int r, uint8_t* out){
+        switch(mFactor){
+        case 1:
+            return sourceRow(r, 0, out);
+        case 2:
+            reduceRowsBy2<vectorized>(sourceRow(2 * r, 0, nullptr), sourceRow(2 * r + 1, 1, nullptr), out, mDstWidth);
+            return out;
+        case 4: {
+            const uint8_t* rows[4];
+            for(int i = 0; i < 4; i++){
+                rows[i] = sourceRow(4 * r + i, i, nullptr);
+            }
+            reduceRowsBy4<vectorized>(rows, out, mDstWidth);
+            return out;
+        }
+        default:
+            boxRow(r, out);
+            return out;
+        }
+    }
+
+private:
+    const uint8_t* mPlane;
+    int mStride;
+    int mPixelStride;
+    int mSrcWidth;
+    int mDstWidth;
+    int mFactor;
+    const SpanTable& mColumns;
+    const SpanTable& mRows;
+    PlaneScratch& mScratch;
+
+    /**
+     * Source row y with contiguous samples, gathered into buffer (or input row slot if null) for interleaved planes.
+     */
+    const uint8_t* sourceRow(int y, int slot, uint8_t* buffer){
+        const uint8_t* in = mPlane + static_cast<size_t>(y) * mStride;
+        if(mPixelStride == 1){
+            return in;
+        }
+        if(buffer == nullptr){
+            buffer = mScratch.input.data() + static_cast<size_t>(slot) * mSrcWidth;
+        }
+        gatherSamples<vectorized>(in, mPixelStride, buffer, mSrcWidth);
+        return buffer;
+    }
+
+    void boxRow(int r, uint8_t* out){
+        const int y0 = mRows.start[r];
+        const int y1 = mRows.end[r];
+        uint32_t* sums = mScratch.sums.data();
+        std::fill(sums, sums + mSrcWidth, 0u);
+        for(int y = y0; y < y1; y++){
+            accumulateRow<vectorized>(sourceRow(y, 0, nullptr), sums, mSrcWidth);
+        }
+
+        // (sum + count / 2) / count as a multiplication with the reciprocal of the box size,
+        // exact while count < 2^20 (sums of bytes stay below 2^28 then)
+        const uint32_t height = static_cast<uint32_t>(y1 - y0);
+        const bool reciprocal = static_cast<uint64_t>(mColumns.maxLength) * height < (1u << 20);
+        if(reciprocal){
+            for(int length = 1; length <= mColumns.maxLength; length++){
+                mScratch.reciprocals[length] = (uint64_t(1) << 48) / (length * height) + 1;
+            }
+        }
+        for(int i = 0; i < mDstWidth; i++){
+            const int x0 = mColumns.start[i];
+            const int x1 = mColumns.end[i];
+            uint32_t sum = 0;
+            for(int x = x0; x < x1; x++){
+                sum += sums[x];
+            }
+            const uint32_t count = static_cast<uint32_t>(x1 - x0) * height;
+            if(reciprocal){
+                out[i] = static_cast<uint8_t>(((sum + count / 2) * mScratch.reciprocals[x1 - x0]) >> 48);
+            }
+            else{
+                out[i] = static_cast<uint8_t>((sum + count / 2) / count);
+            }
+        }
+    }
+};
+
+template<bool vectorized>
+void convertScaledFrame(const YUVPlanes& planes, uint8_t* dst, size_t dstStep, int dstWidth, int dstHeight){
+    ScaleScratch& scratch = scaleScratch();
+    const int chromaWidth = (planes.width + 1) / 2;
+    const int chromaHeight = (planes.height + 1) / 2;
+
+    // halving takes the chroma as it is, quartering halves it, other sizes average the chroma under each luma span
+    const int factor = reductionFactor(planes.width, planes.height, dstWidth, dstHeight);
+    if(factor == 0){
+        scratch.columns.build(planes.width, dstWidth);
+        scratch.rows.build(planes.height, dstHeight);
+        scratch.chromaColumns.buildChroma(scratch.columns, chromaWidth);
+        scratch.chromaRows.buildChroma(scratch.rows, chromaHeight);
+    }
+    PlaneScaler<vectorized> luma(planes.y, planes.yStride, 1, planes.width, dstWidth, factor,
+                                 scratch.columns, scratch.rows, scratch.planes[0]);
+    PlaneScaler<vectorized> u(planes.u, planes.uvStride, planes.uvPixelStride, chromaWidth, dstWidth, factor / 2,
+                              scratch.chromaColumns, scratch.chromaRows, scratch.planes[1]);
+    PlaneScaler<vectorized> v(planes.v, planes.uvStride, planes.uvPixelStride, chromaWidth, dstWidth, factor / 2,
+                              scratch.chromaColumns, scratch.chromaRows, scratch.planes[2]);
+    for(PlaneScratch& plane : scratch.planes){
+        plane.output.resize(dstWidth);
+    }
+
+    for(int row = 0; row < dstHeight; row++){
+        convertRow444<vectorized>(luma.row(row, scratch.planes[0].output.data()),
+                                  u.row(row, scratch.planes[1].output.data()),
+                                  v.row(row, scratch.planes[2].output.data()),
+                                  dst + static_cast<size_t>(row) * dstStep, dstWidth);
+    }
+}
+
+template<bool vectorized>
+void scaleFrame(const YUVPlanes& src, const YUVPlanes& dst){
+    ScaleScratch& scratch = scaleScratch();
+    const int factor = reductionFactor(src.width, src.height, dst.width, dst.height);
+    if(factor == 0){
+        scratch.columns.build(src.width, dst.width);
+        scratch.rows.build(src.height, dst.height);
+    }
+    PlaneScaler<vectorized> luma(src.y, src.yStride, 1, src.width, dst.width, factor, scratch.columns, scratch.rows, scratch.planes[0]);
+    for(int row = 0; row < dst.height; row++){
+        uint8_t* out = dst.y + static_cast<size_t>(row) * dst.yStride;
+        const uint8_t* in = luma.row(row, out);
+        if(in != out){
+            memcpy(out, in, dst.width);
+        }
+    }
+
+    // the chroma planes are scaled on their own, odd sizes do not always halve along with the luma
+    const int srcChromaWidth = (src.width + 1) / 2;
+    const int srcChromaHeight = (src.height + 1) / 2;
+    const int dstChromaWidth = (dst.width + 1) / 2;
+    const int dstChromaHeight = (dst.height + 1) / 2;
+    const int chromaFactor = reductionFactor(srcChromaWidth, srcChromaHeight, dstChromaWidth, dstChromaHeight);
+    if(chromaFactor == 0){
+        scratch.chromaColumns.build(srcChromaWidth, dstChromaWidth);
+        scratch.chromaRows.build(srcChromaHeight, dstChromaHeight);
+    }
+    PlaneScaler<vectorized> u(src.u, src.uvStride, src.uvPixelStride, srcChromaWidth, dstChromaWidth, chromaFactor,
+                              scratch.chromaColumns, scratch.chromaRows, scratch.planes[1]);
+    PlaneScaler<vectorized> v(src.v, src.uvStride, src.uvPixelStride, srcChromaWidth, dstChromaWidth, chromaFactor,
+                              scratch.chromaColumns, scratch.chromaRows, scratch.planes[2]);
+    if(dst.uvPixelStride == 1){
+        for(int row = 0; row < dstChromaHeight; row++){
+            uint8_t* outU = dst.u + static_cast<size_t>(row) * dst.uvStride;
+            uint8_t* outV = dst.v + static_cast<size_t>(row) * dst.uvStride;
+            const uint8_t* inU = u.row(row, outU);
+            const uint8_t* inV = v.row(row, outV);
+            if(inU != outU){
+                memcpy(outU, inU, dstChromaWidth);
+            }
+            if(inV != outV){
+                memcpy(outV, inV, dstChromaWidth);
+            }
+        }
+        return;
+    }
+
+    // semi-planar destination, scale both rows and weave them together
+    for(int i = 1; i < 3; i++){
+        scratch.planes[i].output.resize(dstChromaWidth);
+    }
+    const bool interleaved = dst.uvPixelStride == 2 && (dst.v == dst.u + 1 || dst.u == dst.v + 1);
+    for(int row = 0; row < dstChromaHeight; row++){
+        const uint8_t* inU = u.row(row, scratch.planes[1].output.data());
+        const uint8_t* inV = v.row(row, scratch.planes[2].output.data());
+        uint8_t* outU = dst.u + static_cast<size_t>(row) * dst.uvStride;
+        uint8_t* outV = dst.v + static_cast<size_t>(row) * dst.uvStride;
+        if(interleaved){
+            if(outU < outV){
+                interleaveSamples<vectorized>(inU, inV, outU, dstChromaWidth);
+            }
+            else{
+                interleaveSamples<vectorized>(inV, inU, outV, dstChromaWidth);
+            }
+            continue;
+        }
+        for(int col = 0; col < dstChromaWidth; col++){
+            outU[col * dst.uvPixelStride] = inU[col];
+            outV[col * dst.uvPixelStride] = inV[col];
+        }
+    }
+}
+
+} // namespace
+
+
+YUVFrameLayout::YUVFrameLayout()
+    :layout(YUV_LAYOUT_I420),
+      width(0),
+      height(0),
+      stride(0),
+      sliceHeight(0),
+      cropLeft(0),
+      cropTop(0),
+      cropRight(-1),
+      cropBottom(-1)
+{
+}
+
+bool yuvLayoutFromColorFormat(int colorFormat, YUVPlaneLayout& layout){
+    switch(colorFormat){
+    case 19:            // COLOR_FormatYUV420Planar
+    case 20:            // COLOR_FormatYUV420PackedPlanar
+        layout = YUV_LAYOUT_I420;
+        return true;
+    case 21:            // COLOR_FormatYUV420SemiPlanar
+    case 39:            // COLOR_FormatYUV420PackedSemiPlanar
+    case 0x7f420888:    // COLOR_FormatYUV420Flexible, hardware decoders hand out NV12 for it
+    case 0x7fa30c04:    // QOMX_COLOR_FORMATYUV420PackedSemiPlanar32m (NV12 with aligned stride)
+    case 0x7f000100:    // OMX_TI_COLOR_FormatYUV420PackedSemiPlanar
+        layout = YUV_LAYOUT_NV12;
+        return true;
+    case 0x7fa30c00:    // QOMX_COLOR_FormatYVU420SemiPlanar
+        layout = YUV_LAYOUT_NV21;
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool yuvResolvePlanes(uint8_t* buf, size_t bufSize, const YUVFrameLayout& frame, YUVPlanes& planes){
+    if(buf == nullptr || frame.width <= 0 || frame.height <= 0){
+        return false;
+    }
+
+    // chroma rows of odd width frames still hold a full sample pair at the end
+    const size_t stride = static_cast<size_t>(std::max(frame.stride, (frame.width + 1) & ~1));
+    const size_t sliceHeight = static_cast<size_t>(std::max(frame.sliceHeight, frame.height));
+
+    int left = 0;
+    int top = 0;
+    int width = frame.width;
+    int height = frame.height;
+    if(frame.cropRight >= frame.cropLeft && frame.cropBottom >= frame.cropTop
+            && frame.cropLeft >= 0 && frame.cropTop >= 0
+            && frame.cropRight < frame.width && frame.cropBottom < frame.height){
+        left = frame.cropLeft & ~1;
+        top = frame.cropTop & ~1;
+        width = std::min(frame.cropWidth(), frame.width - left);
+        height = std::min(frame.cropHeight(), frame.height - top);
+    }
+
+    const size_t lumaSize = stride * sliceHeight;
+    const size_t lastChromaRow = static_cast<size_t>((top + height - 1) / 2);
+    const size_t chromaWidth = static_cast<size_t>((width + 1) / 2);
+    size_t required = 0;
+
+    planes.y = buf + static_cast<size_t>(top) * stride + left;
+    planes.yStride = static_cast<int>(stride);
+    planes.width = width;
+    planes.height = height;
+
+    if(frame.layout == YUV_LAYOUT_I420){
+        const size_t uvStride = (stride + 1) / 2;
+        const size_t uvPlaneSize = uvStride * ((sliceHeight + 1) / 2);
+        planes.u = buf + lumaSize + static_cast<size_t>(top / 2) * uvStride + left / 2;
+        planes.v = planes.u + uvPlaneSize;
+        planes.uvStride = static_cast<int>(uvStride);
+        planes.uvPixelStride = 1;
+        required = lumaSize + uvPlaneSize + lastChromaRow * uvStride + left / 2 + chromaWidth;
+    }
+    else{
+        uint8_t* uv = buf + lumaSize + static_cast<size_t>(top / 2) * stride + left;
+        planes.u = frame.layout == YUV_LAYOUT_NV12 ? uv : uv + 1;
+        planes.v = frame.layout == YUV_LAYOUT_NV12 ? uv + 1 : uv;
+        planes.uvStride = static_cast<int>(stride);
+        planes.uvPixelStride = 2;
+        required = lumaSize + lastChromaRow * stride + left + 2 * chromaWidth;
+    }
+
+    return required <= bufSize;
+}
+
+size_t yuvFrameSize(const YUVFrameLayout& frame){
+    // chroma rows of odd width frames still hold a full sample pair at the end
+    const size_t stride = static_cast<size_t>(std::max(frame.stride, (frame.width + 1) & ~1));
+    const size_t sliceHeight = static_cast<size_t>(std::max(frame.sliceHeight, frame.height));
+    const size_t chromaRows = (static_cast<size_t>(frame.height) + 1) / 2;
+    if(frame.layout == YUV_LAYOUT_I420){
+        const size_t uvStride = (stride + 1) / 2;
+        return stride * sliceHeight + uvStride * ((sliceHeight + 1) / 2) + uvStride * chromaRows;
+    }
+    return stride * sliceHeight + stride * chromaRows;
+}
+
+void yuv420ToBGR(const YUVPlanes& planes, uint8_t* dst, size_t dstStep){
+    convertFrame<true>(planes, dst, dstStep);
+}
+
+void yuv420ToBGRScalar(const YUVPlanes& planes, uint8_t* dst, size_t dstStep){
+    convertFrame<false>(planes, dst, dstStep);
+}
+
+void bgrToYUV420(const uint8_t* src, size_t srcStep, const YUVPlanes& planes){
+    encodeFrame<true>(src, srcStep, planes);
+}
+
+void bgrToYUV420Scalar(const uint8_t* src, size_t srcStep, const YUVPlanes& planes){
+    encodeFrame<false>(src, srcStep, planes);
+}
+
+void yuv420ToGray(const YUVPlanes& planes, uint8_t* dst, size_t dstStep){
+    for(int row = 0; row < planes.height; row++){
+        memcpy(dst + static_cast<size_t>(row) * dstStep, planes.y + static_cast<size_t>(row) * planes.yStride, planes.width);
+    }
+}
+
+void yuv420ToBGRScaled(const YUVPlanes& planes, uint8_t* dst, size_t dstStep, int dstWidth, int dstHeight){
+    if(dstWidth == planes.width && dstHeight == planes.height){
+        yuv420ToBGR(planes, dst, dstStep);
+        return;
+    }
+    convertScaledFrame<true>(planes, dst, dstStep, dstWidth, dstHeight);
+}
+
+void yuv420ToBGRScaledScalar(const YUVPlanes& planes, uint8_t* dst, size_t dstStep, int dstWidth, int dstHeight){
+    if(dstWidth == planes.width && dstHeight == planes.height){
+        yuv420ToBGRScalar(planes, dst, dstStep);
+        return;
+    }
+    convertScaledFrame<false>(planes, dst, dstStep, dstWidth, dstHeight);
+}
+
+void yuv420ToGrayScaled(const YUVPlanes& planes, uint8_t* dst, size_t dstStep, int dstWidth, int dstHeight){
+    if(dstWidth == planes.width && dstHeight == planes.height){
+        yuv420ToGray(planes, dst, dstStep);
+        return;
+    }
+    ScaleScratch& scratch = scaleScratch();
+    const int factor = reductionFactor(planes.width, planes.height, dstWidth, dstHeight);
+    if(factor == 0){
+        scratch.columns.build(planes.width, dstWidth);
+        scratch.rows.build(planes.height, dstHeight);
+    }
+    PlaneScaler<true> luma(planes.y, planes.yStride, 1, planes.width, dstWidth, factor, scratch.columns, scratch.rows, scratch.planes[0]);
+    for(int row = 0; row < dstHeight; row++){
+        uint8_t* out = dst + static_cast<size_t>(row) * dstStep;
+        luma.row(row, out);
+    }
+}
+
+bool yuvCropPlanes(YUVPlanes& planes, int x, int y, int width, int height){
+    // chroma is subsampled, so the origin has to stay on even coordinates
+    x = std::max(x, 0) & ~1;
+    y = std::max(y, 0) & ~1;
+    width = std::min(width, planes.width - x);
+    height = std::min(height, planes.height - y);
+    if(width <= 0 || height <= 0){
+        return false;
+    }
+    planes.y += static_cast<size_t>(y) * planes.yStride + x;
+    planes.u += static_cast<size_t>(y / 2) * planes.uvStride + (x / 2) * planes.uvPixelStride;
+    planes.v += static_cast<size_t>(y / 2) * planes.uvStride + (x / 2) * planes.uvPixelStride;
+    planes.width = width;
+    planes.height = height;
+    return true;
+}
+
+void grayToYUV420(const uint8_t* src, size_t srcStep, const YUVPlanes& planes){
+    const int chromaWidth = (planes.width + 1) / 2;
+    for(int row = 0; row < planes.height; row++){
+        memcpy(planes.y + static_cast<size_t>(row) * planes.yStride, src + static_cast<size_t>(row) * srcStep, planes.width);
+    }
+    for(int row = 0; row < (planes.height + 1) / 2; row++){
+        uint8_t* u = planes.u + static_cast<size_t>(row) * planes.uvStride;
+        uint8_t* v = planes.v + static_cast<size_t>(row) * planes.uvStride;
+        if(planes.uvPixelStride == 2){
+            // u and v are interleaved, one memset covers both
+            memset(std::min(u, v), 128, 2 * chromaWidth);
+        }
+        else{
+            memset(u, 128, chromaWidth);
+            memset(v, 128, chromaWidth);
+        }
+    }
+}
+
+void yuv420Scale(const YUVPlanes& src, const YUVPlanes& dst){
+    scaleFrame<true>(src, dst);
+}
+
+void yuv420ScaleScalar(const YUVPlanes& src, const YUVPlanes& dst){
+    scaleFrame<false>(src, dst);
+}
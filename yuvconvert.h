@@ -0,0 +1,166 @@
+#ifndef YUVCONVERT_H
+#define YUVCONVERT_H
+
+/*
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Color conversion between the YUV 4:2:0 buffers MediaCodec hands out / takes in and OpenCV's packed BGR.
+ * The kernels work directly on the codec buffers (row stride, slice height and crop rect are honored),
+ * so no intermediate copy into a tightly packed cv::Mat is needed.
+ * Vectorized with SSE2 / SSSE3 on x86 and NEON on ARM, with a scalar fallback that produces identical results.
+ * Nothing in here depends on Qt or the NDK, so the kernels can be built and benchmarked on a plain host.
+ *
+ * Conversion uses BT.601 limited range coefficients, in 6 bit fixed point towards BGR and 8 bit fixed point towards YUV.
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+
+/**
+ * @brief The YUVPlaneLayout enum describes how the chroma samples are stored.
+ */
+enum YUVPlaneLayout {
+    YUV_LAYOUT_I420,    ///< Y plane, U plane, V plane (COLOR_FormatYUV420Planar)
+    YUV_LAYOUT_NV12,    ///< Y plane, interleaved UV plane (COLOR_FormatYUV420SemiPlanar)
+    YUV_LAYOUT_NV21     ///< Y plane, interleaved VU plane
+};
+
+/**
+ * @brief The YUVFrameLayout struct describes a decoded frame as found in a codec buffer.
+ * Crop coordinates are inclusive, just like MediaCodec reports them.
+ */
+struct YUVFrameLayout {
+    YUVPlaneLayout layout;
+    int width;
+    int height;
+    int stride;
+    int sliceHeight;
+    int cropLeft;
+    int cropTop;
+    int cropRight;
+    int cropBottom;
+
+    YUVFrameLayout();
+
+    int cropWidth() const { return cropRight - cropLeft + 1; }
+    int cropHeight() const { return cropBottom - cropTop + 1; }
+};
+
+/**
+ * @brief The YUVPlanes struct holds plane pointers into a buffer, already offset to the crop origin.
+ * For semi-planar frames uvPixelStride is 2 and u / v point into the same interleaved plane.
+ */
+struct YUVPlanes {
+    uint8_t* y;
+    uint8_t* u;
+    uint8_t* v;
+    int yStride;
+    int uvStride;
+    int uvPixelStride;
+    int width;
+    int height;
+};
+
+/**
+ * Maps a MediaCodecInfo.CodecCapabilities color format to the plane layout we need to read it.
+ * Returns false for formats we cannot interpret (e.g. vendor tiled formats).
+ */
+bool yuvLayoutFromColorFormat(int colorFormat, YUVPlaneLayout& layout);
+
+/**
+ * Resolves the plane pointers of a frame stored in buf.
+ * Odd crop origins are rounded down to the next even pixel so luma and chroma stay aligned.
+ * Returns false if the buffer is too small for the described layout.
+ */
+bool yuvResolvePlanes(uint8_t* buf, size_t bufSize, const YUVFrameLayout& frame, YUVPlanes& planes);
+
+/**
+ * Number of bytes a codec expects for a full frame of the given layout (including padding rows).
+ */
+size_t yuvFrameSize(const YUVFrameLayout& frame);
+
+/**
+ * Converts a YUV 4:2:0 frame to packed 8 bit BGR.
+ * dst needs to hold planes.height rows of dstStep bytes with at least 3 * planes.width bytes each.
+ */
+void yuv420ToBGR(const YUVPlanes& planes, uint8_t* dst, size_t dstStep);
+
+/**
+ * Scalar reference implementation of yuv420ToBGR, bit exact to the vectorized path.
+ */
+void yuv420ToBGRScalar(const YUVPlanes& planes, uint8_t* dst, size_t dstStep);
+
+/**
+ * Copies the luma plane of a YUV 4:2:0 frame into an 8 bit grayscale image, chroma is not touched.
+ * dst needs to hold planes.height rows of dstStep bytes with at least planes.width bytes each.
+ */
+void yuv420ToGray(const YUVPlanes& planes, uint8_t* dst, size_t dstStep);
+
+/**
+ * Converts a YUV 4:2:0 frame to packed 8 bit BGR of dstWidth x dstHeight in the same pass.
+ * Shrinking averages the luma and chroma samples each output pixel covers, so only the output gets written
+ * and no full size intermediate exists. Enlarging picks the nearest sample. Falls back to yuv420ToBGR at the original size.
+ * Exact halving and quartering are vectorized, other sizes go through precomputed span tables.
+ */
+void yuv420ToBGRScaled(const YUVPlanes& planes, uint8_t* dst, size_t dstStep, int dstWidth, int dstHeight);
+
+/**
+ * Scalar reference implementation of yuv420ToBGRScaled, bit exact to the vectorized path.
+ */
+void yuv420ToBGRScaledScalar(const YUVPlanes& planes, uint8_t* dst, size_t dstStep, int dstWidth, int dstHeight);
+
+/**
+ * Luma only counterpart of yuv420ToBGRScaled.
+ */
+void yuv420ToGrayScaled(const YUVPlanes& planes, uint8_t* dst, size_t dstStep, int dstWidth, int dstHeight);
+
+/**
+ * Narrows planes down to a region of interest, clipped to the frame.
+ * The origin is rounded down to even coordinates so luma and chroma stay aligned. Returns false if nothing is left.
+ */
+bool yuvCropPlanes(YUVPlanes& planes, int x, int y, int width, int height);
+
+/**
+ * Converts packed 8 bit BGR to YUV 4:2:0, writing into the planes (typically an encoder input buffer).
+ * src needs to hold planes.height rows of srcStep bytes. Chroma is the average of each 2x2 block.
+ */
+void bgrToYUV420(const uint8_t* src, size_t srcStep, const YUVPlanes& planes);
+
+/**
+ * Scalar reference implementation of bgrToYUV420, bit exact to the vectorized path.
+ */
+void bgrToYUV420Scalar(const uint8_t* src, size_t srcStep, const YUVPlanes& planes);
+
+/**
+ * Writes an 8 bit grayscale image as YUV 4:2:0 (luma copied, chroma set to neutral).
+ */
+void grayToYUV420(const uint8_t* src, size_t srcStep, const YUVPlanes& planes);
+
+/**
+ * Writes a YUV 4:2:0 frame into planes of dst.width x dst.height, converting between plane layouts on the way.
+ * Same size is a plain copy, shrinking averages the samples each output sample covers (2x2 blocks for exact halving),
+ * enlarging picks the nearest sample. Luma and chroma are scaled separately, no conversion to BGR and back.
+ * Exact halving and quartering as well as (de)interleaving semi-planar chroma are vectorized.
+ */
+void yuv420Scale(const YUVPlanes& src, const YUVPlanes& dst);
+
+/**
+ * Scalar reference implementation of yuv420Scale, bit exact to the vectorized path.
+ */
+void yuv420ScaleScalar(const YUVPlanes& src, const YUVPlanes& dst);
+
+#endif // YUVCONVERT_H